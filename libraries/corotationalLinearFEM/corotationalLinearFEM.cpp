@@ -32,11 +32,17 @@
 
 #include "corotationalLinearFEM.h"
 #include "polarDecomposition.h"
+#include "polarDecompositionBatch.h"
 #include "matrixMultiplyMacros.h"
 #include "mat3d.h"
 #include "volumetricMeshENuMaterial.h"
 #include "volumetricMeshOrthotropicMaterial.h"
 #include "cubicMesh.h"
+#include <functional>
+
+#ifdef VEGAFEM_USE_TBB
+  #include <tbb/tbb.h>
+#endif
 
 namespace vegafem
 {
@@ -354,6 +360,56 @@ CorotationalLinearFEM::~CorotationalLinearFEM()
   clear();
 }
 
+void CorotationalLinearFEM::SetElementCache(const TetMeshElementCache * elementCache_)
+{
+  elementCache = (volumetricMesh->getElementType() == VolumetricMesh::TET) ? elementCache_ : NULL;
+}
+
+void CorotationalLinearFEM::SetPackedStiffnessMatrices(bool enable, bool singlePrecisionStorage)
+{
+  int numElements = volumetricMesh->getNumElements();
+  int numElementVertices = volumetricMesh->getNumElementVertices();
+  int elementStiffnessMatrixSpace = 9 * numElementVertices * numElementVertices;
+
+  if (enable)
+  {
+    if ((packedKElementUndeformed != NULL) && (packedKElementUndeformed->IsSinglePrecision() == singlePrecisionStorage))
+      return;
+
+    PackedElementStiffnessMatrices * packed = new PackedElementStiffnessMatrices(numElements, numElementVertices, singlePrecisionStorage);
+    std::vector<double> buffer(elementStiffnessMatrixSpace);
+    for(int el=0; el<numElements; el++)
+    {
+      packed->SetMatrix(el, GetUndeformedElementStiffnessMatrix(el, buffer.data()));
+      free(KElementUndeformed[el]);
+      KElementUndeformed[el] = NULL;
+    }
+    delete(packedKElementUndeformed);
+    packedKElementUndeformed = packed;
+  }
+  else
+  {
+    if (packedKElementUndeformed == NULL)
+      return;
+
+    for(int el=0; el<numElements; el++)
+    {
+      KElementUndeformed[el] = (double*) malloc (sizeof(double) * elementStiffnessMatrixSpace);
+      packedKElementUndeformed->GetMatrix(el, KElementUndeformed[el]);
+    }
+    delete(packedKElementUndeformed);
+    packedKElementUndeformed = NULL;
+  }
+}
+
+const double * CorotationalLinearFEM::GetUndeformedElementStiffnessMatrix(int el, double * buffer) const
+{
+  if (packedKElementUndeformed == NULL)
+    return KElementUndeformed[el];
+  packedKElementUndeformed->GetMatrix(el, buffer);
+  return buffer;
+}
+
 void CorotationalLinearFEM::clear()
 {
   free(undeformedPositions);
@@ -365,6 +421,8 @@ void CorotationalLinearFEM::clear()
   }
   free(KElementUndeformed);
   KElementUndeformed = NULL;
+  delete(packedKElementUndeformed);
+  packedKElementUndeformed = NULL;
 
   free(MInverse);
   MInverse = NULL;
@@ -516,7 +574,7 @@ void CorotationalLinearFEM::GetStiffnessMatrixTopology(VolumetricMesh * volumetr
 // compute RK = R * K and RKRT = R * K * R^T (block-wise)
 // input: K, R
 // output: RK, RKRT
-void CorotationalLinearFEM::WarpMatrix(double * K, double * R, double * RK, double * RKRT)
+void CorotationalLinearFEM::WarpMatrix(const double * K, const double * R, double * RK, double * RKRT)
 {
   int numElementVertices = volumetricMesh->getNumElementVertices();
   int Ksize = numElementVertices * 3;
@@ -548,11 +606,142 @@ void CorotationalLinearFEM::ComputeEnergyAndForceAndStiffnessMatrix(const double
   if (stiffnessMatrix != NULL) // clear stiffness matrix to zero
     stiffnessMatrix->ResetToZero();
 
+#ifdef VEGAFEM_USE_TBB
+  if (tbb::this_task_arena::max_concurrency() > 1)
+  {
+    ComputeEnergyAndForceAndStiffnessMatrixMT(u, energy, f, stiffnessMatrix, warp);
+    return;
+  }
+#endif
+
+  if (warp > 0)
+  {
+    ComputePolarDecompositions(u);
+    AddEnergyAndForceAndStiffnessMatrixOfSubmesh(u, energy, f, stiffnessMatrix, warp, 0, volumetricMesh->getNumElements(), elementRs.data(), elementSs.data());
+  }
+  else
+    AddEnergyAndForceAndStiffnessMatrixOfSubmesh(u, energy, f, stiffnessMatrix, warp, 0, volumetricMesh->getNumElements());
+}
+
+void CorotationalLinearFEM::ComputeEnergyAndForceAndStiffnessMatrixMT(const double * u, double * energy, double * f, SparseMatrix * stiffnessMatrix, int warp)
+{
+#ifdef VEGAFEM_USE_TBB
+  const int elementGrainSize = 64;
+
+  const double * elementR = NULL, * elementS = NULL;
+  if (warp > 0)
+  {
+    ComputePolarDecompositions(u);
+    elementR = elementRs.data();
+    elementS = elementSs.data();
+  }
+
+  // no two elements of a color share a vertex, so the elements of one color add their forces and stiffness matrices
+  // directly into f and the global stiffness matrix, in parallel, without write conflicts
+  for(const std::vector<int> & colorElements : elementColors)
+  {
+    // fixed grain size and deterministic reduction: the energy does not depend on the number of threads
+    double colorEnergy = tbb::parallel_deterministic_reduce(tbb::blocked_range<int>(0, (int)colorElements.size(), elementGrainSize), 0.0,
+      [&](const tbb::blocked_range<int> & rng, double rangeEnergy)
+    {
+      for(int i=rng.begin(); i!=rng.end(); ++i)
+        AddElementEnergyAndForceAndStiffnessMatrix(colorElements[i], u, (energy != NULL) ? &rangeEnergy : NULL, f, stiffnessMatrix, warp, elementR, elementS);
+      return rangeEnergy;
+    }, std::plus<double>());
+
+    if (energy != NULL)
+      *energy += colorEnergy;
+  }
+#else
   AddEnergyAndForceAndStiffnessMatrixOfSubmesh(u, energy, f, stiffnessMatrix, warp, 0, volumetricMesh->getNumElements());
+#endif
+}
+
+void CorotationalLinearFEM::ComputeElementDeformationGradient(int el, const double * u, double F[9])
+{
+  double P[16];
+  ComputeDeformationGradient(el, u, P, F);
+}
+
+void CorotationalLinearFEM::ComputeDeformationGradient(int el, const double * u, double P[16], double F[9])
+{
+  VolumetricMesh::elementType type = volumetricMesh->getElementType();
+  const int * vtxIndex = volumetricMesh->getVertexIndices(el);
+
+  if (elementCache != NULL)
+  {
+    // P from the cached vertex indices; F = sum_a x_a g_a^T, where g_a are the shape function gradients
+    for(int a=0; a<4; a++)
+    {
+      int vtx = elementCache->getVertexIndices(a)[el];
+      for(int i=0; i<3; i++)
+        P[4 * i + a] = undeformedPositions[3 * vtx + i] + u[3 * vtx + i];
+      P[12 + a] = 1.0;
+    }
+    for(int i=0; i<3; i++) 
+      for(int j=0; j<3; j++) 
+      {
+        F[3 * i + j] = 0;
+        for(int a=0; a<4; a++)
+          F[3 * i + j] += P[4 * i + a] * elementCache->getShapeFunctionGradients(a, j)[el];
+      }
+    return;
+  }
+
+  // P = [ v0   v1   v2   v3 ]
+  //     [  1    1    1    1 ]
+  // rows 1,2,3
+  const int * tetVertex = (type == VolumetricMesh::CUBIC) ? cubeRotationTetIndex : NULL;
+  assert((type == VolumetricMesh::TET) || (type == VolumetricMesh::CUBIC));
+  for(int j=0; j<4; j++)
+  {
+    int vtx = vtxIndex[(tetVertex != NULL) ? tetVertex[j] : j];
+    for(int i=0; i<3; i++)
+      P[4 * i + j] = undeformedPositions[3 * vtx + i] + u[3 * vtx + i];
+  }
+  // row 4
+  for(int j=0; j<4; j++)
+    P[12 + j] = 1.0;
+
+  // F = P * Inverse(M)
+  for(int i=0; i<3; i++) 
+    for(int j=0; j<3; j++) 
+    {
+      F[3 * i + j] = 0;
+      for(int k=0; k<4; k++)
+        F[3 * i + j] += P[4 * i + k] * MInverse[el][4 * k + j];
+    }
+}
+
+void CorotationalLinearFEM::ComputePolarDecompositions(const double * u)
+{
+  int numElements = volumetricMesh->getNumElements();
+  elementFs.resize(9 * numElements);
+  elementRs.resize(9 * numElements);
+  elementSs.resize(9 * numElements);
+
+  auto computeRange = [&](int elementLo, int elementHi)
+  {
+    double P[16];
+    for(int el=elementLo; el<elementHi; el++)
+      ComputeDeformationGradient(el, u, P, &elementFs[9 * el]);
+    double tolerance = 1E-6;
+    int forceRotation = 1;
+    PolarDecompositionBatch::Compute(elementHi - elementLo, &elementFs[9 * elementLo], &elementRs[9 * elementLo], &elementSs[9 * elementLo], tolerance, forceRotation);
+  };
+
+#ifdef VEGAFEM_USE_TBB
+  tbb::parallel_for(tbb::blocked_range<int>(0, numElements, 64), [&](const tbb::blocked_range<int> & rng)
+  {
+    computeRange(rng.begin(), rng.end());
+  });
+#else
+  computeRange(0, numElements);
+#endif
 }
 
 void CorotationalLinearFEM::ComputeElementEnergyAndForceAndStiffnessMatrix(int el, const double * u, double * elementEnergy, 
-    double * elementInternalForces, double * elementStiffnessMatrix, int warp)
+    double * elementInternalForces, double * elementStiffnessMatrix, int warp, const double * elementR, const double * elementS)
 {
   const int maxNumElementVertices = 8;
   const int maxNumElementDOFs = maxNumElementVertices * 3;
@@ -565,56 +754,43 @@ void CorotationalLinearFEM::ComputeElementEnergyAndForceAndStiffnessMatrix(int e
   // int vtxIndex[4];
   const int * vtxIndex = volumetricMesh->getVertexIndices(el);
 
+  // with packed matrices, warp=0 and warp=1 use the packed kernels; the exact tangent (warp=2) unpacks the full undeformed element matrix
+  bool usePackedKernels = (packedKElementUndeformed != NULL) && !((warp == 2) && (type == VolumetricMesh::TET));
+  double KUndeformedBuffer[maxNumElementDOFs * maxNumElementDOFs];
+  const double * KUndeformed = usePackedKernels ? NULL : GetUndeformedElementStiffnessMatrix(el, KUndeformedBuffer);
+
   Vec3d deformedPos[maxNumElementVertices];
   for (int i = 0; i < numElementVertices; i++)
     deformedPos[i] = Vec3d(&undeformedPositions[3 * vtxIndex[i]]) + Vec3d(&u[3 * vtxIndex[i]]);
 
   if (warp > 0)
   {
-    double P[16] ={0}; // the current world-coordinate positions (row-major)
-    
-    // P = [ v0   v1   v2   v3 ]
-    //     [  1    1    1    1 ]
-    // rows 1,2,3
-    if(type == VolumetricMesh::TET)
+    double P[16]; // the current world-coordinate positions (row-major)
+    double F[9];
+    ComputeDeformationGradient(el, u, P, F);
+
+    double R[9]; // rotation (row-major)
+    double S[9]; // symmetric (row-major)
+    if ((elementR != NULL) && (elementS != NULL))
     {
-      for(int i=0; i<3; i++)
-        for(int j=0; j<4; j++)
-          P[4 * i + j] = deformedPos[j][i];
+      memcpy(R, elementR, sizeof(double) * 9);
+      memcpy(S, elementS, sizeof(double) * 9);
     }
-    else if(type == VolumetricMesh::CUBIC)
+    else
     {
-      for(int i=0; i<3; i++)
-        for(int j=0; j<4; j++)
-          P[4 * i + j] = deformedPos[cubeRotationTetIndex[j]][i];
+      double tolerance = 1E-6;
+      int forceRotation = 1;
+      PolarDecomposition::Compute(F, R, S, tolerance, forceRotation);
     }
-    else
-      assert(0);
-    // row 4
-    for(int j=0; j<4; j++)
-      P[12 + j] = 1.0;
-
-    // F = P * Inverse(M)
-    double F[9]; // upper-left 3x3 block
-    for(int i=0; i<3; i++) 
-      for(int j=0; j<3; j++) 
-      {
-        F[3 * i + j] = 0;
-        for(int k=0; k<4; k++)
-          F[3 * i + j] += P[4 * i + k] * MInverse[el][4 * k + j];
-      }
-
-    double R[9]; // rotation (row-major)
-    double S[9]; // symmetric (row-major)
-    double tolerance = 1E-6;
-    int forceRotation = 1;
-    PolarDecomposition::Compute(F, R, S, tolerance, forceRotation);
 
     // RK = R * K
     // KElement = R * K * R^T
-    double RK[maxNumElementDOFs * maxNumElementDOFs]; // row-major
-    if (elementStiffnessMatrix != NULL)
-      WarpMatrix(KElementUndeformed[el], R, RK, elementStiffnessMatrix);
+    double RK[maxNumElementDOFs * maxNumElementDOFs]; // row-major; not formed by the packed kernels
+    if ((elementStiffnessMatrix != NULL) && usePackedKernels)
+      packedKElementUndeformed->Warp(el, R, elementStiffnessMatrix);
+    else if (elementStiffnessMatrix != NULL)
+      WarpMatrix(KUndeformed, R, RK, elementStiffnessMatrix);
+    bool formedRK = (elementStiffnessMatrix != NULL) && !usePackedKernels;
 
     double z[maxNumElementDOFs]; // z = RT x - x0
     Mat3d Rmat(R);
@@ -626,27 +802,41 @@ void CorotationalLinearFEM::ComputeElementEnergyAndForceAndStiffnessMatrix(int e
       vtxz.convertToArray(z + 3*vtx);
     }
     
-    if (elementEnergy != NULL) // energy = 1/2 <Kz, z>, z = RT x - x0
+    double Kz[maxNumElementDOFs];
+    if ((elementEnergy != NULL) || ((elementInternalForces != NULL) && !formedRK))
     {
-      double Kz[maxNumElementDOFs];
-      memset(Kz, 0, sizeof(Kz));
-      for(int i = 0; i < numElementDOFs; i++)
-        for(int j = 0; j < numElementDOFs; j++)
-          Kz[i] += KElementUndeformed[el][numElementDOFs*i+j] * z[j];
+      if (usePackedKernels)
+        packedKElementUndeformed->MultiplyVector(el, z, Kz);
+      else
+      {
+        memset(Kz, 0, sizeof(Kz));
+        for(int i = 0; i < numElementDOFs; i++)
+          for(int j = 0; j < numElementDOFs; j++)
+            Kz[i] += KUndeformed[numElementDOFs*i+j] * z[j];
+      }
+    }
 
+    if (elementEnergy != NULL) // energy = 1/2 <Kz, z>, z = RT x - x0
+    {
       double e = 0.0;
       for(int i = 0; i < numElementDOFs; i++)
         e += Kz[i] * z[i];
       *elementEnergy = 0.5 * e;
     }
 
-    if (elementInternalForces != NULL) // f = RK (RT x - x0) = RK z
+    if ((elementInternalForces != NULL) && formedRK) // f = RK (RT x - x0) = RK z
     {      
       memset(elementInternalForces, 0, sizeof(double) * numElementDOFs);
       for(int i = 0; i < numElementDOFs; i++)
         for(int j = 0; j < numElementDOFs; j++)
           elementInternalForces[i] += RK[numElementDOFs*i+j] * z[j];
     }
+    else if (elementInternalForces != NULL) // RK is not formed: f = R (K z), one 3-block at a time
+    {
+      for(int vtx = 0; vtx < numElementVertices; vtx++)
+        for(int i = 0; i < 3; i++)
+          elementInternalForces[3 * vtx + i] = R[3 * i + 0] * Kz[3 * vtx + 0] + R[3 * i + 1] * Kz[3 * vtx + 1] + R[3 * i + 2] * Kz[3 * vtx + 2];
+    }
 
     // compute exact stiffness matrix
     if (warp == 2 && type == VolumetricMesh::TET && elementStiffnessMatrix != NULL)
@@ -743,7 +933,7 @@ void CorotationalLinearFEM::ComputeElementEnergyAndForceAndStiffnessMatrix(int e
       {
         a[i] = 0.0;
         for (int j=0; j<12; j++)
-          a[i] += KElementUndeformed[el][12 * i + j] * tempVec[j];
+          a[i] += KUndeformed[12 * i + j] * tempVec[j];
       }
 
       // add [\hat{dR/dxl} K R^T x]_l, l=1 to 12
@@ -792,22 +982,35 @@ void CorotationalLinearFEM::ComputeElementEnergyAndForceAndStiffnessMatrix(int e
   }
   else // no warping, warp == 0
   {
-    if (elementStiffnessMatrix != NULL)
-      memcpy(elementStiffnessMatrix, KElementUndeformed[el], sizeof(double) * elementStiffnessMatrixSpace);
+    if ((elementStiffnessMatrix != NULL) && usePackedKernels)
+      packedKElementUndeformed->GetMatrix(el, elementStiffnessMatrix);
+    else if (elementStiffnessMatrix != NULL)
+      memcpy(elementStiffnessMatrix, KUndeformed, sizeof(double) * elementStiffnessMatrixSpace);
     // f = K u
     if (elementInternalForces != NULL || elementEnergy != NULL)
     {
       double fElementBuffer[maxNumElementDOFs];
       double * fEle = (elementInternalForces ? elementInternalForces : fElementBuffer);
-      for(int i=0; i<numElementDOFs; i++)
+      if (usePackedKernels)
       {
-        fEle[i] = 0.0;
+        double uElement[maxNumElementDOFs];
         for(int j=0; j<numElementVertices; j++)
+          for(int i=0; i<3; i++)
+            uElement[3 * j + i] = u[3 * vtxIndex[j] + i];
+        packedKElementUndeformed->MultiplyVector(el, uElement, fEle);
+      }
+      else
+      {
+        for(int i=0; i<numElementDOFs; i++)
         {
-          fEle[i] += 
-            KElementUndeformed[el][numElementDOFs * i + 3 * j + 0] * u[3 * vtxIndex[j] + 0] +
-            KElementUndeformed[el][numElementDOFs * i + 3 * j + 1] * u[3 * vtxIndex[j] + 1] +
-            KElementUndeformed[el][numElementDOFs * i + 3 * j + 2] * u[3 * vtxIndex[j] + 2];
+          fEle[i] = 0.0;
+          for(int j=0; j<numElementVertices; j++)
+          {
+            fEle[i] += 
+              KUndeformed[numElementDOFs * i + 3 * j + 0] * u[3 * vtxIndex[j] + 0] +
+              KUndeformed[numElementDOFs * i + 3 * j + 1] * u[3 * vtxIndex[j] + 1] +
+              KUndeformed[numElementDOFs * i + 3 * j + 2] * u[3 * vtxIndex[j] + 2];
+          }
         }
       }
       if (elementEnergy != NULL)
@@ -823,343 +1026,90 @@ void CorotationalLinearFEM::ComputeElementEnergyAndForceAndStiffnessMatrix(int e
   }
 }
 
-void CorotationalLinearFEM::AddEnergyAndForceAndStiffnessMatrixOfSubmesh(const double * u, double * energy, double * f, SparseMatrix * stiffnessMatrix, int warp, int elementLo, int elementHi)
+void CorotationalLinearFEM::AddEnergyAndForceAndStiffnessMatrixOfSubmesh(const double * u, double * energy, double * f, SparseMatrix * stiffnessMatrix, int warp, int elementLo, int elementHi, const double * elementRs, const double * elementSs)
 {
-  const int maxNumElementVertices = 8;
-  const int maxNumElementDOFs = maxNumElementVertices * 3;
-
-  int numElementVertices = volumetricMesh->getNumElementVertices();
-
-  int numElementDOFs = numElementVertices * 3;
-  int elementStiffnessMatrixSpace = numElementDOFs * numElementDOFs;
-  VolumetricMesh::elementType type = volumetricMesh->getElementType();
   for (int el=elementLo; el < elementHi; el++)
-  {
-    const int * vtxIndex = volumetricMesh->getVertexIndices(el);
-
-    // element stiffness matrix, to be computed below; row-major
-    double KElement[maxNumElementDOFs * maxNumElementDOFs];
-
-    Vec3d deformedPos[maxNumElementVertices];
-    for (int i = 0; i < numElementVertices; i++)
-      deformedPos[i] = Vec3d(&undeformedPositions[3 * vtxIndex[i]]) + Vec3d(&u[3 * vtxIndex[i]]);
-
-    if (warp > 0)
-    {
-      double P[16] ={0}; // the current world-coordinate positions (row-major)
-      //
-      // P = [ v0   v1   v2   v3 ]
-      //     [  1    1    1    1 ]
-      // rows 1,2,3
-      if(type == VolumetricMesh::TET)
-      {
-        for(int i=0; i<3; i++)
-          for(int j=0; j<4; j++)
-            P[4 * i + j] = deformedPos[j][i];
-      }
-      else if(type == VolumetricMesh::CUBIC)
-      {
-        for(int i=0; i<3; i++)
-          for(int j=0; j<4; j++)
-            P[4 * i + j] = deformedPos[cubeRotationTetIndex[j]][i];
-      }
-      else
-        assert(0);
-      // row 4
-      for(int j=0; j<4; j++)
-        P[12 + j] = 1.0;
-
-      // F = P * Inverse(M)
-      double F[9]; // upper-left 3x3 block
-      for(int i=0; i<3; i++) 
-        for(int j=0; j<3; j++) 
-        {
-          F[3 * i + j] = 0;
-          for(int k=0; k<4; k++)
-            F[3 * i + j] += P[4 * i + k] * MInverse[el][4 * k + j];
-        }
-
-      double R[9]; // rotation (row-major)
-      double S[9]; // symmetric (row-major)
-      double tolerance = 1E-6;
-      int forceRotation = 1;
-      PolarDecomposition::Compute(F, R, S, tolerance, forceRotation);
-
-      // RK = R * K
-      // KElement = R * K * R^T
-      double RK[maxNumElementDOFs * maxNumElementDOFs]; // row-major
-      WarpMatrix(KElementUndeformed[el], R, RK, KElement);
-
-      double z[maxNumElementDOFs]; // z = RT x - x0
-      Mat3d Rmat(R);
-      Mat3d RTmat = trans(Rmat);
-      for(int vtx = 0; vtx < numElementVertices; vtx++)
-      {
-        Vec3d x0 = Vec3d(&undeformedPositions[3 * vtxIndex[vtx]]);
-        Vec3d vtxz = RTmat * deformedPos[vtx] - x0;
-        vtxz.convertToArray(z + 3*vtx);
-      }
-      
-      if (energy != NULL) // energy = 1/2 <Kz, z>, z = RT x - x0
-      {
-        double Kz[maxNumElementDOFs];
-        memset(Kz, 0, sizeof(Kz));
-        for(int i = 0; i < numElementDOFs; i++)
-          for(int j = 0; j < numElementDOFs; j++)
-            Kz[i] += KElementUndeformed[el][numElementDOFs*i+j] * z[j];
-
-        double e = 0.0;
-        for(int i = 0; i < numElementDOFs; i++)
-          e += Kz[i] * z[i];
-        *energy += 0.5 * e;
-      }
-
-      double fElement[maxNumElementDOFs];
-      if (f != NULL) // f = RK (RT x - x0) = RK z
-      {      
-        memset(fElement, 0, sizeof(fElement));
-        for(int i = 0; i < numElementDOFs; i++)
-          for(int j = 0; j < numElementDOFs; j++)
-            fElement[i] += RK[numElementDOFs*i+j] * z[j];
-
-        // write to global matrix
-        for(int j=0; j<numElementVertices; j++)
-          for(int l=0; l<3; l++)
-            f[3 * vtxIndex[j] + l] += fElement[3 * j + l];
-      }
-
-      // compute exact stiffness matrix
-      if (warp == 2 && type == VolumetricMesh::TET)
-      {
-        // compute G = (tr(S) I - S) R^T
-        double G[9]; 
-        double tr = S[0] + S[4] + S[8];
-        double temp[9];
-        for(int i=0; i<9; i++)
-          temp[i] = -S[i];
-        temp[0] += tr;
-        temp[4] += tr;
-        temp[8] += tr;
-        // G = temp * R^T
-        MATRIX_MULTIPLY3X3ABT(temp, R, G);
-
-        double invG[9]; // invG = G^{-1}
-        inverse3x3(G, invG);
-
-        double rhs[27]; // 3 x 9 matrix (column-major)
-        for(int i=0; i<3; i++)
-          for(int j=0; j<3; j++)
-          {
-            double temp[9];
-            for(int k=0; k<9; k++)
-              temp[k] = 0.0;
-            // copy i-th row of R into column j of temp      
-            for(int k=0; k<3; k++)
-              temp[3 * k + j] = R[3 * i + k];
-            // extract the skew-symmetric part
-            SKEW_PART_NO_DIV2(temp, &rhs[3 * (3 * i + j)]);
-          }
-
-        // solve G * omega = rhs
-        double omega[27]; // column-major
-        for(int i=0; i<9; i++)
-        {
-          MATRIX_VECTOR_MULTIPLY3X3(invG, &rhs[3 * i], &omega[3 * i]);
-        }
-
-        double dRdF[81]; // each column is skew(omega) * R ; column-major
-        for(int i=0; i<9; i++)
-        {
-          double skew[9];
-          SKEW_MATRIX(&omega[3 * i], skew);
-          MATRIX_MULTIPLY3X3(skew, R, &dRdF[9 * i]);
-        }
-
-        double B[3][3][9];
-        // re-arrange dRdF into B, for easier dRdF * dFdx multiplication (to exploit sparsity of dFdx)
-        for(int i=0; i<3; i++)
-          for(int j=0; j<3; j++)
-            for(int k=0; k<3; k++)
-              for(int l=0; l<3; l++)
-              {
-                int row = 3 * i + k;
-                int column = 3 * j + l;
-                B[i][j][3 * k + l] = dRdF[9 * column + row];
-              }
-
-        // four pointers to a 3-vector
-        double * minv[4] = { &MInverse[el][0], &MInverse[el][4], &MInverse[el][8], &MInverse[el][12] }; // the four rows of MInverse (last column ignored)
-
-        double dRdx[108]; // derivative of the element rotation matrix with respect to the positions of the tet vertices; column-major
-        for(int k=0; k<4; k++)
-          for(int i=0; i<3; i++)
-            for(int j=0; j<3; j++)
-            {
-              double temp[3];
-              MATRIX_VECTOR_MULTIPLY3X3(B[i][j], minv[k], temp);
-              int row = 3 * i;
-              int column = 3 * k + j;
-              VECTOR_SET3(&dRdx[9 * column + row], temp);
-            }
-
-        // add contribution of dRdx to KElement
-
-        // term 1: \hat{dR/dxl} K (R^T x - m)
-
-        // compute K (R^T x - m)
-        double tempVec[12]; // R^T x - m
-        for(int vtx=0; vtx<4; vtx++)
-        {
-          double pos[3];
-          for(int i=0; i<3; i++)
-            pos[i] = P[4 * i + vtx];
-          MATRIX_VECTOR_MULTIPLY3X3T(R, pos, &tempVec[3*vtx]);
-          // subtract m
-          for(int i=0; i<3; i++)
-            tempVec[3*vtx+i] -= undeformedPositions[3 * vtxIndex[vtx] + i];
-        }
-        double a[12]; // a = K * tempVec
-        for (int i=0; i<12; i++)
-        {
-          a[i] = 0.0;
-          for (int j=0; j<12; j++)
-            a[i] += KElementUndeformed[el][12 * i + j] * tempVec[j];
-        }
-
-        // add [\hat{dR/dxl} K R^T x]_l, l=1 to 12
-        for(int column=0; column<12; column++)
-        {
-          double b[12]; // b = \hat{dR/dxl} * a
-          for(int j=0; j<4; j++)
-          {
-            MATRIX_VECTOR_MULTIPLY3X3(&dRdx[9 * column], &a[3*j], &b[3*j]);
-          }
-          // write b into KElement (add b to i-th column)
-          for(int row=0; row<12; row++)
-            KElement[12 * row + column] += b[row]; // KElement is row-major
-        }
-
-        // term 2: (R K \hat{dRdxl}^T)x
+    AddElementEnergyAndForceAndStiffnessMatrix(el, u, energy, f, stiffnessMatrix, warp, elementRs, elementSs);
+}
 
-        // re-write positions into a
-        for(int vtx=0; vtx<4; vtx++)
-        {
-          for(int i=0; i<3; i++)
-            a[3 * vtx + i] = P[4 * i + vtx];
-        }
+void CorotationalLinearFEM::AddElementEnergyAndForceAndStiffnessMatrix(int el, const double * u, double * energy, double * f, SparseMatrix * stiffnessMatrix, int warp, const double * elementRs, const double * elementSs)
+{
+  const int maxNumElementVertices = 8;
+  int numElementVertices = volumetricMesh->getNumElementVertices();
 
-        // compute [\hat{dRdxl}^T x)]_l, l=1 to 12
-        for(int column=0; column<12; column++)
-        {
-          double b[12]; // b = \hat{dRdxl}^T * a
-          for(int j=0; j<4; j++)
-          {
-            MATRIX_VECTOR_MULTIPLY3X3T(&dRdx[9 * column], &a[3*j], &b[3*j]);
-          }
+  double elementEnergy = 0.0;
+  double fElement[3 * maxNumElementVertices];
+  double KElement[9 * maxNumElementVertices * maxNumElementVertices]; // row-major
+  ComputeElementEnergyAndForceAndStiffnessMatrix(el, u, (energy != NULL) ? &elementEnergy : NULL, (f != NULL) ? fElement : NULL,
+    (stiffnessMatrix != NULL) ? KElement : NULL, warp, (elementRs != NULL) ? &elementRs[9 * el] : NULL, (elementSs != NULL) ? &elementSs[9 * el] : NULL);
 
-          // add RK * b to column of KElement
-          int rowStart = 0;
-          for (int row=0; row<12; row++)
-          {
-            double contrib = 0.0;
-            for (int j=0; j<12; j++)
-              contrib += RK[rowStart + j] * b[j];
-            KElement[rowStart + column] += contrib;
-            rowStart += 12;
-          }
-        }
-      }
-    }
-    else
-    {
-      // no warp
-      memcpy(KElement, KElementUndeformed[el], sizeof(double) * elementStiffnessMatrixSpace);
-      // f = K u
-      double fElement[maxNumElementDOFs];
-      if (f != NULL || energy != NULL)
-      {
-        for(int i=0; i<numElementDOFs; i++)
-        {
-          fElement[i] = 0.0;
-          for(int j=0; j<numElementVertices; j++)
-          {
-            fElement[i] += 
-              KElement[numElementDOFs * i + 3 * j + 0] * u[3 * vtxIndex[j] + 0] +
-              KElement[numElementDOFs * i + 3 * j + 1] * u[3 * vtxIndex[j] + 1] +
-              KElement[numElementDOFs * i + 3 * j + 2] * u[3 * vtxIndex[j] + 2];
-          }
-        }
-        if (energy != NULL)
-        {
-          double elementEnergy = 0.0;
-          for(int j = 0; j < numElementVertices; j++)
-            elementEnergy += fElement[3*j + 0] * u[3*vtxIndex[j] + 0] +
-                             fElement[3*j + 1] * u[3*vtxIndex[j] + 1] +
-                             fElement[3*j + 2] * u[3*vtxIndex[j] + 2];
-          *energy += 0.5 * elementEnergy;
-        }
-
-        // add fElement into the global f
-        if (f != NULL)
-          for(int j=0; j<numElementVertices; j++)
-          {
-            f[3 * vtxIndex[j] + 0] += fElement[3 * j + 0];
-            f[3 * vtxIndex[j] + 1] += fElement[3 * j + 1];
-            f[3 * vtxIndex[j] + 2] += fElement[3 * j + 2];
-          }
-      }
-    }
+  if (energy != NULL)
+    *energy += elementEnergy;
 
-    if (stiffnessMatrix != NULL)
+  // add fElement into the global f
+  if (f != NULL)
+  {
+    const int * vtxIndex = volumetricMesh->getVertexIndices(el);
+    for(int j=0; j<numElementVertices; j++)
     {
-      int * rowIndex = rowIndices[el];
-      int * columnIndex = columnIndices[el];
-
-      // add KElement to the global stiffness matrix
-      for (int i=0; i<numElementVertices; i++)
-        for (int j=0; j<numElementVertices; j++)
-          for(int k=0; k<3; k++)
-            for(int l=0; l<3; l++)
-              stiffnessMatrix->AddEntry(3 * rowIndex[i] + k, 3 * columnIndex[numElementVertices * i + j] + l, KElement[numElementDOFs * (3 * i + k) + 3 * j + l]);
+      f[3 * vtxIndex[j] + 0] += fElement[3 * j + 0];
+      f[3 * vtxIndex[j] + 1] += fElement[3 * j + 1];
+      f[3 * vtxIndex[j] + 2] += fElement[3 * j + 2];
     }
   }
+
+  // add KElement (row-major) to the global stiffness matrix
+  if (stiffnessMatrix != NULL)
+    stiffnessMatrixScatter->AddStencilMatrix(el, KElement, stiffnessMatrix, 0);
 }
 
 void CorotationalLinearFEM::ClearRowColumnIndices()
 {
-  for (int el=0; el < volumetricMesh->getNumElements(); el++)
-  {
-    free(rowIndices[el]);
-    free(columnIndices[el]);
-  }
-
-  free(rowIndices);
-  free(columnIndices);
-  rowIndices = NULL;
-  columnIndices = NULL;
+  delete(stiffnessMatrixScatter);
+  stiffnessMatrixScatter = NULL;
+  elementColors.clear();
 }
 
 void CorotationalLinearFEM::BuildRowColumnIndices(SparseMatrix * sparseMatrix)
 {
   int numElements = volumetricMesh->getNumElements();
   int numElementVertices = volumetricMesh->getNumElementVertices();
-  rowIndices = (int**) malloc (sizeof(int*) * numElements);
-  columnIndices = (int**) malloc (sizeof(int*) * numElements);
 
+  // the rows corresponding to each vertex in the element, and the columns corresponding to all element vertices, in row of each vertex
+  int * elementVertices = (int*) malloc (sizeof(int) * numElements * numElementVertices);
+  for (int el=0; el < numElements; el++)
+    for(int i=0; i<numElementVertices; i++)
+      elementVertices[numElementVertices * el + i] = volumetricMesh->getVertexIndex(el, i);
+
+  stiffnessMatrixScatter = new SparseMatrixScatter(sparseMatrix, numElements, numElementVertices, elementVertices);
+
+  // greedy element coloring: each element gets the smallest color not used by any element sharing one of its vertices
+  elementColors.clear();
+  std::vector<std::vector<int>> vertexColors(numVertices); // colors of the elements incident to each vertex
+  std::vector<int> colorStamp; // colorStamp[color] == el if the color is used by a neighbor of element el
   for (int el=0; el < numElements; el++)
   {
-    // the rows corresponding to each vertices in the element
-    rowIndices[el] = (int*) malloc (sizeof(int) * numElementVertices);
+    const int * vtxIndex = &elementVertices[numElementVertices * el];
     for(int i=0; i<numElementVertices; i++)
-      rowIndices[el][i] = volumetricMesh->getVertexIndex(el, i);
+      for(int color : vertexColors[vtxIndex[i]])
+        colorStamp[color] = el;
+
+    int color = 0;
+    while ((color < (int)colorStamp.size()) && (colorStamp[color] == el))
+      color++;
+
+    if (color == (int)elementColors.size())
+    {
+      elementColors.emplace_back();
+      colorStamp.push_back(-1);
+    }
+    elementColors[color].push_back(el);
 
-    // the columns corresponding to all element vertices, in row of each vertex
-    columnIndices[el] = (int*) malloc (sizeof(int) * numElementVertices * numElementVertices);
-    // find index of vertex j in row of vertex i, and cache it
     for(int i=0; i<numElementVertices; i++)
-      for(int j=0; j<numElementVertices; j++)
-        columnIndices[el][numElementVertices * i + j] = sparseMatrix->GetInverseIndex(3*rowIndices[el][i], 3*rowIndices[el][j]) / 3;
+      vertexColors[vtxIndex[i]].push_back(color);
   }
+
+  free(elementVertices);
 }
 
 // inverse of a 3x3 matrix
@@ -69,10 +69,30 @@
   See also:
      http://en.wikipedia.org/wiki/Orthotropic_material
      http://www.solidmechanics.org/text/Chapter3_2/Chapter3_2.htm
+
+  4. If Intel TBB is provided, ComputeEnergyAndForceAndStiffnessMatrix is multi-threaded.
+  The elements are colored so that the elements of the same color share no vertices. The colors are processed
+  one after another, and the elements of each color in parallel; each element adds its forces and stiffness matrix
+  directly into the output, so there are no write conflicts and no per-element or per-thread buffers.
+  The results do not depend on the number of threads.
+  The number of threads can be controlled outside the class using the Intel TBB APIs.
+
+  5. When warping, ComputeEnergyAndForceAndStiffnessMatrix first computes the polar decompositions of the
+  deformation gradients of all the elements, in batches (PolarDecompositionBatch), which gives the same
+  rotations as decomposing the elements one at a time, but vectorizes across elements.
+
+  6. The undeformed element stiffness matrices can be stored in packed form (SetPackedStiffnessMatrices):
+  only the upper-triangular 3x3 blocks are kept (78 instead of 144 doubles per tet), optionally in single precision.
+  With warp=1, the warped matrix R K R^T and the forces R K z are then computed directly from the packed blocks,
+  and with warp=0, the forces K u. The arithmetic stays in double precision.
 */
 
 #include "tetMesh.h"
+#include "tetMeshElementCache.h"
 #include "sparseMatrix.h"
+#include "sparseMatrixScatter.h"
+#include "packedElementStiffnessMatrices.h"
+#include <vector>
 
 namespace vegafem
 {
@@ -101,15 +121,36 @@ public:
 
   // this routine is same as above, except that (1) it adds to the existing value, (2) only traverses elements from elementLo <= element <= elementHi - 1
   // if you do not want to compute the energy, internal forces or stiffness matrix (any combination), pass a NULL pointer for that argument
-  void AddEnergyAndForceAndStiffnessMatrixOfSubmesh(const double * vertexDisplacements, double * energy, double * internalForces, SparseMatrix * stiffnessMatrix, int warp, int elementLo, int elementHi);
+  // elementRs, elementSs (optional): precomputed polar decompositions F = R * S of all the elements (9 doubles per element, row-major);
+  // if NULL, the polar decompositions are computed element by element
+  void AddEnergyAndForceAndStiffnessMatrixOfSubmesh(const double * vertexDisplacements, double * energy, double * internalForces, SparseMatrix * stiffnessMatrix, int warp, int elementLo, int elementHi,
+    const double * elementRs = NULL, const double * elementSs = NULL);
 
   // this routine is same as above, except that (1) it only computes a single element. (2) the output forces and the matrix 
-  // are stored in dense format.
+  // are stored in dense format. elementR, elementS (optional): the precomputed polar decomposition of this element
   void ComputeElementEnergyAndForceAndStiffnessMatrix(int elementID, const double * vertexDisplacements, double * elementEnergy, 
-    double * elementInternalForces, double * elementStiffnessMatrix, int warp);
+    double * elementInternalForces, double * elementStiffnessMatrix, int warp, const double * elementR = NULL, const double * elementS = NULL);
 
   inline VolumetricMesh * GetVolumetricMesh() { return volumetricMesh; }
 
+  // computes the deformation gradient F (row-major) of element "el" under the displacements u
+  // (for cubic meshes, the deformation gradient of the tet in the center of the cube)
+  void ComputeElementDeformationGradient(int el, const double * u, double F[9]);
+
+  // If an element cache of the (tet) mesh is given (see tetMeshElementCache.h), the deformation gradients are computed
+  // from the cached vertex indices and shape function gradients (the result is the same, up to roundoff).
+  // The cache is not owned by this class, and can be shared with other force models. Pass NULL to disable.
+  // Only supported with tet meshes; ignored for cubic meshes.
+  void SetElementCache(const TetMeshElementCache * elementCache);
+
+  // Stores the undeformed element stiffness matrices in packed form (see packedElementStiffnessMatrices.h),
+  // in double or single precision (singlePrecisionStorage), and releases the full matrices.
+  // With enable=false, the full double-precision matrices are restored (from the packed ones; after single-precision storage, 
+  // the restored matrices keep the single-precision rounding).
+  void SetPackedStiffnessMatrices(bool enable, bool singlePrecisionStorage=false);
+  bool GetPackedStiffnessMatrices() const { return packedKElementUndeformed != NULL; }
+  bool GetSinglePrecisionStiffnessMatrices() const { return (packedKElementUndeformed != NULL) && packedKElementUndeformed->IsSinglePrecision(); }
+
   static void inverse3x3(double * A, double * AInv); // inverse of a row-major 3x3 matrix
   static void inverse4x4(double * A, double * AInv); // inverse of a row-major 4x4 matrix
 
@@ -119,14 +160,31 @@ protected:
   double * undeformedPositions;
   double ** MInverse;
   double ** KElementUndeformed;
-
-  void WarpMatrix(double * K, double * R, double * RK, double * RKRT);
-
-  // acceleration indices
-  int ** rowIndices;
-  int ** columnIndices;
+  PackedElementStiffnessMatrices * packedKElementUndeformed = NULL; // if not NULL, KElementUndeformed[el] are NULL
+  const TetMeshElementCache * elementCache = NULL;
+
+  void WarpMatrix(const double * K, const double * R, double * RK, double * RKRT);
+  // computes element el with ComputeElementEnergyAndForceAndStiffnessMatrix, and adds the result into energy, f and stiffnessMatrix (each can be NULL)
+  void AddElementEnergyAndForceAndStiffnessMatrix(int el, const double * u, double * energy, double * f, SparseMatrix * stiffnessMatrix, int warp,
+    const double * elementRs, const double * elementSs);
+  // returns the (full, row-major) undeformed stiffness matrix of element el; if packed, it is unpacked into buffer
+  const double * GetUndeformedElementStiffnessMatrix(int el, double * buffer) const;
+
+  // P = [ v0 v1 v2 v3 ; 1 1 1 1 ] (row-major, deformed positions of the rotation tet), F = upper-left 3x3 block of P * MInverse[el]
+  void ComputeDeformationGradient(int el, const double * vertexDisplacements, double P[16], double F[9]);
+  // computes the polar decompositions of the deformation gradients of all the elements, in batches (see PolarDecompositionBatch)
+  void ComputePolarDecompositions(const double * vertexDisplacements);
+  std::vector<double> elementFs, elementRs, elementSs; // 9 doubles per element, row-major
+
+  // acceleration indices: locations of the element stiffness matrix entries in the global stiffness matrix
+  SparseMatrixScatter * stiffnessMatrixScatter = NULL;
   void ClearRowColumnIndices();
   void BuildRowColumnIndices(SparseMatrix * sparseMatrix);
+  // element coloring: the elements of each color share no vertices (in increasing order within each color)
+  std::vector<std::vector<int>> elementColors;
+
+  // multi-threaded version of ComputeEnergyAndForceAndStiffnessMatrix
+  void ComputeEnergyAndForceAndStiffnessMatrixMT(const double * vertexDisplacements, double * energy, double * internalForces, SparseMatrix * stiffnessMatrix, int warp);
 
   bool computeElasticityStiffnessTensor(double E[36], int el);
   // build inverse of M = [ v0   v1   v2   v3 ]
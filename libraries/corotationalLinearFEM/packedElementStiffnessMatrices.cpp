@@ -0,0 +1,210 @@
+/*************************************************************************
+ *                                                                       *
+ * Vega FEM Simulation Library Version 4.0                               *
+ *                                                                       *
+ * "corotational linear FEM" library , Copyright (C) 2018 USC            *
+ * All rights reserved.                                                  *
+ *                                                                       *
+ * Code authors: Jernej Barbic, Yijing Li                                *
+ * http://www.jernejbarbic.com/vega                                      *
+ *                                                                       *
+ * Research: Jernej Barbic, Hongyi Xu, Yijing Li,                        *
+ *           Danyong Zhao, Bohan Wang,                                   *
+ *           Fun Shing Sin, Daniel Schroeder,                            *
+ *           Doug L. James, Jovan Popovic                                *
+ *                                                                       *
+ * Funding: National Science Foundation, Link Foundation,                *
+ *          Singapore-MIT GAMBIT Game Lab,                               *
+ *          Zumberge Research and Innovation Fund at USC,                *
+ *          Sloan Foundation, Okawa Foundation,                          *
+ *          USC Annenberg Foundation                                     *
+ *                                                                       *
+ * This library is free software; you can redistribute it and/or         *
+ * modify it under the terms of the BSD-style license that is            *
+ * included with this library in the file LICENSE.txt                    *
+ *                                                                       *
+ * This library is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the file     *
+ * LICENSE.TXT for more details.                                         *
+ *                                                                       *
+ *************************************************************************/
+
+
+#include "packedElementStiffnessMatrices.h"
+
+namespace vegafem
+{
+
+/*
+  Layout of the packed entries of one element: the blocks (a,b), a <= b, in the order
+  (0,0), (0,1), ..., (0,n-1), (1,1), (1,2), ..., (n-1,n-1).
+  A diagonal block stores its upper triangle (00, 01, 02, 11, 12, 22); an off-diagonal block stores its 9 entries, row-major.
+*/
+
+PackedElementStiffnessMatrices::PackedElementStiffnessMatrices(int numElements_, int numElementVertices_, bool singlePrecision_) : 
+  numElements(numElements_), numElementVertices(numElementVertices_), singlePrecision(singlePrecision_)
+{
+  int n = numElementVertices;
+  numPackedEntries = 6 * n + 9 * n * (n - 1) / 2;
+  if (singlePrecision)
+    entriesFloat.assign((size_t)numElements * numPackedEntries, 0.0f);
+  else
+    entries.assign((size_t)numElements * numPackedEntries, 0.0);
+}
+
+size_t PackedElementStiffnessMatrices::GetMemorySize() const
+{
+  return entries.size() * sizeof(double) + entriesFloat.size() * sizeof(float);
+}
+
+template<class real>
+void PackedElementStiffnessMatrices::SetMatrix(real * packed, const double * K) const
+{
+  int dofs = 3 * numElementVertices;
+  #define SYMMETRIZED(row, column) (0.5 * (K[dofs * (row) + (column)] + K[dofs * (column) + (row)]))
+  for(int a=0; a<numElementVertices; a++)
+  {
+    // diagonal block
+    for(int k=0; k<3; k++)
+      for(int l=k; l<3; l++)
+        *(packed++) = (real)SYMMETRIZED(3 * a + k, 3 * a + l);
+
+    // off-diagonal blocks
+    for(int b=a+1; b<numElementVertices; b++)
+      for(int k=0; k<3; k++)
+        for(int l=0; l<3; l++)
+          *(packed++) = (real)SYMMETRIZED(3 * a + k, 3 * b + l);
+  }
+  #undef SYMMETRIZED
+}
+
+template<class real>
+void PackedElementStiffnessMatrices::GetMatrix(const real * packed, double * K) const
+{
+  int dofs = 3 * numElementVertices;
+  for(int a=0; a<numElementVertices; a++)
+  {
+    for(int k=0; k<3; k++)
+      for(int l=k; l<3; l++)
+      {
+        K[dofs * (3 * a + k) + 3 * a + l] = K[dofs * (3 * a + l) + 3 * a + k] = *packed;
+        packed++;
+      }
+
+    for(int b=a+1; b<numElementVertices; b++)
+      for(int k=0; k<3; k++)
+        for(int l=0; l<3; l++)
+        {
+          K[dofs * (3 * a + k) + 3 * b + l] = K[dofs * (3 * b + l) + 3 * a + k] = *packed;
+          packed++;
+        }
+  }
+}
+
+template<class real>
+void PackedElementStiffnessMatrices::MultiplyVector(const real * packed, const double * x, double * Kx) const
+{
+  int dofs = 3 * numElementVertices;
+  for(int i=0; i<dofs; i++)
+    Kx[i] = 0.0;
+
+  for(int a=0; a<numElementVertices; a++)
+  {
+    const double * xa = &x[3 * a];
+    double * Kxa = &Kx[3 * a];
+    // diagonal block: [ p0 p1 p2 ; p1 p3 p4 ; p2 p4 p5 ]
+    Kxa[0] += packed[0] * xa[0] + packed[1] * xa[1] + packed[2] * xa[2];
+    Kxa[1] += packed[1] * xa[0] + packed[3] * xa[1] + packed[4] * xa[2];
+    Kxa[2] += packed[2] * xa[0] + packed[4] * xa[1] + packed[5] * xa[2];
+    packed += 6;
+
+    // off-diagonal block B = K_ab: Kx_a += B x_b, Kx_b += B^T x_a
+    for(int b=a+1; b<numElementVertices; b++)
+    {
+      const double * xb = &x[3 * b];
+      double * Kxb = &Kx[3 * b];
+      for(int k=0; k<3; k++)
+      {
+        Kxa[k] += packed[3 * k + 0] * xb[0] + packed[3 * k + 1] * xb[1] + packed[3 * k + 2] * xb[2];
+        Kxb[k] += packed[k] * xa[0] + packed[3 + k] * xa[1] + packed[6 + k] * xa[2];
+      }
+      packed += 9;
+    }
+  }
+}
+
+template<class real>
+void PackedElementStiffnessMatrices::Warp(const real * packed, const double R[9], double * RKRT) const
+{
+  int dofs = 3 * numElementVertices;
+  for(int a=0; a<numElementVertices; a++)
+    for(int b=a; b<numElementVertices; b++)
+    {
+      // the block B = K_ab
+      double B[9];
+      if (a == b)
+      {
+        B[0] = packed[0]; B[1] = packed[1]; B[2] = packed[2];
+        B[3] = packed[1]; B[4] = packed[3]; B[5] = packed[4];
+        B[6] = packed[2]; B[7] = packed[4]; B[8] = packed[5];
+        packed += 6;
+      }
+      else
+      {
+        for(int i=0; i<9; i++)
+          B[i] = packed[i];
+        packed += 9;
+      }
+
+      // T = B R^T, M = R T = R B R^T
+      double T[9];
+      for(int k=0; k<3; k++)
+        for(int l=0; l<3; l++)
+          T[3 * k + l] = B[3 * k + 0] * R[3 * l + 0] + B[3 * k + 1] * R[3 * l + 1] + B[3 * k + 2] * R[3 * l + 2];
+
+      // block (a,b) is M, block (b,a) is M^T
+      for(int k=0; k<3; k++)
+        for(int l=0; l<3; l++)
+        {
+          double M = R[3 * k + 0] * T[l] + R[3 * k + 1] * T[3 + l] + R[3 * k + 2] * T[6 + l];
+          RKRT[dofs * (3 * a + k) + 3 * b + l] = M;
+          RKRT[dofs * (3 * b + l) + 3 * a + k] = M;
+        }
+    }
+}
+
+void PackedElementStiffnessMatrices::SetMatrix(int el, const double * K)
+{
+  if (singlePrecision)
+    SetMatrix(&entriesFloat[(size_t)el * numPackedEntries], K);
+  else
+    SetMatrix(&entries[(size_t)el * numPackedEntries], K);
+}
+
+void PackedElementStiffnessMatrices::GetMatrix(int el, double * K) const
+{
+  if (singlePrecision)
+    GetMatrix(&entriesFloat[(size_t)el * numPackedEntries], K);
+  else
+    GetMatrix(&entries[(size_t)el * numPackedEntries], K);
+}
+
+void PackedElementStiffnessMatrices::MultiplyVector(int el, const double * x, double * Kx) const
+{
+  if (singlePrecision)
+    MultiplyVector(&entriesFloat[(size_t)el * numPackedEntries], x, Kx);
+  else
+    MultiplyVector(&entries[(size_t)el * numPackedEntries], x, Kx);
+}
+
+void PackedElementStiffnessMatrices::Warp(int el, const double R3[9], double * RKRT) const
+{
+  if (singlePrecision)
+    Warp(&entriesFloat[(size_t)el * numPackedEntries], R3, RKRT);
+  else
+    Warp(&entries[(size_t)el * numPackedEntries], R3, RKRT);
+}
+
+}//namespace vegafem
+
@@ -0,0 +1,97 @@
+/*************************************************************************
+ *                                                                       *
+ * Vega FEM Simulation Library Version 4.0                               *
+ *                                                                       *
+ * "corotational linear FEM" library , Copyright (C) 2018 USC            *
+ * All rights reserved.                                                  *
+ *                                                                       *
+ * Code authors: Jernej Barbic, Yijing Li                                *
+ * http://www.jernejbarbic.com/vega                                      *
+ *                                                                       *
+ * Research: Jernej Barbic, Hongyi Xu, Yijing Li,                        *
+ *           Danyong Zhao, Bohan Wang,                                   *
+ *           Fun Shing Sin, Daniel Schroeder,                            *
+ *           Doug L. James, Jovan Popovic                                *
+ *                                                                       *
+ * Funding: National Science Foundation, Link Foundation,                *
+ *          Singapore-MIT GAMBIT Game Lab,                               *
+ *          Zumberge Research and Innovation Fund at USC,                *
+ *          Sloan Foundation, Okawa Foundation,                          *
+ *          USC Annenberg Foundation                                     *
+ *                                                                       *
+ * This library is free software; you can redistribute it and/or         *
+ * modify it under the terms of the BSD-style license that is            *
+ * included with this library in the file LICENSE.txt                    *
+ *                                                                       *
+ * This library is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the file     *
+ * LICENSE.TXT for more details.                                         *
+ *                                                                       *
+ *************************************************************************/
+
+
+#ifndef VEGAFEM_PACKEDELEMENTSTIFFNESSMATRICES_H
+#define VEGAFEM_PACKEDELEMENTSTIFFNESSMATRICES_H
+
+/*
+  Stores the (symmetric) stiffness matrices of all the elements of a mesh, in a compressed form.
+
+  Each element matrix, of size 3n x 3n (n = number of element vertices), is split into 3x3 blocks (one per pair of element vertices),
+  and only the blocks (a,b) with a <= b are stored: the full 9 entries of the off-diagonal blocks,
+  and the 6 entries of the upper triangle of the (symmetric) diagonal blocks.
+  This is n(3n+1)*3/2 entries per element: 78 for a tet (instead of 144), and 300 for a cube (instead of 576).
+  The entries can be stored in double or single precision; in the latter case, the matrix algebra is still performed
+  in double precision, and the savings are in the memory footprint and memory traffic.
+
+  The block layout makes it possible to warp the matrix, R K R^T with R = diag(R3, ..., R3), in a single pass over
+  the stored blocks ("Warp"), with about one third of the floating-point operations of warping the full matrix.
+*/
+
+#include <vector>
+#include <cstddef>
+
+namespace vegafem
+{
+
+class PackedElementStiffnessMatrices
+{
+public:
+  PackedElementStiffnessMatrices(int numElements, int numElementVertices, bool singlePrecision = false);
+
+  // sets the matrix of element "el" from a full 3n x 3n matrix K; the matrix is symmetrized, i.e., (K + K^T) / 2 is stored
+  // K may be row-major or column-major (the result is the same)
+  void SetMatrix(int el, const double * K);
+  // returns the full 3n x 3n matrix of element "el" (symmetric, hence both row-major and column-major)
+  void GetMatrix(int el, double * K) const;
+
+  // Kx = K * x, where K is the matrix of element "el", and x, Kx are vectors of length 3n
+  void MultiplyVector(int el, const double * x, double * Kx) const;
+  // RKRT = R * K * R^T (full 3n x 3n matrix), where K is the matrix of element "el", and R = diag(R3, ..., R3);
+  // R3 is a 3x3 row-major matrix
+  void Warp(int el, const double R3[9], double * RKRT) const;
+
+  int GetNumElements() const { return numElements; }
+  int GetNumElementVertices() const { return numElementVertices; }
+  bool IsSinglePrecision() const { return singlePrecision; }
+  int GetNumPackedEntries() const { return numPackedEntries; } // per element
+  size_t GetMemorySize() const; // in bytes
+
+protected:
+  int numElements;
+  int numElementVertices;
+  bool singlePrecision;
+  int numPackedEntries;
+  std::vector<double> entries; // double-precision storage (empty in single-precision mode)
+  std::vector<float> entriesFloat; // single-precision storage (empty in double-precision mode)
+
+  template<class real> void SetMatrix(real * packed, const double * K) const;
+  template<class real> void GetMatrix(const real * packed, double * K) const;
+  template<class real> void MultiplyVector(const real * packed, const double * x, double * Kx) const;
+  template<class real> void Warp(const real * packed, const double R3[9], double * RKRT) const;
+};
+
+}//namespace vegafem
+
+#endif
+
@@ -72,5 +72,10 @@ void StVKForceModel::GetTangentStiffnessMatrix(const double * u, SparseMatrix *
   stVKStiffnessMatrix->ComputeStiffnessMatrix(u, tangentStiffnessMatrix);
 } 
 
+void StVKForceModel::GetForceAndMatrix(const double * u, double * internalForces, SparseMatrix * tangentStiffnessMatrix)
+{
+  stVKStiffnessMatrix->ComputeForceAndStiffnessMatrix(u, internalForces, tangentStiffnessMatrix);
+}
+
 
 }//namespace vegafem
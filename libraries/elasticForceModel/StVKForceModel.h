@@ -54,6 +54,7 @@ public:
   virtual void GetInternalForce(const double * u, double * internalForces) override;
   virtual void GetTangentStiffnessMatrixTopology(SparseMatrix ** tangentStiffnessMatrix) override;
   virtual void GetTangentStiffnessMatrix(const double * u, SparseMatrix * tangentStiffnessMatrix) override; 
+  virtual void GetForceAndMatrix(const double * u, double * internalForces, SparseMatrix * tangentStiffnessMatrix) override; 
 
 protected:
   StVKInternalForces * stVKInternalForces;
@@ -49,5 +49,18 @@ void ForceModel::GetForceAndMatrix(const double * u, double * internalForces, Sp
   GetTangentStiffnessMatrix(u, tangentStiffnessMatrix);
 }
 
+void ForceModel::GetEnergyAndForceAndMatrix(const double * u, double * energy, double * internalForces, SparseMatrix * tangentStiffnessMatrix)
+{
+  if (energy != NULL)
+    *energy = GetElasticEnergy(u);
+
+  if ((internalForces != NULL) && (tangentStiffnessMatrix != NULL))
+    GetForceAndMatrix(u, internalForces, tangentStiffnessMatrix);
+  else if (internalForces != NULL)
+    GetInternalForce(u, internalForces);
+  else if (tangentStiffnessMatrix != NULL)
+    GetTangentStiffnessMatrix(u, tangentStiffnessMatrix);
+}
+
 
 }//namespace vegafem
@@ -58,6 +58,9 @@ public:
 
   // sometimes computation time can be saved if we know that we will need both internal forces and tangent stiffness matrices:
   virtual void GetForceAndMatrix(const double * u, double * internalForces, SparseMatrix * tangentStiffnessMatrix); 
+  // computes the elastic energy, internal forces and tangent stiffness matrix; any of energy, internalForces, tangentStiffnessMatrix can be NULL
+  // (the corresponding quantity is then not computed); force models that evaluate all three in one pass override this
+  virtual void GetEnergyAndForceAndMatrix(const double * u, double * energy, double * internalForces, SparseMatrix * tangentStiffnessMatrix);
 
   // reset routines
   virtual void ResetToZero() {}
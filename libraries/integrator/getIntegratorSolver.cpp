@@ -1,5 +1,7 @@
 #include <cstring>
-#include "integratorSolverSelection.h"
+#include <cctype>
+#include "sparseSolverAvailability.h"
+#include "getIntegratorSolver.h"
 
 namespace vegafem
 {
@@ -23,4 +25,93 @@ void GetIntegratorSolver(char * solver)
 }
 
 
+void GetIntegratorSolver(integratorSolverType solverType, char * solver)
+{
+  switch(solverType)
+  {
+    case INTEGRATOR_SOLVER_DEFAULT:
+      strcpy(solver, "DEFAULT");
+    break;
+
+    case INTEGRATOR_SOLVER_AUTO:
+      strcpy(solver, "AUTO");
+    break;
+
+    case INTEGRATOR_SOLVER_PARDISO:
+      strcpy(solver, "PARDISO");
+    break;
+
+    case INTEGRATOR_SOLVER_SPOOLES:
+      strcpy(solver, "SPOOLES");
+    break;
+
+    case INTEGRATOR_SOLVER_PCG:
+      strcpy(solver, "PCG");
+    break;
+
+    default:
+      strcpy(solver, "UNKNOWN");
+    break;
+  }
+}
+
+int GetIntegratorSolverType(const char * solver, integratorSolverType * solverType)
+{
+  const char * names[5] = { "DEFAULT", "AUTO", "PARDISO", "SPOOLES", "PCG" };
+  const integratorSolverType types[5] = { INTEGRATOR_SOLVER_DEFAULT, INTEGRATOR_SOLVER_AUTO, INTEGRATOR_SOLVER_PARDISO, INTEGRATOR_SOLVER_SPOOLES, INTEGRATOR_SOLVER_PCG };
+  for(int i=0; i<5; i++)
+  {
+    // case-insensitive comparison
+    int j = 0;
+    while ((solver[j] != 0) && (toupper((unsigned char)solver[j]) == names[i][j]))
+      j++;
+    if ((solver[j] == 0) && (names[i][j] == 0))
+    {
+      *solverType = types[i];
+      return 0;
+    }
+  }
+  return 1;
+}
+
+integratorSolverType SelectIntegratorSolver(integratorSolverType solverType, int numDOFs, int numEntries)
+{
+  if (solverType == INTEGRATOR_SOLVER_DEFAULT)
+  {
+    #ifdef PCG 
+      solverType = INTEGRATOR_SOLVER_PCG;
+    #endif
+
+    #ifdef SPOOLES 
+      solverType = INTEGRATOR_SOLVER_SPOOLES;
+    #endif
+
+    #ifdef PARDISO 
+      solverType = INTEGRATOR_SOLVER_PARDISO;
+    #endif
+  }
+
+  if (solverType != INTEGRATOR_SOLVER_AUTO)
+    return solverType;
+
+  // limits for the direct solvers (SPOOLES is single-threaded and slower than PARDISO, hence the lower limit)
+  integratorSolverType directSolver = INTEGRATOR_SOLVER_PCG; // no direct solver available
+  int maxNumDOFs = 0, maxNumEntries = 0;
+  #if defined(PARDISO_SOLVER_IS_AVAILABLE)
+    directSolver = INTEGRATOR_SOLVER_PARDISO;
+    maxNumDOFs = 150000;
+    maxNumEntries = 6000000;
+  #elif defined(SPOOLES_SOLVER_IS_AVAILABLE)
+    directSolver = INTEGRATOR_SOLVER_SPOOLES;
+    maxNumDOFs = 30000;
+    maxNumEntries = 1200000;
+  #endif
+
+  if ((numDOFs <= maxNumDOFs) && (numEntries <= maxNumEntries))
+    return directSolver;
+
+  return INTEGRATOR_SOLVER_PCG;
+}
+
+
 }//namespace vegafem
@@ -1,6 +1,8 @@
 #ifndef VEGAFEM_GETINTEGRATORSOLVER_H
 #define VEGAFEM_GETINTEGRATORSOLVER_H
 
+#include "integratorSolverSelection.h"
+
 namespace vegafem
 {
 // returns the string corresponding to the selected integrator solver
@@ -8,6 +10,20 @@ namespace vegafem
 // result: PARDISO, SPOOLES or PCG
 void GetIntegratorSolver(char * solver);
 
+// returns the string corresponding to the given run-time solver type
+// result: DEFAULT, AUTO, PARDISO, SPOOLES or PCG
+void GetIntegratorSolver(integratorSolverType solverType, char * solver);
+
+// parses the solver name (DEFAULT, AUTO, PARDISO, SPOOLES or PCG; case-insensitive) into "solverType"
+// returns 0 on success, 1 if the name is not recognized (solverType is then not modified)
+int GetIntegratorSolverType(const char * solver, integratorSolverType * solverType);
+
+// resolves INTEGRATOR_SOLVER_DEFAULT and INTEGRATOR_SOLVER_AUTO into a specific solver (other types are returned unchanged)
+// "auto" mode chooses a direct solver if one is available (PARDISO preferred over SPOOLES) and the system is small enough;
+// the fill-in of the factorization grows faster than the number of non-zero entries, so large systems use PCG instead
+// numDOFs: dimension of the system matrix; numEntries: number of non-zero entries of the system matrix
+integratorSolverType SelectIntegratorSolver(integratorSolverType solverType, int numDOFs, int numEntries);
+
 }//namespace vegafem
 #endif
 
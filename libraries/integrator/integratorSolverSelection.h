@@ -30,7 +30,10 @@
  *                                                                       *
  *************************************************************************/
 
-// Selects which solver is used by the integrator library.
+#ifndef VEGAFEM_INTEGRATORSOLVERSELECTION_H
+#define VEGAFEM_INTEGRATORSOLVERSELECTION_H
+
+// Selects the default solver used by the integrator library.
 // Exactly one of PARDISO, SPOOLES, PCG should be enabled.
 // Note: for PARDISO or SPOOLES, the selected solver must be installed and its
 //       availability also set in libraries/sparseSolvers/sparseSolverAvailability.h .
@@ -41,3 +44,15 @@
 //#define SPOOLES
 #define PCG
 
+namespace vegafem
+{
+
+// The sparse integrators can also select the solver at run time (see integratorSparseSolver.h):
+// INTEGRATOR_SOLVER_DEFAULT: the solver selected by the macro above
+// INTEGRATOR_SOLVER_AUTO: a direct solver (PARDISO or SPOOLES, if available) for small and medium systems, PCG for large systems (see getIntegratorSolver.h)
+typedef enum { INTEGRATOR_SOLVER_DEFAULT, INTEGRATOR_SOLVER_AUTO, INTEGRATOR_SOLVER_PARDISO, INTEGRATOR_SOLVER_SPOOLES, INTEGRATOR_SOLVER_PCG } integratorSolverType;
+
+}//namespace vegafem
+
+#endif
+
@@ -42,11 +42,24 @@
 namespace vegafem
 {
 
-CentralDifferencesSparse::CentralDifferencesSparse(int numDOFs, double timestep, SparseMatrix * massMatrix_, ForceModel * forceModel_, int numConstrainedDOFs, int * constrainedDOFs, double dampingMassCoef, double dampingStiffnessCoef, int tangentialDampingMode_, int numSolverThreads_): IntegratorBaseSparse(numDOFs, timestep, massMatrix_, forceModel_, numConstrainedDOFs, constrainedDOFs, dampingMassCoef, dampingStiffnessCoef), tangentialDampingMode(tangentialDampingMode_), numSolverThreads(numSolverThreads_), timestepIndex(0)
+CentralDifferencesSparse::CentralDifferencesSparse(int numDOFs, double timestep, SparseMatrix * massMatrix_, ForceModel * forceModel_, int numConstrainedDOFs, int * constrainedDOFs, double dampingMassCoef, double dampingStiffnessCoef, int tangentialDampingMode_, int numSolverThreads_, integratorSolverType solverType_): IntegratorBaseSparse(numDOFs, timestep, massMatrix_, forceModel_, numConstrainedDOFs, constrainedDOFs, dampingMassCoef, dampingStiffnessCoef), tangentialDampingMode(tangentialDampingMode_), numSolverThreads(numSolverThreads_), solverType(solverType_), timestepIndex(0)
 {
   rhs = (double*) malloc (sizeof(double) * r);
   rhsConstrained = (double*) malloc (sizeof(double) * (r - numConstrainedDOFs));
 
+  tangentStiffnessMatrix = rayleighDampingMatrix = systemMatrix = NULL;
+  systemSolver = NULL;
+
+  diagonalSystemMatrix = (lumpedMass != NULL) && (dampingStiffnessCoef == 0.0);
+  if (diagonalSystemMatrix)
+    return;
+
+  BuildSystemSolver();
+  DecomposeSystemMatrix();
+}
+
+void CentralDifferencesSparse::BuildSystemSolver()
+{
   forceModel->GetTangentStiffnessMatrixTopology(&tangentStiffnessMatrix);
   rayleighDampingMatrix = new SparseMatrix(*tangentStiffnessMatrix);
   rayleighDampingMatrix->BuildSubMatrixIndices(*massMatrix);
@@ -62,38 +75,18 @@ CentralDifferencesSparse::CentralDifferencesSparse(int numDOFs, double timestep,
   systemMatrix->RemoveRowsColumns(numConstrainedDOFs, constrainedDOFs);
   systemMatrix->BuildSuperMatrixIndices(numConstrainedDOFs, constrainedDOFs, tangentStiffnessMatrix);
 
-  #ifdef PARDISO
-    printf("Creating Pardiso solver for central differences.\n");
-    pardisoSolver = new PardisoSolver(systemMatrix, numSolverThreads, PardisoSolver::REAL_SYM_INDEFINITE);
-  #endif
-
-  #ifdef SPOOLES
-    spoolesSolver = NULL;
-  #endif
-
-  #ifdef PCG
-    printf("Creating Jacobi solver for central differences.\n");
-    jacobiPreconditionedCGSolver = new CGSolver(systemMatrix);
-  #endif
+  systemSolver = new IntegratorSparseSolver(systemMatrix, solverType, numSolverThreads);
+  printf("Creating %s solver for central differences.\n", systemSolver->GetSolverName());
+}
 
-  DecomposeSystemMatrix();
+CentralDifferencesSparse::CentralDifferencesSparse(int numDOFs, double timestep, const double * lumpedMass_, ForceModel * forceModel_, int numConstrainedDOFs, int * constrainedDOFs, double dampingMassCoef, double dampingStiffnessCoef, int tangentialDampingMode_, int numSolverThreads_, integratorSolverType solverType): CentralDifferencesSparse(numDOFs, timestep, CreateDiagonalMatrix(numDOFs, lumpedMass_), forceModel_, numConstrainedDOFs, constrainedDOFs, dampingMassCoef, dampingStiffnessCoef, tangentialDampingMode_, numSolverThreads_, solverType)
+{
+  ownMassMatrix = 1;
 }
 
 CentralDifferencesSparse::~CentralDifferencesSparse()
 {
-  #ifdef PARDISO
-    delete(pardisoSolver);
-  #endif
-
-  #ifdef SPOOLES
-    if (spoolesSolver != NULL)
-      delete(spoolesSolver);
-  #endif
-
-  #ifdef PCG
-    delete(jacobiPreconditionedCGSolver);
-  #endif
-
+  delete(systemSolver);
   delete(systemMatrix);
   delete(tangentStiffnessMatrix);
   delete(rayleighDampingMatrix);
@@ -103,6 +96,10 @@ CentralDifferencesSparse::~CentralDifferencesSparse()
 
 void CentralDifferencesSparse::DecomposeSystemMatrix()
 {
+  // the diagonal system matrix is inverted directly in DoTimestep
+  if (diagonalSystemMatrix)
+    return;
+
   //printf("*** Central differences: decomposing the system matrix.\n");
   // construct damping matrix
   // rayleigh damping matrix = dampingMasscoef * massMatrix + dampingStiffnessCoef * stiffness matrix
@@ -119,24 +116,12 @@ void CentralDifferencesSparse::DecomposeSystemMatrix()
 
   //systemMatrix->SaveToMatlabFormat("system.mat");
   
-  #ifdef PARDISO
-    int info = pardisoSolver->FactorMatrix(systemMatrix);
-    if (info != 0)
-    {
-      printf("Error: PARDISO solver returned non-zero exit code %d.\n", info);
-      exit(1);
-    }
-  #endif
-
-  #ifdef SPOOLES
-    printf("Creating SPOOLES solver for central differences.\n");
-    if (spoolesSolver != NULL)
-      delete(spoolesSolver);
-    if (numSolverThreads > 1)
-      spoolesSolver = new SPOOLESSolverMT(systemMatrix, numSolverThreads);
-    else
-      spoolesSolver = new SPOOLESSolver(systemMatrix);
-  #endif
+  int info = systemSolver->FactorMatrix();
+  if (info != 0)
+  {
+    printf("Error: %s solver returned non-zero exit code %d.\n", systemSolver->GetSolverName(), info);
+    exit(1);
+  }
 }
 
 int CentralDifferencesSparse::DoTimestep()
@@ -148,71 +133,75 @@ int CentralDifferencesSparse::DoTimestep()
   counterForceAssemblyTime.StopCounter();
   forceAssemblyTime = counterForceAssemblyTime.GetElapsedTime();
 
-  if (tangentialDampingMode > 0)
-    if (timestepIndex % tangentialDampingMode == 0)
-      DecomposeSystemMatrix(); // this routines also updates the damping and system matrices
+  if (diagonalSystemMatrix)
+  {
+    // (1 + dt / 2 * dampingMassCoef) * M * (q(t+1) - q(t)) = (dt)^2 * (fext(t) - fint(q(t))) + (1 - dt / 2 * dampingMassCoef) * M * (q(t) - q(t-1))
+    PerformanceCounter counterSystemSolveTime;
+    double timestep2 = timestep * timestep;
+    double previousCoef = 1.0 - 0.5 * timestep * dampingMassCoef;
+    double systemCoef = 1.0 / (1.0 + 0.5 * timestep * dampingMassCoef);
+    for (int i=0; i<r; i++)
+    {
+      // inverseLumpedMass is zero at the constrained DOFs
+      double rhs_i = previousCoef * lumpedMass[i] * (q[i] - q_1[i]) + timestep2 * (externalForces[i] - internalForces[i]);
+      qdelta[i] = systemCoef * inverseLumpedMass[i] * rhs_i;
+    }
+    counterSystemSolveTime.StopCounter();
+    systemSolveTime = counterSystemSolveTime.GetElapsedTime();
+  }
+  else
+  {
+    if (tangentialDampingMode > 0)
+      if (timestepIndex % tangentialDampingMode == 0)
+        DecomposeSystemMatrix(); // this routines also updates the damping and system matrices
   
-  // update equation is (see WRIGGERS P.: Computational Contact Mechanics. John Wiley & Sons, Ltd., 2002., page 275) :
-  //
-  // (M + dt / 2 * C) * q(t+1) = (dt)^2 * (fext(t) - fint(q(t))) + dt / 2 * C * q(t-1) + M * (2q(t) - q(t-1))
-  //
-  // (M + dt / 2 * C) * (q(t+1) - q(t)) = (dt)^2 * (fext(t) - fint(q(t))) + dt / 2 * C * (q(t-1) - q(t)) + M * (q(t) - q(t-1)) 
+    // update equation is (see WRIGGERS P.: Computational Contact Mechanics. John Wiley & Sons, Ltd., 2002., page 275) :
+    //
+    // (M + dt / 2 * C) * q(t+1) = (dt)^2 * (fext(t) - fint(q(t))) + dt / 2 * C * q(t-1) + M * (2q(t) - q(t-1))
+    //
+    // (M + dt / 2 * C) * (q(t+1) - q(t)) = (dt)^2 * (fext(t) - fint(q(t))) + dt / 2 * C * (q(t-1) - q(t)) + M * (q(t) - q(t-1)) 
 
-  // fext are the external forces
-  // fint is the vector of internal forces
+    // fext are the external forces
+    // fint is the vector of internal forces
 
-  // compute rhs = (dt)^2 * (fext - fint(q(t))) + dt / 2 * C * (q(t-1) - q(t)) + M * (q(t) - q(t-1))
-  // first, compute rhs = M * (q - q_1)
-  for (int i=0; i<r; i++)
-    buffer[i] = q[i] - q_1[i];
-  massMatrix->MultiplyVector(buffer, rhs);
+    // compute rhs = (dt)^2 * (fext - fint(q(t))) + dt / 2 * C * (q(t-1) - q(t)) + M * (q(t) - q(t-1))
+    // first, compute rhs = M * (q - q_1)
+    for (int i=0; i<r; i++)
+      buffer[i] = q[i] - q_1[i];
+    MassMatrixMultiplyVector(buffer, rhs);
   
-  // rhs += dt / 2 * dampingMatrix * (q_{n-1} - q_n)
-  for (int i=0; i<r; i++)
-    qdelta[i] = q_1[i] - q[i];
-  rayleighDampingMatrix->MultiplyVector(qdelta, buffer);
-  for (int i=0; i<r; i++)
-    rhs[i] += 0.5 * timestep * buffer[i];
-
-  // rhs += dt * dt * (fext - fint(q(t))) 
-  double timestep2 = timestep * timestep;
-  for (int i=0; i<r; i++)
-    rhs[i] += timestep2 * (externalForces[i] - internalForces[i]);
+    // rhs += dt / 2 * dampingMatrix * (q_{n-1} - q_n)
+    for (int i=0; i<r; i++)
+      qdelta[i] = q_1[i] - q[i];
+    rayleighDampingMatrix->MultiplyVector(qdelta, buffer);
+    for (int i=0; i<r; i++)
+      rhs[i] += 0.5 * timestep * buffer[i];
 
-  // now rhs contains the correct value
+    // rhs += dt * dt * (fext - fint(q(t))) 
+    double timestep2 = timestep * timestep;
+    for (int i=0; i<r; i++)
+      rhs[i] += timestep2 * (externalForces[i] - internalForces[i]);
 
-  ConstrainedDOFs::RemoveDOFs(r, rhsConstrained, rhs, numConstrainedDOFs, constrainedDOFs);
+    // now rhs contains the correct value
 
-  PerformanceCounter counterSystemSolveTime;
+    ConstrainedDOFs::RemoveDOFs(r, rhsConstrained, rhs, numConstrainedDOFs, constrainedDOFs);
 
-  memset(buffer, 0, sizeof(double) * r);
+    PerformanceCounter counterSystemSolveTime;
 
-  #ifdef SPOOLES
-    int info = spoolesSolver->SolveLinearSystem(buffer, rhsConstrained);
-    char solverString[16] = "SPOOLES";
-  #endif
+    memset(buffer, 0, sizeof(double) * r);
 
-  #ifdef PARDISO
-    int info = pardisoSolver->SolveLinearSystem(buffer, rhsConstrained);
-    char solverString[16] = "PARDISO";
-  #endif
-  
-  #ifdef PCG
-    int info = jacobiPreconditionedCGSolver->SolveLinearSystemWithJacobiPreconditioner(buffer, rhsConstrained, 1e-6, 10000);
-    if (info > 0)
-      info = 0;
-    char solverString[16] = "PCG";
-  #endif
+    int info = systemSolver->SolveLinearSystem(buffer, rhsConstrained);
 
-  ConstrainedDOFs::InsertDOFs(r, buffer, qdelta, numConstrainedDOFs, constrainedDOFs);
+    ConstrainedDOFs::InsertDOFs(r, buffer, qdelta, numConstrainedDOFs, constrainedDOFs);
 
-  counterSystemSolveTime.StopCounter();
-  systemSolveTime = counterSystemSolveTime.GetElapsedTime();
+    counterSystemSolveTime.StopCounter();
+    systemSolveTime = counterSystemSolveTime.GetElapsedTime();
 
-  if (info != 0)
-  {
-    printf("Error: %s sparse solver returned non-zero exit status %d.\n", solverString, (int)info);
-    return 1;
+    if (info != 0)
+    {
+      printf("Error: %s sparse solver returned non-zero exit status %d.\n", systemSolver->GetSolverName(), (int)info);
+      return 1;
+    }
   }
 
   // the new value of q is now in buffer
@@ -256,6 +245,23 @@ void CentralDifferencesSparse::SetInternalForceScalingFactor(double internalForc
   DecomposeSystemMatrix();
 }
 
+void CentralDifferencesSparse::SetDampingMassCoef(double dampingMassCoef)
+{
+  IntegratorBaseSparse::SetDampingMassCoef(dampingMassCoef);
+  DecomposeSystemMatrix();
+}
+
+void CentralDifferencesSparse::SetDampingStiffnessCoef(double dampingStiffnessCoef)
+{
+  IntegratorBaseSparse::SetDampingStiffnessCoef(dampingStiffnessCoef);
+
+  // with stiffness damping, the system matrix is no longer diagonal
+  diagonalSystemMatrix = (lumpedMass != NULL) && (dampingStiffnessCoef == 0.0);
+  if (!diagonalSystemMatrix && (systemSolver == NULL))
+    BuildSystemSolver();
+  DecomposeSystemMatrix();
+}
+
 void CentralDifferencesSparse::ResetToRest()
 {
   IntegratorBaseSparse::ResetToRest();
@@ -56,6 +56,11 @@ linear modal analysis simulations (stiffness matrix is constant in that case).
 Mode 2. gives a better damping model for large deformations, but because the
 system matrix changes, requires factoring a linear system anew at each timestep.
 
+With a lumped (diagonal) mass matrix and no stiffness damping (dampingStiffnessCoef = 0),
+the system matrix M + dt / 2 * D is diagonal, and each timestep is a direct O(r) update
+(no tangent stiffness matrices are computed). The linear solver is created when
+stiffness damping is enabled (in the constructor, or later with SetDampingStiffnessCoef).
+
 In order to use this class, you need to set the timestep very small, or 
 else the explicit integrator will go unstable. Roughly speaking, the timestep 
 must resolve the highest frequency present in your simulation. 
@@ -69,22 +74,16 @@ See also integratorBase.h .
 
 #include "integratorBaseSparse.h"
 #include "integratorSolverSelection.h"
-
-#ifdef PARDISO
-  #include "sparseSolvers.h"
-#endif
-#ifdef SPOOLES
-  #include "sparseSolvers.h"
-#endif
-#ifdef PCG
-  #include "CGSolver.h"
-#endif
+#include "integratorSparseSolver.h"
 namespace vegafem
 {
 class CentralDifferencesSparse : public IntegratorBaseSparse
 {
 public:
-  CentralDifferencesSparse(int numDOFs, double timestep, SparseMatrix * massMatrix, ForceModel * forceModel, int numConstrainedDOFs=0, int * constrainedDOFs=NULL, double dampingMassCoef=0.0, double dampingStiffnessCoef=0.0, int tangentialDampingMode=1, int numSolverThreads=0);
+  // solverType selects the sparse linear solver (see integratorSolverSelection.h)
+  CentralDifferencesSparse(int numDOFs, double timestep, SparseMatrix * massMatrix, ForceModel * forceModel, int numConstrainedDOFs=0, int * constrainedDOFs=NULL, double dampingMassCoef=0.0, double dampingStiffnessCoef=0.0, int tangentialDampingMode=1, int numSolverThreads=0, integratorSolverType solverType=INTEGRATOR_SOLVER_DEFAULT);
+  // lumped mass matrix, given as a vector of numDOFs per-DOF masses (see integratorBaseSparse.h)
+  CentralDifferencesSparse(int numDOFs, double timestep, const double * lumpedMass, ForceModel * forceModel, int numConstrainedDOFs=0, int * constrainedDOFs=NULL, double dampingMassCoef=0.0, double dampingStiffnessCoef=0.0, int tangentialDampingMode=1, int numSolverThreads=0, integratorSolverType solverType=INTEGRATOR_SOLVER_DEFAULT);
 
   virtual ~CentralDifferencesSparse();
 
@@ -93,6 +92,9 @@ public:
   // performs one timestep of simulation
   virtual int DoTimestep(); 
 
+  // the sparse linear solver (NULL if the system matrix has been diagonal since construction)
+  inline IntegratorSparseSolver * GetSystemSolver() { return systemSolver; }
+
   // sets q, and (optionally) qvel 
   // returns 0 
   virtual int SetState(double * q, double * qvel=NULL);
@@ -105,6 +107,10 @@ public:
 
   virtual void SetInternalForceScalingFactor(double internalForceScalingFactor);
 
+  // the system matrix is updated (and, if the mass matrix is lumped, switches between the diagonal update and the linear solver)
+  virtual void SetDampingMassCoef(double dampingMassCoef);
+  virtual void SetDampingStiffnessCoef(double dampingStiffnessCoef);
+
   virtual void ResetToRest();
 
 protected:
@@ -115,21 +121,16 @@ protected:
   SparseMatrix * systemMatrix;
   int tangentialDampingMode;
   int numSolverThreads;
+  integratorSolverType solverType;
   int timestepIndex;
+  // lumped mass matrix and no stiffness damping: the system matrix is (1 + dt / 2 * dampingMassCoef) * M
+  bool diagonalSystemMatrix;
 
+  // creates the tangent stiffness, damping and system matrices, and the linear solver (not needed while the system matrix is diagonal)
+  void BuildSystemSolver();
   void DecomposeSystemMatrix();
 
-  #ifdef PARDISO
-    PardisoSolver * pardisoSolver;
-  #endif
-
-  #ifdef SPOOLES
-    LinearSolver * spoolesSolver;
-  #endif
-
-  #ifdef PCG
-    CGSolver * jacobiPreconditionedCGSolver;
-  #endif
+  IntegratorSparseSolver * systemSolver;
 };
 }//namespace vegafem
 #endif
@@ -41,51 +41,39 @@
 namespace vegafem
 {
 
-EulerSparse::EulerSparse(int r, double timestep, SparseMatrix * massMatrix_, ForceModel * forceModel_, int symplectic_, int numConstrainedDOFs_, int * constrainedDOFs_, double dampingMassCoef, int numSolverThreads): IntegratorBaseSparse(r, timestep, massMatrix_, forceModel_, numConstrainedDOFs_, constrainedDOFs_, dampingMassCoef, 0.0), symplectic(symplectic_)
+EulerSparse::EulerSparse(int r, double timestep, SparseMatrix * massMatrix_, ForceModel * forceModel_, int symplectic_, int numConstrainedDOFs_, int * constrainedDOFs_, double dampingMassCoef, int numSolverThreads, integratorSolverType solverType): IntegratorBaseSparse(r, timestep, massMatrix_, forceModel_, numConstrainedDOFs_, constrainedDOFs_, dampingMassCoef, 0.0), symplectic(symplectic_)
 {
-  systemMatrix = new SparseMatrix(*massMatrix);
-  systemMatrix->RemoveRowsColumns(numConstrainedDOFs, constrainedDOFs);
-  #ifdef PARDISO
-    printf("Creating Pardiso solver for M.\n");
-    pardisoSolver = new PardisoSolver(systemMatrix, numSolverThreads, PardisoSolver::REAL_SPD);
-    int info = pardisoSolver->FactorMatrix(systemMatrix);
-    if (info != 0)
-    {
-      printf("Error: PARDISO solver returned non-zero exit code %d.\n", info);
-      exit(1);
-    }
-    printf("Solver created.\n");
-  #endif
+  systemMatrix = NULL;
+  systemSolver = NULL;
+  bufferConstrained = NULL;
 
-  #ifdef SPOOLES
-    printf("Creating SPOOLES solver for M.\n");
-    spoolesSolver = new SPOOLESSolver(systemMatrix);
-    printf("Solver created.\n");
-  #endif
+  // a lumped mass matrix is inverted directly
+  if (lumpedMass != NULL)
+    return;
 
-  #ifdef PCG
-    printf("Creating Jacobi solver for M.\n");
-    jacobiPreconditionedCGSolver = new CGSolver(systemMatrix);
-    printf("Solver created.\n");
-  #endif
+  systemMatrix = new SparseMatrix(*massMatrix);
+  systemMatrix->RemoveRowsColumns(numConstrainedDOFs, constrainedDOFs);
+  systemSolver = new IntegratorSparseSolver(systemMatrix, solverType, numSolverThreads, 1);
+  printf("Creating %s solver for M.\n", systemSolver->GetSolverName());
+  int info = systemSolver->FactorMatrix();
+  if (info != 0)
+  {
+    printf("Error: %s solver returned non-zero exit code %d.\n", systemSolver->GetSolverName(), info);
+    exit(1);
+  }
+  printf("Solver created.\n");
 
   bufferConstrained = (double*)malloc(sizeof(double) * (r - numConstrainedDOFs));
 }
 
-EulerSparse::~EulerSparse()
+EulerSparse::EulerSparse(int r, double timestep, const double * lumpedMass_, ForceModel * forceModel_, int symplectic_, int numConstrainedDOFs_, int * constrainedDOFs_, double dampingMassCoef, int numSolverThreads, integratorSolverType solverType): EulerSparse(r, timestep, CreateDiagonalMatrix(r, lumpedMass_), forceModel_, symplectic_, numConstrainedDOFs_, constrainedDOFs_, dampingMassCoef, numSolverThreads, solverType)
 {
-  #ifdef PARDISO
-    delete(pardisoSolver);
-  #endif
-
-  #ifdef SPOOLES
-    delete(spoolesSolver);
-  #endif
-
-  #ifdef PCG
-    delete(jacobiPreconditionedCGSolver);
-  #endif
+  ownMassMatrix = 1;
+}
 
+EulerSparse::~EulerSparse()
+{
+  delete(systemSolver);
   delete(systemMatrix);
   free(bufferConstrained);
 }
@@ -126,7 +114,7 @@ int EulerSparse::DoTimestep()
 
   // damping
   double * dampingForces = buffer;
-  massMatrix->MultiplyVector(qvel, dampingForces);
+  MassMatrixMultiplyVector(qvel, dampingForces);
   for(int i=0; i<r; i++)
     dampingForces[i] *= dampingMassCoef;
   dampingMatrix->MultiplyVectorAdd(qvel, dampingForces);
@@ -141,41 +129,34 @@ int EulerSparse::DoTimestep()
     qresidual[i] = externalForces[i] - internalForces[i] - dampingForces[i];
   }
 
-  ConstrainedDOFs::RemoveDOFs(r, bufferConstrained, qresidual, numConstrainedDOFs, constrainedDOFs);
-
   PerformanceCounter counterSystemSolveTime;
 
   // solve: M * qdelta = qresidual
 
-  memset(buffer, 0, sizeof(double)*r);
-
-  #ifdef PARDISO
-    int info = pardisoSolver->SolveLinearSystem(buffer, bufferConstrained);
-    char solverString[16] = "PARDISO";
-  #endif
+  if (lumpedMass != NULL)
+  {
+    // inverseLumpedMass is zero at the constrained DOFs
+    for(int i=0; i<r; i++)
+      qdelta[i] = inverseLumpedMass[i] * qresidual[i];
+  }
+  else
+  {
+    ConstrainedDOFs::RemoveDOFs(r, bufferConstrained, qresidual, numConstrainedDOFs, constrainedDOFs);
 
-  #ifdef SPOOLES
-    int info = spoolesSolver->SolveLinearSystem(buffer, bufferConstrained);
-    char solverString[16] = "SPOOLES";
-  #endif
+    memset(buffer, 0, sizeof(double)*r);
 
-  #ifdef PCG
-    int info = jacobiPreconditionedCGSolver->SolveLinearSystemWithJacobiPreconditioner(buffer, bufferConstrained, 1e-6, 10000);
-    if (info > 0)
-      info = 0;
-    char solverString[16] = "PCG";
-  #endif
+    int info = systemSolver->SolveLinearSystem(buffer, bufferConstrained);
+    if (info != 0)
+    {
+      printf("Error: %s sparse solver returned non-zero exit status %d.\n", systemSolver->GetSolverName(), (int)info);
+      return 1;
+    }
 
-  if (info != 0)
-  {
-    printf("Error: %s sparse solver returned non-zero exit status %d.\n", solverString, (int)info);
-    return 1;
+    ConstrainedDOFs::InsertDOFs(r, buffer, qdelta, numConstrainedDOFs, constrainedDOFs);
   }
 
   counterSystemSolveTime.StopCounter();
   systemSolveTime = counterSystemSolveTime.GetElapsedTime();
-
-  ConstrainedDOFs::InsertDOFs(r, buffer, qdelta, numConstrainedDOFs, constrainedDOFs);
   // update state
   if (symplectic)
   {
@@ -47,16 +47,7 @@
 
 #include "integratorSolverSelection.h"
 #include "integratorBaseSparse.h"
-
-#ifdef PARDISO
-  #include "sparseSolvers.h"
-#endif
-#ifdef SPOOLES
-  #include "sparseSolvers.h"
-#endif
-#ifdef PCG
-  #include "CGSolver.h"
-#endif
+#include "integratorSparseSolver.h"
 
 namespace vegafem
 {
@@ -67,7 +58,11 @@ public:
   // constrainedDOFs is an integer array of degrees of freedom that are to be fixed to zero (e.g., to permanently fix a vertex in a deformable simulation)
   // constrainedDOFs are 0-indexed (separate DOFs for x,y,z), and must be pre-sorted (ascending)
   // dampingMatrix is optional and provides damping (in addition to mass damping)
-  EulerSparse(int r, double timestep, SparseMatrix * massMatrix, ForceModel * forceModel, int symplectic=0, int numConstrainedDOFs=0, int * constrainedDOFs=NULL, double dampingMassCoef=0.0, int numSolverThreads=1);
+  // solverType selects the sparse linear solver for the mass matrix (see integratorSolverSelection.h)
+  // if the mass matrix is diagonal (lumped), no solver is created, and each timestep is a direct O(r) update
+  EulerSparse(int r, double timestep, SparseMatrix * massMatrix, ForceModel * forceModel, int symplectic=0, int numConstrainedDOFs=0, int * constrainedDOFs=NULL, double dampingMassCoef=0.0, int numSolverThreads=1, integratorSolverType solverType=INTEGRATOR_SOLVER_DEFAULT);
+  // lumped mass matrix, given as a vector of r per-DOF masses (see integratorBaseSparse.h)
+  EulerSparse(int r, double timestep, const double * lumpedMass, ForceModel * forceModel, int symplectic=0, int numConstrainedDOFs=0, int * constrainedDOFs=NULL, double dampingMassCoef=0.0, int numSolverThreads=1, integratorSolverType solverType=INTEGRATOR_SOLVER_DEFAULT);
 
   virtual ~EulerSparse();
 
@@ -77,22 +72,14 @@ public:
 
   virtual int DoTimestep(); 
 
+  // the sparse linear solver (NULL with a lumped mass matrix)
+  inline IntegratorSparseSolver * GetSystemSolver() { return systemSolver; }
+
 protected:
   int symplectic;
   SparseMatrix * systemMatrix;
   double * bufferConstrained;
-  
-  #ifdef PARDISO
-    PardisoSolver * pardisoSolver;
-  #endif
-
-  #ifdef SPOOLES
-    SPOOLESSolver * spoolesSolver;
-  #endif
-
-  #ifdef PCG
-    CGSolver * jacobiPreconditionedCGSolver;
-  #endif
+  IntegratorSparseSolver * systemSolver;
 };
 
 }//namespace vegafem
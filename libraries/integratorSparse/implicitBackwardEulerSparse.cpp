@@ -33,6 +33,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <cmath>
 #include "matrixIO.h"
 #include "performanceCounter.h"
 #include "constrainedDOFs.h"
@@ -41,8 +42,14 @@
 namespace vegafem
 {
 
-ImplicitBackwardEulerSparse::ImplicitBackwardEulerSparse(int r, double timestep, SparseMatrix * massMatrix_, ForceModel * forceModel_, int numConstrainedDOFs_, int * constrainedDOFs_, double dampingMassCoef, double dampingStiffnessCoef, int maxIterations, double epsilon, int numSolverThreads_): ImplicitNewmarkSparse(r, timestep, massMatrix_, forceModel_, numConstrainedDOFs_, constrainedDOFs_, dampingMassCoef, dampingStiffnessCoef, maxIterations, epsilon, 0.25, 0.5, numSolverThreads_)
+ImplicitBackwardEulerSparse::ImplicitBackwardEulerSparse(int r, double timestep, SparseMatrix * massMatrix_, ForceModel * forceModel_, int numConstrainedDOFs_, int * constrainedDOFs_, double dampingMassCoef, double dampingStiffnessCoef, int maxIterations, double epsilon, int numSolverThreads_, integratorSolverType solverType): ImplicitNewmarkSparse(r, timestep, massMatrix_, forceModel_, numConstrainedDOFs_, constrainedDOFs_, dampingMassCoef, dampingStiffnessCoef, maxIterations, epsilon, 0.25, 0.5, numSolverThreads_, solverType)
 {
+  localErrorOrder = 2.0;
+}
+
+ImplicitBackwardEulerSparse::ImplicitBackwardEulerSparse(int r, double timestep, const double * lumpedMass_, ForceModel * forceModel_, int numConstrainedDOFs_, int * constrainedDOFs_, double dampingMassCoef, double dampingStiffnessCoef, int maxIterations, double epsilon, int numSolverThreads_, integratorSolverType solverType): ImplicitBackwardEulerSparse(r, timestep, CreateDiagonalMatrix(r, lumpedMass_), forceModel_, numConstrainedDOFs_, constrainedDOFs_, dampingMassCoef, dampingStiffnessCoef, maxIterations, epsilon, numSolverThreads_, solverType)
+{
+  ownMassMatrix = 1;
 }
 
 ImplicitBackwardEulerSparse::~ImplicitBackwardEulerSparse()
@@ -58,30 +65,68 @@ int ImplicitBackwardEulerSparse::SetState(double * q_, double * qvel_)
   if (qvel_ != NULL)
     memcpy(qvel, qvel_, sizeof(double)*r);
 
+  // no velocity change is known (used by the warm start)
+  memset(qaccel, 0, sizeof(double)*r);
+
   return 0;
 }
 
-int ImplicitBackwardEulerSparse::DoTimestep()
+double ImplicitBackwardEulerSparse::ComputeLocalErrorEstimate()
+{
+  // backward Euler: q = q_1 + h qvel, whereas q(t+h) = q_1 + h qvel_1 + h^2/2 qaccel + O(h^3); the difference is about h/2 (qvel - qvel_1)
+  double norm2 = 0.0;
+  for(int i=0; i<r; i++)
+    norm2 += (qvel[i] - qvel_1[i]) * (qvel[i] - qvel_1[i]);
+  return 0.5 * timestep * sqrt(norm2);
+}
+
+int ImplicitBackwardEulerSparse::DoFixedTimestep()
 {
   int numIter = 0;
 
   double error0 = 0; // error after the first step
   double errorQuotient;
 
+  // with the warm start, the initial guess is not the previous state
+  bool warmStart = newtonWarmStart && !useStaticSolver;
+  numLineSearchBacktracks = 0;
+
   // store current amplitudes and set initial guesses for qaccel, qvel
+  // (the acceleration is not used in this integrator, except by the warm start; it is the change of velocity over the last step)
   for(int i=0; i<r; i++)
   {
-    qaccel_1[i] = qaccel[i] = 0; // acceleration is actually not used in this integrator
+    qaccel_1[i] = qaccel[i];
     q_1[i] = q[i]; 
     qvel_1[i] = qvel[i];
+
+    if (warmStart)
+    {
+      qvel[i] += timestep * qaccel_1[i];
+      q[i] += timestep * qvel[i];
+    }
   }
 
+  // matrix-free mode: the tangent stiffness matrix is not formed; products with it are computed by the force model
+  bool matrixFree = (matrixFreeForceModel != NULL);
+
   do
   {
     PerformanceCounter counterForceAssemblyTime;
-    forceModel->GetForceAndMatrix(q, internalForces, tangentStiffnessMatrix);
+    double energy = 0.0; // only needed by the line search
+    if (matrixFree)
+    {
+      // internal forces and the diagonal of the tangent stiffness matrix
+      matrixFreeForceModel->GetForceAndMatrixDiagonal(q, internalForces, systemMatrixDiagonal);
+      if (useLineSearch)
+        energy = matrixFreeForceModel->GetElasticEnergy(q);
+    }
+    else if (useLineSearch)
+      forceModel->GetEnergyAndForceAndMatrix(q, &energy, internalForces, tangentStiffnessMatrix);
+    else
+      forceModel->GetForceAndMatrix(q, internalForces, tangentStiffnessMatrix);
     counterForceAssemblyTime.StopCounter();
     forceAssemblyTime = counterForceAssemblyTime.GetElapsedTime();
+    energy *= internalForceScalingFactor;
 
     //tangentStiffnessMatrix->Print();
     //tangentStiffnessMatrix->Save("K");
@@ -103,7 +148,13 @@ int ImplicitBackwardEulerSparse::DoTimestep()
 */
 
     // scale stiffness matrix
-    *tangentStiffnessMatrix *= internalForceScalingFactor;
+    if (matrixFree)
+    {
+      for(int i=0; i<r; i++)
+        systemMatrixDiagonal[i] *= internalForceScalingFactor;
+    }
+    else
+      *tangentStiffnessMatrix *= internalForceScalingFactor;
 
     memset(qresidual, 0, sizeof(double) * r);
 
@@ -118,6 +169,56 @@ int ImplicitBackwardEulerSparse::DoTimestep()
         qdelta[i] = qresidual[i];
       }
     }
+    else if (matrixFree)
+    {
+      // the same residual as in the assembled case below, with K = tangent stiffness matrix + offset,
+      // and D = dampingStiffnessCoef * (tangent stiffness matrix) + dampingMassCoef * M + dampingMatrix
+      if ((numIter != 0) || warmStart) // can skip on first iteration (zero contribution)
+      {
+        // add K * (q_1 - q) to qresidual (will multiply by -h later)
+        for(int i=0; i<r; i++)
+          buffer[i] = q_1[i] - q[i];
+        MatrixFreeStiffnessProduct(buffer, qresidual);
+        if (tangentStiffnessMatrixOffset != NULL)
+          tangentStiffnessMatrixOffset->MultiplyVectorAdd(buffer, qresidual);
+      }
+
+      // add (h * K + D) * qvel to qresidual
+      MatrixFreeStiffnessProduct(qvel, buffer);
+      for(int i=0; i<r; i++)
+        qresidual[i] += (timestep + dampingStiffnessCoef) * buffer[i];
+      if (tangentStiffnessMatrixOffset != NULL)
+      {
+        tangentStiffnessMatrixOffset->MultiplyVector(qvel, buffer);
+        for(int i=0; i<r; i++)
+          qresidual[i] += timestep * buffer[i];
+      }
+      MassMatrixMultiplyVector(qvel, buffer);
+      for(int i=0; i<r; i++)
+        qresidual[i] += dampingMassCoef * buffer[i];
+      dampingMatrix->MultiplyVectorAdd(qvel, qresidual);
+
+      // diagonal of the system matrix h^2 * K + h * D + M
+      double stiffnessCoef = timestep * (timestep + dampingStiffnessCoef);
+      double massCoef = 1.0 + timestep * dampingMassCoef;
+      for(int i=0; i<r; i++)
+        systemMatrixDiagonal[i] *= stiffnessCoef;
+
+      if (tangentStiffnessMatrixOffset != NULL)
+      {
+        tangentStiffnessMatrixOffset->GetDiagonal(buffer);
+        for(int i=0; i<r; i++)
+          systemMatrixDiagonal[i] += timestep * timestep * buffer[i];
+      }
+
+      massMatrix->GetDiagonal(buffer);
+      for(int i=0; i<r; i++)
+        systemMatrixDiagonal[i] += massCoef * buffer[i];
+
+      dampingMatrix->GetDiagonal(buffer);
+      for(int i=0; i<r; i++)
+        systemMatrixDiagonal[i] += timestep * buffer[i];
+    }
     else
     {
       // compute D_Rayleigh = dampingStiffnessCoef * tangentStiffnessMatrix + dampingMassCoef * massMatrix
@@ -133,7 +234,7 @@ int ImplicitBackwardEulerSparse::DoTimestep()
       // qresidual = h * (-D qdot - fint + fext - h * K * qdot)) // this is semi-implicit Euler
       // qresidual = M (qvel_1 - qvel) + h * (-D qdot - fint + fext - K * (q_1 - q + h qdot) )) // for fully implicit Euler
 
-      if (numIter != 0) // can skip on first iteration (zero contribution)
+      if ((numIter != 0) || warmStart) // can skip on first iteration (zero contribution)
       {
         // add K * (q_1 - q) to qresidual (will multiply by -h later)
         for(int i=0; i<r; i++)
@@ -148,7 +249,10 @@ int ImplicitBackwardEulerSparse::DoTimestep()
       tangentStiffnessMatrix->MultiplyVectorAdd(qvel, qresidual);
       *tangentStiffnessMatrix *= timestep; // h^2 * K + h * (D_Rayleigh + D_externnal)
       tangentStiffnessMatrix->AddSubMatrix(1.0, *massMatrix); // h^2 * K + h * (D_Rayleigh + D_external) + M
+    }
 
+    if (!useStaticSolver)
+    {
       // add externalForces, internalForces
       for(int i=0; i<r; i++)
       {
@@ -156,12 +260,12 @@ int ImplicitBackwardEulerSparse::DoTimestep()
         qresidual[i] *= -timestep;
       }
 
-      if (numIter != 0) // can skip on first iteration (zero contribution)
+      if ((numIter != 0) || warmStart) // can skip on first iteration (zero contribution)
       {
         // add M * (qvel_1 - qvel) to qresidual
         for(int i=0; i<r; i++)
           buffer[i] = qvel_1[i] - qvel[i];
-        massMatrix->MultiplyVectorAdd(buffer, qresidual);
+        MassMatrixMultiplyVectorAdd(buffer, qresidual);
       }
 
       for(int i=0; i<r; i++)
@@ -211,48 +315,36 @@ int ImplicitBackwardEulerSparse::DoTimestep()
     if (errorQuotient < epsilon * epsilon)
       break;
 
-    systemMatrix->AssignSuperMatrix(*tangentStiffnessMatrix);
-
     // solve: systemMatrix * buffer = bufferConstrained
 
     PerformanceCounter counterSystemSolveTime;
     memset(buffer, 0, sizeof(double) * r);
 
-    #ifdef SPOOLES
-      int info;
-      if (numSolverThreads > 1)
-      {
-        SPOOLESSolverMT * solver = new SPOOLESSolverMT(systemMatrix, numSolverThreads);
-        info = solver->SolveLinearSystem(buffer, bufferConstrained);
-        delete(solver);
-      }
-      else
+    if (matrixFree)
+    {
+      // without forming systemMatrix, with the Jacobi preconditioner
+      ConstrainedDOFs::RemoveDOFs(r, systemMatrixDiagonalConstrained, systemMatrixDiagonal, numConstrainedDOFs, constrainedDOFs);
+      matrixFreeCGSolver->SetDiagonal(systemMatrixDiagonalConstrained);
+      numMatrixFreeCGIterations = matrixFreeCGSolver->SolveLinearSystemWithJacobiPreconditioner(buffer, bufferConstrained, matrixFreeCGEpsilon, maxMatrixFreeCGIterations);
+      if (numMatrixFreeCGIterations < 0)
       {
-        SPOOLESSolver * solver = new SPOOLESSolver(systemMatrix);
-        info = solver->SolveLinearSystem(buffer, bufferConstrained);
-        delete(solver);
+        printf("Error: matrix-free CG solver did not converge in %d iterations.\n", maxMatrixFreeCGIterations);
+        return 1;
       }
-      char solverString[16] = "SPOOLES";
-    #endif
+    }
+    else
+    {
+      systemMatrix->AssignSuperMatrix(*tangentStiffnessMatrix);
 
-    #ifdef PARDISO
-      int info = pardisoSolver->FactorMatrix(systemMatrix);
+      int info = systemSolver->FactorMatrix();
       if (info == 0)
-        info = pardisoSolver->SolveLinearSystem(buffer, bufferConstrained);
-      char solverString[16] = "PARDISO";
-    #endif
-
-    #ifdef PCG
-      int info = jacobiPreconditionedCGSolver->SolveLinearSystemWithJacobiPreconditioner(buffer, bufferConstrained, 1e-6, 10000);
-      if (info > 0)
-        info = 0;
-      char solverString[16] = "PCG";
-    #endif
-
-    if (info != 0)
-    {
-      printf("Error: %s sparse solver returned non-zero exit status %d.\n", solverString, (int)info);
-      return 1;
+        info = systemSolver->SolveLinearSystem(buffer, bufferConstrained);
+
+      if (info != 0)
+      {
+        printf("Error: %s sparse solver returned non-zero exit status %d.\n", systemSolver->GetSolverName(), (int)info);
+        return 1;
+      }
     }
 
     counterSystemSolveTime.StopCounter();
@@ -267,12 +359,22 @@ int ImplicitBackwardEulerSparse::DoTimestep()
     printf("\n");
     exit(1);
 */
+    // the line search needs q = q_1 + h * qvel, which does not hold on the first iteration (q = q_1), unless warm-started
+    double stepLength = 1.0;
+    if (useLineSearch)
+    {
+      if (useStaticSolver)
+        stepLength = LineSearch(energy, 1.0, 0.0, 0.0);
+      else if ((numIter != 0) || warmStart)
+        stepLength = LineSearch(energy, timestep, 1.0, timestep);
+    }
+
     // update state
     if (useStaticSolver)
     {
       for(int i=0; i<r; i++)
       {
-        q[i] += qdelta[i];
+        q[i] += stepLength * qdelta[i];
         qvel[i] = (q[i] - q_1[i]) / timestep;
       }
     }
@@ -280,7 +382,7 @@ int ImplicitBackwardEulerSparse::DoTimestep()
     {
       for(int i=0; i<r; i++)
       {
-        qvel[i] += qdelta[i];
+        qvel[i] += stepLength * qdelta[i];
         q[i] += q_1[i] - q[i] + timestep * qvel[i];
       }
     }
@@ -292,6 +394,13 @@ int ImplicitBackwardEulerSparse::DoTimestep()
   }
   while (numIter < maxIterations);
 
+  // the step is usable if the residual converged, or at least decreased before the last iteration
+  numNewtonIterations = numIter;
+  newtonConverged = (numIter < maxIterations) || (errorQuotient < 1.0);
+
+  for(int i=0; i<r; i++)
+    qaccel[i] = (qvel[i] - qvel_1[i]) / timestep;
+
 /*
   printf("q:\n");
   for(int i=0; i<r; i++)
@@ -313,5 +422,34 @@ int ImplicitBackwardEulerSparse::DoTimestep()
   return 0;
 }
 
+void ImplicitBackwardEulerSparse::MatrixFreeSystemMatrixProduct(const double * x, double * Ax)
+{
+  // same operator as the assembled system matrix in DoFixedTimestep:
+  // K with the static solver; otherwise, (h^2 + h * dampingStiffnessCoef) * K + h^2 * offset + (1 + h * dampingMassCoef) * M + h * dampingMatrix
+  MatrixFreeStiffnessProduct(x, Ax);
+  if (useStaticSolver)
+    return;
+
+  double stiffnessCoef = timestep * (timestep + dampingStiffnessCoef);
+  for(int i=0; i<r; i++)
+    Ax[i] *= stiffnessCoef;
+
+  if (tangentStiffnessMatrixOffset != NULL)
+  {
+    tangentStiffnessMatrixOffset->MultiplyVector(x, matrixFreeBuffer);
+    for(int i=0; i<r; i++)
+      Ax[i] += timestep * timestep * matrixFreeBuffer[i];
+  }
+
+  MassMatrixMultiplyVector(x, matrixFreeBuffer);
+  double massCoef = 1.0 + timestep * dampingMassCoef;
+  for(int i=0; i<r; i++)
+    Ax[i] += massCoef * matrixFreeBuffer[i];
+
+  dampingMatrix->MultiplyVector(x, matrixFreeBuffer);
+  for(int i=0; i<r; i++)
+    Ax[i] += timestep * matrixFreeBuffer[i];
+}
+
 
 }//namespace vegafem
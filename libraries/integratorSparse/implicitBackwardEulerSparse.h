@@ -49,16 +49,23 @@ public:
   // constrainedDOFs is an integer array of degrees of freedom that are to be fixed to zero (e.g., to permanently fix a vertex in a deformable simulation)
   // constrainedDOFs are 0-indexed (separate DOFs for x,y,z), and must be pre-sorted (ascending)
   // numThreads applies only to the PARDISO and SPOOLES solvers; if numThreads > 0, the sparse linear solves are multi-threaded; default: 0 (use single-threading)
-  ImplicitBackwardEulerSparse(int r, double timestep, SparseMatrix * massMatrix, ForceModel * forceModel, int numConstrainedDOFs=0, int * constrainedDOFs=NULL, double dampingMassCoef=0.0, double dampingStiffnessCoef=0.0, int maxIterations = 1, double epsilon = 1E-6, int numSolverThreads=0); 
+  // solverType selects the sparse linear solver (see integratorSolverSelection.h)
+  ImplicitBackwardEulerSparse(int r, double timestep, SparseMatrix * massMatrix, ForceModel * forceModel, int numConstrainedDOFs=0, int * constrainedDOFs=NULL, double dampingMassCoef=0.0, double dampingStiffnessCoef=0.0, int maxIterations = 1, double epsilon = 1E-6, int numSolverThreads=0, integratorSolverType solverType=INTEGRATOR_SOLVER_DEFAULT); 
+  // lumped mass matrix, given as a vector of r per-DOF masses (see integratorBaseSparse.h)
+  ImplicitBackwardEulerSparse(int r, double timestep, const double * lumpedMass, ForceModel * forceModel, int numConstrainedDOFs=0, int * constrainedDOFs=NULL, double dampingMassCoef=0.0, double dampingStiffnessCoef=0.0, int maxIterations = 1, double epsilon = 1E-6, int numSolverThreads=0, integratorSolverType solverType=INTEGRATOR_SOLVER_DEFAULT);
 
   virtual ~ImplicitBackwardEulerSparse();
 
   // sets q, and (optionally) qvel 
   // returns 0 
   virtual int SetState(double * q, double * qvel=NULL);
-  virtual int DoTimestep(); 
 
 protected:
+  virtual int DoFixedTimestep(); 
+  // matrix-free mode: Ax = (M + h * D + h^2 * K) * x, or K * x with the static solver
+  virtual void MatrixFreeSystemMatrixProduct(const double * x, double * Ax);
+  // h/2 ||qvel - qvel_1||
+  virtual double ComputeLocalErrorEstimate();
 };
 
 
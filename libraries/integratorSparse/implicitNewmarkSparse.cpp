@@ -33,15 +33,19 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <cmath>
 #include "matrixIO.h"
 #include "performanceCounter.h"
 #include "constrainedDOFs.h"
 #include "implicitNewmarkSparse.h"
+#ifdef VEGAFEM_USE_TBB
+  #include <tbb/tbb.h>
+#endif
 
 namespace vegafem
 {
 
-ImplicitNewmarkSparse::ImplicitNewmarkSparse(int r, double timestep, SparseMatrix * massMatrix_, ForceModel * forceModel_, int numConstrainedDOFs_, int * constrainedDOFs_, double dampingMassCoef, double dampingStiffnessCoef, int maxIterations, double epsilon, double NewmarkBeta, double NewmarkGamma, int numSolverThreads_): IntegratorBaseSparse(r, timestep, massMatrix_, forceModel_, numConstrainedDOFs_, constrainedDOFs_, dampingMassCoef, dampingStiffnessCoef), numSolverThreads(numSolverThreads_)
+ImplicitNewmarkSparse::ImplicitNewmarkSparse(int r, double timestep, SparseMatrix * massMatrix_, ForceModel * forceModel_, int numConstrainedDOFs_, int * constrainedDOFs_, double dampingMassCoef, double dampingStiffnessCoef, int maxIterations, double epsilon, double NewmarkBeta, double NewmarkGamma, int numSolverThreads_, integratorSolverType solverType): IntegratorBaseSparse(r, timestep, massMatrix_, forceModel_, numConstrainedDOFs_, constrainedDOFs_, dampingMassCoef, dampingStiffnessCoef), numSolverThreads(numSolverThreads_)
 {
   this->maxIterations = maxIterations; // maxIterations = 1 for semi-implicit
   this->epsilon = epsilon; 
@@ -77,15 +81,39 @@ ImplicitNewmarkSparse::ImplicitNewmarkSparse(int r, double timestep, SparseMatri
   systemMatrix = new SparseMatrix(*tangentStiffnessMatrix);
   systemMatrix->RemoveRowsColumns(numConstrainedDOFs, constrainedDOFs);
   systemMatrix->BuildSuperMatrixIndices(numConstrainedDOFs, constrainedDOFs, tangentStiffnessMatrix);
+  BuildSystemMatrixIndices();
+  systemMatrixFused = false;
+
+  systemSolver = new IntegratorSparseSolver(systemMatrix, solverType, numSolverThreads);
+
+  matrixFreeForceModel = NULL;
+  matrixFreeCGSolver = NULL;
+  matrixFreeCGEpsilon = 1E-6;
+  maxMatrixFreeCGIterations = 10000;
+  numMatrixFreeCGIterations = 0;
+  matrixFreeVector = matrixFreeProduct = matrixFreeBuffer = NULL;
+  systemMatrixDiagonal = systemMatrixDiagonalConstrained = NULL;
+
+  numNewtonIterations = 0;
+  newtonConverged = false;
+  adaptiveTimestep = false;
+  minTimestep = maxTimestep = timestep;
+  errorTolerance = 1E-3;
+  absoluteErrorTolerance = 1E-8;
+  lastTimestep = timestep;
+  numAcceptedSteps = numRejectedSteps = 0;
+  localErrorOrder = 3.0;
+
+  useLineSearch = false;
+  maxLineSearchIterations = 8;
+  numLineSearchBacktracks = 0;
+  lineSearchq = NULL;
+  newtonWarmStart = false;
+}
 
-  #ifdef PARDISO
-    printf("Creating Pardiso solver. Num threads: %d\n", numSolverThreads);
-    pardisoSolver = new PardisoSolver(systemMatrix, numSolverThreads, PardisoSolver::REAL_SYM_INDEFINITE);
-  #endif
-
-  #ifdef PCG
-    jacobiPreconditionedCGSolver = new CGSolver(systemMatrix);
-  #endif
+ImplicitNewmarkSparse::ImplicitNewmarkSparse(int r, double timestep, const double * lumpedMass_, ForceModel * forceModel_, int numConstrainedDOFs_, int * constrainedDOFs_, double dampingMassCoef, double dampingStiffnessCoef, int maxIterations, double epsilon, double NewmarkBeta, double NewmarkGamma, int numSolverThreads_, integratorSolverType solverType): ImplicitNewmarkSparse(r, timestep, CreateDiagonalMatrix(r, lumpedMass_), forceModel_, numConstrainedDOFs_, constrainedDOFs_, dampingMassCoef, dampingStiffnessCoef, maxIterations, epsilon, NewmarkBeta, NewmarkGamma, numSolverThreads_, solverType)
+{
+  ownMassMatrix = 1;
 }
 
 ImplicitNewmarkSparse::~ImplicitNewmarkSparse()
@@ -94,9 +122,14 @@ ImplicitNewmarkSparse::~ImplicitNewmarkSparse()
   delete(rayleighDampingMatrix);
   delete(systemMatrix);
   free(bufferConstrained);
-  #ifdef PARDISO
-    delete(pardisoSolver);
-  #endif
+  delete(systemSolver);
+  delete(matrixFreeCGSolver);
+  free(matrixFreeVector);
+  free(matrixFreeProduct);
+  free(matrixFreeBuffer);
+  free(systemMatrixDiagonal);
+  free(systemMatrixDiagonalConstrained);
+  free(lineSearchq);
 }
 
 void ImplicitNewmarkSparse::SetDampingMatrix(SparseMatrix * dampingMatrix)
@@ -115,6 +148,101 @@ void ImplicitNewmarkSparse::UpdateAlphas()
   alpha6 = (1.0 - NewmarkGamma / (2.0 * NewmarkBeta)) * timestep;
 }
 
+void ImplicitNewmarkSparse::BuildSystemMatrixIndices()
+{
+  // invert the supermatrix indices of systemMatrix (which map the entries of systemMatrix to the entries of tangentStiffnessMatrix)
+  systemRows.assign(r, -1);
+  systemEntryOffsets.resize(r + 1);
+  systemEntryOffsets[0] = 0;
+  for(int i=0; i<r; i++)
+    systemEntryOffsets[i+1] = systemEntryOffsets[i] + tangentStiffnessMatrix->GetRowLength(i);
+  systemEntryIndices.assign(systemEntryOffsets[r], -1);
+
+  for(int row=0; row<systemMatrix->GetNumRows(); row++)
+  {
+    int superRow = systemMatrix->GetSuperMatrixRow(row);
+    const int * indices = systemMatrix->GetSuperMatrixIndices(row);
+    systemRows[superRow] = row;
+    for(int j=0; j<systemMatrix->GetRowLength(row); j++)
+      systemEntryIndices[systemEntryOffsets[superRow] + indices[j]] = j;
+  }
+}
+
+void ImplicitNewmarkSparse::FormSystemMatrixAndResidual()
+{
+  // systemMatrix = (alpha1 + alpha4 * dampingMassCoef) * M + s * (1 + alpha4 * dampingStiffnessCoef) * K + alpha4 * dampingMatrix + offset
+  // qresidual = M * (qaccel + dampingMassCoef * qvel) + s * dampingStiffnessCoef * K * qvel + dampingMatrix * qvel
+  // where s = internalForceScalingFactor; the sparsity of M, dampingMatrix and offset is a subset of the sparsity of K, and every entry of systemMatrix is an entry of K
+  double stiffnessCoef = internalForceScalingFactor * (1.0 + alpha4 * dampingStiffnessCoef);
+  double stiffnessDampingCoef = internalForceScalingFactor * dampingStiffnessCoef;
+  double massCoef = alpha1 + alpha4 * dampingMassCoef;
+  SparseMatrix * offset = tangentStiffnessMatrixOffset;
+
+  auto formRows = [&](int startRow, int endRow)
+  {
+    for(int i=startRow; i<endRow; i++)
+    {
+      const int * KColumns = tangentStiffnessMatrix->GetColumnIndices()[i];
+      const double * KEntries = tangentStiffnessMatrix->GetRowHandle(i);
+      int KRowLength = tangentStiffnessMatrix->GetRowLength(i);
+      const int * positions = systemEntryIndices.data() + systemEntryOffsets[i];
+      double * systemRow = (systemRows[i] >= 0) ? systemMatrix->GetRowHandle(systemRows[i]) : NULL;
+
+      double stiffnessForce = 0.0;
+      for(int j=0; j<KRowLength; j++)
+        stiffnessForce += KEntries[j] * qvel[KColumns[j]];
+      double residual = stiffnessDampingCoef * stiffnessForce;
+
+      if (systemRow != NULL)
+      {
+        for(int j=0; j<KRowLength; j++)
+          if (positions[j] >= 0)
+            systemRow[positions[j]] = stiffnessCoef * KEntries[j];
+      }
+
+      const int * indices = tangentStiffnessMatrix->GetSubMatrixIndices(i, 0);
+      const int * columns = massMatrix->GetColumnIndices()[i];
+      const double * entries = massMatrix->GetRowHandle(i);
+      for(int j=0; j<massMatrix->GetRowLength(i); j++)
+      {
+        residual += entries[j] * (qaccel[columns[j]] + dampingMassCoef * qvel[columns[j]]);
+        if ((systemRow != NULL) && (positions[indices[j]] >= 0))
+          systemRow[positions[indices[j]]] += massCoef * entries[j];
+      }
+
+      indices = tangentStiffnessMatrix->GetSubMatrixIndices(i, 1);
+      columns = dampingMatrix->GetColumnIndices()[i];
+      entries = dampingMatrix->GetRowHandle(i);
+      for(int j=0; j<dampingMatrix->GetRowLength(i); j++)
+      {
+        residual += entries[j] * qvel[columns[j]];
+        if ((systemRow != NULL) && (positions[indices[j]] >= 0))
+          systemRow[positions[indices[j]]] += alpha4 * entries[j];
+      }
+
+      if ((offset != NULL) && (systemRow != NULL))
+      {
+        indices = tangentStiffnessMatrix->GetSubMatrixIndices(i, 2);
+        entries = offset->GetRowHandle(i);
+        for(int j=0; j<offset->GetRowLength(i); j++)
+          if (positions[indices[j]] >= 0)
+            systemRow[positions[indices[j]]] += entries[j];
+      }
+
+      qresidual[i] = residual;
+    }
+  };
+
+  #ifdef VEGAFEM_USE_TBB
+    tbb::parallel_for(tbb::blocked_range<int>(0, r, 1024), [&](const tbb::blocked_range<int> & rng)
+    {
+      formRows(rng.begin(), rng.end());
+    });
+  #else
+    formRows(0, r);
+  #endif
+}
+
 // sets the state based on given q, qvel
 // automatically computes acceleration assuming zero external force
 int ImplicitNewmarkSparse::SetState(double * q_, double * qvel_)
@@ -145,6 +273,15 @@ int ImplicitNewmarkSparse::SetState(double * q_, double * qvel_)
   for(int i=0; i<r; i++)
     buffer[i] = -buffer[i] - internalForces[i];
 
+  // lumped mass matrix, and no damping matrix: M + dampingMatrix is diagonal
+  if ((lumpedMass != NULL) && (dampingMatrix->GetNumEntries() == 0))
+  {
+    // inverseLumpedMass is zero at the constrained DOFs
+    for(int i=0; i<r; i++)
+      qaccel[i] = inverseLumpedMass[i] * buffer[i];
+    return 0;
+  }
+
   // solve M * qaccel = buffer
   ConstrainedDOFs::RemoveDOFs(r, bufferConstrained, buffer, numConstrainedDOFs, constrainedDOFs);
 
@@ -156,31 +293,16 @@ int ImplicitNewmarkSparse::SetState(double * q_, double * qvel_)
 
   memset(buffer, 0, sizeof(double) * r);
 
-  #ifdef SPOOLES
-    SPOOLESSolver solver(systemMatrix);
-    int info = solver.SolveLinearSystem(buffer, bufferConstrained);
-    char solverString[16] = "SPOOLES";
-  #endif
-
   //massMatrix->Save("M");
   //systemMatrix->Save("A");
 
-  #ifdef PARDISO
-    pardisoSolver->FactorMatrix(systemMatrix);
-    int info = pardisoSolver->SolveLinearSystem(buffer, bufferConstrained);
-    char solverString[16] = "PARDISO";
-  #endif
-
-  #ifdef PCG
-    int info = jacobiPreconditionedCGSolver->SolveLinearSystemWithJacobiPreconditioner(buffer, bufferConstrained, 1e-6, 10000);
-    if (info > 0)
-      info = 0;
-    char solverString[16] = "PCG";
-  #endif
+  int info = systemSolver->FactorMatrix(0); // M + C is unrelated to the Newton system matrices, so its factorization is not reused
+  if (info == 0)
+    info = systemSolver->SolveLinearSystem(buffer, bufferConstrained);
 
   if (info != 0)
   {
-    printf("Error: %s sparse solver returned non-zero exit status %d.\n", solverString, (int)info);
+    printf("Error: %s sparse solver returned non-zero exit status %d.\n", systemSolver->GetSolverName(), (int)info);
     return 1;
   }
   
@@ -191,6 +313,258 @@ int ImplicitNewmarkSparse::SetState(double * q_, double * qvel_)
  
 int ImplicitNewmarkSparse::DoTimestep()
 {
+  if (adaptiveTimestep && !useStaticSolver)
+    return DoAdaptiveTimestep(maxTimestep);
+
+  int code = DoFixedTimestep();
+  if (code == 0)
+    lastTimestep = timestep;
+  return code;
+}
+
+void ImplicitNewmarkSparse::SetAdaptiveTimestep(bool adaptiveTimestep_, double minTimestep_, double maxTimestep_, double errorTolerance_, double absoluteErrorTolerance_)
+{
+  adaptiveTimestep = adaptiveTimestep_;
+  minTimestep = minTimestep_;
+  maxTimestep = (maxTimestep_ > minTimestep_) ? maxTimestep_ : minTimestep_;
+  errorTolerance = errorTolerance_;
+  absoluteErrorTolerance = absoluteErrorTolerance_;
+  if (adaptiveTimestep)
+  {
+    if (timestep < minTimestep)
+      SetTimestep(minTimestep);
+    if (timestep > maxTimestep)
+      SetTimestep(maxTimestep);
+  }
+}
+
+double ImplicitNewmarkSparse::ComputeLocalErrorEstimate()
+{
+  // difference between the Newmark and the third-order Taylor expansion: h^2 (beta - 1/6) (qaccel - qaccel_1)
+  double norm2 = 0.0;
+  for(int i=0; i<r; i++)
+    norm2 += (qaccel[i] - qaccel_1[i]) * (qaccel[i] - qaccel_1[i]);
+  return timestep * timestep * fabs(NewmarkBeta - 1.0 / 6) * sqrt(norm2);
+}
+
+int ImplicitNewmarkSparse::DoAdaptiveTimestep(double maxStep)
+{
+  const double safetyFactor = 0.9;
+  const double maxGrowthFactor = 2.0;
+  const double maxShrinkFactor = 0.2;
+
+  // the timestep of the next step, as predicted by the controller
+  double predictedTimestep = timestep;
+
+  while (true)
+  {
+    double h = (predictedTimestep < maxStep) ? predictedTimestep : maxStep;
+    if (h != timestep)
+      SetTimestep(h);
+
+    // DoFixedTimestep saves the state into q_1, qvel_1, qaccel_1
+    int code = DoFixedTimestep();
+
+    double qNorm2 = 0.0;
+    for(int i=0; i<r; i++)
+      qNorm2 += q[i] * q[i];
+    bool finite = (code == 0) && std::isfinite(qNorm2);
+    bool converged = finite && (newtonConverged || (maxIterations <= 1));
+    double errorRatio = finite ? ComputeLocalErrorEstimate() / (errorTolerance * sqrt(qNorm2) + absoluteErrorTolerance) : 0.0;
+    if (!std::isfinite(errorRatio))
+      finite = converged = false;
+
+    if ((!converged || (errorRatio > 1.0)) && (h > minTimestep))
+    {
+      // reject the step, and retry with a smaller timestep
+      memcpy(q, q_1, sizeof(double) * r);
+      memcpy(qvel, qvel_1, sizeof(double) * r);
+      memcpy(qaccel, qaccel_1, sizeof(double) * r);
+      numRejectedSteps++;
+
+      double factor = 0.5;
+      if (converged)
+      {
+        factor = safetyFactor * pow(errorRatio, -1.0 / localErrorOrder);
+        if (factor > safetyFactor)
+          factor = safetyFactor;
+        if (factor < maxShrinkFactor)
+          factor = maxShrinkFactor;
+      }
+      predictedTimestep = h * factor;
+      if (predictedTimestep < minTimestep)
+        predictedTimestep = minTimestep;
+      continue;
+    }
+
+    if (!finite)
+    {
+      // diverged at the minimal timestep
+      memcpy(q, q_1, sizeof(double) * r);
+      memcpy(qvel, qvel_1, sizeof(double) * r);
+      memcpy(qaccel, qaccel_1, sizeof(double) * r);
+      printf("Error: adaptive timestep failed at the minimal timestep %G.\n", h);
+      return 1;
+    }
+
+    // accept the step, and predict the next timestep
+    lastTimestep = h;
+    numAcceptedSteps++;
+
+    double factor = maxGrowthFactor;
+    if (errorRatio > 0.0)
+    {
+      factor = safetyFactor * pow(errorRatio, -1.0 / localErrorOrder);
+      if (factor > maxGrowthFactor)
+        factor = maxGrowthFactor;
+      if (factor < maxShrinkFactor)
+        factor = maxShrinkFactor;
+    }
+
+    double nextTimestep = h * factor;
+    // if the step was shortened to maxStep, do not let that shrink the prediction
+    if ((h < predictedTimestep) && (factor >= 1.0) && (nextTimestep < predictedTimestep))
+      nextTimestep = predictedTimestep;
+    if (nextTimestep < minTimestep)
+      nextTimestep = minTimestep;
+    if (nextTimestep > maxTimestep)
+      nextTimestep = maxTimestep;
+    SetTimestep(nextTimestep);
+
+    return 0;
+  }
+}
+
+void ImplicitNewmarkSparse::SetLineSearch(bool useLineSearch_, int maxLineSearchIterations_)
+{
+  useLineSearch = useLineSearch_;
+  maxLineSearchIterations = (maxLineSearchIterations_ > 1) ? maxLineSearchIterations_ : 1;
+  if (useLineSearch && (lineSearchq == NULL))
+    lineSearchq = (double*) malloc (sizeof(double) * r);
+}
+
+double ImplicitNewmarkSparse::LineSearch(double energy, double qScale, double massCoef, double dampingCoef)
+{
+  // Phi(stepLength) - Phi(0) = E(q + stepLength * qScale * qdelta) - E(q) + stepLength * linearTerm + 0.5 * stepLength^2 * curvature,
+  // where E is the scaled elastic energy; the slope of Phi at 0 is qdelta^T * gradient = -qdelta^T * qresidual
+  double slope = 0.0;
+  double internalForceSlope = 0.0;
+  for(int i=0; i<r; i++)
+  {
+    slope -= qdelta[i] * qresidual[i];
+    internalForceSlope += qdelta[i] * internalForces[i];
+  }
+
+  // not a descent direction (e.g., the tangent stiffness matrix is indefinite), or the decrease is below the round-off
+  // of the energy (close to convergence, where the energy cannot resolve the decrease): take the full step
+  if (!(slope < -1E-10 * fabs(energy)))
+    return 1.0;
+
+  double linearTerm = slope - qScale * internalForceSlope;
+
+  double curvature = 0.0;
+  if (!useStaticSolver)
+  {
+    // buffer is free after the linear solve
+    double massCurvature = 0.0;
+    MassMatrixMultiplyVector(qdelta, buffer);
+    for(int i=0; i<r; i++)
+      massCurvature += qdelta[i] * buffer[i];
+
+    double dampingCurvature = 0.0;
+    if (matrixFreeForceModel != NULL)
+    {
+      // the tangent stiffness matrix is not formed; MatrixFreeStiffnessProduct is scaled
+      double stiffnessCurvature = 0.0;
+      if (dampingStiffnessCoef != 0.0)
+      {
+        MatrixFreeStiffnessProduct(qdelta, buffer);
+        for(int i=0; i<r; i++)
+          stiffnessCurvature += qdelta[i] * buffer[i];
+      }
+      dampingCurvature = dampingStiffnessCoef * stiffnessCurvature + dampingMassCoef * massCurvature;
+      dampingMatrix->MultiplyVector(qdelta, buffer);
+    }
+    else if (systemMatrixFused)
+    {
+      // rayleighDampingMatrix was not formed, and tangentStiffnessMatrix is unscaled
+      tangentStiffnessMatrix->MultiplyVector(qdelta, buffer);
+      double stiffnessCurvature = 0.0;
+      for(int i=0; i<r; i++)
+        stiffnessCurvature += qdelta[i] * buffer[i];
+      dampingCurvature = internalForceScalingFactor * dampingStiffnessCoef * stiffnessCurvature + dampingMassCoef * massCurvature;
+      dampingMatrix->MultiplyVector(qdelta, buffer);
+    }
+    else
+    {
+      rayleighDampingMatrix->MultiplyVector(qdelta, buffer);
+      dampingMatrix->MultiplyVectorAdd(qdelta, buffer);
+    }
+    for(int i=0; i<r; i++)
+      dampingCurvature += qdelta[i] * buffer[i];
+
+    curvature = massCoef * massCurvature + dampingCoef * dampingCurvature;
+  }
+
+  const double sufficientDecrease = 1E-4;
+  double stepLength = 1.0;
+  for(int iter=1; ; iter++)
+  {
+    for(int i=0; i<r; i++)
+      lineSearchq[i] = q[i] + stepLength * qScale * qdelta[i];
+    double trialEnergy = internalForceScalingFactor * forceModel->GetElasticEnergy(lineSearchq);
+    double decrease = trialEnergy - energy + stepLength * linearTerm + 0.5 * stepLength * stepLength * curvature;
+
+    // (a NaN energy fails the test)
+    if ((decrease <= sufficientDecrease * stepLength * slope) || (iter >= maxLineSearchIterations))
+      break;
+
+    stepLength *= 0.5;
+    numLineSearchBacktracks++;
+  }
+
+  return stepLength;
+}
+
+int ImplicitNewmarkSparse::AdvanceTime(double duration)
+{
+  if (!adaptiveTimestep || useStaticSolver)
+  {
+    int numSteps = (int)(duration / timestep + 0.5);
+    if (numSteps < 1)
+      numSteps = 1;
+    for(int step=0; step<numSteps; step++)
+    {
+      int code = DoTimestep();
+      if (code != 0)
+        return code;
+    }
+    return 0;
+  }
+
+  double remaining = duration;
+  while (remaining > 1E-12 * duration)
+  {
+    // split the remaining interval evenly, instead of following a full step with a very short one
+    double maxStep = remaining;
+    if ((remaining > timestep) && (remaining < 2.0 * timestep))
+      maxStep = 0.5 * remaining;
+
+    int code = DoAdaptiveTimestep(maxStep);
+    if (code != 0)
+      return code;
+    remaining -= lastTimestep;
+  }
+  return 0;
+}
+
+int ImplicitNewmarkSparse::DoFixedTimestep()
+{
+  numLineSearchBacktracks = 0;
+
+  if (matrixFreeForceModel != NULL)
+    return DoTimestepMatrixFree();
+
   int numIter = 0;
 
   double error0 = 0; // error after the first step
@@ -203,6 +577,9 @@ int ImplicitNewmarkSparse::DoTimestep()
     qvel_1[i] = qvel[i];
     qaccel_1[i] = qaccel[i];
 
+    if (newtonWarmStart && !useStaticSolver)
+      q[i] += timestep * qvel_1[i] + 0.5 * timestep * timestep * qaccel_1[i];
+
     qaccel[i] = alpha1 * (q[i] - q_1[i]) - alpha2 * qvel_1[i] - alpha3 * qaccel_1[i];
     qvel[i] = alpha4 * (q[i] - q_1[i]) + alpha5 * qvel_1[i] + alpha6 * qaccel_1[i];
   }
@@ -224,9 +601,14 @@ int ImplicitNewmarkSparse::DoTimestep()
 */
 
     PerformanceCounter counterForceAssemblyTime;
-    forceModel->GetForceAndMatrix(q, internalForces, tangentStiffnessMatrix);
+    double energy = 0.0; // only needed by the line search
+    if (useLineSearch)
+      forceModel->GetEnergyAndForceAndMatrix(q, &energy, internalForces, tangentStiffnessMatrix);
+    else
+      forceModel->GetForceAndMatrix(q, internalForces, tangentStiffnessMatrix);
     counterForceAssemblyTime.StopCounter();
     forceAssemblyTime = counterForceAssemblyTime.GetElapsedTime();
+    energy *= internalForceScalingFactor;
 
     //tangentStiffnessMatrix->Print();
     //tangentStiffnessMatrix->Save("K");
@@ -235,38 +617,19 @@ int ImplicitNewmarkSparse::DoTimestep()
     for(i=0; i<r; i++)
       internalForces[i] *= internalForceScalingFactor;
 
-    *tangentStiffnessMatrix *= internalForceScalingFactor;
-
-    memset(qresidual, 0, sizeof(double) * r);
-
+    systemMatrixFused = !useStaticSolver;
     if (useStaticSolver)
     {
-      // no operation
+      *tangentStiffnessMatrix *= internalForceScalingFactor;
+      memset(qresidual, 0, sizeof(double) * r);
     }
     else
     {
-      // build effective stiffness: add mass matrix and damping matrix to tangentStiffnessMatrix
-      tangentStiffnessMatrix->ScalarMultiply(dampingStiffnessCoef, rayleighDampingMatrix);
-      rayleighDampingMatrix->AddSubMatrix(dampingMassCoef, *massMatrix);
-
-      rayleighDampingMatrix->ScalarMultiplyAdd(alpha4, tangentStiffnessMatrix);
-
-      if (tangentStiffnessMatrixOffset != NULL)
-        tangentStiffnessMatrix->AddSubMatrix(1.0, *tangentStiffnessMatrixOffset, 2);
-
-      // form the system matrix
-
-      //*tangentStiffnessMatrix += alpha4 * *rayleighDampingMatrix;
-      tangentStiffnessMatrix->AddSubMatrix(alpha4, *dampingMatrix, 1);
-
-      tangentStiffnessMatrix->AddSubMatrix(alpha1, *massMatrix);
-
-      // compute force residual, store it into aux variable qresidual
+      // form the system matrix (the effective stiffness: scaled tangent stiffness matrix plus the mass and damping terms),
+      // and compute the force residual, store it into aux variable qresidual
       // qresidual = M * qaccel + C * qvel - externalForces + internalForces
-
-      massMatrix->MultiplyVector(qaccel, qresidual);
-      rayleighDampingMatrix->MultiplyVectorAdd(qvel, qresidual);
-      dampingMatrix->MultiplyVectorAdd(qvel, qresidual);
+      // (tangentStiffnessMatrix is not modified)
+      FormSystemMatrixAndResidual();
     }
 
     // add externalForces, internalForces
@@ -317,36 +680,21 @@ int ImplicitNewmarkSparse::DoTimestep()
 
     //tangentStiffnessMatrix->Save("Keff");
     ConstrainedDOFs::RemoveDOFs(r, bufferConstrained, qdelta, numConstrainedDOFs, constrainedDOFs);
-    systemMatrix->AssignSuperMatrix(*tangentStiffnessMatrix);
+    if (useStaticSolver)
+      systemMatrix->AssignSuperMatrix(*tangentStiffnessMatrix);
 
     // solve: systemMatrix * buffer = bufferConstrained
 
     PerformanceCounter counterSystemSolveTime;
     memset(buffer, 0, sizeof(double) * r);
 
-    #ifdef SPOOLES
-      SPOOLESSolver solver(systemMatrix);
-      int info = solver.SolveLinearSystem(buffer, bufferConstrained);
-      char solverString[16] = "SPOOLES";
-    #endif
-
-    #ifdef PARDISO
-      int info = pardisoSolver->FactorMatrix(systemMatrix);
-      if (info == 0)
-        info = pardisoSolver->SolveLinearSystem(buffer, bufferConstrained);
-      char solverString[16] = "PARDISO";
-    #endif
-
-    #ifdef PCG
-      int info = jacobiPreconditionedCGSolver->SolveLinearSystemWithJacobiPreconditioner(buffer, bufferConstrained, 1e-6, 10000);
-      if (info > 0)
-        info = 0;
-      char solverString[16] = "PCG";
-    #endif
+    int info = systemSolver->FactorMatrix();
+    if (info == 0)
+      info = systemSolver->SolveLinearSystem(buffer, bufferConstrained);
 
     if (info != 0)
     {
-      printf("Error: %s sparse solver returned non-zero exit status %d.\n", solverString, (int)info);
+      printf("Error: %s sparse solver returned non-zero exit status %d.\n", systemSolver->GetSolverName(), (int)info);
       return 1;
     }
 
@@ -362,10 +710,14 @@ int ImplicitNewmarkSparse::DoTimestep()
     printf("\n");
     exit(1);
 */
+    double stepLength = 1.0;
+    if (useLineSearch)
+      stepLength = LineSearch(energy, 1.0, alpha1, alpha4);
+
     // update state
     for(i=0; i<r; i++)
     {
-      q[i] += qdelta[i];
+      q[i] += stepLength * qdelta[i];
       qaccel[i] = alpha1 * (q[i] - q_1[i]) - alpha2 * qvel_1[i] - alpha3 * qaccel_1[i];
       qvel[i] = alpha4 * (q[i] - q_1[i]) + alpha5 * qvel_1[i] + alpha6 * qaccel_1[i];
     }
@@ -377,6 +729,10 @@ int ImplicitNewmarkSparse::DoTimestep()
   }
   while (numIter < maxIterations);
 
+  // the step is usable if the residual converged, or at least decreased before the last iteration
+  numNewtonIterations = numIter;
+  newtonConverged = (numIter < maxIterations) || (errorQuotient < 1.0);
+
 /*
   printf("qvel:\n");
   for(int i=0; i<r; i++)
@@ -398,6 +754,270 @@ int ImplicitNewmarkSparse::DoTimestep()
   return 0;
 }
 
+int ImplicitNewmarkSparse::UseMatrixFreeSolver(bool useMatrixFreeSolver, double CGEpsilon, int maxCGIterations)
+{
+  if (!useMatrixFreeSolver)
+  {
+    delete(matrixFreeCGSolver);
+    matrixFreeCGSolver = NULL;
+    matrixFreeForceModel = NULL;
+    return 0;
+  }
+
+  ForceModelAssembler * forceModelAssembler = dynamic_cast<ForceModelAssembler*>(forceModel);
+  if (forceModelAssembler == NULL)
+  {
+    printf("Warning: the force model does not provide tangent stiffness matrix-vector products. Matrix-free solver will not be used.\n");
+    return 1;
+  }
+
+  matrixFreeForceModel = forceModelAssembler;
+  matrixFreeCGEpsilon = CGEpsilon;
+  maxMatrixFreeCGIterations = maxCGIterations;
+
+  if (matrixFreeCGSolver == NULL)
+  {
+    if (matrixFreeVector == NULL)
+    {
+      matrixFreeVector = (double*) malloc (sizeof(double) * r);
+      matrixFreeProduct = (double*) malloc (sizeof(double) * r);
+      matrixFreeBuffer = (double*) malloc (sizeof(double) * r);
+      systemMatrixDiagonal = (double*) malloc (sizeof(double) * r);
+      systemMatrixDiagonalConstrained = (double*) malloc (sizeof(double) * (r - numConstrainedDOFs));
+    }
+    matrixFreeCGSolver = new CGSolver(r - numConstrainedDOFs, MatrixFreeSystemProduct, this);
+  }
+
+  return 0;
+}
+
+void ImplicitNewmarkSparse::MatrixFreeStiffnessProduct(const double * x, double * Kx)
+{
+  matrixFreeForceModel->GetTangentStiffnessMatrixVectorProduct(q, x, Kx);
+  if (internalForceScalingFactor != 1.0)
+  {
+    for(int i=0; i<r; i++)
+      Kx[i] *= internalForceScalingFactor;
+  }
+}
+
+void ImplicitNewmarkSparse::MatrixFreeSystemProduct(const void * data, const double * x, double * Ax)
+{
+  ImplicitNewmarkSparse * integrator = (ImplicitNewmarkSparse*) data;
+  int r = integrator->r;
+  double * xFull = integrator->matrixFreeVector;
+  double * AxFull = integrator->matrixFreeProduct;
+
+  ConstrainedDOFs::InsertDOFs(r, x, xFull, integrator->numConstrainedDOFs, integrator->constrainedDOFs);
+  integrator->MatrixFreeSystemMatrixProduct(xFull, AxFull);
+  ConstrainedDOFs::RemoveDOFs(r, Ax, AxFull, integrator->numConstrainedDOFs, integrator->constrainedDOFs);
+}
+
+void ImplicitNewmarkSparse::MatrixFreeSystemMatrixProduct(const double * x, double * Ax)
+{
+  // same operator as the assembled system matrix in DoTimestep:
+  // (1 + alpha4 * dampingStiffnessCoef) * K + offset + (alpha1 + alpha4 * dampingMassCoef) * M + alpha4 * dampingMatrix
+  MatrixFreeStiffnessProduct(x, Ax);
+
+  if (!useStaticSolver)
+  {
+    double stiffnessCoef = 1.0 + alpha4 * dampingStiffnessCoef;
+    if (stiffnessCoef != 1.0)
+    {
+      for(int i=0; i<r; i++)
+        Ax[i] *= stiffnessCoef;
+    }
+  }
+
+  if (tangentStiffnessMatrixOffset != NULL)
+    tangentStiffnessMatrixOffset->MultiplyVectorAdd(x, Ax);
+
+  if (!useStaticSolver)
+  {
+    MassMatrixMultiplyVector(x, matrixFreeBuffer);
+    double massCoef = alpha1 + alpha4 * dampingMassCoef;
+    for(int i=0; i<r; i++)
+      Ax[i] += massCoef * matrixFreeBuffer[i];
+
+    dampingMatrix->MultiplyVector(x, matrixFreeBuffer);
+    for(int i=0; i<r; i++)
+      Ax[i] += alpha4 * matrixFreeBuffer[i];
+  }
+}
+
+int ImplicitNewmarkSparse::DoTimestepMatrixFree()
+{
+  int numIter = 0;
+
+  double error0 = 0; // error after the first step
+  double errorQuotient;
+
+  // store current amplitudes and set initial guesses for qaccel, qvel
+  for(int i=0; i<r; i++)
+  {
+    q_1[i] = q[i]; 
+    qvel_1[i] = qvel[i];
+    qaccel_1[i] = qaccel[i];
+
+    if (newtonWarmStart && !useStaticSolver)
+      q[i] += timestep * qvel_1[i] + 0.5 * timestep * timestep * qaccel_1[i];
+
+    qaccel[i] = alpha1 * (q[i] - q_1[i]) - alpha2 * qvel_1[i] - alpha3 * qaccel_1[i];
+    qvel[i] = alpha4 * (q[i] - q_1[i]) + alpha5 * qvel_1[i] + alpha6 * qaccel_1[i];
+  }
+
+  do
+  {
+    int i;
+
+    // internal forces and the diagonal of the tangent stiffness matrix; the tangent stiffness matrix is not formed
+    PerformanceCounter counterForceAssemblyTime;
+    matrixFreeForceModel->GetForceAndMatrixDiagonal(q, internalForces, systemMatrixDiagonal);
+    double energy = 0.0; // only needed by the line search
+    if (useLineSearch)
+      energy = internalForceScalingFactor * matrixFreeForceModel->GetElasticEnergy(q);
+    counterForceAssemblyTime.StopCounter();
+    forceAssemblyTime = counterForceAssemblyTime.GetElapsedTime();
+
+    // scale internal forces
+    for(i=0; i<r; i++)
+    {
+      internalForces[i] *= internalForceScalingFactor;
+      systemMatrixDiagonal[i] *= internalForceScalingFactor;
+    }
+
+    memset(qresidual, 0, sizeof(double) * r);
+
+    if (useStaticSolver)
+    {
+      if (tangentStiffnessMatrixOffset != NULL)
+      {
+        tangentStiffnessMatrixOffset->GetDiagonal(buffer);
+        for(i=0; i<r; i++)
+          systemMatrixDiagonal[i] += buffer[i];
+      }
+    }
+    else
+    {
+      // diagonal of the system matrix
+      double stiffnessCoef = 1.0 + alpha4 * dampingStiffnessCoef;
+      double massCoef = alpha1 + alpha4 * dampingMassCoef;
+      for(i=0; i<r; i++)
+        systemMatrixDiagonal[i] *= stiffnessCoef;
+
+      if (tangentStiffnessMatrixOffset != NULL)
+      {
+        tangentStiffnessMatrixOffset->GetDiagonal(buffer);
+        for(i=0; i<r; i++)
+          systemMatrixDiagonal[i] += buffer[i];
+      }
+
+      massMatrix->GetDiagonal(buffer);
+      for(i=0; i<r; i++)
+        systemMatrixDiagonal[i] += massCoef * buffer[i];
+
+      dampingMatrix->GetDiagonal(buffer);
+      for(i=0; i<r; i++)
+        systemMatrixDiagonal[i] += alpha4 * buffer[i];
+
+      // compute force residual, store it into aux variable qresidual
+      // qresidual = M * qaccel + C * qvel - externalForces + internalForces
+      // with C = dampingStiffnessCoef * K + dampingMassCoef * M + dampingMatrix
+
+      if (dampingStiffnessCoef != 0.0)
+      {
+        MatrixFreeStiffnessProduct(qvel, buffer);
+        for(i=0; i<r; i++)
+          qresidual[i] = dampingStiffnessCoef * buffer[i];
+      }
+
+      MassMatrixMultiplyVector(qaccel, buffer);
+      for(i=0; i<r; i++)
+        qresidual[i] += buffer[i];
+
+      MassMatrixMultiplyVector(qvel, buffer);
+      for(i=0; i<r; i++)
+        qresidual[i] += dampingMassCoef * buffer[i];
+
+      dampingMatrix->MultiplyVectorAdd(qvel, qresidual);
+    }
+
+    // add externalForces, internalForces
+    for(i=0; i<r; i++)
+    {
+      qresidual[i] += internalForces[i] - externalForces[i];
+      qresidual[i] *= -1;
+      qdelta[i] = qresidual[i];
+    }
+
+    double error = 0;
+    for(i=0; i<r; i++)
+      error += qresidual[i] * qresidual[i];
+
+    // on the first iteration, compute initial error
+    if (numIter == 0) 
+    {
+      error0 = error;
+      errorQuotient = 1.0;
+    }
+    else
+    {
+      // error divided by the initial error, before performing this iteration
+      errorQuotient = error / error0; 
+    }
+
+    if (errorQuotient < epsilon * epsilon)
+    {
+      break;
+    }
+
+    ConstrainedDOFs::RemoveDOFs(r, bufferConstrained, qdelta, numConstrainedDOFs, constrainedDOFs);
+    ConstrainedDOFs::RemoveDOFs(r, systemMatrixDiagonalConstrained, systemMatrixDiagonal, numConstrainedDOFs, constrainedDOFs);
+    matrixFreeCGSolver->SetDiagonal(systemMatrixDiagonalConstrained);
+
+    // solve: systemMatrix * buffer = bufferConstrained, without forming systemMatrix
+
+    PerformanceCounter counterSystemSolveTime;
+    memset(buffer, 0, sizeof(double) * r);
+
+    numMatrixFreeCGIterations = matrixFreeCGSolver->SolveLinearSystemWithJacobiPreconditioner(buffer, bufferConstrained, matrixFreeCGEpsilon, maxMatrixFreeCGIterations);
+    if (numMatrixFreeCGIterations < 0)
+    {
+      printf("Error: matrix-free CG solver did not converge in %d iterations.\n", maxMatrixFreeCGIterations);
+      return 1;
+    }
+
+    counterSystemSolveTime.StopCounter();
+    systemSolveTime = counterSystemSolveTime.GetElapsedTime();
+
+    ConstrainedDOFs::InsertDOFs(r, buffer, qdelta, numConstrainedDOFs, constrainedDOFs);
+
+    double stepLength = 1.0;
+    if (useLineSearch)
+      stepLength = LineSearch(energy, 1.0, alpha1, alpha4);
+
+    // update state
+    for(i=0; i<r; i++)
+    {
+      q[i] += stepLength * qdelta[i];
+      qaccel[i] = alpha1 * (q[i] - q_1[i]) - alpha2 * qvel_1[i] - alpha3 * qaccel_1[i];
+      qvel[i] = alpha4 * (q[i] - q_1[i]) + alpha5 * qvel_1[i] + alpha6 * qaccel_1[i];
+    }
+
+    for(int i=0; i<numConstrainedDOFs; i++)
+      q[constrainedDOFs[i]] = qvel[constrainedDOFs[i]] = qaccel[constrainedDOFs[i]] = 0.0;
+
+    numIter++;
+  }
+  while (numIter < maxIterations);
+
+  // the step is usable if the residual converged, or at least decreased before the last iteration
+  numNewtonIterations = numIter;
+  newtonConverged = (numIter < maxIterations) || (errorQuotient < 1.0);
+
+  return 0;
+}
+
 void ImplicitNewmarkSparse::UseStaticSolver(bool useStaticSolver_)
 { 
   useStaticSolver = useStaticSolver_;
@@ -412,6 +1032,27 @@ void ImplicitNewmarkSparse::UseStaticSolver(bool useStaticSolver_)
   }
 } 
 
+int ImplicitNewmarkSparse::UseBlockSparseMatrix(bool useBlockSparseMatrix)
+{
+  if (useBlockSparseMatrix && (systemSolver->GetSolverType() != INTEGRATOR_SOLVER_PCG))
+    return 1;
+
+  if (useBlockSparseMatrix)
+  {
+    // removing entire vertices preserves the 3x3 block structure of the system matrix
+    bool entireVertices = (numConstrainedDOFs % 3 == 0);
+    for(int i=0; entireVertices && (i<numConstrainedDOFs); i+=3)
+      entireVertices = (constrainedDOFs[i] % 3 == 0) && (constrainedDOFs[i+1] == constrainedDOFs[i] + 1) && (constrainedDOFs[i+2] == constrainedDOFs[i] + 2);
+    if (!entireVertices)
+    {
+      printf("Warning: the constrained DOFs do not fix entire vertices. Block-sparse system matrix will not be used.\n");
+      return 1;
+    }
+  }
+
+  return systemSolver->UseBlockSparseMatrix(useBlockSparseMatrix);
+}
+
 void ImplicitNewmarkSparse::SetTangentStiffnessMatrixOffset(SparseMatrix * tangentStiffnessMatrixOffset_, int reuseTopology)
 {
   if (tangentStiffnessMatrixOffset == NULL)
@@ -39,9 +39,14 @@
   This class either uses SPOOLES, PARDISO, or our own Jacobi-preconitioned 
   CG to solve the large sparse linear systems.
 
-  You can switch between these solvers at compile time,
-  by modifying the file integratorSolverSelection.h (see below)
-  (run-time solver switching would be possible too with more coding).
+  The solver is selected at run time, via the "solverType" constructor parameter 
+  (see integratorSolverSelection.h and integratorSparseSolver.h).
+  The default is the solver selected by the macro in integratorSolverSelection.h .
+
+  Alternatively, the Newton systems can be solved matrix-free (see UseMatrixFreeSolver),
+  which avoids forming the tangent stiffness matrix and the system matrix in each Newton iteration.
+
+  The timestep can be adapted automatically during the simulation (see SetAdaptiveTimestep).
 */
 
 #ifndef VEGAFEM_IMPLICITNEWMARKSPARSE_H
@@ -53,25 +58,17 @@
 
 // This code supports three different solvers for sparse linear systems of equations:
 // SPOOLES, PARDISO, Jacobi-preconditioned Conjugate Gradients
-// You must define exactly one of the macros SPOOLES, PARDISO, PCG,
-// by changing the file integratorSolverSelection.h .
 // PCG is available with our code; look for it in the "sparseMatrix" library (CGSolver.h)
 // SPOOLES is available at: http://www.netlib.org/linalg/spooles/spooles.2.2.html
 // For PARDISO, the class was tested with the PARDISO implementation from the Intel Math Kernel Library
 
+#include <vector>
 #include "integratorSolverSelection.h"
 #include "sparseMatrix.h"
 #include "integratorBaseSparse.h"
-
-#ifdef PARDISO
-  #include "sparseSolvers.h"
-#endif
-#ifdef SPOOLES
-  #include "sparseSolvers.h"
-#endif
-#ifdef PCG
-  #include "CGSolver.h"
-#endif
+#include "integratorSparseSolver.h"
+#include "forceModelAssembler.h"
+#include "CGSolver.h"
 
 namespace vegafem
 {
@@ -81,8 +78,11 @@ public:
 
   // constrainedDOFs is an integer array of degrees of freedom that are to be fixed to zero (e.g., to permanently fix a vertex in a deformable simulation)
   // constrainedDOFs are 0-indexed (separate DOFs for x,y,z), and must be pre-sorted (ascending)
-  // numThreads applies only to the PARDISO solver; if numThreads > 0, the sparse linear solves are multi-threaded; default: 0 (use single-threading)
-  ImplicitNewmarkSparse(int r, double timestep, SparseMatrix * massMatrix, ForceModel * forceModel, int numConstrainedDOFs=0, int * constrainedDOFs=NULL, double dampingMassCoef=0.0, double dampingStiffnessCoef=0.0, int maxIterations = 1, double epsilon = 1E-6, double NewmarkBeta=0.25, double NewmarkGamma=0.5, int numSolverThreads=0); 
+  // numThreads applies only to the PARDISO and SPOOLES solvers; if numThreads > 0, the sparse linear solves are multi-threaded; default: 0 (use single-threading)
+  // solverType selects the sparse linear solver (see integratorSolverSelection.h)
+  ImplicitNewmarkSparse(int r, double timestep, SparseMatrix * massMatrix, ForceModel * forceModel, int numConstrainedDOFs=0, int * constrainedDOFs=NULL, double dampingMassCoef=0.0, double dampingStiffnessCoef=0.0, int maxIterations = 1, double epsilon = 1E-6, double NewmarkBeta=0.25, double NewmarkGamma=0.5, int numSolverThreads=0, integratorSolverType solverType=INTEGRATOR_SOLVER_DEFAULT); 
+  // lumped mass matrix, given as a vector of r per-DOF masses (see integratorBaseSparse.h)
+  ImplicitNewmarkSparse(int r, double timestep, const double * lumpedMass, ForceModel * forceModel, int numConstrainedDOFs=0, int * constrainedDOFs=NULL, double dampingMassCoef=0.0, double dampingStiffnessCoef=0.0, int maxIterations = 1, double epsilon = 1E-6, double NewmarkBeta=0.25, double NewmarkGamma=0.5, int numSolverThreads=0, integratorSolverType solverType=INTEGRATOR_SOLVER_DEFAULT);
 
   virtual ~ImplicitNewmarkSparse();
 
@@ -100,14 +100,85 @@ public:
   virtual void SetTangentStiffnessMatrixOffset(SparseMatrix * tangentStiffnessMatrixOffset, int reuseTopology=1);
 
   // performs one step of simulation (returns 0 on sucess, and 1 on failure)
+  // with adaptive timestepping, the step has the current (adaptive) timestep; see SetAdaptiveTimestep
   virtual int DoTimestep(); 
 
+  // Adaptive timestepping. If enabled, DoTimestep attempts a step with the current timestep, and then:
+  // (1) if the step fails (solver failure, non-finite state, Newton iterations that neither converged nor reduced the residual
+  //     (if maxIterations > 1), or a local error estimate above the tolerance), the state is restored from q_1, qvel_1, qaccel_1,
+  //     and the step is retried with a smaller timestep;
+  // (2) if the step succeeds, the timestep for the next step is predicted from the local error estimate (growing at most 2x per step).
+  // The timestep stays within [minTimestep, maxTimestep]; steps at minTimestep are accepted regardless of the error estimate
+  // (but not if the solver failed or the state is not finite, in which case DoTimestep returns 1, with the state restored).
+  // The local error estimate is h^2 |beta - 1/6| ||qaccel - qaccel_1|| for Newmark, and h/2 ||qvel - qvel_1|| for backward Euler;
+  // a step is accepted if this estimate is at most errorTolerance * ||q|| + absoluteErrorTolerance.
+  // SetTimestep sets the timestep of the next attempt. Not used with the static solver. Default: disabled.
+  virtual void SetAdaptiveTimestep(bool adaptiveTimestep, double minTimestep, double maxTimestep, double errorTolerance=1E-3, double absoluteErrorTolerance=1E-8);
+  inline bool GetAdaptiveTimestep() const { return adaptiveTimestep; }
+  // the size of the last successful step
+  inline double GetLastTimestep() const { return lastTimestep; }
+  // number of Newton iterations (linear solves) in the last attempted step
+  inline int GetNumNewtonIterations() const { return numNewtonIterations; }
+  // number of accepted and rejected adaptive steps since the last reset
+  inline void GetAdaptiveTimestepStatistics(int * numAcceptedSteps, int * numRejectedSteps) const { *numAcceptedSteps = this->numAcceptedSteps; *numRejectedSteps = this->numRejectedSteps; }
+  inline void ResetAdaptiveTimestepStatistics() { numAcceptedSteps = numRejectedSteps = 0; }
+
+  // advances the simulation by the given time interval (e.g., one frame), with as many steps as needed
+  // with adaptive timestepping, the last step is shortened to end exactly at the end of the interval;
+  // otherwise, round(duration / timestep) steps are performed (at least one)
+  // returns 0 on success, and 1 on failure
+  virtual int AdvanceTime(double duration);
+
+  // Newton line search: each Newton update is scaled by a step length, found by backtracking (halving) from the full step, until
+  // the incremental potential of the timestep decreases sufficiently (Armijo condition). The incremental potential is the elastic energy,
+  // minus the work of the external forces, plus the inertia and damping terms; its gradient is the Newton residual.
+  // At most maxLineSearchIterations step lengths are tried; the last one is taken if none decreases the potential sufficiently.
+  // Requires ForceModel::GetElasticEnergy; the energy at the Newton iterates is computed with the internal forces (see ForceModel::GetEnergyAndForceAndMatrix),
+  // and each tried step length costs one energy evaluation. In the matrix-free mode, the energy at the Newton iterates costs one more energy evaluation,
+  // and, with stiffness damping, one more tangent stiffness matrix-vector product. Default: disabled.
+  virtual void SetLineSearch(bool useLineSearch, int maxLineSearchIterations=8);
+  inline bool GetLineSearch() const { return useLineSearch; }
+  // number of step length halvings in the last step
+  inline int GetNumLineSearchBacktracks() const { return numLineSearchBacktracks; }
+
+  // Newton warm start: the initial guess of each step extrapolates the previous velocity and acceleration
+  // (assuming constant acceleration over the step), instead of starting at the previous positions. Not used with the static solver. Default: disabled.
+  inline void SetNewtonWarmStart(bool newtonWarmStart) { this->newtonWarmStart = newtonWarmStart; }
+  inline bool GetNewtonWarmStart() const { return newtonWarmStart; }
+
   inline void SetNewmarkBeta(double NewmarkBeta) { this->NewmarkBeta = NewmarkBeta; UpdateAlphas(); }
   inline void SetNewmarkGamma(double NewmarkGamma) { this->NewmarkGamma = NewmarkGamma; UpdateAlphas(); }
 
   // dynamic solver is default (i.e. useStaticSolver=false)
   virtual void UseStaticSolver(bool useStaticSolver);
 
+  // the sparse linear solver (e.g., to query the selected solver type, or to set solver parameters)
+  inline IntegratorSparseSolver * GetSystemSolver() { return systemSolver; }
+
+  // PCG solver only: run the conjugate gradient iterations on a 3x3 block-sparse copy of the system matrix (see blockSparseMatrix3x3.h),
+  // which has faster matrix-vector products; default: false
+  // requires that the constrained DOFs fix entire vertices (all three DOFs 3i, 3i+1, 3i+2); returns 0 on success, 1 otherwise
+  virtual int UseBlockSparseMatrix(bool useBlockSparseMatrix);
+
+  // PARDISO solver only: reuse the most recent numerical factorization as a preconditioner for conjugate gradients,
+  // instead of factoring the system matrix in every Newton iteration (see IntegratorSparseSolver::SetFactorizationReuse);
+  // the factorization computed in SetState (of the matrix M + C) is never reused
+  // maxPCGIterations = 0 disables the reuse (default: the matrix is factored before every solve)
+  virtual void SetFactorizationReuse(int maxPCGIterations, int refactorPCGIterations=5, double PCGEpsilon=1E-6) { systemSolver->SetFactorizationReuse(maxPCGIterations, refactorPCGIterations, PCGEpsilon); }
+  // number of performed and skipped numerical factorizations
+  inline int GetNumFactorizations() const { return systemSolver->GetNumFactorizations(); }
+  inline int GetNumSkippedFactorizations() const { return systemSolver->GetNumSkippedFactorizations(); }
+  inline void ResetFactorizationCounters() { systemSolver->ResetFactorizationCounters(); }
+
+  // Matrix-free Newton-Krylov mode: solve the Newton systems with Jacobi-preconditioned CG, using products of the tangent stiffness matrix with vectors
+  // (ForceModelAssembler::GetTangentStiffnessMatrixVectorProduct), instead of assembling the tangent stiffness matrix and the system matrix.
+  // The Jacobi preconditioner uses the diagonal of the system matrix, which is assembled together with the internal forces.
+  // CGEpsilon and maxCGIterations are the convergence parameters of each CG solve.
+  // Requires that the force model is a ForceModelAssembler; returns 0 on success, 1 otherwise (the call is then ignored). Default: false.
+  virtual int UseMatrixFreeSolver(bool useMatrixFreeSolver, double CGEpsilon=1E-6, int maxCGIterations=10000);
+  // number of CG iterations in the last matrix-free solve
+  inline int GetNumMatrixFreeCGIterations() const { return numMatrixFreeCGIterations; }
+
 protected:
   SparseMatrix * rayleighDampingMatrix;
   SparseMatrix * tangentStiffnessMatrix;
@@ -124,14 +195,61 @@ protected:
   void UpdateAlphas();
   bool useStaticSolver;
 
+  // fused formation of the system matrix and the force residual (dynamic solver)
+  std::vector<int> systemRows; // for each row of tangentStiffnessMatrix, the corresponding row of systemMatrix, or -1 if the DOF is constrained
+  std::vector<int> systemEntryOffsets; // start of each row of tangentStiffnessMatrix in systemEntryIndices (length r+1)
+  std::vector<int> systemEntryIndices; // for each entry of tangentStiffnessMatrix, its position within the row of systemMatrix, or -1 if the column is constrained
+  bool systemMatrixFused; // true if the last Newton iteration used FormSystemMatrixAndResidual (tangentStiffnessMatrix is then unscaled, and rayleighDampingMatrix is not formed)
+  void BuildSystemMatrixIndices();
+  // in one (multi-threaded) pass over the rows of the tangent stiffness matrix K, and the mass, damping and offset matrices that share its topology:
+  // systemMatrix = (alpha1 * M + alpha4 * C + scaled K + offset) with the constrained DOFs removed, and qresidual = M * qaccel + C * qvel,
+  // where C = dampingMassCoef * M + dampingStiffnessCoef * (scaled K) + dampingMatrix
+  void FormSystemMatrixAndResidual();
+
+  // one step with the current timestep (DoTimestep without adaptive timestepping)
+  virtual int DoFixedTimestep();
+  int numNewtonIterations;
+  bool newtonConverged; // whether the Newton iterations of the last step converged (or reduced the residual)
+
+  // line search and warm start
+  bool useLineSearch;
+  int maxLineSearchIterations;
+  int numLineSearchBacktracks;
+  double * lineSearchq;
+  bool newtonWarmStart;
+  // returns the step length along qdelta, from the scaled elastic energy at q, the Newton residual (qresidual), and the scaled internal forces;
+  // the unknowns move along qdelta, and q moves along qScale * qdelta; the inertia and damping terms of the incremental potential
+  // have the Hessian massCoef * M + dampingCoef * (rayleighDampingMatrix + dampingMatrix) with respect to the unknowns
+  double LineSearch(double energy, double qScale, double massCoef, double dampingCoef);
+
+  // adaptive timestepping
+  bool adaptiveTimestep;
+  double minTimestep, maxTimestep, errorTolerance, absoluteErrorTolerance;
+  double lastTimestep;
+  int numAcceptedSteps, numRejectedSteps;
+  double localErrorOrder; // the local error estimate is proportional to h^localErrorOrder
+  // one adaptive step, of size at most maxStep
+  int DoAdaptiveTimestep(double maxStep);
+  // norm of the local error estimate of the last step
+  virtual double ComputeLocalErrorEstimate();
+
   int numSolverThreads;
-  #ifdef PARDISO
-    PardisoSolver * pardisoSolver;
-  #endif
+  IntegratorSparseSolver * systemSolver;
 
-  #ifdef PCG
-    CGSolver * jacobiPreconditionedCGSolver;
-  #endif
+  // matrix-free mode
+  ForceModelAssembler * matrixFreeForceModel; // NULL if the matrix-free mode is not used
+  CGSolver * matrixFreeCGSolver;
+  double matrixFreeCGEpsilon;
+  int maxMatrixFreeCGIterations, numMatrixFreeCGIterations;
+  double * matrixFreeVector, * matrixFreeProduct, * matrixFreeBuffer; // full-size buffers for the system matrix-vector products
+  double * systemMatrixDiagonal, * systemMatrixDiagonalConstrained;
+  int DoTimestepMatrixFree();
+  // Ax = systemMatrix * x, without forming systemMatrix (data is the integrator); x and Ax exclude the constrained DOFs
+  static void MatrixFreeSystemProduct(const void * data, const double * x, double * Ax);
+  // Ax = systemMatrix * x, for full-size vectors (the system matrix of the integrator, before the constrained DOFs are removed)
+  virtual void MatrixFreeSystemMatrixProduct(const double * x, double * Ax);
+  // Ax = (scaled) tangent stiffness matrix * x
+  void MatrixFreeStiffnessProduct(const double * x, double * Kx);
 };
 }//namespace vegafem
 #endif
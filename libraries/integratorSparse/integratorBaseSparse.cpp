@@ -51,10 +51,42 @@ IntegratorBaseSparse::IntegratorBaseSparse(int r, double timestep, SparseMatrix
   dampingMatrix = new SparseMatrix(&outline);
 
   tangentStiffnessMatrixOffset = NULL;
+
+  // detect a lumped (diagonal) mass matrix
+  ownMassMatrix = 0;
+  lumpedMass = inverseLumpedMass = NULL;
+  bool diagonal = (massMatrix->GetNumRows() == r);
+  for(int row=0; diagonal && (row < r); row++)
+    for(int j=0; j<massMatrix->GetRowLength(row); j++)
+      if (massMatrix->GetColumnIndex(row, j) != row)
+      {
+        diagonal = false;
+        break;
+      }
+
+  if (diagonal)
+  {
+    lumpedMass = (double*) calloc (r, sizeof(double)); // rows without entries have zero mass
+    massMatrix->GetDiagonal(lumpedMass);
+    inverseLumpedMass = (double*) malloc (sizeof(double) * r);
+    for(int i=0; i<r; i++)
+      inverseLumpedMass[i] = (lumpedMass[i] != 0.0) ? 1.0 / lumpedMass[i] : 0.0;
+    for(int i=0; i<numConstrainedDOFs; i++)
+      inverseLumpedMass[constrainedDOFs[i]] = 0.0;
+  }
+}
+
+IntegratorBaseSparse::IntegratorBaseSparse(int r, double timestep, const double * lumpedMass_, ForceModel * forceModel_, int numConstrainedDOFs_, int * constrainedDOFs_, double dampingMassCoef, double dampingStiffnessCoef): IntegratorBaseSparse(r, timestep, CreateDiagonalMatrix(r, lumpedMass_), forceModel_, numConstrainedDOFs_, constrainedDOFs_, dampingMassCoef, dampingStiffnessCoef)
+{
+  ownMassMatrix = 1;
 }
 
 IntegratorBaseSparse::~IntegratorBaseSparse()
 {
+  if (ownMassMatrix)
+    delete(massMatrix);
+  free(lumpedMass);
+  free(inverseLumpedMass);
   free(constrainedDOFs);
   if (ownDampingMatrix)
     delete(dampingMatrix);
@@ -72,6 +104,14 @@ void IntegratorBaseSparse::SetDampingMatrix(SparseMatrix * dampingMatrix_)
 
 double IntegratorBaseSparse::GetKineticEnergy()
 {
+  if (lumpedMass != NULL)
+  {
+    double energy = 0.0;
+    for(int i=0; i<r; i++)
+      energy += lumpedMass[i] * qvel[i] * qvel[i];
+    return 0.5 * energy;
+  }
+
   return 0.5 * massMatrix->QuadraticForm(qvel);
 }
 
@@ -80,6 +120,36 @@ double IntegratorBaseSparse::GetTotalMass()
   return massMatrix->SumEntries();
 }
 
+SparseMatrix * IntegratorBaseSparse::CreateDiagonalMatrix(int r, const double * diagonal)
+{
+  SparseMatrixOutline outline(r);
+  for(int i=0; i<r; i++)
+    outline.AddEntry(i, i, diagonal[i]);
+  return new SparseMatrix(&outline);
+}
+
+void IntegratorBaseSparse::MassMatrixMultiplyVector(const double * x, double * Mx)
+{
+  if (lumpedMass != NULL)
+  {
+    for(int i=0; i<r; i++)
+      Mx[i] = lumpedMass[i] * x[i];
+  }
+  else
+    massMatrix->MultiplyVector(x, Mx);
+}
+
+void IntegratorBaseSparse::MassMatrixMultiplyVectorAdd(const double * x, double * Mx)
+{
+  if (lumpedMass != NULL)
+  {
+    for(int i=0; i<r; i++)
+      Mx[i] += lumpedMass[i] * x[i];
+  }
+  else
+    massMatrix->MultiplyVectorAdd(x, Mx);
+}
+
 void IntegratorBaseSparse::SetTangentStiffnessMatrixOffset(SparseMatrix * tangentStiffnessMatrixOffset_, int reuseTopology)
 {
   if (reuseTopology && (tangentStiffnessMatrixOffset != NULL))
@@ -34,6 +34,11 @@
   A base class to timestep large sparse dynamics.
   E.g., unreduced nonlinear FEM deformable dynamics.
 
+  The mass matrix can be lumped (diagonal). Such a mass matrix can be given either as a SparseMatrix
+  (it is detected automatically) or as a vector of per-DOF masses (e.g., from GenerateMassMatrix::computeVertexMasses
+  with inflate3Dim=true). With a lumped mass matrix, the explicit integrators update the state
+  without solving linear systems with the mass matrix, and all the integrators multiply with the mass matrix in O(r).
+
   See also integratorBase.h .
 */
 
@@ -55,6 +60,8 @@ public:
   // constrainedDOFs are 0-indexed (separate DOFs for x,y,z), and must be pre-sorted (ascending)
   // damping matrix provides damping in addition to mass and stiffness damping
   IntegratorBaseSparse(int r, double timestep, SparseMatrix * massMatrix, ForceModel * forceModel, int numConstrainedDOFs=0, int * constrainedDOFs=NULL, double dampingMassCoef=0.0, double dampingStiffnessCoef=0.0);
+  // lumped mass matrix: lumpedMass is a vector of r per-DOF masses (the diagonal of the mass matrix); it is copied
+  IntegratorBaseSparse(int r, double timestep, const double * lumpedMass, ForceModel * forceModel, int numConstrainedDOFs=0, int * constrainedDOFs=NULL, double dampingMassCoef=0.0, double dampingStiffnessCoef=0.0);
 
   virtual ~IntegratorBaseSparse();
 
@@ -79,8 +86,25 @@ public:
   virtual double GetKineticEnergy();
   virtual double GetTotalMass();
 
+  // whether the mass matrix is lumped (diagonal)
+  inline bool HasLumpedMass() const { return lumpedMass != NULL; }
+  // the per-DOF masses of a lumped mass matrix (NULL if the mass matrix is not diagonal)
+  inline const double * GetLumpedMass() const { return lumpedMass; }
+
+  // creates a diagonal r x r sparse matrix with the given diagonal entries
+  static SparseMatrix * CreateDiagonalMatrix(int r, const double * diagonal);
+
 protected:
   SparseMatrix * massMatrix; 
+  int ownMassMatrix;
+  // lumped mass matrix: the diagonal of the mass matrix, and its inverse, with zeros at the constrained DOFs; both are NULL if the mass matrix is not diagonal
+  double * lumpedMass;
+  double * inverseLumpedMass;
+  // Mx = M * x (in O(r) with a lumped mass matrix)
+  void MassMatrixMultiplyVector(const double * x, double * Mx);
+  // Mx += M * x
+  void MassMatrixMultiplyVectorAdd(const double * x, double * Mx);
+
   ForceModel * forceModel;
   int ownDampingMatrix;
   SparseMatrix * dampingMatrix;
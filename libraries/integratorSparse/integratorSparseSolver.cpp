@@ -0,0 +1,243 @@
+/*************************************************************************
+ *                                                                       *
+ * Vega FEM Simulation Library Version 4.0                               *
+ *                                                                       *
+ * "integrator" library , Copyright (C) 2007 CMU, 2009 MIT, 2018 USC     *
+ * All rights reserved.                                                  *
+ *                                                                       *
+ * Code author: Jernej Barbic                                            *
+ * http://www.jernejbarbic.com/vega                                      *
+ *                                                                       *
+ * Research: Jernej Barbic, Hongyi Xu, Yijing Li,                        *
+ *           Danyong Zhao, Bohan Wang,                                   *
+ *           Fun Shing Sin, Daniel Schroeder,                            *
+ *           Doug L. James, Jovan Popovic                                *
+ *                                                                       *
+ * Funding: National Science Foundation, Link Foundation,                *
+ *          Singapore-MIT GAMBIT Game Lab,                               *
+ *          Zumberge Research and Innovation Fund at USC,                *
+ *          Sloan Foundation, Okawa Foundation,                          *
+ *          USC Annenberg Foundation                                     *
+ *                                                                       *
+ * This library is free software; you can redistribute it and/or         *
+ * modify it under the terms of the BSD-style license that is            *
+ * included with this library in the file LICENSE.txt                    *
+ *                                                                       *
+ * This library is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the file     *
+ * LICENSE.TXT for more details.                                         *
+ *                                                                       *
+ *************************************************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "getIntegratorSolver.h"
+#include "integratorSparseSolver.h"
+
+namespace vegafem
+{
+
+IntegratorSparseSolver::IntegratorSparseSolver(SparseMatrix * A_, integratorSolverType solverType_, int numThreads_, int positiveDefinite): A(A_), numThreads(numThreads_)
+{
+  solverType = SelectIntegratorSolver(solverType_, A->GetNumRows(), A->GetNumEntries());
+  GetIntegratorSolver(solverType, solverName);
+
+  pardisoSolver = NULL;
+  spoolesSolver = NULL;
+  jacobiPreconditionedCGSolver = NULL;
+  blockA = NULL;
+  blockJacobiPreconditionedCGSolver = NULL;
+  PCGEpsilon = 1E-6;
+  maxPCGIterations = 10000;
+
+  pardisoPreconditionedCGSolver = NULL;
+  maxReusePCGIterations = 0;
+  refactorPCGIterations = 0;
+  reusePCGEpsilon = 1E-6;
+  factorizationIsCurrent = 0;
+  reuseFactorization = 0;
+  numFactorizations = 0;
+  numSkippedFactorizations = 0;
+
+  switch(solverType)
+  {
+    case INTEGRATOR_SOLVER_PARDISO:
+      printf("Creating Pardiso solver. Num threads: %d\n", numThreads);
+      pardisoSolver = new PardisoSolver(A, numThreads, positiveDefinite ? PardisoSolver::REAL_SPD : PardisoSolver::REAL_SYM_INDEFINITE);
+    break;
+
+    case INTEGRATOR_SOLVER_SPOOLES:
+      // SPOOLES factors the matrix in its constructor; the solver is created in FactorMatrix
+    break;
+
+    case INTEGRATOR_SOLVER_PCG:
+      jacobiPreconditionedCGSolver = new CGSolver(A);
+    break;
+
+    default:
+      printf("Error: unknown integrator solver type %d.\n", (int)solverType);
+      exit(1);
+    break;
+  }
+}
+
+IntegratorSparseSolver::~IntegratorSparseSolver()
+{
+  delete(pardisoPreconditionedCGSolver);
+  delete(pardisoSolver);
+  delete(spoolesSolver);
+  delete(jacobiPreconditionedCGSolver);
+  delete(blockJacobiPreconditionedCGSolver);
+  delete(blockA);
+}
+
+int IntegratorSparseSolver::FactorMatrix(int reusable)
+{
+  switch(solverType)
+  {
+    case INTEGRATOR_SOLVER_PARDISO:
+    {
+      factorizationIsCurrent = 0;
+      if (!reusable)
+        reuseFactorization = 0;
+      if ((pardisoPreconditionedCGSolver != NULL) && reuseFactorization)
+        return 0; // deferred to SolveLinearSystem
+
+      int info = FactorPardiso();
+      reuseFactorization = reusable && (info == 0);
+      return info;
+    }
+    break;
+
+    case INTEGRATOR_SOLVER_SPOOLES:
+      delete(spoolesSolver);
+      if (numThreads > 1)
+        spoolesSolver = new SPOOLESSolverMT(A, numThreads);
+      else
+        spoolesSolver = new SPOOLESSolver(A);
+      numFactorizations++;
+    break;
+
+    case INTEGRATOR_SOLVER_PCG:
+      if (blockA != NULL)
+        blockA->AssignSparseMatrix(A);
+    break;
+
+    default:
+    break;
+  }
+
+  return 0;
+}
+
+int IntegratorSparseSolver::FactorPardiso()
+{
+  int info = pardisoSolver->FactorMatrix(A);
+  numFactorizations++;
+  factorizationIsCurrent = (info == 0);
+  return info;
+}
+
+int IntegratorSparseSolver::SolveLinearSystem(double * x, const double * rhs)
+{
+  switch(solverType)
+  {
+    case INTEGRATOR_SOLVER_PARDISO:
+    {
+      if (!factorizationIsCurrent)
+      {
+        if (reuseFactorization)
+        {
+          int numIterations = pardisoPreconditionedCGSolver->SolveLinearSystemWithPreconditioner(pardisoSolver, x, rhs, reusePCGEpsilon, maxReusePCGIterations);
+          if (numIterations >= 0)
+          {
+            numSkippedFactorizations++;
+            if (numIterations > refactorPCGIterations)
+              reuseFactorization = 0;
+            return 0;
+          }
+          // PCG stalled; discard its result and refactor
+        }
+
+        int info = FactorPardiso();
+        if (info != 0)
+          return info;
+        reuseFactorization = 1;
+      }
+      return pardisoSolver->SolveLinearSystem(x, rhs);
+    }
+    break;
+
+    case INTEGRATOR_SOLVER_SPOOLES:
+      if (spoolesSolver == NULL)
+      {
+        printf("Error: SPOOLES solver: FactorMatrix has not been called.\n");
+        return 1;
+      }
+      return spoolesSolver->SolveLinearSystem(x, rhs);
+    break;
+
+    case INTEGRATOR_SOLVER_PCG:
+    {
+      int info;
+      if (blockA != NULL)
+        info = blockJacobiPreconditionedCGSolver->SolveLinearSystemWithJacobiPreconditioner(x, rhs, PCGEpsilon, maxPCGIterations);
+      else
+        info = jacobiPreconditionedCGSolver->SolveLinearSystemWithJacobiPreconditioner(x, rhs, PCGEpsilon, maxPCGIterations);
+      return (info > 0) ? 0 : info;
+    }
+    break;
+
+    default:
+    break;
+  }
+
+  return 1;
+}
+
+int IntegratorSparseSolver::UseBlockSparseMatrix(bool useBlockSparseMatrix)
+{
+  if (solverType != INTEGRATOR_SOLVER_PCG)
+    return useBlockSparseMatrix ? 1 : 0;
+
+  delete(blockJacobiPreconditionedCGSolver);
+  delete(blockA);
+  blockJacobiPreconditionedCGSolver = NULL;
+  blockA = NULL;
+
+  if (useBlockSparseMatrix)
+  {
+    blockA = new BlockSparseMatrix3x3(A);
+    blockJacobiPreconditionedCGSolver = new CGSolver(blockA);
+  }
+  return 0;
+}
+
+void IntegratorSparseSolver::SetFactorizationReuse(int maxPCGIterations_, int refactorPCGIterations_, double PCGEpsilon_)
+{
+  if (solverType != INTEGRATOR_SOLVER_PARDISO)
+  {
+    if (maxPCGIterations_ > 0)
+      printf("Warning: factorization reuse is only available with the PARDISO solver.\n");
+    return;
+  }
+
+  maxReusePCGIterations = maxPCGIterations_;
+  refactorPCGIterations = refactorPCGIterations_;
+  reusePCGEpsilon = PCGEpsilon_;
+
+  if ((maxReusePCGIterations > 0) && (pardisoPreconditionedCGSolver == NULL))
+    pardisoPreconditionedCGSolver = new CGSolver(A);
+
+  if (maxReusePCGIterations <= 0)
+  {
+    delete(pardisoPreconditionedCGSolver);
+    pardisoPreconditionedCGSolver = NULL;
+    reuseFactorization = 0; // a deferred factorization is then performed in the next solve
+  }
+}
+
+}//namespace vegafem
+
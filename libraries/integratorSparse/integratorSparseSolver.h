@@ -0,0 +1,126 @@
+/*************************************************************************
+ *                                                                       *
+ * Vega FEM Simulation Library Version 4.0                               *
+ *                                                                       *
+ * "integrator" library , Copyright (C) 2007 CMU, 2009 MIT, 2018 USC     *
+ * All rights reserved.                                                  *
+ *                                                                       *
+ * Code author: Jernej Barbic                                            *
+ * http://www.jernejbarbic.com/vega                                      *
+ *                                                                       *
+ * Research: Jernej Barbic, Hongyi Xu, Yijing Li,                        *
+ *           Danyong Zhao, Bohan Wang,                                   *
+ *           Fun Shing Sin, Daniel Schroeder,                            *
+ *           Doug L. James, Jovan Popovic                                *
+ *                                                                       *
+ * Funding: National Science Foundation, Link Foundation,                *
+ *          Singapore-MIT GAMBIT Game Lab,                               *
+ *          Zumberge Research and Innovation Fund at USC,                *
+ *          Sloan Foundation, Okawa Foundation,                          *
+ *          USC Annenberg Foundation                                     *
+ *                                                                       *
+ * This library is free software; you can redistribute it and/or         *
+ * modify it under the terms of the BSD-style license that is            *
+ * included with this library in the file LICENSE.txt                    *
+ *                                                                       *
+ * This library is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the file     *
+ * LICENSE.TXT for more details.                                         *
+ *                                                                       *
+ *************************************************************************/
+
+/*
+  Solves the sparse linear systems of the sparse integrators, A * x = rhs.
+  The topology of A is fixed, but its entries may change between solves.
+
+  The solver (PARDISO, SPOOLES or Jacobi-preconditioned CG) is selected at run time,
+  by passing an integratorSolverType (see integratorSolverSelection.h). 
+  The "DEFAULT" type selects the solver given by the compile-time macro in integratorSolverSelection.h, 
+  and the "AUTO" type chooses based on the size of A (see SelectIntegratorSolver in getIntegratorSolver.h).
+*/
+
+#ifndef VEGAFEM_INTEGRATORSPARSESOLVER_H
+#define VEGAFEM_INTEGRATORSPARSESOLVER_H
+
+#include "integratorSolverSelection.h"
+#include "sparseMatrix.h"
+#include "sparseSolvers.h"
+
+namespace vegafem
+{
+
+class IntegratorSparseSolver : public LinearSolver
+{
+public:
+  // A is the system matrix; it is not copied, and must stay alive during the lifetime of the solver
+  // numThreads applies to the PARDISO and SPOOLES solvers
+  // positiveDefinite: whether A is positive-definite (selects the PARDISO matrix type); PCG requires a positive-definite A
+  // Note: you must call FactorMatrix before the first solve
+  IntegratorSparseSolver(SparseMatrix * A, integratorSolverType solverType = INTEGRATOR_SOLVER_DEFAULT, int numThreads = 0, int positiveDefinite = 0);
+  virtual ~IntegratorSparseSolver();
+
+  // the selected solver (never DEFAULT or AUTO)
+  inline integratorSolverType GetSolverType() const { return solverType; }
+  inline const char * GetSolverName() const { return solverName; }
+
+  // Must be called every time the entries of A change, before the next solve.
+  // PARDISO: numerical factorization; SPOOLES: creates the solver (factorization); PCG: updates the block-sparse copy of A (if used).
+  // When factorization reuse is enabled (PARDISO, see below), the factorization is deferred to the next solve, and may be skipped.
+  // "reusable" = 0 means that A is unrelated to the matrices of the subsequent solves; its factorization is then never reused.
+  // Returns 0 on success, the solver's error code otherwise.
+  int FactorMatrix(int reusable = 1);
+
+  // solves A * x = rhs; x is the initial guess for PCG
+  // returns 0 on success, the solver's error code otherwise (PCG: negative number of iterations if not converged)
+  virtual int SolveLinearSystem(double * x, const double * rhs);
+
+  // PCG solver only: run the conjugate gradient iterations on a 3x3 block-sparse copy of A (see blockSparseMatrix3x3.h),
+  // which has faster matrix-vector products; A must consist of 3x3 blocks
+  // returns 0 on success, 1 if the solver is not PCG (the call is then ignored)
+  int UseBlockSparseMatrix(bool useBlockSparseMatrix);
+
+  // PCG solver only: convergence parameters (default: eps=1E-6, maxIterations=10000)
+  inline void SetPCGParameters(double eps, int maxIterations) { PCGEpsilon = eps; maxPCGIterations = maxIterations; }
+
+  // PARDISO solver only: reuse the most recent numerical factorization as a preconditioner for conjugate gradients, 
+  // instead of factoring A every time its entries change (the sparsity structure never changes).
+  // A is refactored when PCG does not converge to "PCGEpsilon" within "maxPCGIterations" iterations,
+  // or when the previous PCG solve needed more than "refactorPCGIterations" iterations (the old factorization has become a poor preconditioner).
+  // maxPCGIterations = 0 disables the reuse (default).
+  // A must be positive-definite; otherwise, PCG fails and each solve falls back to a refactorization.
+  void SetFactorizationReuse(int maxPCGIterations, int refactorPCGIterations=5, double PCGEpsilon=1E-6);
+  // number of performed and skipped numerical factorizations
+  inline int GetNumFactorizations() const { return numFactorizations; }
+  inline int GetNumSkippedFactorizations() const { return numSkippedFactorizations; }
+  inline void ResetFactorizationCounters() { numFactorizations = numSkippedFactorizations = 0; }
+
+protected:
+  SparseMatrix * A;
+  integratorSolverType solverType;
+  char solverName[16];
+  int numThreads;
+
+  PardisoSolver * pardisoSolver;
+  LinearSolver * spoolesSolver;
+  CGSolver * jacobiPreconditionedCGSolver;
+  BlockSparseMatrix3x3 * blockA;
+  CGSolver * blockJacobiPreconditionedCGSolver;
+  double PCGEpsilon;
+  int maxPCGIterations;
+
+  // PARDISO factorization reuse
+  CGSolver * pardisoPreconditionedCGSolver; // NULL if factorization reuse is disabled
+  int maxReusePCGIterations, refactorPCGIterations;
+  double reusePCGEpsilon;
+  int factorizationIsCurrent; // 1 if the factorization corresponds to the current entries of A
+  int reuseFactorization; // 1 if the factorization may be used as a preconditioner in the next solve
+  int numFactorizations, numSkippedFactorizations;
+
+  int FactorPardiso();
+};
+
+}//namespace vegafem
+
+#endif
+
@@ -33,6 +33,13 @@
 #include "isotropicHyperelasticFEM.h"
 #include "matrixIO.h"
 #include "mat3d.h"
+#include "polarDecompositionBatch.h"
+#include <functional>
+#include <utility>
+
+#ifdef VEGAFEM_USE_TBB
+  #include <tbb/tbb.h>
+#endif
 
 namespace vegafem
 {
@@ -45,7 +52,8 @@ IsotropicHyperelasticFEM::IsotropicHyperelasticFEM(TetMesh * tetMesh_, Isotropic
   inversionThreshold(inversionThreshold_),
   addGravity(addGravity_), 
   g(g_),
-  enforceSPD(false)
+  enforceSPD(false),
+  elementCache(NULL)
 {
   if (tetMesh->getNumElementVertices() != 4)
   {
@@ -114,6 +122,31 @@ IsotropicHyperelasticFEM::IsotropicHyperelasticFEM(TetMesh * tetMesh_, Isotropic
 
   delete(stiffnessMatrixTopology);
 
+  // greedy element coloring, used to assemble in parallel: each element gets the smallest color
+  // not used by any element sharing one of its vertices
+  std::vector<std::vector<int>> vertexColors(numVertices); // colors of the elements incident to each vertex
+  std::vector<int> colorStamp; // colorStamp[color] == el if the color is used by a neighbor of element el
+  for (int el=0; el < numElements; el++)
+  {
+    for(int vertex=0; vertex<numElementVertices; vertex++)
+      for(int color : vertexColors[row_[el][vertex]])
+        colorStamp[color] = el;
+
+    int color = 0;
+    while ((color < (int)colorStamp.size()) && (colorStamp[color] == el))
+      color++;
+
+    if (color == (int)elementColors.size())
+    {
+      elementColors.emplace_back();
+      colorStamp.push_back(-1);
+    }
+    elementColors[color].push_back(el);
+
+    for(int vertex=0; vertex<numElementVertices; vertex++)
+      vertexColors[row_[el][vertex]].push_back(color);
+  }
+
   // DS = D_s
   // dDSdU = d D_s / d U
   // set dDSdU here, it's a constant matrix (does not change during the simulation)
@@ -380,10 +413,94 @@ void IsotropicHyperelasticFEM::PrepareDeformGrad()
 int IsotropicHyperelasticFEM::GetEnergyAndForceAndTangentStiffnessMatrixHelper(const double * u, double * energy, double * internalForces, SparseMatrix * tangentStiffnessMatrix)
 {
   GetEnergyAndForceAndTangentStiffnessMatrixHelperPrologue(u, energy, internalForces, tangentStiffnessMatrix); // resets the energy, internal forces and/or tangent stiffness matrix to zero
+#ifdef VEGAFEM_USE_TBB
+  if (tbb::this_task_arena::max_concurrency() > 1)
+    return GetEnergyAndForceAndTangentStiffnessMatrixHelperMT(u, energy, internalForces, tangentStiffnessMatrix);
+#endif
   int code = GetEnergyAndForceAndTangentStiffnessMatrixHelperWorkhorse(0, tetMesh->getNumElements(), u, energy, internalForces, tangentStiffnessMatrix);
   return code;
 }
 
+int IsotropicHyperelasticFEM::GetEnergyAndForceAndTangentStiffnessMatrixHelperMT(const double * u, double * energy, double * internalForces, SparseMatrix * tangentStiffnessMatrix)
+{
+#ifdef VEGAFEM_USE_TBB
+  const int elementGrainSize = 64;
+  int numElements = tetMesh->getNumElements();
+  int numElementVertices = tetMesh->getNumElementVertices();
+
+  // compute the deformation gradients of the elements, and their modified SVDs, in batches of consecutive elements
+  int exitCode = tbb::parallel_reduce(tbb::blocked_range<int>(0, numElements, elementGrainSize), 0,
+    [&](const tbb::blocked_range<int> & rng, int rangeExitCode)
+  {
+    int startEl = rng.begin(), endEl = rng.end();
+    for (int el=startEl; el<endEl; el++)
+      ComputeDeformationGradient(el);
+    int modifiedSVD = 1;
+    if (PolarDecompositionBatch::SVD(endEl - startEl, &Fs[startEl], &Us[startEl], &Fhats[startEl], &Vs[startEl], SVD_singularValue_eps, modifiedSVD) != 0)
+    {
+      printf("error in diagonalization, elements %d <= el < %d\n", startEl, endEl);
+      rangeExitCode = 1;
+    }
+    return rangeExitCode;
+  }, std::bit_or<int>());
+
+  // no two elements of a color share a vertex, so the elements of one color add their internal forces and stiffness matrices
+  // directly into the outputs, in parallel, without write conflicts;
+  // fixed grain size and deterministic reduction: the energy does not depend on the number of threads
+  typedef std::pair<double, int> EnergyAndExitCode;
+  for(const std::vector<int> & colorElements : elementColors)
+  {
+    EnergyAndExitCode colorResult = tbb::parallel_deterministic_reduce(tbb::blocked_range<int>(0, (int)colorElements.size(), elementGrainSize), EnergyAndExitCode(0.0, 0),
+      [&](const tbb::blocked_range<int> & rng, EnergyAndExitCode rangeResult)
+    {
+      double fElement[12];
+      double KElement[144];
+      double eleEnergy = 0.0;
+      for(int i=rng.begin(); i!=rng.end(); ++i)
+      {
+        int el = colorElements[i];
+        rangeResult.second |= ComputeElementLocalData(el, u, (energy ? &eleEnergy : NULL), (internalForces ? fElement : NULL), (tangentStiffnessMatrix ? KElement : NULL), false);
+
+        if (energy)
+          rangeResult.first += eleEnergy;
+
+        if (internalForces)
+        {
+          for(int vertex=0; vertex<numElementVertices; vertex++)
+          {
+            int vIndex = 3 * row_[el][vertex];
+            internalForces[vIndex+0] += fElement[3*vertex+0];
+            internalForces[vIndex+1] += fElement[3*vertex+1];
+            internalForces[vIndex+2] += fElement[3*vertex+2];
+          }
+        }
+
+        if (tangentStiffnessMatrix)
+        {
+          for(int vtxIndexA=0; vtxIndexA<4; vtxIndexA++)
+            for(int vtxIndexB=0; vtxIndexB<4; vtxIndexB++)
+            {
+              int columnIndexCompressed = column_[el][numElementVertices * vtxIndexA + vtxIndexB];
+              for(int i=0; i<3; i++)
+                for(int j=0; j<3; j++)
+                  tangentStiffnessMatrix->AddEntry(3 * row_[el][vtxIndexA] + i, 3 * columnIndexCompressed + j, KElement[ELT(12, 3*vtxIndexA+i, 3*vtxIndexB+j)]);
+            }
+        }
+      }
+      return rangeResult;
+    }, [](const EnergyAndExitCode & a, const EnergyAndExitCode & b) { return EnergyAndExitCode(a.first + b.first, a.second | b.second); });
+
+    if (energy)
+      *energy += colorResult.first;
+    exitCode |= colorResult.second;
+  }
+
+  return exitCode;
+#else
+  return GetEnergyAndForceAndTangentStiffnessMatrixHelperWorkhorse(0, tetMesh->getNumElements(), u, energy, internalForces, tangentStiffnessMatrix);
+#endif
+}
+
 // initializes the energy, internal forces, and/or stiffness matrix
 void IsotropicHyperelasticFEM::GetEnergyAndForceAndTangentStiffnessMatrixHelperPrologue(const double * u, double * energy, double * internalForces, SparseMatrix * tangentStiffnessMatrix)
 {
@@ -434,9 +551,24 @@ void IsotropicHyperelasticFEM::GetElementLocalEnergyAndForceAndMatrix(int el, co
   ComputeElementLocalData(el, u, energy, internalForces, tangentStiffnessMatrix);
 }
 
-int IsotropicHyperelasticFEM::ComputeElementLocalData(int el, const double * u, double * energy, double internalForces[12], double tangentStiffnessMatrix[144])
+void IsotropicHyperelasticFEM::ComputeDeformationGradient(int el)
 {
-  int exitCode = 0;
+  if (elementCache != NULL)
+  {
+    // F = sum_a x_a g_a^T, where g_a are the shape function gradients
+    double F[3][3] = { { 0.0 } };
+    for(int a=0; a<4; a++)
+    {
+      const double * x = &currentVerticesPosition[3 * elementCache->getVertexIndices(a)[el]];
+      double g[3] = { elementCache->getShapeFunctionGradients(a, 0)[el], elementCache->getShapeFunctionGradients(a, 1)[el], elementCache->getShapeFunctionGradients(a, 2)[el] };
+      for(int i=0; i<3; i++)
+        for(int j=0; j<3; j++)
+          F[i][j] += x[i] * g[j];
+    }
+    Fs[el] = Mat3d(F[0][0], F[0][1], F[0][2], F[1][0], F[1][1], F[1][2], F[2][0], F[2][1], F[2][2]);
+    return;
+  }
+
   //  Compute the deformation gradient F.
   //  F = Ds * inv(Dm), where Ds is a 3x3 matrix where
   //  the columns are edge vectors of a tet in the current deformation,
@@ -458,21 +590,30 @@ int IsotropicHyperelasticFEM::ComputeElementLocalData(int el, const double * u,
   
   Mat3d tmp(ds1[0], ds2[0], ds3[0], ds1[1], ds2[1], ds3[1], ds1[2], ds2[2], ds3[2]);
   Fs[el] = tmp * dmInverses[el];
+}
 
-  /*
-    The deformation gradient has now been computed and is available in Fs[el]
-  */
-
-  // perform modified SVD on the deformation gradient
-  Mat3d & F = Fs[el];
-  Mat3d & U = Us[el];
-  Mat3d & V = Vs[el];
-  Vec3d & Fhat = Fhats[el];
-  int modifiedSVD = 1;
-  if (SVD(F, U, Fhat, V, SVD_singularValue_eps, modifiedSVD) != 0)
+int IsotropicHyperelasticFEM::ComputeElementLocalData(int el, const double * u, double * energy, double internalForces[12], double tangentStiffnessMatrix[144], bool computeSVD, bool singlePrecision)
+{
+  int exitCode = 0;
+  if (computeSVD)
   {
-    printf("error in diagonalization, el=%d\n", el);
-    exitCode = 1;
+    ComputeDeformationGradient(el);
+
+    /*
+      The deformation gradient has now been computed and is available in Fs[el]
+    */
+
+    // perform modified SVD on the deformation gradient
+    Mat3d & F = Fs[el];
+    Mat3d & U = Us[el];
+    Mat3d & V = Vs[el];
+    Vec3d & Fhat = Fhats[el];
+    int modifiedSVD = 1;
+    if (SVD(F, U, Fhat, V, SVD_singularValue_eps, modifiedSVD) != 0)
+    {
+      printf("error in diagonalization, el=%d\n", el);
+      exitCode = 1;
+    }
   }
 
   /*
@@ -546,7 +687,10 @@ int IsotropicHyperelasticFEM::ComputeElementLocalData(int el, const double * u,
       the correct position of the final stiffness matrix (i.e.,
       the stiffness matrix for the entire mesh)
      */
-    ComputeTetK(el, tangentStiffnessMatrix, clamped);
+    if (singlePrecision)
+      ComputeTetKSinglePrecision(el, tangentStiffnessMatrix, clamped);
+    else
+      ComputeTetK(el, tangentStiffnessMatrix, clamped);
   }
 
   return exitCode;
@@ -569,14 +713,24 @@ int IsotropicHyperelasticFEM::GetEnergyAndForceAndTangentStiffnessMatrixHelperWo
   int numElementVertices = tetMesh->getNumElementVertices();
   //bool dropBelowThreshold = false; // becomes true when a principal stretch falls below the threshold; only used for printing out informative comments
   
-  // traverse the elements and assemble strain energy, internal forces and tangent stiffness matrix
+  // compute the deformation gradients of the elements, and their modified SVDs in batches
   int exitCode = 0;
+  for (int el=startEl; el<endEl; el++)
+    ComputeDeformationGradient(el);
+  int modifiedSVD = 1;
+  if (PolarDecompositionBatch::SVD(endEl - startEl, &Fs[startEl], &Us[startEl], &Fhats[startEl], &Vs[startEl], SVD_singularValue_eps, modifiedSVD) != 0)
+  {
+    printf("error in diagonalization, elements %d <= el < %d\n", startEl, endEl);
+    exitCode = 1;
+  }
+
+  // traverse the elements and assemble strain energy, internal forces and tangent stiffness matrix
   double fElement[12];
   double KElement[144];
   double eleEnergy = 0.0;
   for (int el=startEl; el<endEl; el++)
   {
-    exitCode |= ComputeElementLocalData(el, u, (energy ? &eleEnergy : NULL), (internalForces ? fElement : NULL), (tangentStiffnessMatrix ? KElement : NULL));
+    exitCode |= ComputeElementLocalData(el, u, (energy ? &eleEnergy : NULL), (internalForces ? fElement : NULL), (tangentStiffnessMatrix ? KElement : NULL), false);
 
     if (energy)
       *energy += eleEnergy;
@@ -631,6 +785,25 @@ int IsotropicHyperelasticFEM::GetEnergyAndForceAndTangentStiffnessMatrixHelperWo
   return exitCode;
 }
 
+void IsotropicHyperelasticFEM::ComputeElementDeformationGradient(int el, const double * u, double F[9]) const
+{
+  const int * vertices = tetMesh->getVertexIndices(el);
+  double uEl[12];
+  for (int m=0; m<4; m++)
+    for (int n=0; n<3; n++)
+      uEl[3 * m + n] = u[3 * vertices[m] + n];
+
+  // rows of dFdU are the entries of F (row-major), columns are the element dofs
+  const double * dFdU = &dFdUs[108 * el];
+  for (int ij=0; ij<9; ij++)
+  {
+    double Fij = (ij % 4 == 0) ? 1.0 : 0.0;
+    for (int k=0; k<12; k++)
+      Fij += dFdU[12 * ij + k] * uEl[k];
+    F[ij] = Fij;
+  }
+}
+
 /*
   Converts a 3x3x3x4 tensor index to 9x12 matrix index
 
@@ -828,6 +1001,64 @@ void IsotropicHyperelasticFEM::ComputeTetK(int el, double K[144], int clamped)
   }
 }
 
+void IsotropicHyperelasticFEM::ComputeTetKSinglePrecision(int el, double K[144], int clamped)
+{
+  // same as ComputeTetK, except that dG/dF and K = dG/dF * dF/dU are computed in single precision
+  double dPdF[81]; //in 9x9 matrix format
+  Compute_dPdF(el, dPdF, clamped);
+
+  float dGdF[81]; //in 9x9 matrix format
+  for(int i=0; i<81; i++)
+    dGdF[i] = 0.0f;
+  Vec3d * bVec[3] = { &areaWeightedVertexNormals[4 * el + 0], &areaWeightedVertexNormals[4 * el + 1], &areaWeightedVertexNormals[4 * el + 2] };
+  for(int abc=0; abc<3; abc++)
+  {
+    float b[3] = { (float)(*bVec[abc])[0], (float)(*bVec[abc])[1], (float)(*bVec[abc])[2] };
+    for(int i=0; i<3; i++)
+      for (int column=0; column<9; column++)
+        for(int k=0; k<3; k++)
+          dGdF[27 * abc + 9 * i + column] += (float)dPdF[(3*i+k)*9+column] * b[k];
+  }
+
+  const float * dFdU = &dFdUsFloat[108 * el];
+  for (int row=0; row<9; row++)
+  {
+    for (int column=0; column<12; column++)
+    {
+      float result = 0;
+      for (int inner=0; inner<9; inner++)
+        result += dGdF[9 * row + inner]*dFdU[12 * inner + column];
+      K[12 * column + row] = result;
+    }
+  }
+
+  for (int row = 0; row < 12; row++)
+  {
+    K[12 * row +  9] = -K[12 * row + 0] - K[12 * row + 3] - K[12 * row + 6];
+    K[12 * row + 10] = -K[12 * row + 1] - K[12 * row + 4] - K[12 * row + 7];
+    K[12 * row + 11] = -K[12 * row + 2] - K[12 * row + 5] - K[12 * row + 8];
+  }
+}
+
+void IsotropicHyperelasticFEM::BuildSinglePrecisionData()
+{
+  if (dFdUsFloat.size() > 0)
+    return;
+  int numElements = tetMesh->getNumElements();
+  dFdUsFloat.assign(dFdUs, dFdUs + 108 * numElements);
+}
+
+void IsotropicHyperelasticFEM::GetElementLocalEnergyAndForceAndMatrixSinglePrecision(int el, const double * u, double * energy, double * internalForces, double * tangentStiffnessMatrix)
+{
+  for(int i = 0; i < 4; i++)
+  {
+    int index = 3 * tetMesh->getVertexIndex(el, i);
+    Vec3d pos = Vec3d(&restVerticesPosition[index]) + Vec3d(&u[index]);
+    pos.convertToArray(&currentVerticesPosition[index]);
+  }
+  ComputeElementLocalData(el, u, energy, internalForces, tangentStiffnessMatrix, true, true);
+}
+
 double IsotropicHyperelasticFEM::ComputeEnergyFromStretches(int elementIndex, double * lambda)
 {
   double invariants[3];
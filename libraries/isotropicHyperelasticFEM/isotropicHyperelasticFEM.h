@@ -34,7 +34,9 @@
 #define VEGAFEM_ISOTROPICHYPERELASTICFEM_H
 
 #include <cfloat>
+#include <vector>
 #include "tetMesh.h"
+#include "tetMeshElementCache.h"
 #include "sparseMatrix.h"
 #include "isotropicMaterial.h"
 
@@ -60,6 +62,11 @@ es (derivative of internal forces). It can also handle and restore from element
   ACM SIGGRAPH / Eurographics Symp. on Computer Animation
   (July 2005), pp. 181–190.
 
+  If Intel TBB is provided, the energy, internal forces and tangent stiffness matrix are computed in parallel.
+  The elements are colored so that the elements of the same color share no vertices. The colors are processed
+  one after another, and the elements of each color in parallel, adding their internal forces and stiffness matrices
+  directly into the outputs (no per-element or per-thread buffers). The results do not depend on the number of threads.
+  The number of threads can be controlled outside the class using the Intel TBB APIs.
 */
 
 class IsotropicHyperelasticFEM
@@ -99,6 +106,9 @@ public:
   // enables or disables the gravity (note: you can also set this in the constructor; use this routine to turn the gravity on/off during the simulation)
   void SetGravity(bool addGravity) { this->addGravity = addGravity; } // if addGravity is enabled, ComputeForces will subtract the gravity force from the internal forces (note: subtraction, not addition, is used because the internal forces are returned with the sign as described in the f_int(x) comment above)
 
+  // computes the deformation gradient F (row-major) of element "el" under the displacements u, as F = I + dF/du * u
+  void ComputeElementDeformationGradient(int el, const double * u, double F[9]) const;
+
   inline TetMesh * GetTetMesh() { return tetMesh; }
 
   void SetMaterial(IsotropicMaterial * isotropicMaterial_) { isotropicMaterial = isotropicMaterial_; }
@@ -106,6 +116,11 @@ public:
   // enforces the tangent stiffness matrix to be symmetric positive-definite (which is good for stability)
   void EnforceSPD(bool enforceSPD) { this->enforceSPD = enforceSPD; }
 
+  // If an element cache of the tet mesh is given (see tetMeshElementCache.h), the deformation gradients are computed
+  // from the cached vertex indices and shape function gradients (the result is the same, up to roundoff).
+  // The cache is not owned by this class, and can be shared with other force models. Pass NULL to disable.
+  void SetElementCache(const TetMeshElementCache * elementCache) { this->elementCache = elementCache; }
+
   // === Advanced functions below; you normally do not need to use them: ===
   // Computes strain energy, internal forces, and/or tangent stiffness matrix, 
   // It returns 0 on success, and non-zero on failure.
@@ -118,13 +133,27 @@ public:
   int GetEnergyAndForceAndTangentStiffnessMatrixHelperWorkhorse(int startEl, int endEl, const double * u, double * energy, double * internalForces, SparseMatrix * tangentStiffnessMatrix);
   // the same as above, except that it processes a single mesh element el ans store the date in dense format.
   void GetElementLocalEnergyAndForceAndMatrix(int el, const double * u, double * energy, double * internalForces, double * tangentStiffnessMatrix);
+  // Mixed-precision version of the above: the tangent stiffness matrix is assembled from dP/dF in single precision (float),
+  // using a single-precision copy of dF/dU (relative accuracy about 1e-7). The energy and forces are computed in double precision.
+  // BuildSinglePrecisionData must be called first.
+  void BuildSinglePrecisionData(); // allocates and fills the single-precision copy of dF/dU (if not already done)
+  void GetElementLocalEnergyAndForceAndMatrixSinglePrecision(int el, const double * u, double * energy, double * internalForces, double * tangentStiffnessMatrix);
 
 protected:
   void ComputeTetVolume(int el);
   void ComputeAreaWeightedVertexNormals(int el);
   void PrepareDeformGrad(int el);
+  // multi-threaded version of GetEnergyAndForceAndTangentStiffnessMatrixHelper (after the prologue)
+  int GetEnergyAndForceAndTangentStiffnessMatrixHelperMT(const double * u, double * energy, double * internalForces, SparseMatrix * tangentStiffnessMatrix);
+  // element coloring: the elements of each color share no vertices (in increasing order within each color)
+  std::vector<std::vector<int>> elementColors;
+
+  // compute the deformation gradient Fs[el], assuming currentVerticesPosition is updated
+  void ComputeDeformationGradient(int el);
   // compute local energy, internalForces, tangentStiffnessMatrix assuming currentVerticesPosition is updated
-  int ComputeElementLocalData(int el, const double * u, double * energy, double internalForces[12], double tangentStiffnessMatrix[144]);
+  // if computeSVD is false, Fs[el] and its SVD (Us[el], Fhats[el], Vs[el]) must have already been computed
+  // if singlePrecision is true, the tangent stiffness matrix is computed with ComputeTetKSinglePrecision
+  int ComputeElementLocalData(int el, const double * u, double * energy, double internalForces[12], double tangentStiffnessMatrix[144], bool computeSVD = true, bool singlePrecision = false);
   TetMesh * tetMesh; // the tet mesh
   IsotropicMaterial * isotropicMaterial; // the material 
 
@@ -145,6 +174,8 @@ protected:
 
   bool enforceSPD;
 
+  const TetMeshElementCache * elementCache;
+
   // this is the b=(A1N1 + A2N2 + A3N3) in the paper,
   // see p.3 section 4
   Vec3d * areaWeightedVertexNormals;
@@ -176,6 +207,8 @@ protected:
   virtual void ComputeDiagonalPFromStretches(int elementIndex, double * lambda, double * PDiag);
   // Compute the element stiffness matrix
   virtual void ComputeTetK(int el, double K[144], int clamped);
+  // same as ComputeTetK, except that dG/dF and K are computed in single precision, from dFdUsFloat
+  void ComputeTetKSinglePrecision(int el, double K[144], int clamped);
   // Compute the derivative of the first Piola Kirchhoff stress P with respect to
   // the deformation gradient F. Since P and F both have 9 entries, dPdF has 81 entries
   virtual void Compute_dPdF(int el, double dPdF[81], int clamped);
@@ -195,6 +228,7 @@ protected:
   // dFdUs is an array of dFdU (i.e., derivative of the deformation gradient with
   // respect to the displacement vector u), and dFdU is stored as a array of doubles.
   double * dFdUs; // array of length 9x12 x numElements
+  std::vector<float> dFdUsFloat; // single-precision copy of dFdUs; empty unless built
   // Ds is the matrix which the columns are the edge vector of a tet (see p3 
   // section 3 of [Irving 04]). dDSdU is a 9x12 matrix which stores the derivative
   // of the Ds matrix with respect to the displacement vector u. Because Ds has 9 entries
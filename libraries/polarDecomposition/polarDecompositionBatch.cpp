@@ -0,0 +1,325 @@
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include "polarDecompositionBatch.h"
+#include "polarDecomposition.h"
+
+namespace vegafem
+{
+
+/*
+  See polarDecompositionBatch.h for an overview.
+  All the per-batch arrays are stored as [entry][lane], and the loops over the lanes are the innermost loops.
+*/
+
+enum { W = PolarDecompositionBatch::batchSize };
+
+// one-norm (maximum column sum) and inf-norm (maximum row sum) of a row-major 3x3 matrix; same as PolarDecomposition::oneNorm, infNorm
+static inline double oneNorm3x3(double a0, double a1, double a2, double a3, double a4, double a5, double a6, double a7, double a8)
+{
+  double norm = 0.0;
+  double columnAbsSum = fabs(a0) + fabs(a3) + fabs(a6);
+  norm = (columnAbsSum > norm) ? columnAbsSum : norm;
+  columnAbsSum = fabs(a1) + fabs(a4) + fabs(a7);
+  norm = (columnAbsSum > norm) ? columnAbsSum : norm;
+  columnAbsSum = fabs(a2) + fabs(a5) + fabs(a8);
+  norm = (columnAbsSum > norm) ? columnAbsSum : norm;
+  return norm;
+}
+
+static inline double infNorm3x3(double a0, double a1, double a2, double a3, double a4, double a5, double a6, double a7, double a8)
+{
+  return oneNorm3x3(a0, a3, a6, a1, a4, a7, a2, a5, a8);
+}
+
+void PolarDecompositionBatch::Compute(int numMatrices, const double * M, double * Q, double * S, double tolerance, int forceRotation, double * det)
+{
+  static const double identity[9] = { 1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0 };
+
+  for(int batchStart=0; batchStart < numMatrices; batchStart += W)
+  {
+    int numLanes = std::min((int)W, numMatrices - batchStart);
+
+    double Mk[9][W];
+    double MOne[W], MInf[W], detk[W];
+    int active[W]; // lane is still iterating
+    int fallback[W]; // lane is handed to PolarDecomposition::Compute
+
+    // Mk = M^T; the unused lanes of the last batch hold the identity, which converges immediately
+    for(int l=0; l<W; l++)
+    {
+      const double * Ml = (l < numLanes) ? &M[9 * (batchStart + l)] : identity;
+      for(int i=0; i<3; i++)
+        for(int j=0; j<3; j++)
+          Mk[3 * i + j][l] = Ml[3 * j + i];
+      active[l] = 1;
+      fallback[l] = 0;
+      detk[l] = 1.0;
+    }
+
+    for(int l=0; l<W; l++)
+    {
+      MOne[l] = oneNorm3x3(Mk[0][l], Mk[1][l], Mk[2][l], Mk[3][l], Mk[4][l], Mk[5][l], Mk[6][l], Mk[7][l], Mk[8][l]);
+      MInf[l] = infNorm3x3(Mk[0][l], Mk[1][l], Mk[2][l], Mk[3][l], Mk[4][l], Mk[5][l], Mk[6][l], Mk[7][l], Mk[8][l]);
+    }
+
+    int anyActive = 1;
+    while (anyActive)
+    {
+      anyActive = 0;
+      for(int l=0; l<W; l++)
+      {
+        // MadjTk: row 2 x row 3, row 3 x row 1, row 1 x row 2
+        double A[9];
+        A[0] = Mk[4][l] * Mk[8][l] - Mk[5][l] * Mk[7][l];
+        A[1] = Mk[5][l] * Mk[6][l] - Mk[3][l] * Mk[8][l];
+        A[2] = Mk[3][l] * Mk[7][l] - Mk[4][l] * Mk[6][l];
+        A[3] = Mk[7][l] * Mk[2][l] - Mk[8][l] * Mk[1][l];
+        A[4] = Mk[8][l] * Mk[0][l] - Mk[6][l] * Mk[2][l];
+        A[5] = Mk[6][l] * Mk[1][l] - Mk[7][l] * Mk[0][l];
+        A[6] = Mk[1][l] * Mk[5][l] - Mk[2][l] * Mk[4][l];
+        A[7] = Mk[2][l] * Mk[3][l] - Mk[0][l] * Mk[5][l];
+        A[8] = Mk[0][l] * Mk[4][l] - Mk[1][l] * Mk[3][l];
+
+        double d = Mk[0][l] * A[0] + Mk[1][l] * A[1] + Mk[2][l] * A[2];
+
+        // (bitwise operators, so that the compiler does not introduce branches)
+        int special = ((d <= 1e-6) & (forceRotation != 0)) | (d == 0.0);
+        int update = active[l] & (special ^ 1);
+        detk[l] = active[l] ? d : detk[l];
+        fallback[l] |= active[l] & special;
+
+        double MadjTOne = oneNorm3x3(A[0], A[1], A[2], A[3], A[4], A[5], A[6], A[7], A[8]);
+        double MadjTInf = infNorm3x3(A[0], A[1], A[2], A[3], A[4], A[5], A[6], A[7], A[8]);
+
+        double safeDet = update ? d : 1.0;
+        double gamma = sqrt(sqrt((MadjTOne * MadjTInf) / (MOne[l] * MInf[l] * safeDet * safeDet)));
+        double g1 = gamma * 0.5;
+        double g2 = 0.5 / (gamma * safeDet);
+
+        double Mnew[9], E[9];
+        for(int i=0; i<9; i++)
+        {
+          Mnew[i] = g1 * Mk[i][l] + g2 * A[i];
+          E[i] = Mk[i][l] - Mnew[i];
+        }
+
+        double EOne = oneNorm3x3(E[0], E[1], E[2], E[3], E[4], E[5], E[6], E[7], E[8]);
+        double MnewOne = oneNorm3x3(Mnew[0], Mnew[1], Mnew[2], Mnew[3], Mnew[4], Mnew[5], Mnew[6], Mnew[7], Mnew[8]);
+        double MnewInf = infNorm3x3(Mnew[0], Mnew[1], Mnew[2], Mnew[3], Mnew[4], Mnew[5], Mnew[6], Mnew[7], Mnew[8]);
+
+        for(int i=0; i<9; i++)
+          Mk[i][l] = update ? Mnew[i] : Mk[i][l];
+        MOne[l] = update ? MnewOne : MOne[l];
+        MInf[l] = update ? MnewInf : MInf[l];
+
+        active[l] = update & (EOne > MnewOne * tolerance);
+        anyActive |= active[l];
+      }
+    }
+
+    for(int l=0; l<numLanes; l++)
+    {
+      int matrix = batchStart + l;
+      const double * Ml = &M[9 * matrix];
+      double * Ql = &Q[9 * matrix];
+      double * Sl = &S[9 * matrix];
+
+      if (fallback[l])
+      {
+        double d = PolarDecomposition::Compute(Ml, Ql, Sl, tolerance, forceRotation);
+        if (det != NULL)
+          det[matrix] = d;
+        continue;
+      }
+
+      // Q = Mk^T
+      for(int i=0; i<3; i++)
+        for(int j=0; j<3; j++)
+          Ql[3 * i + j] = Mk[3 * j + i][l];
+
+      for(int i=0; i<3; i++)
+        for(int j=0; j<3; j++)
+        {
+          Sl[3 * i + j] = 0;
+          for(int k=0; k<3; k++)
+            Sl[3 * i + j] += Mk[3 * i + k][l] * Ml[3 * k + j];
+        }
+
+      // S must be symmetric; enforce the symmetry
+      Sl[1] = Sl[3] = 0.5 * (Sl[1] + Sl[3]);
+      Sl[2] = Sl[6] = 0.5 * (Sl[2] + Sl[6]);
+      Sl[5] = Sl[7] = 0.5 * (Sl[5] + Sl[7]);
+
+      if (det != NULL)
+        det[matrix] = detk[l];
+    }
+  }
+}
+
+// Jacobi rotation that zeroes the off-diagonal entry apq of the symmetric matrix A, applied to A and to the columns p, q of V:
+// A = J^T A J, V = V J; "r" is the remaining index
+static inline void jacobiRotation(double & app, double & aqq, double & apq, double & arp, double & arq,
+  double & v0p, double & v0q, double & v1p, double & v1q, double & v2p, double & v2q)
+{
+  double tau = aqq - app;
+  // tan(theta), |theta| <= pi/4; DBL_MIN avoids 0/0 when apq = tau = 0 (then t = 0)
+  double t = 2.0 * apq * copysign(1.0, tau) / (fabs(tau) + sqrt(tau * tau + 4.0 * apq * apq) + DBL_MIN);
+  double c = 1.0 / sqrt(1.0 + t * t);
+  double s = t * c;
+
+  app -= t * apq;
+  aqq += t * apq;
+  apq = 0.0;
+
+  double rp = arp, rq = arq;
+  arp = c * rp - s * rq;
+  arq = s * rp + c * rq;
+
+  rp = v0p; rq = v0q;
+  v0p = c * rp - s * rq;
+  v0q = s * rp + c * rq;
+  rp = v1p; rq = v1q;
+  v1p = c * rp - s * rq;
+  v1q = s * rp + c * rq;
+  rp = v2p; rq = v2q;
+  v2p = c * rp - s * rq;
+  v2q = s * rp + c * rq;
+}
+
+// swaps eigenvalues p, q and the corresponding columns of V, if dp < dq
+static inline void sortPair(double & dp, double & dq, double & v0p, double & v0q, double & v1p, double & v1q, double & v2p, double & v2q)
+{
+  int swap = dp < dq;
+  double tmp;
+  tmp = dp; dp = swap ? dq : dp; dq = swap ? tmp : dq;
+  tmp = v0p; v0p = swap ? v0q : v0p; v0q = swap ? tmp : v0q;
+  tmp = v1p; v1p = swap ? v1q : v1p; v1q = swap ? tmp : v1q;
+  tmp = v2p; v2p = swap ? v2q : v2p; v2q = swap ? tmp : v2q;
+}
+
+int PolarDecompositionBatch::SVD(int numMatrices, const Mat3d * F, Mat3d * U, Vec3d * Sigma, Mat3d * V, double singularValue_eps, int modifiedSVD)
+{
+  int code = 0;
+  const int maxNumSweeps = 10; // the cyclic Jacobi method converges quadratically; about 4 sweeps are usually enough in double precision
+
+  for(int batchStart=0; batchStart < numMatrices; batchStart += W)
+  {
+    int numLanes = std::min((int)W, numMatrices - batchStart);
+
+    double f[9][W]; // row-major F
+    double a[6][W]; // F^T F: a00, a11, a22, a01, a02, a12
+    double v[9][W]; // row-major V
+    int fallback[W]; // lane is handed to SVD() in mat3d.h
+
+    for(int l=0; l<W; l++)
+      for(int i=0; i<3; i++)
+        for(int j=0; j<3; j++)
+          f[3 * i + j][l] = (l < numLanes) ? F[batchStart + l][i][j] : ((i == j) ? 1.0 : 0.0);
+
+    for(int l=0; l<W; l++)
+    {
+      a[0][l] = f[0][l] * f[0][l] + f[3][l] * f[3][l] + f[6][l] * f[6][l];
+      a[1][l] = f[1][l] * f[1][l] + f[4][l] * f[4][l] + f[7][l] * f[7][l];
+      a[2][l] = f[2][l] * f[2][l] + f[5][l] * f[5][l] + f[8][l] * f[8][l];
+      a[3][l] = f[0][l] * f[1][l] + f[3][l] * f[4][l] + f[6][l] * f[7][l];
+      a[4][l] = f[0][l] * f[2][l] + f[3][l] * f[5][l] + f[6][l] * f[8][l];
+      a[5][l] = f[1][l] * f[2][l] + f[4][l] * f[5][l] + f[7][l] * f[8][l];
+      for(int i=0; i<9; i++)
+        v[i][l] = (i % 4 == 0) ? 1.0 : 0.0;
+    }
+
+    // cyclic Jacobi sweeps, until the off-diagonal entries of all lanes are negligible
+    for(int sweep=0; sweep < maxNumSweeps; sweep++)
+    {
+      int converged = 1;
+      for(int l=0; l<W; l++)
+      {
+        double offDiagonal = a[3][l] * a[3][l] + a[4][l] * a[4][l] + a[5][l] * a[5][l];
+        double diagonal = a[0][l] * a[0][l] + a[1][l] * a[1][l] + a[2][l] * a[2][l];
+        converged &= (offDiagonal <= 1e-32 * diagonal);
+      }
+      if (converged)
+        break;
+
+      for(int l=0; l<W; l++) // (p,q,r) = (0,1,2)
+        jacobiRotation(a[0][l], a[1][l], a[3][l], a[4][l], a[5][l], v[0][l], v[1][l], v[3][l], v[4][l], v[6][l], v[7][l]);
+      for(int l=0; l<W; l++) // (p,q,r) = (0,2,1)
+        jacobiRotation(a[0][l], a[2][l], a[4][l], a[3][l], a[5][l], v[0][l], v[2][l], v[3][l], v[5][l], v[6][l], v[8][l]);
+      for(int l=0; l<W; l++) // (p,q,r) = (1,2,0)
+        jacobiRotation(a[1][l], a[2][l], a[5][l], a[3][l], a[4][l], v[1][l], v[2][l], v[4][l], v[5][l], v[7][l], v[8][l]);
+    }
+
+    double sigma[3][W];
+    double u[9][W];
+    for(int l=0; l<W; l++)
+    {
+      // sort the eigenvalues in descending order (as in eigen_sym)
+      sortPair(a[0][l], a[1][l], v[0][l], v[1][l], v[3][l], v[4][l], v[6][l], v[7][l]);
+      sortPair(a[1][l], a[2][l], v[1][l], v[2][l], v[4][l], v[5][l], v[7][l], v[8][l]);
+      sortPair(a[0][l], a[1][l], v[0][l], v[1][l], v[3][l], v[4][l], v[6][l], v[7][l]);
+
+      // if det(V) == -1, multiply the first column of V by -1
+      double detV = v[0][l] * (v[4][l] * v[8][l] - v[5][l] * v[7][l])
+                  - v[1][l] * (v[3][l] * v[8][l] - v[5][l] * v[6][l])
+                  + v[2][l] * (v[3][l] * v[7][l] - v[4][l] * v[6][l]);
+      double flip = (detV < 0.0) ? -1.0 : 1.0;
+      v[0][l] *= flip;
+      v[3][l] *= flip;
+      v[6][l] *= flip;
+
+      int smallSingularValue = 0;
+      double sigmaInverse[3];
+      for(int i=0; i<3; i++)
+      {
+        sigma[i][l] = sqrt((a[i][l] > 0.0) ? a[i][l] : 0.0);
+        smallSingularValue |= (sigma[i][l] < singularValue_eps);
+        int large = sigma[i][l] > singularValue_eps;
+        sigmaInverse[i] = 1.0 / (large ? sigma[i][l] : 1.0);
+        sigmaInverse[i] = large ? sigmaInverse[i] : 0.0;
+      }
+      fallback[l] = smallSingularValue;
+
+      // U = F * V * diag(SigmaInverse)
+      for(int i=0; i<3; i++)
+        for(int j=0; j<3; j++)
+          u[3 * i + j][l] = (f[3 * i + 0][l] * v[0 + j][l] + f[3 * i + 1][l] * v[3 + j][l] + f[3 * i + 2][l] * v[6 + j][l]) * sigmaInverse[j];
+
+      // modified SVD: if det(U) == -1, negate the smallest singular value and the corresponding column of U
+      double detU = u[0][l] * (u[4][l] * u[8][l] - u[5][l] * u[7][l])
+                  - u[1][l] * (u[3][l] * u[8][l] - u[5][l] * u[6][l])
+                  + u[2][l] * (u[3][l] * u[7][l] - u[4][l] * u[6][l]);
+      double negate = ((modifiedSVD != 0) & (detU < 0.0)) ? -1.0 : 1.0;
+      sigma[2][l] *= negate;
+      u[2][l] *= negate;
+      u[5][l] *= negate;
+      u[8][l] *= negate;
+    }
+
+    for(int l=0; l<numLanes; l++)
+    {
+      int matrix = batchStart + l;
+      if (fallback[l])
+      {
+        Mat3d Fl = F[matrix];
+        code |= vegafem::SVD(Fl, U[matrix], Sigma[matrix], V[matrix], singularValue_eps, modifiedSVD);
+        continue;
+      }
+
+      for(int i=0; i<3; i++)
+      {
+        for(int j=0; j<3; j++)
+        {
+          U[matrix][i][j] = u[3 * i + j][l];
+          V[matrix][i][j] = v[3 * i + j][l];
+        }
+        Sigma[matrix][i] = sigma[i][l];
+      }
+    }
+  }
+
+  return code;
+}
+
+}//namespace vegafem
+
@@ -0,0 +1,52 @@
+#ifndef VEGAFEM_POLARDECOMPOSITIONBATCH_H
+#define VEGAFEM_POLARDECOMPOSITIONBATCH_H
+
+#include "mat3d.h"
+
+namespace vegafem
+{
+/*
+  Batched polar decomposition and singular value decomposition of many 3x3 matrices,
+  e.g., the deformation gradients of all the elements of a mesh.
+
+  The matrices are processed in batches of "batchSize" matrices. Within a batch, the matrices are
+  transposed into a structure-of-arrays layout (entry-major, matrix-minor), and all the iterations
+  run over the matrices of the batch ("lanes") with unit stride, without data-dependent branches,
+  so that the compiler can vectorize them (4 matrices per AVX2 vector, 8 per AVX-512 vector,
+  when the code is compiled for these instruction sets). Iterations continue until all the lanes
+  of a batch have converged.
+
+  Compute gives exactly the same result as calling PolarDecomposition::Compute on each matrix
+  (the lanes that have converged are frozen, and the rare matrices that PolarDecomposition::Compute
+  handles with the SVD fallback are handed to PolarDecomposition::Compute).
+
+  SVD gives the same decomposition as SVD() in mat3d.h (with singular values sorted in descending order),
+  but computes the eigenvectors of F^T F with cyclic Jacobi rotations instead of eig3.
+  Hence, the singular vectors can differ from SVD() in sign (in pairs of columns of U and V,
+  so that U * diag(Sigma) * V^T is the same). Matrices with singular values below singularValue_eps
+  are handed to SVD().
+*/
+
+class PolarDecompositionBatch
+{
+public:
+#ifdef __AVX512F__
+  enum { batchSize = 8 };
+#else
+  enum { batchSize = 4 };
+#endif
+
+  // Polar decompositions M[i] = Q[i] * S[i] of numMatrices matrices; see PolarDecomposition::Compute.
+  // M, Q, S hold 9 doubles (a row-major 3x3 matrix) per matrix.
+  // det (if not NULL) receives the value returned by PolarDecomposition::Compute for each matrix.
+  static void Compute(int numMatrices, const double * M, double * Q, double * S, double tolerance=1E-6, int forceRotation=0, double * det=NULL);
+
+  // Singular value decompositions F[i] = U[i] * diag(Sigma[i]) * V[i]^T of numMatrices matrices; see SVD() in mat3d.h.
+  // Returns 0 on success, and non-zero if SVD() failed on some matrix.
+  static int SVD(int numMatrices, const Mat3d * F, Mat3d * U, Vec3d * Sigma, Mat3d * V, double singularValue_eps=1e-8, int modifiedSVD=0);
+};
+
+}//namespace vegafem
+
+#endif
+
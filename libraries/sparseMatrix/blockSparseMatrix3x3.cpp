@@ -0,0 +1,315 @@
+/*************************************************************************
+ *                                                                       *
+ * Vega FEM Simulation Library Version 4.0                               *
+ *                                                                       *
+ * "sparseMatrix" library , Copyright (C) 2007 CMU, 2009 MIT, 2018 USC   *
+ * All rights reserved.                                                  *
+ *                                                                       *
+ * Code author: Jernej Barbic                                            *
+ * http://www.jernejbarbic.com/vega                                      *
+ *                                                                       *
+ * Research: Jernej Barbic, Hongyi Xu, Yijing Li,                        *
+ *           Danyong Zhao, Bohan Wang,                                   *
+ *           Fun Shing Sin, Daniel Schroeder,                            *
+ *           Doug L. James, Jovan Popovic                                *
+ *                                                                       *
+ * Funding: National Science Foundation, Link Foundation,                *
+ *          Singapore-MIT GAMBIT Game Lab,                               *
+ *          Zumberge Research and Innovation Fund at USC,                *
+ *          Sloan Foundation, Okawa Foundation,                          *
+ *          USC Annenberg Foundation                                     *
+ *                                                                       *
+ * This library is free software; you can redistribute it and/or         *
+ * modify it under the terms of the BSD-style license that is            *
+ * included with this library in the file LICENSE.txt                    *
+ *                                                                       *
+ * This library is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the file     *
+ * LICENSE.TXT for more details.                                         *
+ *                                                                       *
+ *************************************************************************/
+
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include "blockSparseMatrix3x3.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+  #include <emmintrin.h>
+  #define VEGAFEM_BLOCK_SPARSE_MATRIX_USE_SSE2
+#endif
+
+using namespace std;
+
+namespace vegafem
+{
+
+BlockSparseMatrix3x3::BlockSparseMatrix3x3(int numBlockRows_, int numStencilTypes, const int * numStencils, const int * numStencilVertices_, const int * const * stencilVertices) : numBlockRows(numBlockRows_)
+{
+  InitFromStencils(numStencilTypes, numStencils, numStencilVertices_, stencilVertices);
+}
+
+BlockSparseMatrix3x3::BlockSparseMatrix3x3(int numBlockRows_, int numStencils, int numStencilVertices_, const int * stencilVertices) : numBlockRows(numBlockRows_)
+{
+  InitFromStencils(1, &numStencils, &numStencilVertices_, &stencilVertices);
+}
+
+BlockSparseMatrix3x3::BlockSparseMatrix3x3(const SparseMatrix * matrix)
+{
+  assert(matrix->GetNumRows() % 3 == 0);
+  numBlockRows = matrix->GetNumRows() / 3;
+
+  vector<vector<int>> blockColumns(numBlockRows);
+  for(int row=0; row<matrix->GetNumRows(); row++)
+    for(int j=0; j<matrix->GetRowLength(row); j++)
+      blockColumns[row / 3].push_back(matrix->GetColumnIndex(row, j) / 3);
+  InitFromBlockColumns(blockColumns);
+
+  AssignSparseMatrix(matrix);
+}
+
+BlockSparseMatrix3x3::BlockSparseMatrix3x3(const BlockSparseMatrix3x3 & source) = default;
+
+BlockSparseMatrix3x3::~BlockSparseMatrix3x3() {}
+
+void BlockSparseMatrix3x3::InitFromStencils(int numStencilTypes, const int * numStencils, const int * numStencilVertices_, const int * const * stencilVertices)
+{
+  vector<vector<int>> blockColumns(numBlockRows);
+  for(int type=0; type<numStencilTypes; type++)
+  {
+    int nv = numStencilVertices_[type];
+    for(int stencil=0; stencil<numStencils[type]; stencil++)
+    {
+      const int * vertices = stencilVertices[type] + stencil * nv;
+      for(int va=0; va<nv; va++)
+        for(int vb=0; vb<nv; vb++)
+          blockColumns[vertices[va]].push_back(vertices[vb]);
+    }
+  }
+  InitFromBlockColumns(blockColumns);
+
+  numStencilVertices.assign(numStencilVertices_, numStencilVertices_ + numStencilTypes);
+  stencilBlockIndices.resize(numStencilTypes);
+  for(int type=0; type<numStencilTypes; type++)
+  {
+    int nv = numStencilVertices_[type];
+    stencilBlockIndices[type].resize(numStencils[type] * nv * nv);
+    for(int stencil=0; stencil<numStencils[type]; stencil++)
+    {
+      const int * vertices = stencilVertices[type] + stencil * nv;
+      for(int va=0; va<nv; va++)
+        for(int vb=0; vb<nv; vb++)
+          stencilBlockIndices[type][(stencil * nv + va) * nv + vb] = GetBlockIndex(vertices[va], vertices[vb]);
+    }
+  }
+}
+
+void BlockSparseMatrix3x3::InitFromBlockColumns(vector<vector<int>> & blockColumns)
+{
+  blockRowOffsets.resize(numBlockRows + 1);
+  blockRowOffsets[0] = 0;
+  for(int blockRow=0; blockRow<numBlockRows; blockRow++)
+  {
+    vector<int> & columns = blockColumns[blockRow];
+    sort(columns.begin(), columns.end());
+    columns.erase(unique(columns.begin(), columns.end()), columns.end());
+    blockRowOffsets[blockRow+1] = blockRowOffsets[blockRow] + (int)columns.size();
+  }
+
+  blockColumnIndices.resize(blockRowOffsets[numBlockRows]);
+  for(int blockRow=0; blockRow<numBlockRows; blockRow++)
+  {
+    copy(blockColumns[blockRow].begin(), blockColumns[blockRow].end(), blockColumnIndices.begin() + blockRowOffsets[blockRow]);
+    vector<int>().swap(blockColumns[blockRow]);
+  }
+
+  blockEntries.assign(9 * blockColumnIndices.size(), 0.0);
+
+  diagonalBlockIndices.resize(numBlockRows);
+  for(int blockRow=0; blockRow<numBlockRows; blockRow++)
+    diagonalBlockIndices[blockRow] = GetBlockIndex(blockRow, blockRow);
+}
+
+int BlockSparseMatrix3x3::GetBlockIndex(int blockRow, int blockColumn) const
+{
+  const int * begin = blockColumnIndices.data() + blockRowOffsets[blockRow];
+  const int * end = blockColumnIndices.data() + blockRowOffsets[blockRow+1];
+  const int * pos = lower_bound(begin, end, blockColumn);
+  if ((pos == end) || (*pos != blockColumn))
+    return -1;
+  return (int)(pos - blockColumnIndices.data());
+}
+
+SparseMatrix * BlockSparseMatrix3x3::CreateSparseMatrix() const
+{
+  SparseMatrixOutline outline(3 * numBlockRows);
+  for(int blockRow=0; blockRow<numBlockRows; blockRow++)
+    for(int k=blockRowOffsets[blockRow]; k<blockRowOffsets[blockRow+1]; k++)
+      outline.AddBlock3x3Entry(blockRow, blockColumnIndices[k], &blockEntries[9 * k]);
+  return new SparseMatrix(&outline);
+}
+
+void BlockSparseMatrix3x3::AssignSparseMatrix(const SparseMatrix * matrix)
+{
+  assert(matrix->GetNumRows() == 3 * numBlockRows);
+  for(int row=0; row<3 * numBlockRows; row++)
+  {
+    int blockRow = row / 3;
+    int i = row % 3;
+    const int * columnIndices = matrix->GetColumnIndices()[row];
+    const double * entries = matrix->GetRowHandle(row);
+    int rowLength = matrix->GetRowLength(row);
+
+    // merge the (sorted) scalar row with the (sorted) block row
+    int j = 0;
+    for(int k=blockRowOffsets[blockRow]; k<blockRowOffsets[blockRow+1]; k++)
+    {
+      int blockColumn = blockColumnIndices[k];
+      double * blockEntryRow = &blockEntries[9 * k + 3 * i];
+      blockEntryRow[0] = blockEntryRow[1] = blockEntryRow[2] = 0.0;
+      while ((j < rowLength) && (columnIndices[j] < 3 * blockColumn))
+        j++;
+      while ((j < rowLength) && (columnIndices[j] < 3 * blockColumn + 3))
+      {
+        blockEntryRow[columnIndices[j] - 3 * blockColumn] = entries[j];
+        j++;
+      }
+    }
+  }
+}
+
+void BlockSparseMatrix3x3::ResetToZero()
+{
+  fill(blockEntries.begin(), blockEntries.end(), 0.0);
+}
+
+void BlockSparseMatrix3x3::AddStencilMatrix(int stencilType, int stencil, const double * stencilMatrix, int columnMajor)
+{
+  int nv = numStencilVertices[stencilType];
+  int numStencilDOFs = 3 * nv;
+  const int * blockIndices = &stencilBlockIndices[stencilType][stencil * nv * nv];
+  for(int va=0; va<nv; va++)
+    for(int vb=0; vb<nv; vb++)
+    {
+      double * block = &blockEntries[9 * blockIndices[va * nv + vb]];
+      for(int i=0; i<3; i++)
+        for(int j=0; j<3; j++)
+        {
+          int localRow = 3 * va + i;
+          int localColumn = 3 * vb + j;
+          block[3 * i + j] += columnMajor ? stencilMatrix[numStencilDOFs * localColumn + localRow] : stencilMatrix[numStencilDOFs * localRow + localColumn];
+        }
+    }
+}
+
+void BlockSparseMatrix3x3::ScalarMultiply(double alpha)
+{
+  for(size_t i=0; i<blockEntries.size(); i++)
+    blockEntries[i] *= alpha;
+}
+
+void BlockSparseMatrix3x3::ScalarMultiplyAdd(double alpha, BlockSparseMatrix3x3 * dest) const
+{
+  for(size_t i=0; i<blockEntries.size(); i++)
+    dest->blockEntries[i] += alpha * blockEntries[i];
+}
+
+void BlockSparseMatrix3x3::MultiplyVector(const double * vector, double * result) const
+{
+  Multiply<false>(vector, result);
+}
+
+void BlockSparseMatrix3x3::MultiplyVectorAdd(const double * vector, double * result) const
+{
+  Multiply<true>(vector, result);
+}
+
+template<bool add>
+void BlockSparseMatrix3x3::Multiply(const double * vector, double * result) const
+{
+  const int * columns = blockColumnIndices.data();
+  const double * entries = blockEntries.data();
+  for(int blockRow=0; blockRow<numBlockRows; blockRow++)
+  {
+    int kEnd = blockRowOffsets[blockRow+1];
+    double y[3];
+
+    #ifdef VEGAFEM_BLOCK_SPARSE_MATRIX_USE_SSE2
+      // accumulate the nine products B_ij * x_j of all blocks in the row, pairwise in block order, 
+      // and sum the three products of each row at the end
+      __m128d acc01 = _mm_setzero_pd(), acc23 = _mm_setzero_pd(), acc45 = _mm_setzero_pd(), acc67 = _mm_setzero_pd();
+      double acc8 = 0.0;
+      for(int k=blockRowOffsets[blockRow]; k<kEnd; k++)
+      {
+        const double * x = vector + 3 * columns[k];
+        const double * B = entries + 9 * k;
+        __m128d x01 = _mm_loadu_pd(x);
+        __m128d x12 = _mm_loadu_pd(x + 1);
+        __m128d x20 = _mm_shuffle_pd(x12, x01, 1); // (x2, x0)
+        acc01 = _mm_add_pd(acc01, _mm_mul_pd(_mm_loadu_pd(B), x01));
+        acc23 = _mm_add_pd(acc23, _mm_mul_pd(_mm_loadu_pd(B + 2), x20));
+        acc45 = _mm_add_pd(acc45, _mm_mul_pd(_mm_loadu_pd(B + 4), x12));
+        acc67 = _mm_add_pd(acc67, _mm_mul_pd(_mm_loadu_pd(B + 6), x01));
+        acc8 += B[8] * x[2];
+      }
+      double acc[8];
+      _mm_storeu_pd(acc, acc01);
+      _mm_storeu_pd(acc + 2, acc23);
+      _mm_storeu_pd(acc + 4, acc45);
+      _mm_storeu_pd(acc + 6, acc67);
+      y[0] = acc[0] + acc[1] + acc[2];
+      y[1] = acc[3] + acc[4] + acc[5];
+      y[2] = acc[6] + acc[7] + acc8;
+    #else
+      y[0] = y[1] = y[2] = 0.0;
+      for(int k=blockRowOffsets[blockRow]; k<kEnd; k++)
+      {
+        const double * x = vector + 3 * columns[k];
+        const double * B = entries + 9 * k;
+        y[0] += B[0] * x[0] + B[1] * x[1] + B[2] * x[2];
+        y[1] += B[3] * x[0] + B[4] * x[1] + B[5] * x[2];
+        y[2] += B[6] * x[0] + B[7] * x[1] + B[8] * x[2];
+      }
+    #endif
+
+    double * resultBlock = result + 3 * blockRow;
+    if (add)
+    {
+      resultBlock[0] += y[0];
+      resultBlock[1] += y[1];
+      resultBlock[2] += y[2];
+    }
+    else
+    {
+      resultBlock[0] = y[0];
+      resultBlock[1] = y[1];
+      resultBlock[2] = y[2];
+    }
+  }
+}
+
+void BlockSparseMatrix3x3::GetDiagonal(double * diagonal) const
+{
+  for(int blockRow=0; blockRow<numBlockRows; blockRow++)
+  {
+    int k = diagonalBlockIndices[blockRow];
+    for(int i=0; i<3; i++)
+      diagonal[3 * blockRow + i] = (k >= 0) ? blockEntries[9 * k + 4 * i] : 0.0;
+  }
+}
+
+void BlockSparseMatrix3x3::GetDiagonalBlocks(double * diagonalBlocks) const
+{
+  for(int blockRow=0; blockRow<numBlockRows; blockRow++)
+  {
+    int k = diagonalBlockIndices[blockRow];
+    if (k >= 0)
+      memcpy(&diagonalBlocks[9 * blockRow], &blockEntries[9 * k], sizeof(double) * 9);
+    else
+      memset(&diagonalBlocks[9 * blockRow], 0, sizeof(double) * 9);
+  }
+}
+
+}//namespace vegafem
+
@@ -0,0 +1,149 @@
+/*************************************************************************
+ *                                                                       *
+ * Vega FEM Simulation Library Version 4.0                               *
+ *                                                                       *
+ * "sparseMatrix" library , Copyright (C) 2007 CMU, 2009 MIT, 2018 USC   *
+ * All rights reserved.                                                  *
+ *                                                                       *
+ * Code author: Jernej Barbic                                            *
+ * http://www.jernejbarbic.com/vega                                      *
+ *                                                                       *
+ * Research: Jernej Barbic, Hongyi Xu, Yijing Li,                        *
+ *           Danyong Zhao, Bohan Wang,                                   *
+ *           Fun Shing Sin, Daniel Schroeder,                            *
+ *           Doug L. James, Jovan Popovic                                *
+ *                                                                       *
+ * Funding: National Science Foundation, Link Foundation,                *
+ *          Singapore-MIT GAMBIT Game Lab,                               *
+ *          Zumberge Research and Innovation Fund at USC,                *
+ *          Sloan Foundation, Okawa Foundation,                          *
+ *          USC Annenberg Foundation                                     *
+ *                                                                       *
+ * This library is free software; you can redistribute it and/or         *
+ * modify it under the terms of the BSD-style license that is            *
+ * included with this library in the file LICENSE.txt                    *
+ *                                                                       *
+ * This library is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the file     *
+ * LICENSE.TXT for more details.                                         *
+ *                                                                       *
+ *************************************************************************/
+
+#ifndef VEGAFEM_BLOCK_SPARSE_MATRIX_3X3_H
+#define VEGAFEM_BLOCK_SPARSE_MATRIX_3X3_H
+
+/*
+  A sparse matrix made of dense 3x3 blocks (block compressed sparse row, "BSR" format).
+
+  FEM stiffness and mass matrices couple vertices, not individual degrees of freedom: 
+  each non-zero entry belongs to a full 3x3 block (vi, vj). SparseMatrix stores such matrices
+  entry by entry, repeating each block column index three times in each of the three rows of the block.
+  This class stores one column index per 3x3 block instead (9x less index memory), and the nine values 
+  of each block contiguously, in row-major order. Matrix-vector products process one block at a time (using SSE2 
+  instructions if available), reading each block column index and each x[3j..3j+2] only once per block.
+
+  The matrix has numBlockRows x numBlockRows blocks, i.e., it is a (3 * numBlockRows) x (3 * numBlockRows) scalar matrix.
+  The block structure is fixed at construction time. The matrix can be created:
+    - from the stencil topology used by ForceModelAssembler (see stencilForceModel.h): each stencil couples all of its vertices;
+      dense stencil matrices can then be added with AddStencilMatrix, using precomputed block locations, or
+    - from a SparseMatrix (see CreateSparseMatrix and AssignSparseMatrix for the opposite direction and for value updates).
+
+  The class can be passed to CGSolver.
+*/
+
+#include "sparseMatrix.h"
+#include <vector>
+
+namespace vegafem
+{
+
+class BlockSparseMatrix3x3
+{
+public:
+  // creates the blocks coupling all vertices of each stencil, for several stencil types; all entries are zero
+  // for each stencil type t, stencilVertices[t] gives the numStencilVertices[t] vertex indices of each stencil, stencil after stencil 
+  // (length numStencils[t] x numStencilVertices[t])
+  BlockSparseMatrix3x3(int numBlockRows, int numStencilTypes, const int * numStencils, const int * numStencilVertices, const int * const * stencilVertices);
+  // same as above, for a single stencil type
+  BlockSparseMatrix3x3(int numBlockRows, int numStencils, int numStencilVertices, const int * stencilVertices);
+  // creates the block matrix from a scalar matrix with 3 * numBlockRows rows;
+  // a block is created if any of its 9 entries is present in the scalar matrix; absent entries are set to zero
+  BlockSparseMatrix3x3(const SparseMatrix * matrix);
+  BlockSparseMatrix3x3(const BlockSparseMatrix3x3 & source);
+  virtual ~BlockSparseMatrix3x3();
+
+  // conversion to SparseMatrix (each block becomes a full 3x3 block)
+  SparseMatrix * CreateSparseMatrix() const;
+  // copies the values of a scalar matrix with 3 * numBlockRows rows into this matrix;
+  // entries of 'matrix' that are outside the blocks of this matrix are ignored; block entries absent in 'matrix' are set to zero
+  // runs in a single pass over both matrices (no searching)
+  void AssignSparseMatrix(const SparseMatrix * matrix);
+
+  inline int GetNumBlockRows() const { return numBlockRows; }
+  inline int GetNumRows() const { return 3 * numBlockRows; }
+  inline int GetNumBlocks() const { return (int)blockColumnIndices.size(); }
+  inline int GetNumEntries() const { return 9 * GetNumBlocks(); }
+
+  // returns the index of block (blockRow, blockColumn), or -1 if the block is not present
+  int GetBlockIndex(int blockRow, int blockColumn) const;
+  // the blocks of block row I are blockRowOffsets[I], ..., blockRowOffsets[I+1]-1 (length(blockRowOffsets) = numBlockRows + 1)
+  inline const int * GetBlockRowOffsets() const { return blockRowOffsets.data(); }
+  inline const int * GetBlockColumnIndices() const { return blockColumnIndices.data(); }
+  inline int GetBlockColumnIndex(int blockIndex) const { return blockColumnIndices[blockIndex]; }
+  // the nine values of a block (row-major)
+  inline double * GetBlock(int blockIndex) { return &blockEntries[9 * blockIndex]; }
+  inline const double * GetBlock(int blockIndex) const { return &blockEntries[9 * blockIndex]; }
+  // all values, block after block
+  inline double * GetBlockEntries() { return blockEntries.data(); }
+  inline const double * GetBlockEntries() const { return blockEntries.data(); }
+
+  void ResetToZero();
+  // block3x3 is row-major
+  inline void AddBlock(int blockIndex, const double * block3x3);
+  // adds the dense 3nv x 3nv stencil matrix of the given stencil (nv = number of stencil vertices)
+  // only available if the matrix was created from stencils
+  // the stencil matrix is column-major if columnMajor=1 (as in StencilForceModel), otherwise row-major
+  void AddStencilMatrix(int stencilType, int stencil, const double * stencilMatrix, int columnMajor=1);
+
+  void ScalarMultiply(double alpha); // this = alpha * this
+  void ScalarMultiplyAdd(double alpha, BlockSparseMatrix3x3 * dest) const; // dest += alpha * this (dest must have the same block structure)
+
+  // result = A * vector
+  void MultiplyVector(const double * vector, double * result) const;
+  // result += A * vector
+  void MultiplyVectorAdd(const double * vector, double * result) const;
+
+  // diagonal (3 * numBlockRows scalars)
+  void GetDiagonal(double * diagonal) const;
+  // diagonal blocks, block after block, row-major (9 * numBlockRows scalars); missing diagonal blocks are returned as zero
+  void GetDiagonalBlocks(double * diagonalBlocks) const;
+
+protected:
+  int numBlockRows;
+  std::vector<int> blockRowOffsets;
+  std::vector<int> blockColumnIndices;
+  std::vector<int> diagonalBlockIndices; // -1 if not present
+  std::vector<double> blockEntries;
+
+  // block indices of all (va, vb) vertex pairs of each stencil, for each stencil type: 
+  // stencilBlockIndices[type][(stencil * nv + va) * nv + vb]
+  std::vector<int> numStencilVertices;
+  std::vector<std::vector<int>> stencilBlockIndices;
+
+  void InitFromStencils(int numStencilTypes, const int * numStencils, const int * numStencilVertices, const int * const * stencilVertices);
+  void InitFromBlockColumns(std::vector<std::vector<int>> & blockColumns); // sorts and removes duplicates
+  template<bool add> void Multiply(const double * vector, double * result) const;
+};
+
+inline void BlockSparseMatrix3x3::AddBlock(int blockIndex, const double * block3x3)
+{
+  double * block = &blockEntries[9 * blockIndex];
+  for(int i=0; i<9; i++)
+    block[i] += block3x3[i];
+}
+
+}//namespace vegafem
+
+#endif
+
@@ -37,8 +37,13 @@
 #include <cmath>
 #include <cassert>
 #include <limits>
+#include <climits>
+#include <algorithm>
 #include "sparseMatrix.h"
 #include "constrainedDOFs.h"
+#ifdef VEGAFEM_USE_TBB
+  #include <tbb/tbb.h>
+#endif
 
 namespace vegafem
 {
@@ -276,22 +281,30 @@ SparseMatrix::SparseMatrix(const char * filename)
   InitFromOutline(&sparseMatrixOutline);
 }
 
-SparseMatrix::SparseMatrix(SparseMatrixOutline * sparseMatrixOutline)
+SparseMatrix::SparseMatrix(SparseMatrixOutline * sparseMatrixOutline, int contiguousStorage)
 {
-  InitFromOutline(sparseMatrixOutline);
+  InitFromOutline(sparseMatrixOutline, contiguousStorage);
 }
 
 // construct matrix from the outline
-void SparseMatrix::InitFromOutline(SparseMatrixOutline * sparseMatrixOutline)
+void SparseMatrix::InitFromOutline(SparseMatrixOutline * sparseMatrixOutline, int contiguousStorage)
 {
   numRows = sparseMatrixOutline->GetNumRows();
   Allocate();
 
   for(int i=0; i<numRows; i++)
-  {
     rowLength[i] = (int)(sparseMatrixOutline->columnEntries[i].size());
-    columnIndices[i] = (int*) malloc (sizeof(int) * rowLength[i]);
-    columnEntries[i] = (double*) malloc (sizeof(double) * rowLength[i]);
+
+  if (contiguousStorage)
+    AllocateContiguous();
+
+  for(int i=0; i<numRows; i++)
+  {
+    if (!contiguousStorage)
+    {
+      columnIndices[i] = (int*) malloc (sizeof(int) * rowLength[i]);
+      columnEntries[i] = (double*) malloc (sizeof(double) * rowLength[i]);
+    }
 
     map<int,double>::iterator pos;
     int j = 0;
@@ -306,6 +319,8 @@ void SparseMatrix::InitFromOutline(SparseMatrixOutline * sparseMatrixOutline)
       j++;
     }
   }
+
+  BuildRowPartition();
 }
 
 // construct matrix by specifying all entries: number of rows, length of each row, indices of columns of non-zero entries in each row, values of non-zero entries in each row
@@ -316,6 +331,11 @@ SparseMatrix::SparseMatrix(int numRows_, int * rowLength_, int ** columnIndices_
     rowLength = rowLength_;
     columnIndices = columnIndices_;
     columnEntries = columnEntries_;
+    rowOffsets = NULL;
+    contiguousColumnIndices = NULL;
+    contiguousColumnEntries = NULL;
+    numThreads = 0;
+    rowPartitionNumColumns = 0;
     numSubMatrixIDs = 0;
     subMatrixIndices = NULL;
     subMatrixIndexLengths = NULL;
@@ -325,6 +345,7 @@ SparseMatrix::SparseMatrix(int numRows_, int * rowLength_, int ** columnIndices_
     superRows = NULL;
     diagonalIndices = NULL;
     transposedIndices = NULL;
+    BuildRowPartition();
     return;
   }
 
@@ -338,6 +359,7 @@ SparseMatrix::SparseMatrix(int numRows_, int * rowLength_, int ** columnIndices_
     memcpy(columnIndices[i], columnIndices_[i], sizeof(int) * rowLength[i]);
     memcpy(columnEntries[i], columnEntries_[i], sizeof(double) * rowLength[i]);
   }
+  BuildRowPartition();
 }
 
 SparseMatrix::SparseMatrix(int numSubMatrices, const SparseMatrix ** subMatrices, const int * numColumns)
@@ -366,6 +388,7 @@ SparseMatrix::SparseMatrix(int numSubMatrices, const SparseMatrix ** subMatrices
     rowStart += mat->numRows;
     colStart += numColumns[matid];
   }
+  BuildRowPartition();
 }
 // allocator
 void SparseMatrix::Allocate()
@@ -374,6 +397,11 @@ void SparseMatrix::Allocate()
   rowLength = (int*) malloc(sizeof(int) * numRows);
   columnIndices = (int**) malloc(sizeof(int*) * numRows);
   columnEntries = (double**) malloc(sizeof(double*) * numRows);
+  rowOffsets = NULL;
+  contiguousColumnIndices = NULL;
+  contiguousColumnEntries = NULL;
+  numThreads = 0;
+  rowPartitionNumColumns = 0;
   numSubMatrixIDs = 0;
   subMatrixIndices = NULL;
   subMatrixIndexLengths = NULL;
@@ -385,14 +413,101 @@ void SparseMatrix::Allocate()
   transposedIndices = NULL;
 }
 
-// destructor
-SparseMatrix::~SparseMatrix()
+// allocates the contiguous arrays, and points the rows into them
+void SparseMatrix::AllocateContiguous()
 {
+  rowOffsets = (int*) malloc (sizeof(int) * (numRows + 1));
+  rowOffsets[0] = 0;
+  for(int i=0; i<numRows; i++)
+    rowOffsets[i+1] = rowOffsets[i] + rowLength[i];
+
+  // allocate at least one entry, so that the pointers are valid even for an empty matrix
+  int numEntries = rowOffsets[numRows];
+  contiguousColumnIndices = (int*) malloc (sizeof(int) * (numEntries > 0 ? numEntries : 1));
+  contiguousColumnEntries = (double*) malloc (sizeof(double) * (numEntries > 0 ? numEntries : 1));
+
   for(int i=0; i<numRows; i++)
   {
-    free(columnIndices[i]);
-    free(columnEntries[i]);
+    columnIndices[i] = contiguousColumnIndices + rowOffsets[i];
+    columnEntries[i] = contiguousColumnEntries + rowOffsets[i];
   }
+}
+
+void SparseMatrix::FreeRows()
+{
+  if (IsContiguous())
+  {
+    free(contiguousColumnIndices);
+    free(contiguousColumnEntries);
+    free(rowOffsets);
+    contiguousColumnIndices = NULL;
+    contiguousColumnEntries = NULL;
+    rowOffsets = NULL;
+  }
+  else
+  {
+    for(int i=0; i<numRows; i++)
+    {
+      free(columnIndices[i]);
+      free(columnEntries[i]);
+    }
+  }
+}
+
+// Routines that change the sparsity structure (RemoveRows, AppendRowsColumns, etc.) free and reallocate individual rows.
+// They therefore convert the matrix to row storage first, and convert back to contiguous storage at the end if needed.
+void SparseMatrix::ConvertToContiguousStorage()
+{
+  if (IsContiguous())
+    return;
+
+  int ** rowColumnIndices = (int**) malloc (sizeof(int*) * numRows);
+  double ** rowColumnEntries = (double**) malloc (sizeof(double*) * numRows);
+  memcpy(rowColumnIndices, columnIndices, sizeof(int*) * numRows);
+  memcpy(rowColumnEntries, columnEntries, sizeof(double*) * numRows);
+
+  AllocateContiguous();
+
+  for(int i=0; i<numRows; i++)
+  {
+    if (rowLength[i] > 0) // rows added by IncreaseNumRows are NULL
+    {
+      memcpy(columnIndices[i], rowColumnIndices[i], sizeof(int) * rowLength[i]);
+      memcpy(columnEntries[i], rowColumnEntries[i], sizeof(double) * rowLength[i]);
+    }
+    free(rowColumnIndices[i]);
+    free(rowColumnEntries[i]);
+  }
+
+  free(rowColumnIndices);
+  free(rowColumnEntries);
+}
+
+void SparseMatrix::ConvertToRowStorage()
+{
+  if (!IsContiguous())
+    return;
+
+  for(int i=0; i<numRows; i++)
+  {
+    columnIndices[i] = (int*) malloc (sizeof(int) * rowLength[i]);
+    columnEntries[i] = (double*) malloc (sizeof(double) * rowLength[i]);
+    memcpy(columnIndices[i], contiguousColumnIndices + rowOffsets[i], sizeof(int) * rowLength[i]);
+    memcpy(columnEntries[i], contiguousColumnEntries + rowOffsets[i], sizeof(double) * rowLength[i]);
+  }
+
+  free(contiguousColumnIndices);
+  free(contiguousColumnEntries);
+  free(rowOffsets);
+  contiguousColumnIndices = NULL;
+  contiguousColumnEntries = NULL;
+  rowOffsets = NULL;
+}
+
+// destructor
+SparseMatrix::~SparseMatrix()
+{
+  FreeRows();
 
   if (subMatrixIndices != NULL)
   {
@@ -435,17 +550,31 @@ SparseMatrix::SparseMatrix(const SparseMatrix & source)
   rowLength = (int*) malloc(sizeof(int) * numRows);
   columnIndices = (int**) malloc(sizeof(int*) * numRows);
   columnEntries = (double**) malloc(sizeof(double*) * numRows);
+  rowOffsets = NULL;
+  contiguousColumnIndices = NULL;
+  contiguousColumnEntries = NULL;
+  numThreads = source.numThreads;
+  rowPartitionNumColumns = 0;
 
-  for(int i=0; i<numRows; i++)
+  memcpy(rowLength, source.rowLength, sizeof(int) * numRows);
+  if (source.IsContiguous())
   {
-    rowLength[i] = source.rowLength[i];
-    columnIndices[i] = (int*) malloc (sizeof(int) * rowLength[i]);
-    columnEntries[i] = (double*) malloc (sizeof(double) * rowLength[i]);
-
-    for(int j=0; j < rowLength[i]; j++)
+    AllocateContiguous();
+    memcpy(contiguousColumnIndices, source.contiguousColumnIndices, sizeof(int) * rowOffsets[numRows]);
+    memcpy(contiguousColumnEntries, source.contiguousColumnEntries, sizeof(double) * rowOffsets[numRows]);
+  }
+  else
+  {
+    for(int i=0; i<numRows; i++)
     {
-      columnIndices[i][j] = source.columnIndices[i][j];
-      columnEntries[i][j] = source.columnEntries[i][j];
+      columnIndices[i] = (int*) malloc (sizeof(int) * rowLength[i]);
+      columnEntries[i] = (double*) malloc (sizeof(double) * rowLength[i]);
+
+      for(int j=0; j < rowLength[i]; j++)
+      {
+        columnIndices[i][j] = source.columnIndices[i][j];
+        columnEntries[i][j] = source.columnEntries[i][j];
+      }
     }
   }
 
@@ -520,6 +649,10 @@ SparseMatrix::SparseMatrix(const SparseMatrix & source)
         transposedIndices[i][j] = source.transposedIndices[i][j];
     }
   }
+
+  rowPartition = source.rowPartition;
+  rowPartitionColumnSpans = source.rowPartitionColumnSpans;
+  rowPartitionNumColumns = source.rowPartitionNumColumns;
 }
 
 void SparseMatrix::MultiplyVector(int startRow, int endRow, const double * vector, double * result) const // result = A(startRow:endRow-1,:) * vector
@@ -532,21 +665,99 @@ void SparseMatrix::MultiplyVector(int startRow, int endRow, const double * vecto
   }
 }
 
-void SparseMatrix::MultiplyVector(const double * vector, double * result) const
+void SparseMatrix::SetNumThreads(int numThreads_)
 {
-  for(int i=0; i<numRows; i++)
+  numThreads = numThreads_;
+  BuildRowPartition();
+}
+
+void SparseMatrix::BuildRowPartition()
+{
+  int numEntries = GetNumEntries();
+  int numRanges = 1;
+  #ifdef VEGAFEM_USE_TBB
+    if (numEntries >= minNumEntriesForMultiThreading)
+      numRanges = (numThreads > 0) ? numThreads : tbb::this_task_arena::max_concurrency();
+  #endif
+  if (numRanges > numRows)
+    numRanges = (numRows > 0) ? numRows : 1;
+
+  // split the rows so that each range has approximately numEntries / numRanges entries
+  rowPartition.resize(numRanges + 1);
+  rowPartition[0] = 0;
+  int row = 0;
+  long long count = 0;
+  for(int range=1; range<numRanges; range++)
   {
-    result[i] = 0.0;
-    for(int j=0; j < rowLength[i]; j++)
-      result[i] += vector[columnIndices[i][j]] * columnEntries[i][j];
+    long long target = (long long)numEntries * range / numRanges;
+    while ((row < numRows) && (count < target))
+      count += rowLength[row++];
+    rowPartition[range] = row;
+  }
+  rowPartition[numRanges] = numRows;
+
+  // columns touched by each range (and GetNumColumns, computed in the same pass)
+  rowPartitionColumnSpans.resize(2 * numRanges);
+  rowPartitionNumColumns = 0;
+  for(int range=0; range<numRanges; range++)
+  {
+    int startColumn = INT_MAX, endColumn = 0;
+    for(int i=rowPartition[range]; i<rowPartition[range+1]; i++)
+      for(int j=0; j < rowLength[i]; j++)
+      {
+        startColumn = min(startColumn, columnIndices[i][j]);
+        endColumn = max(endColumn, columnIndices[i][j] + 1);
+      }
+    if (startColumn > endColumn)
+      startColumn = endColumn; // no entries
+    rowPartitionColumnSpans[2 * range] = startColumn;
+    rowPartitionColumnSpans[2 * range + 1] = endColumn;
+    rowPartitionNumColumns = max(rowPartitionNumColumns, endColumn);
   }
 }
 
+// calls rangeFunction(range, startRow, endRow) for all row ranges of the row partition (in parallel if multi-threading is enabled)
+template<class RangeFunction>
+static void ForEachRowRange(const vector<int> & rowPartition, RangeFunction rangeFunction)
+{
+  int numRanges = (int)rowPartition.size() - 1;
+  #ifdef VEGAFEM_USE_TBB
+    if (numRanges > 1)
+    {
+      tbb::parallel_for(tbb::blocked_range<int>(0, numRanges, 1), [&](const tbb::blocked_range<int> & rng)
+      {
+        for(int range=rng.begin(); range!=rng.end(); ++range)
+          rangeFunction(range, rowPartition[range], rowPartition[range+1]);
+      }, tbb::static_partitioner());
+      return;
+    }
+  #endif
+  for(int range=0; range<numRanges; range++)
+    rangeFunction(range, rowPartition[range], rowPartition[range+1]);
+}
+
+void SparseMatrix::MultiplyVector(const double * vector, double * result) const
+{
+  ForEachRowRange(rowPartition, [&](int, int startRow, int endRow)
+  {
+    for(int i=startRow; i<endRow; i++)
+    {
+      double sum = 0.0;
+      for(int j=0; j < rowLength[i]; j++)
+        sum += vector[columnIndices[i][j]] * columnEntries[i][j];
+      result[i] = sum;
+    }
+  });
+}
+
 void SparseMatrix::MultiplyVectorAdd(const double * vector, double * result) const
 {
-  for(int i=0; i<numRows; i++)
-    for(int j=0; j < rowLength[i]; j++)
-      result[i] += vector[columnIndices[i][j]] * columnEntries[i][j];
+  ForEachRowRange(rowPartition, [&](int, int startRow, int endRow)
+  {
+    for(int i=startRow; i<endRow; i++)
+      for(int j=0; j < rowLength[i]; j++)
+        result[i] += vector[columnIndices[i][j]] * columnEntries[i][j];
+  });
 }
 
 void SparseMatrix::TransposeMultiplyVector(const double * vector, int resultLength, double * result) const
@@ -554,20 +765,56 @@ void SparseMatrix::TransposeMultiplyVector(const double * vector, int resultLeng
   for(int i=0; i<resultLength; i++)
     result[i] = 0;
 
-  for(int i=0; i<numRows; i++)
-    for(int j=0; j < rowLength[i]; j++)
-      result[columnIndices[i][j]] += vector[i] * columnEntries[i][j];
+  TransposeMultiplyVectorAdd(vector, result);
 }
 
 void SparseMatrix::TransposeMultiplyVectorAdd(const double * vector, double * result) const
 {
-  for(int i=0; i<numRows; i++)
+  int numRanges = (int)rowPartition.size() - 1;
+  if (numRanges == 1)
   {
-    for(int j=0; j < rowLength[i]; j++)
+    for(int i=0; i<numRows; i++)
     {
-      result[columnIndices[i][j]] += vector[i] * columnEntries[i][j];
+      for(int j=0; j < rowLength[i]; j++)
+      {
+        result[columnIndices[i][j]] += vector[i] * columnEntries[i][j];
+      }
     }
+    return;
   }
+
+  // several row ranges may write to the same column; each range accumulates into its own buffer,
+  // which covers only the columns touched by the range (see BuildRowPartition)
+  const int * spans = rowPartitionColumnSpans.data();
+  std::vector<size_t> bufferOffsets(numRanges + 1);
+  bufferOffsets[0] = 0;
+  for(int range=0; range<numRanges; range++)
+    bufferOffsets[range+1] = bufferOffsets[range] + (spans[2 * range + 1] - spans[2 * range]);
+  std::vector<double> rangeResults(bufferOffsets[numRanges], 0.0);
+  ForEachRowRange(rowPartition, [&](int range, int startRow, int endRow)
+  {
+    double * rangeResult = rangeResults.data() + bufferOffsets[range];
+    int startColumn = spans[2 * range];
+    for(int i=startRow; i<endRow; i++)
+      for(int j=0; j < rowLength[i]; j++)
+        rangeResult[columnIndices[i][j] - startColumn] += vector[i] * columnEntries[i][j];
+  });
+
+  // add the buffers in range order; the columns are split evenly among the ranges
+  int numColumns = rowPartitionNumColumns;
+  ForEachRowRange(rowPartition, [&](int range, int, int)
+  {
+    int startColumn = (int)((long long)numColumns * range / numRanges);
+    int endColumn = (int)((long long)numColumns * (range + 1) / numRanges);
+    for(int r=0; r<numRanges; r++)
+    {
+      const double * rangeResult = rangeResults.data() + bufferOffsets[r];
+      int start = max(startColumn, spans[2 * r]);
+      int end = min(endColumn, spans[2 * r + 1]);
+      for(int column=start; column<end; column++)
+        result[column] += rangeResult[column - spans[2 * r]];
+    }
+  });
 }
 
 void SparseMatrix::MultiplyMatrix(int numDenseRows, int numDenseColumns, const double * denseMatrix, double * result) const
@@ -595,20 +842,30 @@ void SparseMatrix::MultiplyMatrixTranspose(int numDenseColumns, const double * d
 
 double SparseMatrix::QuadraticForm(const double * vector) const
 {
-  double result = 0;
-  for(int i=0; i<numRows; i++)
+  // partial sums of the row ranges are added in range order, so the result does not depend on thread scheduling
+  std::vector<double> rangeResults(rowPartition.size() - 1);
+  ForEachRowRange(rowPartition, [&](int range, int startRow, int endRow)
   {
-    for(int j=0; j < rowLength[i]; j++)
+    double result = 0;
+    for(int i=startRow; i<endRow; i++)
     {
-      int index = columnIndices[i][j];
-      if (index < i)
-        continue;
-      if (index == i)
-        result += columnEntries[i][j] * vector[i] * vector[index];
-      else
-        result += 2.0 * columnEntries[i][j] * vector[i] * vector[index];
+      for(int j=0; j < rowLength[i]; j++)
+      {
+        int index = columnIndices[i][j];
+        if (index < i)
+          continue;
+        if (index == i)
+          result += columnEntries[i][j] * vector[i] * vector[index];
+        else
+          result += 2.0 * columnEntries[i][j] * vector[i] * vector[index];
+      }
     }
-  }
+    rangeResults[range] = result;
+  });
+
+  double result = 0;
+  for(size_t range=0; range<rangeResults.size(); range++)
+    result += rangeResults[range];
 
   return result;
 }
@@ -745,6 +1002,12 @@ void SparseMatrix::ScalarMultiplyAdd(const double alpha, SparseMatrix * dest)
 
 void SparseMatrix::ResetToZero()
 {
+  if (IsContiguous())
+  {
+    memset(contiguousColumnEntries, 0, sizeof(double) * rowOffsets[numRows]);
+    return;
+  }
+
   for(int i=0; i<numRows; i++)
     memset(columnEntries[i], 0, sizeof(double) * rowLength[i]);
 }
@@ -1413,6 +1676,20 @@ int SparseMatrix::GenerateNAGFormat(double * a, int * irow, int * icol, int * is
 
 void SparseMatrix::GenerateCompressedRowMajorFormat(double * a, int * ia, int * ja, int upperTriangleOnly, int oneIndexed) const
 {
+  if (IsContiguous() && (!upperTriangleOnly))
+  {
+    int numEntries = rowOffsets[numRows];
+    if (a != NULL)
+      memcpy(a, contiguousColumnEntries, sizeof(double) * numEntries);
+    if (ia != NULL)
+      for(int row=0; row<=numRows; row++)
+        ia[row] = rowOffsets[row] + oneIndexed;
+    if (ja != NULL)
+      for(int j=0; j<numEntries; j++)
+        ja[j] = contiguousColumnIndices[j] + oneIndexed;
+    return;
+  }
+
   int count = 0;
   for(int row=0; row<numRows; row++)
   {
@@ -1507,6 +1784,8 @@ int SparseMatrix::SaveToMatlabFormat(const char * filename) const
 void SparseMatrix::RemoveRowColumn(int index)
 {
   FreeAuxiliaryData();
+  int contiguous = IsContiguous();
+  ConvertToRowStorage();
   // remove row 'index'
   free(columnEntries[index]);
   free(columnIndices[index]);
@@ -1549,17 +1828,26 @@ void SparseMatrix::RemoveRowColumn(int index)
   }
 
   numRows--;
+  if (contiguous)
+    ConvertToContiguousStorage();
+  BuildRowPartition();
 }
 
 void SparseMatrix::RemoveRowsColumnsSlow(int numRemovedRowsColumns, const int * removedRowsColumns, int oneIndexed)
 {
+  int contiguous = IsContiguous();
+  ConvertToRowStorage();
   for(int i=0; i<numRemovedRowsColumns; i++)
     RemoveRowColumn(removedRowsColumns[i]-i-oneIndexed);
+  if (contiguous)
+    ConvertToContiguousStorage();
 }
 
 void SparseMatrix::RemoveRowsColumns(int numRemovedRowsColumns, const int * removedRowsColumns, int oneIndexed)
 {
   FreeAuxiliaryData();
+  int contiguous = IsContiguous();
+  ConvertToRowStorage();
   // the removed dofs must be pre-sorted
   // build a map from old dofs to new ones
   vector<int> oldToNew(numRows);
@@ -1619,11 +1907,16 @@ void SparseMatrix::RemoveRowsColumns(int numRemovedRowsColumns, const int * remo
   columnEntries = (double**) realloc(columnEntries, sizeof(double*) * numRows);
   columnIndices = (int**) realloc(columnIndices, sizeof(int*) * numRows);
   rowLength = (int*) realloc(rowLength, sizeof(int) * numRows);
+  if (contiguous)
+    ConvertToContiguousStorage();
+  BuildRowPartition();
 }
 
 void SparseMatrix::RemoveColumn(int index)
 {
   FreeAuxiliaryData();
+  int contiguous = IsContiguous();
+  ConvertToRowStorage();
   // remove column 'index'
   for(int i=0; i<numRows; i++)
   {
@@ -1653,11 +1946,16 @@ void SparseMatrix::RemoveColumn(int index)
       }
     }
   }
+  if (contiguous)
+    ConvertToContiguousStorage();
+  BuildRowPartition();
 }
 
 void SparseMatrix::RemoveColumns(int numRemovedColumns, const int * removedColumns, int oneIndexed)
 {
   FreeAuxiliaryData();
+  int contiguous = IsContiguous();
+  ConvertToRowStorage();
   // the removed dofs must be pre-sorted
   // build a map from old dofs to new ones
   int numColumns = GetNumColumns();
@@ -1711,17 +2009,26 @@ void SparseMatrix::RemoveColumns(int numRemovedColumns, const int * removedColum
     columnEntries[row] = (double*) realloc(columnEntries[row], sizeof(double) * targetIndex);
     rowLength[row] = targetIndex;
   }
+  if (contiguous)
+    ConvertToContiguousStorage();
+  BuildRowPartition();
 }
 
 void SparseMatrix::RemoveColumnsSlow(int numColumns, const int * columns, int oneIndexed)
 {
+  int contiguous = IsContiguous();
+  ConvertToRowStorage();
   for(int i=0; i<numColumns; i++)
     RemoveColumn(columns[i]-i-oneIndexed);
+  if (contiguous)
+    ConvertToContiguousStorage();
 }
 
 void SparseMatrix::RemoveRow(int index)
 {
   FreeAuxiliaryData();
+  int contiguous = IsContiguous();
+  ConvertToRowStorage();
   // remove row 'index'
   free(columnEntries[index]);
   free(columnIndices[index]);
@@ -1734,17 +2041,26 @@ void SparseMatrix::RemoveRow(int index)
   }
 
   numRows--;
+  if (contiguous)
+    ConvertToContiguousStorage();
+  BuildRowPartition();
 }
 
 void SparseMatrix::RemoveRowsSlow(int numRows, const int * rows, int oneIndexed)
 {
+  int contiguous = IsContiguous();
+  ConvertToRowStorage();
   for(int i=0; i<numRows; i++)
     RemoveRow(rows[i]-i-oneIndexed);
+  if (contiguous)
+    ConvertToContiguousStorage();
 }
 
 void SparseMatrix::RemoveRows(int numRemovedRows, const int * removedRows, int oneIndexed)
 {
   FreeAuxiliaryData();
+  int contiguous = IsContiguous();
+  ConvertToRowStorage();
   // the removed dofs must be pre-sorted
   // build a map from old dofs to new ones
   vector<int> oldToNew(numRows);
@@ -1789,6 +2105,9 @@ void SparseMatrix::RemoveRows(int numRemovedRows, const int * removedRows, int o
   columnEntries = (double**) realloc(columnEntries, sizeof(double*) * numRows);
   columnIndices = (int**) realloc(columnIndices, sizeof(double*) * numRows);
   rowLength = (int*) realloc(rowLength, sizeof(int) * numRows);
+  if (contiguous)
+    ConvertToContiguousStorage();
+  BuildRowPartition();
 }
 
 double SparseMatrix::GetInfinityNorm() const
@@ -1838,9 +2157,16 @@ void SparseMatrix::DoOneGaussSeidelIteration(double * x, const double * b) const
 
 void SparseMatrix::ComputeResidual(const double * x, const double * b, double * residual) const
 {
-  MultiplyVector(x,residual);
-  for(int i=0; i<numRows; i++)
-    residual[i] -= b[i];
+  ForEachRowRange(rowPartition, [&](int, int startRow, int endRow)
+  {
+    for(int i=startRow; i<endRow; i++)
+    {
+      double sum = 0.0;
+      for(int j=0; j < rowLength[i]; j++)
+        sum += x[columnIndices[i][j]] * columnEntries[i][j];
+      residual[i] = sum - b[i];
+    }
+  });
 }
 
 double SparseMatrix::CheckLinearSystemSolution(const double * x, const double * b, int verbose, double * buffer) const
@@ -1925,6 +2251,8 @@ int SparseMatrix::GetNumColumns() const
 void SparseMatrix::IncreaseNumRows(int numAddedRows)
 {
   FreeAuxiliaryData();
+  int contiguous = IsContiguous();
+  ConvertToRowStorage();
   int newn = numRows + numAddedRows;
 
   rowLength = (int*) realloc (rowLength, sizeof(int) * newn);
@@ -1940,6 +2268,9 @@ void SparseMatrix::IncreaseNumRows(int numAddedRows)
     columnEntries[numRows + i] = NULL;
 
   numRows = newn;
+  if (contiguous)
+    ConvertToContiguousStorage();
+  BuildRowPartition();
 }
 
 SparseMatrix SparseMatrix::ConjugateMatrix(const SparseMatrix & U, int verbose, int numColumns) const
@@ -2115,11 +2446,13 @@ void SparseMatrix::AssignTransposedMatrix(SparseMatrix & AT)
 void SparseMatrix::SetRows(const SparseMatrix * source, int startRow, int startColumn)
 {
   FreeAuxiliaryData();
+  int contiguous = IsContiguous();
+  ConvertToRowStorage();
   for(int i=0; i<source->GetNumRows(); i++)
   {
     int row = startRow + i;
     if (row >= numRows)
-      return;
+      break;
 
     rowLength[row] = source->GetRowLength(i);
     columnIndices[row] = (int*) realloc (columnIndices[row], sizeof(int) * rowLength[row]);
@@ -2130,16 +2463,25 @@ void SparseMatrix::SetRows(const SparseMatrix * source, int startRow, int startC
       columnEntries[row][j] = source->columnEntries[i][j];
     }
   }
+  if (contiguous)
+    ConvertToContiguousStorage();
+  BuildRowPartition();
 }
 void SparseMatrix::AppendRows(const SparseMatrix * source)
 {
+  int contiguous = IsContiguous();
+  ConvertToRowStorage();
   int oldNumRows = numRows;
   IncreaseNumRows(source->GetNumRows());
   SetRows(source, oldNumRows);
+  if (contiguous)
+    ConvertToContiguousStorage();
 }
 
 void SparseMatrix::AppendRowsColumns(const SparseMatrix * source)
 {
+  int contiguous = IsContiguous();
+  ConvertToRowStorage();
   int * oldRowLengths = (int*) malloc (sizeof(int) * numRows);
   for(int i=0; i<numRows; i++)
     oldRowLengths[i] = rowLength[i];
@@ -2193,6 +2535,9 @@ void SparseMatrix::AppendRowsColumns(const SparseMatrix * source)
     columnIndices[oldNumRows + row][rowLength[oldNumRows + row] - 1] = oldNumRows + row;
     columnEntries[oldNumRows + row][rowLength[oldNumRows + row] - 1] = 0.0;
   }
+  if (contiguous)
+    ConvertToContiguousStorage();
+  BuildRowPartition();
 }
 
 SparseMatrix * SparseMatrix::CreateIdentityMatrix(int numRows)
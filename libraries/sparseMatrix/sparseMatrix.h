@@ -46,6 +46,17 @@
   together with the corresponding double precision values. 
   All quantities (rows, columns, etc.) in this class are 0-indexed.
 
+  By default, each row is a separately allocated array. Optionally, the matrix
+  can be switched to contiguous storage (ConvertToContiguousStorage), where all 
+  column indices and values are kept in two single arrays, together with a 
+  row offset array (standard 0-indexed CSR format). The row pointers then point 
+  into these arrays, so all the routines below (GetRowHandle, GetEntries, AddEntry, etc.) 
+  work unchanged. Contiguous storage is friendlier to hardware prefetching in 
+  matrix-vector products, and the CSR arrays can be handed to external 
+  libraries (e.g., Intel MKL's PARDISO or sparse BLAS) without a copy.
+  Routines that change the sparsity structure (row/column removal, appending rows, etc.)
+  preserve the storage mode.
+
   Also included is a Conjugate Gradient iterative linear system solver 
   (for positive-definite large sparse symmetric matrices).
   The solver can be used without preconditioning, or with diagonal (Jacobi) preconditoning.
@@ -169,14 +180,14 @@ class SparseMatrix
 public:
 
   SparseMatrix(const char * filename); // load from text file (same text file format as SparseMatrixOutline)
-  SparseMatrix(SparseMatrixOutline * sparseMatrixOutline); // create it from the outline
+  SparseMatrix(SparseMatrixOutline * sparseMatrixOutline, int contiguousStorage=0); // create it from the outline; optionally, use contiguous storage (see above)
   // create it by specifying all entries: number of rows, length of each row, indices of columns of non-zero entries in each row, values of non-zero entries in each row
   // column indices in each row must be sorted (ascending)
   // if shallowCopy=1, the class will not allocate its own internal buffers, but will assume ownership of the input rowLength, columnIndices and columnEntries parameters
   SparseMatrix(int numRows, int * rowLength, int ** columnIndices, double ** columnEntries, int shallowCopy=0); 
   SparseMatrix(int numSubMatrices, const SparseMatrix ** subMatrices, const int * numColumns); // construct a diagonal block matrix from submatrices
 
-  SparseMatrix(const SparseMatrix & source); // copy constructor
+  SparseMatrix(const SparseMatrix & source); // copy constructor (the copy uses the same storage mode as the source)
   virtual ~SparseMatrix();
 
   int Save(const char * filename, int oneIndexed=0) const; // save matrix to a disk text file 
@@ -249,6 +260,20 @@ public:
   void MultiplyMatrixAdd(int numDenseRows, int numDenseColumns, const double * denseMatrix, double * result) const; // result += A * denseMatrix (denseMatrix is a numDenseRows x numDenseColumns dense matrix, result is a numDenseRows x numDenseColumns dense matrix)
   void MultiplyMatrixTranspose(int numDenseColumns, const double * denseMatrix, double * result) const; // result = A * trans(denseMatrix) (trans(denseMatrix) is a dense matrix with 'numDenseColumns' columns, result is a numRows x numDenseColumns dense matrix)
 
+  // Multi-threading (TBB builds): MultiplyVector, MultiplyVectorAdd, TransposeMultiplyVector(Add), QuadraticForm and ComputeResidual 
+  // split the rows into contiguous ranges with approximately equal numbers of entries, one range per thread. 
+  // Transposed products accumulate each range into a separate buffer that spans only the columns touched by the range (for banded matrices,
+  // e.g., FEM matrices with a bandwidth-reducing ordering, the buffers add up to little more than one vector), and then add the buffers
+  // in range order, so there are no write conflicts, and the result does not depend on thread scheduling. Matrices with fewer than "minNumEntriesForMultiThreading" entries are processed single-threaded.
+  // numThreads=0 (default): use all TBB threads; numThreads=1: single-threaded
+  void SetNumThreads(int numThreads);
+  inline int GetNumThreads() const { return numThreads; }
+  static const int minNumEntriesForMultiThreading = 20000;
+  // The row partition is built when the matrix is constructed, and rebuilt when the sparsity structure or the number of threads changes,
+  // so the products of the same matrix can be called from several threads at once. With numThreads=0, the number of ranges is the
+  // concurrency of the TBB task arena at the time of the build; call BuildRowPartition to rebuild the partition for the current arena.
+  void BuildRowPartition();
+
   // computes <M * vector, vector> (assumes symmetric M)
   double QuadraticForm(const double * vector) const;
   // normalizes vector in the M-norm: vector := vector / sqrt(<M * vector, vector>)  (assumes symmetric M)
@@ -356,6 +381,8 @@ public:
   // += factor * mat2
   // returns *this
   SparseMatrix & AddSubMatrix(double factor, SparseMatrix & submatrix, int subMatrixID=0);
+  // low-level access to the submatrix indices: entry j of row "row" of the submatrix is entry GetSubMatrixIndices(row, subMatrixID)[j] of row "startRow + row" of the current matrix
+  inline const int * GetSubMatrixIndices(int row, int subMatrixID=0) const { return subMatrixIndices[subMatrixID][row]; }
 
   // Build supermatrix indices is used for pair of matrices with rows/columns removed.
   // It allows you to assign a super matrix to the current matrix.
@@ -367,6 +394,10 @@ public:
   // For example, you can use this to copy data from a matrix into a submatrix obtained by a previous call to RemoveRowColumns.
   void AssignSuperMatrix(const SparseMatrix & superMatrix);
   void FreeSuperMatrixIndices();
+  // low-level access to the supermatrix indices: row "row" of the current matrix is row GetSuperMatrixRow(row) of the superMatrix,
+  // and entry j of row "row" is entry GetSuperMatrixIndices(row)[j] of that row of the superMatrix
+  inline int GetSuperMatrixRow(int row) const { return superRows[row]; }
+  inline const int * GetSuperMatrixIndices(int row) const { return superMatrixIndices[row]; }
 
   // returns the total number of non-zero entries in the lower triangle (including diagonal)
   int GetNumLowerTriangleEntries() const;
@@ -394,6 +425,16 @@ public:
   // passing a buffer (length of n) will avoid a malloc/free pair to generate scratch space for the residual
   double CheckLinearSystemSolution(const double * x, const double * b, int verbose=1, double * buffer=NULL) const;
 
+  // contiguous storage (see the comments at the top of this file)
+  void ConvertToContiguousStorage(); // no-op if already contiguous
+  void ConvertToRowStorage(); // no-op if already using row storage
+  inline bool IsContiguous() const { return rowOffsets != NULL; }
+  // CSR arrays (0-indexed); NULL unless contiguous
+  // row i occupies positions rowOffsets[i], ..., rowOffsets[i+1]-1; length(rowOffsets) = numRows + 1
+  inline int * GetRowOffsets() const { return rowOffsets; }
+  inline int * GetContiguousColumnIndices() const { return contiguousColumnIndices; }
+  inline double * GetContiguousEntries() const { return contiguousColumnEntries; }
+
   // below are low-level routines which are rarely used
   inline double ** GetDataHandle() const { return columnEntries; }
   inline double * GetRowHandle(int row) const { return columnEntries[row]; }
@@ -409,9 +450,19 @@ protected:
   int ** columnIndices; // indices of columns of non-zero entries in each row
   double ** columnEntries; // values of non-zero entries in each row
 
+  // contiguous storage; if not NULL, columnIndices[i] and columnEntries[i] point into these arrays
+  int * rowOffsets;
+  int * contiguousColumnIndices;
+  double * contiguousColumnEntries;
+
   int * diagonalIndices;
   int ** transposedIndices;
 
+  int numThreads;
+  std::vector<int> rowPartition; // boundaries of the row ranges (number of ranges + 1)
+  std::vector<int> rowPartitionColumnSpans; // for each row range, the first column and one past the last column of its entries (two ints per range)
+  int rowPartitionNumColumns; // GetNumColumns(), cached for TransposeMultiplyVectorAdd
+
   /*
     numSubMatrixIDs specifies how many sub-matrix relationships we have
     length(subMatrixIndices) == length(subMatrixIndexLengths) == length(subMatrixStartRow) == (numSubMatrixIDs + 1)
@@ -427,8 +478,10 @@ protected:
   int ** superMatrixIndices;
   int * superRows;
 
-  void InitFromOutline(SparseMatrixOutline * sparseMatrixOutline);
+  void InitFromOutline(SparseMatrixOutline * sparseMatrixOutline, int contiguousStorage=0);
   void Allocate();
+  void AllocateContiguous(); // rowLength must be set
+  void FreeRows();
   void FreeAuxiliaryData();
 };
 
@@ -0,0 +1,77 @@
+/*************************************************************************
+ *                                                                       *
+ * Vega FEM Simulation Library Version 4.0                               *
+ *                                                                       *
+ * "sparseMatrix" library , Copyright (C) 2007 CMU, 2009 MIT, 2018 USC   *
+ * All rights reserved.                                                  *
+ *                                                                       *
+ * Code author: Jernej Barbic                                            *
+ * http://www.jernejbarbic.com/vega                                      *
+ *                                                                       *
+ * Research: Jernej Barbic, Hongyi Xu, Yijing Li,                        *
+ *           Danyong Zhao, Bohan Wang,                                   *
+ *           Fun Shing Sin, Daniel Schroeder,                            *
+ *           Doug L. James, Jovan Popovic                                *
+ *                                                                       *
+ * Funding: National Science Foundation, Link Foundation,                *
+ *          Singapore-MIT GAMBIT Game Lab,                               *
+ *          Zumberge Research and Innovation Fund at USC,                *
+ *          Sloan Foundation, Okawa Foundation,                          *
+ *          USC Annenberg Foundation                                     *
+ *                                                                       *
+ * This library is free software; you can redistribute it and/or         *
+ * modify it under the terms of the BSD-style license that is            *
+ * included with this library in the file LICENSE.txt                    *
+ *                                                                       *
+ * This library is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the file     *
+ * LICENSE.TXT for more details.                                         *
+ *                                                                       *
+ *************************************************************************/
+
+
+#include <cassert>
+#include "sparseMatrixScatter.h"
+
+namespace vegafem
+{
+
+SparseMatrixScatter::SparseMatrixScatter(const SparseMatrix * matrix, int numStencils_, int numStencilVertices_, const int * stencilVertices) :
+  numStencils(numStencils_), numStencilVertices(numStencilVertices_), numStencilDOFs(3 * numStencilVertices_)
+{
+  rows.resize(numStencils * numStencilDOFs);
+  blockPositions.resize(numStencils * numStencilDOFs * numStencilVertices);
+
+  for(int stencil=0; stencil<numStencils; stencil++)
+  {
+    const int * vertices = stencilVertices + stencil * numStencilVertices;
+    for(int va=0; va<numStencilVertices; va++)
+    {
+      // find the block column positions in the first row of vertex va; the other two rows of the vertex have the same layout
+      int * positions = &blockPositions[(stencil * numStencilDOFs + 3 * va) * numStencilVertices];
+      for(int vb=0; vb<numStencilVertices; vb++)
+      {
+        positions[vb] = matrix->GetInverseIndex(3 * vertices[va], 3 * vertices[vb]);
+        assert(positions[vb] >= 0);
+        assert(matrix->GetColumnIndex(3 * vertices[va], positions[vb] + 2) == 3 * vertices[vb] + 2);
+      }
+
+      for(int i=0; i<3; i++)
+      {
+        rows[stencil * numStencilDOFs + 3 * va + i] = 3 * vertices[va] + i;
+        if (i > 0)
+        {
+          for(int vb=0; vb<numStencilVertices; vb++)
+          {
+            assert(matrix->GetColumnIndex(3 * vertices[va] + i, positions[vb]) == 3 * vertices[vb]);
+            positions[i * numStencilVertices + vb] = positions[vb];
+          }
+        }
+      }
+    }
+  }
+}
+
+}//namespace vegafem
+
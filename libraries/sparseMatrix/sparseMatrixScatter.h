@@ -0,0 +1,151 @@
+/*************************************************************************
+ *                                                                       *
+ * Vega FEM Simulation Library Version 4.0                               *
+ *                                                                       *
+ * "sparseMatrix" library , Copyright (C) 2007 CMU, 2009 MIT, 2018 USC   *
+ * All rights reserved.                                                  *
+ *                                                                       *
+ * Code author: Jernej Barbic                                            *
+ * http://www.jernejbarbic.com/vega                                      *
+ *                                                                       *
+ * Research: Jernej Barbic, Hongyi Xu, Yijing Li,                        *
+ *           Danyong Zhao, Bohan Wang,                                   *
+ *           Fun Shing Sin, Daniel Schroeder,                            *
+ *           Doug L. James, Jovan Popovic                                *
+ *                                                                       *
+ * Funding: National Science Foundation, Link Foundation,                *
+ *          Singapore-MIT GAMBIT Game Lab,                               *
+ *          Zumberge Research and Innovation Fund at USC,                *
+ *          Sloan Foundation, Okawa Foundation,                          *
+ *          USC Annenberg Foundation                                     *
+ *                                                                       *
+ * This library is free software; you can redistribute it and/or         *
+ * modify it under the terms of the BSD-style license that is            *
+ * included with this library in the file LICENSE.txt                    *
+ *                                                                       *
+ * This library is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the file     *
+ * LICENSE.TXT for more details.                                         *
+ *                                                                       *
+ *************************************************************************/
+
+
+#ifndef VEGAFEM_SPARSE_MATRIX_SCATTER_H
+#define VEGAFEM_SPARSE_MATRIX_SCATTER_H
+
+/*
+  Precomputed locations for adding dense "stencil" matrices into a SparseMatrix.
+
+  A stencil is a group of nv vertices (e.g., the 4 vertices of a tet, or the 8 vertices of a cube).
+  Its dense matrix has 3nv x 3nv entries, and is added into the 3x3 blocks (vi, vj), 0 <= i,j < nv,
+  of the global 3n x 3n matrix. Computing the global location of each entry requires translating
+  local rows and columns into global row indices and sparse (compressed) column positions.
+  This class performs this translation once, at construction time, and stores, for each stencil:
+    - the global matrix row of each of its 3nv local rows, and
+    - for each local row and each stencil vertex vj, the position, within the global row,
+      of the first of the three entries of block column vj (the "j" in SparseMatrix::AddEntry(row, j, value)).
+  Afterwards, each matrix entry is added with a single indexed add, without any index arithmetic
+  or searching. This is shared by ForceModelAssembler, CorotationalLinearFEM and StVKStiffnessMatrix.
+
+  The global matrix must contain all the 3x3 blocks (vi, vj) of each stencil, as full 3x3 blocks (for example, 
+  the matrix was created using SparseMatrixOutline::AddBlock3x3Entry), so that the three entries of each block row 
+  are consecutive in the sparse row. The scatter remains valid for all matrices with the same structure
+  (e.g., copies of the matrix used at construction).
+*/
+
+#include "sparseMatrix.h"
+#include <vector>
+
+namespace vegafem
+{
+
+class SparseMatrixScatter
+{
+public:
+  SparseMatrixScatter() {}
+  // stencilVertices gives the nv vertex indices of each stencil, stencil after stencil (length numStencils x numStencilVertices)
+  SparseMatrixScatter(const SparseMatrix * matrix, int numStencils, int numStencilVertices, const int * stencilVertices);
+
+  inline int GetNumStencils() const { return numStencils; }
+  inline int GetNumStencilVertices() const { return numStencilVertices; }
+
+  // adds the dense 3nv x 3nv stencil matrix into the global matrix
+  // the stencil matrix is column-major if columnMajor=1 (as in StencilForceModel), otherwise row-major
+  inline void AddStencilMatrix(int stencil, const double * stencilMatrix, SparseMatrix * matrix, int columnMajor=1) const;
+  // same as above, but only adds the three rows that correspond to the stencil vertex 'localVertex';
+  // these rows are not touched by any stencil that does not contain the same global vertex
+  inline void AddStencilVertexRows(int stencil, int localVertex, const double * stencilMatrix, SparseMatrix * matrix, int columnMajor=1) const;
+  // adds a 3x3 block (row-major) at block (localRowVertex, localColumnVertex) of the stencil
+  inline void AddStencilBlock3x3(int stencil, int localRowVertex, int localColumnVertex, const double * block3x3, SparseMatrix * matrix) const;
+
+  // low-level access
+  // global row of local row 'localRow' (0 <= localRow < 3nv)
+  inline int GetRow(int stencil, int localRow) const { return rows[stencil * numStencilDOFs + localRow]; }
+  // position (within the global row of 'localRow') of the first entry of block column 'localColumnVertex'
+  inline int GetBlockPosition(int stencil, int localRow, int localColumnVertex) const { return blockPositions[(stencil * numStencilDOFs + localRow) * numStencilVertices + localColumnVertex]; }
+
+protected:
+  int numStencils = 0;
+  int numStencilVertices = 0;
+  int numStencilDOFs = 0;
+  std::vector<int> rows; // numStencils x 3nv
+  std::vector<int> blockPositions; // numStencils x 3nv x nv
+};
+
+inline void SparseMatrixScatter::AddStencilVertexRows(int stencil, int localVertex, const double * stencilMatrix, SparseMatrix * matrix, int columnMajor) const
+{
+  for(int i=0; i<3; i++)
+  {
+    int localRow = 3 * localVertex + i;
+    double * rowEntries = matrix->GetRowHandle(rows[stencil * numStencilDOFs + localRow]);
+    const int * positions = &blockPositions[(stencil * numStencilDOFs + localRow) * numStencilVertices];
+    if (columnMajor)
+    {
+      const double * entry = stencilMatrix + localRow;
+      for(int vb=0; vb<numStencilVertices; vb++)
+      {
+        double * dest = rowEntries + positions[vb];
+        dest[0] += entry[0];
+        dest[1] += entry[numStencilDOFs];
+        dest[2] += entry[2 * numStencilDOFs];
+        entry += 3 * numStencilDOFs;
+      }
+    }
+    else
+    {
+      const double * entry = stencilMatrix + localRow * numStencilDOFs;
+      for(int vb=0; vb<numStencilVertices; vb++)
+      {
+        double * dest = rowEntries + positions[vb];
+        dest[0] += entry[0];
+        dest[1] += entry[1];
+        dest[2] += entry[2];
+        entry += 3;
+      }
+    }
+  }
+}
+
+inline void SparseMatrixScatter::AddStencilMatrix(int stencil, const double * stencilMatrix, SparseMatrix * matrix, int columnMajor) const
+{
+  for(int va=0; va<numStencilVertices; va++)
+    AddStencilVertexRows(stencil, va, stencilMatrix, matrix, columnMajor);
+}
+
+inline void SparseMatrixScatter::AddStencilBlock3x3(int stencil, int localRowVertex, int localColumnVertex, const double * block3x3, SparseMatrix * matrix) const
+{
+  for(int i=0; i<3; i++)
+  {
+    int localRow = 3 * localRowVertex + i;
+    double * dest = matrix->GetRowHandle(rows[stencil * numStencilDOFs + localRow]) + blockPositions[(stencil * numStencilDOFs + localRow) * numStencilVertices + localColumnVertex];
+    dest[0] += block3x3[3 * i + 0];
+    dest[1] += block3x3[3 * i + 1];
+    dest[2] += block3x3[3 * i + 2];
+  }
+}
+
+}//namespace vegafem
+
+#endif
+
@@ -38,7 +38,7 @@
 namespace vegafem
 {
 
-CGSolver::CGSolver(SparseMatrix * A_): A(A_) 
+CGSolver::CGSolver(SparseMatrix * A_): A(A_), blockA(NULL)
 {
   numRows = A->GetNumRows();
   InitBuffers();
@@ -47,10 +47,27 @@ CGSolver::CGSolver(SparseMatrix * A_): A(A_)
   invDiagonal = NULL;
 }
 
-CGSolver::CGSolver(int numRows_, blackBoxProductType callBackFunction_, void * data_, double * diagonal): numRows(numRows_), multiplicator(callBackFunction_), multiplicatorData(data_), A(NULL)
+CGSolver::CGSolver(BlockSparseMatrix3x3 * A_): A(NULL), blockA(A_)
 {
+  numRows = blockA->GetNumRows();
   InitBuffers();
-  invDiagonal = (double*) malloc (sizeof(double) * numRows);
+  multiplicator = CGSolver::BlockMultiplicator;
+  multiplicatorData = (void*)blockA;
+  invDiagonal = NULL;
+}
+
+CGSolver::CGSolver(int numRows_, blackBoxProductType callBackFunction_, void * data_, double * diagonal): numRows(numRows_), multiplicator(callBackFunction_), multiplicatorData(data_), A(NULL), blockA(NULL)
+{
+  InitBuffers();
+  invDiagonal = NULL;
+  SetDiagonal(diagonal);
+}
+
+void CGSolver::SetDiagonal(const double * diagonal)
+{
+  if (invDiagonal == NULL)
+    invDiagonal = (double*) malloc (sizeof(double) * numRows);
+
   if (diagonal == NULL)
   {
     for(int i=0; i<numRows; i++)
@@ -77,6 +94,12 @@ void CGSolver::DefaultMultiplicator(const void * data, const double * x, double
   A->MultiplyVector(x, Ax);
 }
 
+void CGSolver::BlockMultiplicator(const void * data, const double * x, double * Ax)
+{
+  BlockSparseMatrix3x3 * A = (BlockSparseMatrix3x3*)data;
+  A->MultiplyVector(x, Ax);
+}
+
 void CGSolver::InitBuffers()
 {
   r = (double*) malloc (sizeof(double) * numRows);
@@ -204,14 +227,18 @@ int CGSolver::SolveLinearSystemWithJacobiPreconditioner(double * x, const double
 {
   if (invDiagonal == NULL)
   {
-    // This code will only execute when the class was constructed via the "SparseMatrix * A_" constructor (and only once).
+    // This code will only execute when the class was constructed via the "SparseMatrix * A_" or "BlockSparseMatrix3x3 * A_" constructor (and only once).
     // In the "blackBoxProductType callBackFunction_" constructor, invDiagonal would have already been set to non-NULL.
 
     // extract diagonal entries
-    A->BuildDiagonalIndices(); // note: if indices are already built, this call will do nothing (you can therefore also call BuildDiagonalIndices() once and for all before calling SolveLinearSystemWithJacobiPreconditioner); in any case, BuildDiagonalIndices() is fast (a single linear traversal of all matrix elements)
-
     invDiagonal = (double*) malloc (sizeof(double) * numRows);
-    A->GetDiagonal(invDiagonal);
+    if (A != NULL)
+    {
+      A->BuildDiagonalIndices(); // note: if indices are already built, this call will do nothing (you can therefore also call BuildDiagonalIndices() once and for all before calling SolveLinearSystemWithJacobiPreconditioner); in any case, BuildDiagonalIndices() is fast (a single linear traversal of all matrix elements)
+      A->GetDiagonal(invDiagonal);
+    }
+    else
+      blockA->GetDiagonal(invDiagonal);
     for(int i=0; i<numRows; i++)
       invDiagonal[i] = 1.0 / invDiagonal[i]; // potential division by zero here (uncommon in practice)
   }
@@ -52,6 +52,7 @@
 
 #include "linearSolver.h"
 #include "sparseMatrix.h"
+#include "blockSparseMatrix3x3.h"
 
 namespace vegafem
 {
@@ -65,6 +66,8 @@ public:
   // Minor note: the code will generate an internal acceleration structure, by calling A->BuildDiagonalIndices() when using the Jacobi preconditioner. Technically speaking, this modifies the SparseMatrix object since it builds the acceleration structure. It does not modify
   // the matrix A or any of its entries.
   CGSolver(SparseMatrix * A);
+  // Same as above, for a 3x3 block-sparse matrix (see blockSparseMatrix3x3.h). Matrix A will not be modified.
+  CGSolver(BlockSparseMatrix3x3 * A);
 
   // This constructor makes it possible to only provide a "black-box" matrix-vector multiplication routine 
   // (no need to explicitly give the matrix).
@@ -76,6 +79,9 @@ public:
   // i.e., the solve will be identical to SolveLinearSystemWithoutPreconditioner.
   typedef void (*blackBoxProductType)(const void * data, const double * x, double * Ax);
   CGSolver(int n, blackBoxProductType callBackFunction, void * data, double * diagonal=NULL);
+  // Replaces the diagonal used by "SolveLinearSystemWithJacobiPreconditioner" (e.g., when the black-box matrix changes between solves).
+  // Passing NULL reverts to the identity preconditioner.
+  void SetDiagonal(const double * diagonal);
 
   ~CGSolver();
 
@@ -95,6 +101,7 @@ public:
 
   // Solve the linear system with a user-provided preconditioner.
   // Solving the linear system "preconditioner * x = b" should approximate solving the linear system "(this matrix) * x = b".
+  // Available preconditioners: BlockJacobiPreconditioner, IncompleteCholeskyPreconditioner, SmoothedAggregationPreconditioner (AMG).
   int SolveLinearSystemWithPreconditioner(LinearSolver * preconditioner, double * x, const double * b, double eps=1e-6, int maxIterations=1000, int verbose=0);
 
   virtual int SolveLinearSystem(double * x, const double * b); // implements the virtual method from LinearSolver by calling "SolveLinearSystemWithJacobiPreconditioner" with default parameters
@@ -107,11 +114,13 @@ protected:
   blackBoxProductType multiplicator;
   void * multiplicatorData;
   SparseMatrix * A; 
+  BlockSparseMatrix3x3 * blockA;
   double * r, * d, * q; // terminology from Shewchuk's work
   double * invDiagonal;
 
   double ComputeTriDotProduct(double * x, double * y, double * z); // sum_i x[i] * y[i] * z[i]
   static void DefaultMultiplicator(const void * data, const double * x, double * Ax);
+  static void BlockMultiplicator(const void * data, const double * x, double * Ax);
   void InitBuffers();
 };
 
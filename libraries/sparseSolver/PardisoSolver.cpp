@@ -64,8 +64,6 @@ PardisoSolver::PardisoSolver(const SparseMatrix * A, int numThreads_, matrixType
   if (verbose >= 1)
     printf("Converting matrix to Pardiso format...\n");
 
-  int numEntries;
-  int upperTriangleOnly;  
   if ((mtype == REAL_SPD) || (mtype == REAL_SYM_INDEFINITE))  // matrix is symmetric
   {
     numEntries = A->GetNumUpperTriangleEntries();
@@ -77,11 +75,15 @@ PardisoSolver::PardisoSolver(const SparseMatrix * A, int numThreads_, matrixType
     numEntries = A->GetNumEntries();
     upperTriangleOnly = 0;
   }
-  a = (double*) malloc (sizeof(double) * numEntries);  
+  // the full matrix in contiguous storage can be passed to Pardiso directly (0-indexed, see iparm[34] below);
+  // the upper triangle of a symmetric matrix is not contiguous in that storage, and is therefore always copied
+  zeroCopy = A->IsContiguous() && (!upperTriangleOnly);
+  aBuffer = NULL;
   ia = (int*) malloc (sizeof(int) * (A->GetNumRows() + 1));  
   ja = (int*) malloc (sizeof(int) * numEntries);  
-  int oneIndexed = 1;
-  A->GenerateCompressedRowMajorFormat(a, ia, ja, upperTriangleOnly, oneIndexed);
+  int oneIndexed = zeroCopy ? 0 : 1;
+  A->GenerateCompressedRowMajorFormat(NULL, ia, ja, upperTriangleOnly, oneIndexed);
+  SetMatrixValues(A);
 
   if (verbose >= 2)
     printf("numEntries: %d\n", numEntries);
@@ -154,6 +156,8 @@ PardisoSolver::PardisoSolver(const SparseMatrix * A, int numThreads_, matrixType
   iparm[23] = 0; // Parallel factorization control. Use default.
   iparm[24] = 0; // Parallel forward/backward solve control. Intel MKL PARDISO uses a parallel algorithm for the solve step.
 
+  iparm[34] = zeroCopy ? 1 : 0; // 1: zero-based (C-style) indexing of ia and ja
+
   // the other iparms (above 24) are left at 0
 
   /* -------------------------------------------------------------------- *\
@@ -197,13 +201,27 @@ PardisoSolver::~PardisoSolver()
   if (error != 0)
     printf("Error: Pardiso Cholesky dealloacation returned non-zero exit code %d.\n", error);
 
-  free(a);
+  free(aBuffer);
   free(ia);
   free(ja);
 }
 
 void PardisoSolver::DisabledSolverError() {}
 
+void PardisoSolver::SetMatrixValues(const SparseMatrix * A)
+{
+  if (zeroCopy && A->IsContiguous())
+  {
+    a = A->GetContiguousEntries();
+    return;
+  }
+
+  if (aBuffer == NULL)
+    aBuffer = (double*) malloc (sizeof(double) * numEntries);
+  A->GenerateCompressedRowMajorFormat(aBuffer, NULL, NULL, upperTriangleOnly);
+  a = aBuffer;
+}
+
 MKL_INT PardisoSolver::FactorMatrix(const SparseMatrix * A)
 {
   if (directIterative)
@@ -215,14 +233,7 @@ MKL_INT PardisoSolver::FactorMatrix(const SparseMatrix * A)
   if (verbose >= 1)
     printf("Factoring the %d x %d matrix (%d threads)...\n", n, n, numThreads);
 
-  int upperTriangleOnly = 1;
-  int oneIndexed = 1;
-
-  if ((mtype == REAL_SPD) || (mtype == REAL_SYM_INDEFINITE))  // matrix is symmetric
-    upperTriangleOnly = 1;    // symmetric matrix can only be represented by its upper triangle elements
-  else  // structural symmetric or unsymmetric
-    upperTriangleOnly = 0;    // unsymmetric matrix must store all its elements
-  A->GenerateCompressedRowMajorFormat(a, NULL, NULL, upperTriangleOnly, oneIndexed);
+  SetMatrixValues(A);
 
   // factor 
   phase = 22;
@@ -396,9 +407,7 @@ MKL_INT PardisoSolver::SolveLinearSystemDirectIterative(const SparseMatrix * A,
   if (verbose >= 2)
     printf("Solving linear system...(%d threads, direct-iterative)\n", numThreads);
 
-  int upperTriangleOnly = 1;
-  int oneIndexed = 1;
-  A->GenerateCompressedRowMajorFormat(a, NULL, NULL, upperTriangleOnly, oneIndexed);
+  SetMatrixValues(A);
 
   phase = 23;
   PARDISO(pt, &maxfct, &mnum, (MKL_INT*)&mtype, &phase, &n, a, ia, ja, NULL, &nrhs, iparm, &msglvl, (double*)rhs, x, &error);
@@ -65,6 +65,13 @@ public:
   // The constructor computes the permutation to re-order A, and performs symbolic factorization.
   // Only the topology of A matters for the constructor. A is not modified.
   // Note: after calling the constructor, you must call "FactorMatrix" to perform numerical factorization.
+  // If A uses contiguous storage (see sparseMatrix.h) and the matrix is not symmetric (REAL_STRUCTURAL_SYM or REAL_UNSYM), 
+  // Pardiso reads the matrix values directly from A's storage, without a copy. In that case, the matrix passed to 
+  // FactorMatrix (or SolveLinearSystemDirectIterative) must stay alive and unmodified until the subsequent solves are completed.
+  // Limitation: symmetric matrices (REAL_SPD, REAL_SYM_INDEFINITE; this includes the default type, and the types used by the
+  // integrators) are always copied into an internal buffer. Pardiso requires the upper triangle only, stored row after row
+  // without gaps, whereas the contiguous storage of A keeps the full rows, so the lower-triangle entries interleave the
+  // upper-triangle ones. For these types, contiguous storage of A brings no savings in PardisoSolver.
   //  "mtype" gives the matrix type:
   //  = 1   structurally symmetric matrix
   //  = 2   symmetric positive-definite matrix
@@ -114,8 +121,12 @@ public:
 
 protected:
   int n;
-  double * a;
+  int numEntries;
+  double * a; // values passed to Pardiso; either aBuffer, or the contiguous entries of the matrix (zero-copy)
+  double * aBuffer;
   int * ia, * ja;
+  int upperTriangleOnly;
+  int zeroCopy;
   void *pt[64];
   MKL_INT iparm[64];
 
@@ -127,6 +138,7 @@ protected:
   MKL_INT nrhs; 
   MKL_INT maxfct, mnum, phase, error, msglvl;
 
+  void SetMatrixValues(const SparseMatrix * A);
   static void DisabledSolverError();
 };
 
@@ -0,0 +1,140 @@
+/*************************************************************************
+ *                                                                       *
+ * Vega FEM Simulation Library Version 4.0                               *
+ *                                                                       *
+ * "sparseSolver" library , Copyright (C) 2007 CMU, 2009 MIT, 2018 USC   *
+ * All rights reserved.                                                  *
+ *                                                                       *
+ * Code author: Jernej Barbic                                            *
+ * http://www.jernejbarbic.com/vega                                      *
+ *                                                                       *
+ * Research: Jernej Barbic, Hongyi Xu, Yijing Li,                        *
+ *           Danyong Zhao, Bohan Wang,                                   *
+ *           Fun Shing Sin, Daniel Schroeder,                            *
+ *           Doug L. James, Jovan Popovic                                *
+ *                                                                       *
+ * Funding: National Science Foundation, Link Foundation,                *
+ *          Singapore-MIT GAMBIT Game Lab,                               *
+ *          Zumberge Research and Innovation Fund at USC,                *
+ *          Sloan Foundation, Okawa Foundation,                          *
+ *          USC Annenberg Foundation                                     *
+ *                                                                       *
+ * This library is free software; you can redistribute it and/or         *
+ * modify it under the terms of the BSD-style license that is            *
+ * included with this library in the file LICENSE.txt                    *
+ *                                                                       *
+ * This library is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the file     *
+ * LICENSE.TXT for more details.                                         *
+ *                                                                       *
+ *************************************************************************/
+
+#include <cmath>
+#include <cstring>
+#include "blockJacobiPreconditioner.h"
+
+namespace vegafem
+{
+
+BlockJacobiPreconditioner::BlockJacobiPreconditioner(const SparseMatrix * A)
+{
+  if (A->GetNumRows() % 3 != 0)
+  {
+    printf("Error: BlockJacobiPreconditioner: the number of matrix rows (%d) is not a multiple of 3.\n", A->GetNumRows());
+    throw 1;
+  }
+  numBlocks = A->GetNumRows() / 3;
+  blocks.resize(9 * numBlocks);
+  FactorMatrix(A);
+}
+
+BlockJacobiPreconditioner::BlockJacobiPreconditioner(const BlockSparseMatrix3x3 * A)
+{
+  numBlocks = A->GetNumBlockRows();
+  blocks.resize(9 * numBlocks);
+  FactorMatrix(A);
+}
+
+BlockJacobiPreconditioner::~BlockJacobiPreconditioner() {}
+
+void BlockJacobiPreconditioner::FactorMatrix(const SparseMatrix * A)
+{
+  memset(blocks.data(), 0, sizeof(double) * blocks.size());
+  for(int row=0; row<3*numBlocks; row++)
+  {
+    int block = row / 3;
+    int rowLength = A->GetRowLength(row);
+    const int * columnIndices = A->GetColumnIndices()[row];
+    const double * entries = A->GetEntries()[row];
+    for(int j=0; j<rowLength; j++)
+    {
+      int column = columnIndices[j];
+      if ((column >= 3 * block) && (column < 3 * block + 3))
+        blocks[9 * block + 3 * (row - 3 * block) + column - 3 * block] = entries[j];
+    }
+  }
+  InvertBlocks();
+}
+
+void BlockJacobiPreconditioner::FactorMatrix(const BlockSparseMatrix3x3 * A)
+{
+  A->GetDiagonalBlocks(blocks.data());
+  InvertBlocks();
+}
+
+void BlockJacobiPreconditioner::InvertBlocks()
+{
+  for(int block=0; block<numBlocks; block++)
+  {
+    double * M = &blocks[9 * block];
+    double inv[9];
+    // adjugate
+    inv[0] = M[4] * M[8] - M[5] * M[7];
+    inv[1] = M[2] * M[7] - M[1] * M[8];
+    inv[2] = M[1] * M[5] - M[2] * M[4];
+    inv[3] = M[5] * M[6] - M[3] * M[8];
+    inv[4] = M[0] * M[8] - M[2] * M[6];
+    inv[5] = M[2] * M[3] - M[0] * M[5];
+    inv[6] = M[3] * M[7] - M[4] * M[6];
+    inv[7] = M[1] * M[6] - M[0] * M[7];
+    inv[8] = M[0] * M[4] - M[1] * M[3];
+    double det = M[0] * inv[0] + M[1] * inv[3] + M[2] * inv[6];
+
+    double scale = fabs(M[0]) + fabs(M[4]) + fabs(M[8]);
+    if (fabs(det) > 1E-14 * scale * scale * scale)
+    {
+      double invDet = 1.0 / det;
+      for(int i=0; i<9; i++)
+        M[i] = inv[i] * invDet;
+    }
+    else
+    {
+      // singular block: use the scalar Jacobi preconditioner for this block
+      for(int i=0; i<3; i++)
+      {
+        double diag = M[4 * i];
+        inv[4 * i] = (diag != 0.0) ? 1.0 / diag : 0.0;
+      }
+      for(int i=0; i<9; i++)
+        M[i] = (i % 4 == 0) ? inv[i] : 0.0;
+    }
+  }
+}
+
+int BlockJacobiPreconditioner::SolveLinearSystem(double * x, const double * rhs)
+{
+  for(int block=0; block<numBlocks; block++)
+  {
+    const double * M = &blocks[9 * block];
+    const double * b = &rhs[3 * block];
+    double b0 = b[0], b1 = b[1], b2 = b[2]; // x and rhs may alias
+    x[3 * block + 0] = M[0] * b0 + M[1] * b1 + M[2] * b2;
+    x[3 * block + 1] = M[3] * b0 + M[4] * b1 + M[5] * b2;
+    x[3 * block + 2] = M[6] * b0 + M[7] * b1 + M[8] * b2;
+  }
+  return 0;
+}
+
+}//namespace vegafem
+
@@ -0,0 +1,80 @@
+/*************************************************************************
+ *                                                                       *
+ * Vega FEM Simulation Library Version 4.0                               *
+ *                                                                       *
+ * "sparseSolver" library , Copyright (C) 2007 CMU, 2009 MIT, 2018 USC   *
+ * All rights reserved.                                                  *
+ *                                                                       *
+ * Code author: Jernej Barbic                                            *
+ * http://www.jernejbarbic.com/vega                                      *
+ *                                                                       *
+ * Research: Jernej Barbic, Hongyi Xu, Yijing Li,                        *
+ *           Danyong Zhao, Bohan Wang,                                   *
+ *           Fun Shing Sin, Daniel Schroeder,                            *
+ *           Doug L. James, Jovan Popovic                                *
+ *                                                                       *
+ * Funding: National Science Foundation, Link Foundation,                *
+ *          Singapore-MIT GAMBIT Game Lab,                               *
+ *          Zumberge Research and Innovation Fund at USC,                *
+ *          Sloan Foundation, Okawa Foundation,                          *
+ *          USC Annenberg Foundation                                     *
+ *                                                                       *
+ * This library is free software; you can redistribute it and/or         *
+ * modify it under the terms of the BSD-style license that is            *
+ * included with this library in the file LICENSE.txt                    *
+ *                                                                       *
+ * This library is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the file     *
+ * LICENSE.TXT for more details.                                         *
+ *                                                                       *
+ *************************************************************************/
+
+#ifndef VEGAFEM_BLOCKJACOBIPRECONDITIONER_H
+#define VEGAFEM_BLOCKJACOBIPRECONDITIONER_H
+
+/*
+  3x3 block-Jacobi preconditioner for matrices whose degrees of freedom come in groups of three 
+  (e.g., FEM stiffness matrices, where DOFs 3i, 3i+1, 3i+2 belong to vertex i).
+  "Solving" the system applies the inverses of the 3x3 diagonal blocks of A: x = inv(D) * rhs.
+  Unlike the (scalar) Jacobi preconditioner, this captures the coupling between the x,y,z components at each vertex.
+
+  Use it with CGSolver::SolveLinearSystemWithPreconditioner. See also incompleteCholeskyPreconditioner.h and 
+  smoothedAggregationPreconditioner.h .
+*/
+
+#include <vector>
+#include "linearSolver.h"
+#include "sparseMatrix.h"
+#include "blockSparseMatrix3x3.h"
+
+namespace vegafem
+{
+
+class BlockJacobiPreconditioner : public LinearSolver
+{
+public:
+  // A must be a 3n x 3n matrix; only its 3x3 diagonal blocks are used
+  BlockJacobiPreconditioner(const SparseMatrix * A);
+  BlockJacobiPreconditioner(const BlockSparseMatrix3x3 * A);
+  virtual ~BlockJacobiPreconditioner();
+
+  // recomputes the inverses of the diagonal blocks; must be called after the entries of A change
+  void FactorMatrix(const SparseMatrix * A);
+  void FactorMatrix(const BlockSparseMatrix3x3 * A);
+
+  // x = inv(D) * rhs, where D is the block-diagonal part of A
+  virtual int SolveLinearSystem(double * x, const double * rhs);
+
+protected:
+  int numBlocks;
+  std::vector<double> blocks; // the diagonal blocks, and then their inverses; 9 entries per block, row-major
+
+  // inverts all blocks in place; singular blocks fall back to the inverse of their diagonal 
+  void InvertBlocks();
+};
+
+}//namespace vegafem
+
+#endif
+
@@ -0,0 +1,166 @@
+/*************************************************************************
+ *                                                                       *
+ * Vega FEM Simulation Library Version 4.0                               *
+ *                                                                       *
+ * "sparseSolver" library , Copyright (C) 2007 CMU, 2009 MIT, 2018 USC   *
+ * All rights reserved.                                                  *
+ *                                                                       *
+ * Code author: Jernej Barbic                                            *
+ * http://www.jernejbarbic.com/vega                                      *
+ *                                                                       *
+ * Research: Jernej Barbic, Hongyi Xu, Yijing Li,                        *
+ *           Danyong Zhao, Bohan Wang,                                   *
+ *           Fun Shing Sin, Daniel Schroeder,                            *
+ *           Doug L. James, Jovan Popovic                                *
+ *                                                                       *
+ * Funding: National Science Foundation, Link Foundation,                *
+ *          Singapore-MIT GAMBIT Game Lab,                               *
+ *          Zumberge Research and Innovation Fund at USC,                *
+ *          Sloan Foundation, Okawa Foundation,                          *
+ *          USC Annenberg Foundation                                     *
+ *                                                                       *
+ * This library is free software; you can redistribute it and/or         *
+ * modify it under the terms of the BSD-style license that is            *
+ * included with this library in the file LICENSE.txt                    *
+ *                                                                       *
+ * This library is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the file     *
+ * LICENSE.TXT for more details.                                         *
+ *                                                                       *
+ *************************************************************************/
+
+#include <cmath>
+#include <algorithm>
+#include <utility>
+#include "incompleteCholeskyPreconditioner.h"
+
+namespace vegafem
+{
+
+IncompleteCholeskyPreconditioner::IncompleteCholeskyPreconditioner(const SparseMatrix * A)
+{
+  n = A->GetNumRows();
+
+  // extract the sparsity structure of the lower triangle
+  rowOffsets.resize(n + 1);
+  rowOffsets[0] = 0;
+  std::vector<std::pair<int, int> > rowEntries; // (column, index in A's row)
+  for(int i=0; i<n; i++)
+  {
+    rowEntries.clear();
+    int diagonalIndex = -1;
+    for(int j=0; j<A->GetRowLength(i); j++)
+    {
+      int column = A->GetColumnIndex(i, j);
+      if (column < i)
+        rowEntries.push_back(std::make_pair(column, j));
+      else if (column == i)
+        diagonalIndex = j;
+    }
+    std::sort(rowEntries.begin(), rowEntries.end());
+    rowEntries.push_back(std::make_pair(i, diagonalIndex));
+
+    for(size_t j=0; j<rowEntries.size(); j++)
+    {
+      columnIndices.push_back(rowEntries[j].first);
+      sourceIndices.push_back(rowEntries[j].second);
+    }
+    rowOffsets[i+1] = (int)columnIndices.size();
+  }
+  L.resize(columnIndices.size());
+
+  if (FactorMatrix(A) != 0)
+    printf("Warning: IncompleteCholeskyPreconditioner: incomplete Cholesky factorization failed. Is the matrix positive-definite?\n");
+}
+
+IncompleteCholeskyPreconditioner::~IncompleteCholeskyPreconditioner() {}
+
+int IncompleteCholeskyPreconditioner::FactorMatrix(const SparseMatrix * A)
+{
+  diagonalShift = 0.0;
+  if (Factor(A, diagonalShift) == 0)
+    return 0;
+
+  // breakdown: shift the diagonal (Manteuffel)
+  for(diagonalShift = 1E-3; diagonalShift < 1E3; diagonalShift *= 2.0)
+  {
+    if (Factor(A, diagonalShift) == 0)
+      return 0;
+  }
+  return 1;
+}
+
+int IncompleteCholeskyPreconditioner::Factor(const SparseMatrix * A, double shift)
+{
+  // copy the values of A
+  for(int i=0; i<n; i++)
+  {
+    const double * rowEntries = A->GetEntries()[i];
+    for(int e=rowOffsets[i]; e<rowOffsets[i+1]; e++)
+      L[e] = (sourceIndices[e] >= 0) ? rowEntries[sourceIndices[e]] : 0.0;
+    L[rowOffsets[i+1]-1] *= 1.0 + shift;
+  }
+
+  for(int i=0; i<n; i++)
+  {
+    int rowStart = rowOffsets[i];
+    int diagonal = rowOffsets[i+1] - 1;
+    for(int e=rowStart; e<diagonal; e++)
+    {
+      // L_ik = (a_ik - sum_{j<k} L_ij * L_kj) / L_kk, summing over the common columns of rows i and k
+      int k = columnIndices[e];
+      int kDiagonal = rowOffsets[k+1] - 1;
+      int p = rowStart;
+      int q = rowOffsets[k];
+      double sum = L[e];
+      while ((p < e) && (q < kDiagonal))
+      {
+        if (columnIndices[p] < columnIndices[q])
+          p++;
+        else if (columnIndices[p] > columnIndices[q])
+          q++;
+        else
+          sum -= L[p++] * L[q++];
+      }
+      L[e] = sum / L[kDiagonal];
+    }
+
+    double pivot = L[diagonal];
+    for(int e=rowStart; e<diagonal; e++)
+      pivot -= L[e] * L[e];
+    if (!(pivot > 0.0))
+      return 1;
+    L[diagonal] = sqrt(pivot);
+  }
+
+  return 0;
+}
+
+int IncompleteCholeskyPreconditioner::SolveLinearSystem(double * x, const double * rhs)
+{
+  // forward substitution: L * y = rhs (y is stored in x)
+  for(int i=0; i<n; i++)
+  {
+    int diagonal = rowOffsets[i+1] - 1;
+    double sum = rhs[i];
+    for(int e=rowOffsets[i]; e<diagonal; e++)
+      sum -= L[e] * x[columnIndices[e]];
+    x[i] = sum / L[diagonal];
+  }
+
+  // backward substitution: L^T * x = y; L is stored by rows, so the update is column-oriented
+  for(int i=n-1; i>=0; i--)
+  {
+    int diagonal = rowOffsets[i+1] - 1;
+    x[i] /= L[diagonal];
+    double xi = x[i];
+    for(int e=rowOffsets[i]; e<diagonal; e++)
+      x[columnIndices[e]] -= L[e] * xi;
+  }
+
+  return 0;
+}
+
+}//namespace vegafem
+
@@ -0,0 +1,87 @@
+/*************************************************************************
+ *                                                                       *
+ * Vega FEM Simulation Library Version 4.0                               *
+ *                                                                       *
+ * "sparseSolver" library , Copyright (C) 2007 CMU, 2009 MIT, 2018 USC   *
+ * All rights reserved.                                                  *
+ *                                                                       *
+ * Code author: Jernej Barbic                                            *
+ * http://www.jernejbarbic.com/vega                                      *
+ *                                                                       *
+ * Research: Jernej Barbic, Hongyi Xu, Yijing Li,                        *
+ *           Danyong Zhao, Bohan Wang,                                   *
+ *           Fun Shing Sin, Daniel Schroeder,                            *
+ *           Doug L. James, Jovan Popovic                                *
+ *                                                                       *
+ * Funding: National Science Foundation, Link Foundation,                *
+ *          Singapore-MIT GAMBIT Game Lab,                               *
+ *          Zumberge Research and Innovation Fund at USC,                *
+ *          Sloan Foundation, Okawa Foundation,                          *
+ *          USC Annenberg Foundation                                     *
+ *                                                                       *
+ * This library is free software; you can redistribute it and/or         *
+ * modify it under the terms of the BSD-style license that is            *
+ * included with this library in the file LICENSE.txt                    *
+ *                                                                       *
+ * This library is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the file     *
+ * LICENSE.TXT for more details.                                         *
+ *                                                                       *
+ *************************************************************************/
+
+#ifndef VEGAFEM_INCOMPLETECHOLESKYPRECONDITIONER_H
+#define VEGAFEM_INCOMPLETECHOLESKYPRECONDITIONER_H
+
+/*
+  Incomplete Cholesky preconditioner with zero fill-in, IC(0): A ~= L * L^T, where the lower-triangular
+  factor L has the same sparsity structure as the lower triangle of A.
+  "Solving" the system performs a forward and a backward substitution with L.
+
+  A must be symmetric positive-definite. Even then, IC(0) can break down (non-positive pivot); 
+  in that case, the factorization is recomputed for A + shift * diag(A), increasing the shift until the factorization succeeds.
+
+  Use it with CGSolver::SolveLinearSystemWithPreconditioner. See also blockJacobiPreconditioner.h and 
+  smoothedAggregationPreconditioner.h .
+*/
+
+#include <vector>
+#include "linearSolver.h"
+#include "sparseMatrix.h"
+
+namespace vegafem
+{
+
+class IncompleteCholeskyPreconditioner : public LinearSolver
+{
+public:
+  // only the lower triangle of A is used
+  IncompleteCholeskyPreconditioner(const SparseMatrix * A);
+  virtual ~IncompleteCholeskyPreconditioner();
+
+  // recomputes the factorization; must be called after the entries of A change (the topology of A must not change)
+  // returns 0 on success, 1 if the factorization failed even with the largest diagonal shift
+  int FactorMatrix(const SparseMatrix * A);
+
+  // x = inv(L * L^T) * rhs
+  virtual int SolveLinearSystem(double * x, const double * rhs);
+
+  // the relative diagonal shift used in the last factorization (0 if IC(0) did not break down)
+  inline double GetDiagonalShift() const { return diagonalShift; }
+
+protected:
+  int n;
+  // lower triangle of A (including the diagonal) in compressed row format, columns sorted; the diagonal is the last entry of each row
+  std::vector<int> rowOffsets;
+  std::vector<int> columnIndices;
+  std::vector<int> sourceIndices; // index of each entry within its row of A (-1 if the entry is a diagonal that is absent in A)
+  std::vector<double> L;
+  double diagonalShift;
+
+  int Factor(const SparseMatrix * A, double shift); // returns 0 on success, 1 on breakdown
+};
+
+}//namespace vegafem
+
+#endif
+
@@ -0,0 +1,631 @@
+/*************************************************************************
+ *                                                                       *
+ * Vega FEM Simulation Library Version 4.0                               *
+ *                                                                       *
+ * "sparseSolver" library , Copyright (C) 2007 CMU, 2009 MIT, 2018 USC   *
+ * All rights reserved.                                                  *
+ *                                                                       *
+ * Code author: Jernej Barbic                                            *
+ * http://www.jernejbarbic.com/vega                                      *
+ *                                                                       *
+ * Research: Jernej Barbic, Hongyi Xu, Yijing Li,                        *
+ *           Danyong Zhao, Bohan Wang,                                   *
+ *           Fun Shing Sin, Daniel Schroeder,                            *
+ *           Doug L. James, Jovan Popovic                                *
+ *                                                                       *
+ * Funding: National Science Foundation, Link Foundation,                *
+ *          Singapore-MIT GAMBIT Game Lab,                               *
+ *          Zumberge Research and Innovation Fund at USC,                *
+ *          Sloan Foundation, Okawa Foundation,                          *
+ *          USC Annenberg Foundation                                     *
+ *                                                                       *
+ * This library is free software; you can redistribute it and/or         *
+ * modify it under the terms of the BSD-style license that is            *
+ * included with this library in the file LICENSE.txt                    *
+ *                                                                       *
+ * This library is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the file     *
+ * LICENSE.TXT for more details.                                         *
+ *                                                                       *
+ *************************************************************************/
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "computeStiffnessMatrixNullspace.h"
+#include "constrainedDOFs.h"
+#include "smoothedAggregationPreconditioner.h"
+
+namespace vegafem
+{
+
+int SmoothedAggregationPreconditioner::maxNumLevels = 10;
+int SmoothedAggregationPreconditioner::maxCoarseSize = 500;
+int SmoothedAggregationPreconditioner::numCoarseSweeps = 4;
+double SmoothedAggregationPreconditioner::strengthThreshold = 0.08;
+
+SmoothedAggregationPreconditioner::SmoothedAggregationPreconditioner(const SparseMatrix * A, int nullspaceDimension, const double * nullspaceBasis, int blockSize, int verbose_): verbose(verbose_)
+{
+  Setup(A, nullspaceDimension, nullspaceBasis, blockSize);
+}
+
+SmoothedAggregationPreconditioner::SmoothedAggregationPreconditioner(const SparseMatrix * A, int numVertices, const double * vertexPositions, int numConstrainedDOFs, const int * constrainedDOFs, int verbose_): verbose(verbose_)
+{
+  int r = 3 * numVertices;
+  if (A->GetNumRows() != r - numConstrainedDOFs)
+  {
+    printf("Error: SmoothedAggregationPreconditioner: matrix has %d rows, expected %d.\n", A->GetNumRows(), r - numConstrainedDOFs);
+    throw 1;
+  }
+
+  // the six rigid-body modes
+  const int nullspaceDimension = 6;
+  std::vector<double> basis(r * nullspaceDimension);
+  ComputeStiffnessMatrixNullspace::ComputeNullspace(numVertices, vertexPositions, basis.data(), 1);
+  std::vector<double> constrainedBasis((r - numConstrainedDOFs) * nullspaceDimension);
+  for(int i=0; i<nullspaceDimension; i++)
+    ConstrainedDOFs::RemoveDOFs(r, &constrainedBasis[(r - numConstrainedDOFs) * i], &basis[r * i], numConstrainedDOFs, constrainedDOFs);
+
+  // removing entire vertices preserves the vertex structure of the DOFs
+  bool entireVertices = (numConstrainedDOFs % 3 == 0);
+  for(int i=0; entireVertices && (i<numConstrainedDOFs); i+=3)
+    entireVertices = (constrainedDOFs[i] % 3 == 0) && (constrainedDOFs[i+1] == constrainedDOFs[i] + 1) && (constrainedDOFs[i+2] == constrainedDOFs[i] + 2);
+
+  Setup(A, nullspaceDimension, constrainedBasis.data(), entireVertices ? 3 : 1);
+}
+
+SmoothedAggregationPreconditioner::~SmoothedAggregationPreconditioner() {}
+
+void SmoothedAggregationPreconditioner::CopyMatrix(const SparseMatrix * A, CSRMatrix * M)
+{
+  int n = A->GetNumRows();
+  M->numRows = n;
+  M->numColumns = n;
+  M->rowOffsets.resize(n + 1);
+  M->rowOffsets[0] = 0;
+  for(int i=0; i<n; i++)
+    M->rowOffsets[i+1] = M->rowOffsets[i] + A->GetRowLength(i);
+  M->columnIndices.resize(M->rowOffsets[n]);
+  M->entries.resize(M->rowOffsets[n]);
+
+  std::vector<std::pair<int, double> > row;
+  for(int i=0; i<n; i++)
+  {
+    row.clear();
+    for(int j=0; j<A->GetRowLength(i); j++)
+      row.push_back(std::make_pair(A->GetColumnIndex(i, j), A->GetEntry(i, j)));
+    std::sort(row.begin(), row.end());
+    for(size_t j=0; j<row.size(); j++)
+    {
+      M->columnIndices[M->rowOffsets[i] + j] = row[j].first;
+      M->entries[M->rowOffsets[i] + j] = row[j].second;
+    }
+  }
+}
+
+void SmoothedAggregationPreconditioner::Setup(const SparseMatrix * A, int nullspaceDimension, const double * nullspaceBasis, int blockSize)
+{
+  levels.resize(1);
+  CopyMatrix(A, &levels[0].A);
+
+  // build the aggregates and tentative prolongators, level by level
+  // the Galerkin products are needed to aggregate the next level; they are recomputed in ComputeCoarseMatrices
+  std::vector<double> basis(nullspaceBasis, nullspaceBasis + A->GetNumRows() * nullspaceDimension);
+  std::vector<double> coarseBasis;
+  while (((int)levels.size() < maxNumLevels) && (levels.back().A.numRows > maxCoarseSize))
+  {
+    int level = (int)levels.size() - 1;
+    BuildTentativeProlongator(level, nullspaceDimension, basis, blockSize, coarseBasis);
+    int numCoarseRows = levels[level].tentativeP.numColumns;
+    if (numCoarseRows >= levels[level].A.numRows)
+      break; // no coarsening
+
+    levels.resize(levels.size() + 1);
+    Level & fine = levels[level];
+    Level & coarse = levels[level+1];
+    ComputeInverseDiagonal(fine);
+    Transpose(fine.tentativeP, &fine.R);
+    CSRMatrix AP;
+    Multiply(fine.A, fine.tentativeP, &AP);
+    Multiply(fine.R, AP, &coarse.A);
+
+    // coarse nodes are the aggregates, each with nullspaceDimension DOFs
+    basis.swap(coarseBasis);
+    blockSize = nullspaceDimension;
+  }
+
+  ComputeCoarseMatrices();
+  if (verbose)
+  {
+    for(int level=0; level<(int)levels.size(); level++)
+      printf("AMG level %d: %d rows, %d entries\n", level, GetNumRows(level), GetNumEntries(level));
+  }
+}
+
+void SmoothedAggregationPreconditioner::BuildTentativeProlongator(int level, int nullspaceDimension, const std::vector<double> & basis, int blockSize, std::vector<double> & coarseBasis)
+{
+  const CSRMatrix & A = levels[level].A;
+  int n = A.numRows;
+  int numNodes = n / blockSize;
+  double threshold = strengthThreshold * pow(0.5, level);
+
+  // node graph, with the Frobenius norms of the blocks
+  std::vector<int> nodeOffsets(numNodes + 1, 0);
+  std::vector<int> nodeNeighbors;
+  std::vector<double> nodeNorms;
+  std::vector<int> position(numNodes, -1);
+  for(int node=0; node<numNodes; node++)
+  {
+    int start = (int)nodeNeighbors.size();
+    for(int row=node*blockSize; row<(node+1)*blockSize; row++)
+    {
+      for(int e=A.rowOffsets[row]; e<A.rowOffsets[row+1]; e++)
+      {
+        int neighbor = A.columnIndices[e] / blockSize;
+        if (position[neighbor] < start)
+        {
+          position[neighbor] = (int)nodeNeighbors.size();
+          nodeNeighbors.push_back(neighbor);
+          nodeNorms.push_back(0.0);
+        }
+        nodeNorms[position[neighbor]] += A.entries[e] * A.entries[e];
+      }
+    }
+    nodeOffsets[node+1] = (int)nodeNeighbors.size();
+  }
+
+  std::vector<double> diagonalNorms(numNodes, 0.0);
+  for(int node=0; node<numNodes; node++)
+    for(int e=nodeOffsets[node]; e<nodeOffsets[node+1]; e++)
+      if (nodeNeighbors[e] == node)
+        diagonalNorms[node] = sqrt(nodeNorms[e]);
+
+  // keep only the strong connections (excluding the diagonal)
+  std::vector<int> strongOffsets(numNodes + 1, 0);
+  std::vector<int> strongNeighbors;
+  for(int node=0; node<numNodes; node++)
+  {
+    for(int e=nodeOffsets[node]; e<nodeOffsets[node+1]; e++)
+    {
+      int neighbor = nodeNeighbors[e];
+      if ((neighbor != node) && (sqrt(nodeNorms[e]) >= threshold * sqrt(diagonalNorms[node] * diagonalNorms[neighbor])))
+        strongNeighbors.push_back(neighbor);
+    }
+    strongOffsets[node+1] = (int)strongNeighbors.size();
+  }
+
+  // aggregation
+  std::vector<int> aggregate(numNodes, -1);
+  int numAggregates = 0;
+  // pass 1: nodes whose strong neighborhood is entirely unaggregated form a new aggregate with their neighborhood
+  for(int node=0; node<numNodes; node++)
+  {
+    if ((aggregate[node] >= 0) || (strongOffsets[node] == strongOffsets[node+1]))
+      continue;
+    bool free = true;
+    for(int e=strongOffsets[node]; free && (e<strongOffsets[node+1]); e++)
+      free = (aggregate[strongNeighbors[e]] < 0);
+    if (!free)
+      continue;
+    aggregate[node] = numAggregates;
+    for(int e=strongOffsets[node]; e<strongOffsets[node+1]; e++)
+      aggregate[strongNeighbors[e]] = numAggregates;
+    numAggregates++;
+  }
+  // pass 2: the remaining nodes join an aggregate of a strong neighbor (from pass 1)
+  std::vector<int> pass1Aggregate = aggregate;
+  for(int node=0; node<numNodes; node++)
+  {
+    if (aggregate[node] >= 0)
+      continue;
+    for(int e=strongOffsets[node]; e<strongOffsets[node+1]; e++)
+    {
+      if (pass1Aggregate[strongNeighbors[e]] >= 0)
+      {
+        aggregate[node] = pass1Aggregate[strongNeighbors[e]];
+        break;
+      }
+    }
+  }
+  // pass 3: the rest form aggregates with their unaggregated strong neighbors (isolated nodes become single-node aggregates)
+  for(int node=0; node<numNodes; node++)
+  {
+    if (aggregate[node] >= 0)
+      continue;
+    aggregate[node] = numAggregates;
+    for(int e=strongOffsets[node]; e<strongOffsets[node+1]; e++)
+      if (aggregate[strongNeighbors[e]] < 0)
+        aggregate[strongNeighbors[e]] = numAggregates;
+    numAggregates++;
+  }
+
+  // nodes of each aggregate
+  std::vector<int> aggregateOffsets(numAggregates + 1, 0);
+  for(int node=0; node<numNodes; node++)
+    aggregateOffsets[aggregate[node] + 1]++;
+  for(int a=0; a<numAggregates; a++)
+    aggregateOffsets[a+1] += aggregateOffsets[a];
+  std::vector<int> aggregateNodes(numNodes);
+  std::vector<int> fill(aggregateOffsets.begin(), aggregateOffsets.end() - 1);
+  for(int node=0; node<numNodes; node++)
+    aggregateNodes[fill[aggregate[node]]++] = node;
+
+  // tentative prolongator: orthonormalize (modified Gram-Schmidt) the nullspace vectors restricted to each aggregate, Q * R;
+  // Q gives the rows of the prolongator, R the coarse nullspace
+  int k = nullspaceDimension;
+  int numCoarseRows = k * numAggregates;
+  CSRMatrix & P = levels[level].tentativeP;
+  P.numRows = n;
+  P.numColumns = numCoarseRows;
+  P.rowOffsets.assign(n + 1, 0);
+  P.columnIndices.assign(n * k, 0);
+  P.entries.assign(n * k, 0.0);
+  coarseBasis.assign(numCoarseRows * k, 0.0);
+  std::vector<double> Q;
+  for(int a=0; a<numAggregates; a++)
+  {
+    int numAggregateRows = blockSize * (aggregateOffsets[a+1] - aggregateOffsets[a]);
+    Q.resize(numAggregateRows * k);
+    for(int j=0; j<k; j++)
+      for(int node=aggregateOffsets[a]; node<aggregateOffsets[a+1]; node++)
+        for(int dof=0; dof<blockSize; dof++)
+          Q[numAggregateRows * j + blockSize * (node - aggregateOffsets[a]) + dof] = basis[n * j + blockSize * aggregateNodes[node] + dof];
+
+    for(int j=0; j<k; j++)
+    {
+      double * qj = &Q[numAggregateRows * j];
+      double originalNorm2 = 0.0;
+      for(int i=0; i<numAggregateRows; i++)
+        originalNorm2 += qj[i] * qj[i];
+      for(int l=0; l<j; l++)
+      {
+        double * ql = &Q[numAggregateRows * l];
+        double dot = 0.0;
+        for(int i=0; i<numAggregateRows; i++)
+          dot += ql[i] * qj[i];
+        for(int i=0; i<numAggregateRows; i++)
+          qj[i] -= dot * ql[i];
+        coarseBasis[numCoarseRows * j + k * a + l] = dot;
+      }
+      double norm2 = 0.0;
+      for(int i=0; i<numAggregateRows; i++)
+        norm2 += qj[i] * qj[i];
+      // a vector that is (nearly) dependent on the previous ones within this aggregate gives a zero column in P
+      double norm = (norm2 > 1E-20 * originalNorm2) ? sqrt(norm2) : 0.0;
+      double invNorm = (norm > 0.0) ? 1.0 / norm : 0.0;
+      for(int i=0; i<numAggregateRows; i++)
+        qj[i] *= invNorm;
+      coarseBasis[numCoarseRows * j + k * a + j] = norm;
+    }
+
+    for(int node=aggregateOffsets[a]; node<aggregateOffsets[a+1]; node++)
+      for(int dof=0; dof<blockSize; dof++)
+      {
+        int row = blockSize * aggregateNodes[node] + dof;
+        int localRow = blockSize * (node - aggregateOffsets[a]) + dof;
+        for(int j=0; j<k; j++)
+        {
+          P.columnIndices[k * row + j] = k * a + j;
+          P.entries[k * row + j] = Q[numAggregateRows * j + localRow];
+        }
+      }
+  }
+  for(int row=0; row<n; row++)
+    P.rowOffsets[row+1] = k * (row + 1);
+}
+
+void SmoothedAggregationPreconditioner::ComputeInverseDiagonal(Level & level)
+{
+  const CSRMatrix & A = level.A;
+  level.invDiagonal.assign(A.numRows, 0.0);
+  for(int i=0; i<A.numRows; i++)
+    for(int e=A.rowOffsets[i]; e<A.rowOffsets[i+1]; e++)
+      if ((A.columnIndices[e] == i) && (A.entries[e] != 0.0))
+        level.invDiagonal[i] = 1.0 / A.entries[e];
+}
+
+void SmoothedAggregationPreconditioner::FactorMatrix(const SparseMatrix * A)
+{
+  CopyMatrix(A, &levels[0].A);
+  ComputeCoarseMatrices();
+}
+
+void SmoothedAggregationPreconditioner::ComputeCoarseMatrices()
+{
+  int numLevels = (int)levels.size();
+  for(int level=0; level<numLevels-1; level++)
+  {
+    Level & fine = levels[level];
+    ComputeInverseDiagonal(fine);
+    const CSRMatrix & A = fine.A;
+    int n = A.numRows;
+
+    // estimate the spectral radius of D^{-1} A with power iterations
+    std::vector<double> v(n), w(n);
+    for(int i=0; i<n; i++)
+      v[i] = 1.0 + 0.1 * (i % 7);
+    double rho = 1.0;
+    for(int iter=0; iter<20; iter++)
+    {
+      A.MultiplyVector(v.data(), w.data());
+      double norm2 = 0.0, w2 = 0.0;
+      for(int i=0; i<n; i++)
+      {
+        w[i] *= fine.invDiagonal[i];
+        norm2 += v[i] * v[i];
+        w2 += w[i] * w[i];
+      }
+      if (w2 == 0.0)
+        break;
+      rho = sqrt(w2 / norm2);
+      double invNorm = 1.0 / sqrt(w2);
+      for(int i=0; i<n; i++)
+        v[i] = w[i] * invNorm;
+    }
+
+    // P = (I - omega D^{-1} A) * tentativeP
+    double omega = 4.0 / (3.0 * rho);
+    CSRMatrix AP;
+    Multiply(A, fine.tentativeP, &AP);
+    for(int i=0; i<n; i++)
+      for(int e=AP.rowOffsets[i]; e<AP.rowOffsets[i+1]; e++)
+        AP.entries[e] *= -omega * fine.invDiagonal[i];
+    // AP's sparsity structure contains the one of tentativeP (A has a non-zero diagonal), so the sum is computed in place
+    const CSRMatrix & T = fine.tentativeP;
+    for(int i=0; i<n; i++)
+    {
+      int e = AP.rowOffsets[i];
+      for(int t=T.rowOffsets[i]; t<T.rowOffsets[i+1]; t++)
+      {
+        while ((e < AP.rowOffsets[i+1]) && (AP.columnIndices[e] < T.columnIndices[t]))
+          e++;
+        if ((e < AP.rowOffsets[i+1]) && (AP.columnIndices[e] == T.columnIndices[t]))
+          AP.entries[e] += T.entries[t];
+      }
+    }
+    fine.P.numRows = AP.numRows;
+    fine.P.numColumns = AP.numColumns;
+    fine.P.rowOffsets.swap(AP.rowOffsets);
+    fine.P.columnIndices.swap(AP.columnIndices);
+    fine.P.entries.swap(AP.entries);
+
+    // coarse A = P^T * A * P
+    Transpose(fine.P, &fine.R);
+    Multiply(A, fine.P, &AP);
+    Multiply(fine.R, AP, &levels[level+1].A);
+
+    fine.x.resize(n);
+    fine.b.resize(n);
+    fine.residual.resize(n);
+  }
+
+  // dense Cholesky factorization of the coarsest matrix
+  Level & coarsest = levels[numLevels-1];
+  const CSRMatrix & A = coarsest.A;
+  int n = A.numRows;
+  coarsest.x.resize(n);
+  coarsest.b.resize(n);
+  coarsest.residual.resize(n);
+  coarseDirectSolve = (n <= maxCoarseSize);
+  if (!coarseDirectSolve)
+  {
+    // the coarsening stalled, or maxNumLevels was reached: a dense factorization would take O(n^2) memory and O(n^3) time
+    coarseCholesky.clear();
+    ComputeInverseDiagonal(coarsest);
+    return;
+  }
+  coarseCholesky.assign(n * n, 0.0);
+  double maxDiagonal = 0.0;
+  for(int i=0; i<n; i++)
+    for(int e=A.rowOffsets[i]; e<A.rowOffsets[i+1]; e++)
+    {
+      coarseCholesky[n * i + A.columnIndices[e]] = A.entries[e];
+      if (A.columnIndices[e] == i)
+        maxDiagonal = std::max(maxDiagonal, fabs(A.entries[e]));
+    }
+  for(int j=0; j<n; j++)
+  {
+    double * Lj = &coarseCholesky[n * j];
+    double pivot = Lj[j];
+    for(int l=0; l<j; l++)
+      pivot -= Lj[l] * Lj[l];
+    if (pivot <= 1E-12 * maxDiagonal)
+    {
+      // zero coarse DOF (a zero column of P), or a (numerically) singular coarse matrix: decouple this DOF
+      pivot = (maxDiagonal > 0.0) ? maxDiagonal : 1.0;
+      for(int l=0; l<j; l++)
+        Lj[l] = 0.0;
+      for(int i=j+1; i<n; i++)
+        coarseCholesky[n * i + j] = 0.0;
+    }
+    Lj[j] = sqrt(pivot);
+    for(int i=j+1; i<n; i++)
+    {
+      double * Li = &coarseCholesky[n * i];
+      double sum = Li[j];
+      for(int l=0; l<j; l++)
+        sum -= Li[l] * Lj[l];
+      Li[j] = sum / Lj[j];
+    }
+  }
+}
+
+int SmoothedAggregationPreconditioner::SolveLinearSystem(double * x, const double * rhs)
+{
+  Level & finest = levels[0];
+  memcpy(finest.b.data(), rhs, sizeof(double) * finest.A.numRows);
+  VCycle(0);
+  memcpy(x, finest.x.data(), sizeof(double) * finest.A.numRows);
+  return 0;
+}
+
+void SmoothedAggregationPreconditioner::VCycle(int levelIndex)
+{
+  Level & level = levels[levelIndex];
+  const CSRMatrix & A = level.A;
+  int n = A.numRows;
+  double * x = level.x.data();
+  const double * b = level.b.data();
+
+  if ((levelIndex == (int)levels.size() - 1) && !coarseDirectSolve)
+  {
+    // large coarsest level: symmetric Gauss-Seidel sweeps, starting from x = 0 (a symmetric operator, like the rest of the V-cycle)
+    memset(x, 0, sizeof(double) * n);
+    for(int sweep=0; sweep<numCoarseSweeps; sweep++)
+    {
+      for(int pass=0; pass<2; pass++)
+        for(int k=0; k<n; k++)
+        {
+          int i = (pass == 0) ? k : n - 1 - k;
+          if (level.invDiagonal[i] == 0.0)
+            continue;
+          double sum = b[i];
+          for(int e=A.rowOffsets[i]; e<A.rowOffsets[i+1]; e++)
+            if (A.columnIndices[e] != i)
+              sum -= A.entries[e] * x[A.columnIndices[e]];
+          x[i] = sum * level.invDiagonal[i];
+        }
+    }
+    return;
+  }
+
+  if (levelIndex == (int)levels.size() - 1)
+  {
+    // coarsest level: L * L^T * x = b
+    for(int i=0; i<n; i++)
+    {
+      const double * Li = &coarseCholesky[n * i];
+      double sum = b[i];
+      for(int l=0; l<i; l++)
+        sum -= Li[l] * x[l];
+      x[i] = sum / Li[i];
+    }
+    for(int i=n-1; i>=0; i--)
+    {
+      x[i] /= coarseCholesky[n * i + i];
+      for(int l=0; l<i; l++)
+        x[l] -= coarseCholesky[n * i + l] * x[i];
+    }
+    return;
+  }
+
+  // pre-smoothing: forward Gauss-Seidel, starting from x = 0
+  for(int i=0; i<n; i++)
+  {
+    double sum = b[i];
+    for(int e=A.rowOffsets[i]; e<A.rowOffsets[i+1]; e++)
+      if (A.columnIndices[e] < i)
+        sum -= A.entries[e] * x[A.columnIndices[e]];
+    x[i] = sum * level.invDiagonal[i];
+  }
+
+  // coarse-grid correction
+  double * residual = level.residual.data();
+  A.MultiplyVector(x, residual);
+  for(int i=0; i<n; i++)
+    residual[i] = b[i] - residual[i];
+  Level & coarse = levels[levelIndex+1];
+  level.R.MultiplyVector(residual, coarse.b.data());
+  VCycle(levelIndex+1);
+  level.P.MultiplyVectorAdd(coarse.x.data(), x);
+
+  // post-smoothing: backward Gauss-Seidel
+  for(int i=n-1; i>=0; i--)
+  {
+    if (level.invDiagonal[i] == 0.0)
+      continue;
+    double sum = b[i];
+    for(int e=A.rowOffsets[i]; e<A.rowOffsets[i+1]; e++)
+      if (A.columnIndices[e] != i)
+        sum -= A.entries[e] * x[A.columnIndices[e]];
+    x[i] = sum * level.invDiagonal[i];
+  }
+}
+
+void SmoothedAggregationPreconditioner::CSRMatrix::MultiplyVector(const double * x, double * y) const
+{
+  for(int i=0; i<numRows; i++)
+  {
+    double sum = 0.0;
+    for(int e=rowOffsets[i]; e<rowOffsets[i+1]; e++)
+      sum += entries[e] * x[columnIndices[e]];
+    y[i] = sum;
+  }
+}
+
+void SmoothedAggregationPreconditioner::CSRMatrix::MultiplyVectorAdd(const double * x, double * y) const
+{
+  for(int i=0; i<numRows; i++)
+  {
+    double sum = 0.0;
+    for(int e=rowOffsets[i]; e<rowOffsets[i+1]; e++)
+      sum += entries[e] * x[columnIndices[e]];
+    y[i] += sum;
+  }
+}
+
+void SmoothedAggregationPreconditioner::Transpose(const CSRMatrix & M, CSRMatrix * MT)
+{
+  MT->numRows = M.numColumns;
+  MT->numColumns = M.numRows;
+  MT->rowOffsets.assign(M.numColumns + 1, 0);
+  for(size_t e=0; e<M.columnIndices.size(); e++)
+    MT->rowOffsets[M.columnIndices[e] + 1]++;
+  for(int i=0; i<M.numColumns; i++)
+    MT->rowOffsets[i+1] += MT->rowOffsets[i];
+  MT->columnIndices.resize(M.columnIndices.size());
+  MT->entries.resize(M.entries.size());
+  std::vector<int> fill(MT->rowOffsets.begin(), MT->rowOffsets.end() - 1);
+  // rows of M are visited in increasing order, so the columns of MT are sorted
+  for(int i=0; i<M.numRows; i++)
+    for(int e=M.rowOffsets[i]; e<M.rowOffsets[i+1]; e++)
+    {
+      int pos = fill[M.columnIndices[e]]++;
+      MT->columnIndices[pos] = i;
+      MT->entries[pos] = M.entries[e];
+    }
+}
+
+void SmoothedAggregationPreconditioner::Multiply(const CSRMatrix & M1, const CSRMatrix & M2, CSRMatrix * M1M2)
+{
+  // Gustavson's algorithm, with a dense accumulator
+  M1M2->numRows = M1.numRows;
+  M1M2->numColumns = M2.numColumns;
+  M1M2->rowOffsets.assign(M1.numRows + 1, 0);
+  M1M2->columnIndices.clear();
+  M1M2->entries.clear();
+  std::vector<int> position(M2.numColumns, -1);
+  std::vector<double> accumulator(M2.numColumns, 0.0);
+  std::vector<int> rowColumns;
+  for(int i=0; i<M1.numRows; i++)
+  {
+    rowColumns.clear();
+    for(int e1=M1.rowOffsets[i]; e1<M1.rowOffsets[i+1]; e1++)
+    {
+      int k = M1.columnIndices[e1];
+      double value = M1.entries[e1];
+      for(int e2=M2.rowOffsets[k]; e2<M2.rowOffsets[k+1]; e2++)
+      {
+        int column = M2.columnIndices[e2];
+        if (position[column] != i)
+        {
+          position[column] = i;
+          accumulator[column] = 0.0;
+          rowColumns.push_back(column);
+        }
+        accumulator[column] += value * M2.entries[e2];
+      }
+    }
+    std::sort(rowColumns.begin(), rowColumns.end());
+    for(size_t j=0; j<rowColumns.size(); j++)
+    {
+      M1M2->columnIndices.push_back(rowColumns[j]);
+      M1M2->entries.push_back(accumulator[rowColumns[j]]);
+    }
+    M1M2->rowOffsets[i+1] = (int)M1M2->columnIndices.size();
+  }
+}
+
+}//namespace vegafem
+
@@ -0,0 +1,134 @@
+/*************************************************************************
+ *                                                                       *
+ * Vega FEM Simulation Library Version 4.0                               *
+ *                                                                       *
+ * "sparseSolver" library , Copyright (C) 2007 CMU, 2009 MIT, 2018 USC   *
+ * All rights reserved.                                                  *
+ *                                                                       *
+ * Code author: Jernej Barbic                                            *
+ * http://www.jernejbarbic.com/vega                                      *
+ *                                                                       *
+ * Research: Jernej Barbic, Hongyi Xu, Yijing Li,                        *
+ *           Danyong Zhao, Bohan Wang,                                   *
+ *           Fun Shing Sin, Daniel Schroeder,                            *
+ *           Doug L. James, Jovan Popovic                                *
+ *                                                                       *
+ * Funding: National Science Foundation, Link Foundation,                *
+ *          Singapore-MIT GAMBIT Game Lab,                               *
+ *          Zumberge Research and Innovation Fund at USC,                *
+ *          Sloan Foundation, Okawa Foundation,                          *
+ *          USC Annenberg Foundation                                     *
+ *                                                                       *
+ * This library is free software; you can redistribute it and/or         *
+ * modify it under the terms of the BSD-style license that is            *
+ * included with this library in the file LICENSE.txt                    *
+ *                                                                       *
+ * This library is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the file     *
+ * LICENSE.TXT for more details.                                         *
+ *                                                                       *
+ *************************************************************************/
+
+#ifndef VEGAFEM_SMOOTHEDAGGREGATIONPRECONDITIONER_H
+#define VEGAFEM_SMOOTHEDAGGREGATIONPRECONDITIONER_H
+
+/*
+  Smoothed-aggregation algebraic multigrid (AMG) preconditioner for symmetric positive-definite matrices,
+  following Vanek, Mandel, Brezina: Algebraic Multigrid by Smoothed Aggregation for Second and Fourth Order Elliptic Problems, 
+  Computing 56, 1996.
+
+  Setup:
+    1. The nodes of the matrix graph (groups of "blockSize" consecutive DOFs, e.g., the vertices of a FEM mesh) 
+       are grouped into small aggregates, following the strong connections of the matrix.
+    2. The tentative prolongator restricts the near-nullspace vectors (e.g., the six rigid-body modes of an elastic object, 
+       see computeStiffnessMatrixNullspace.h) to each aggregate, and orthonormalizes them. The coarse space therefore 
+       represents the near-nullspace exactly, which is what makes the method effective for elasticity.
+    3. The prolongator P is the tentative prolongator, smoothed with one damped Jacobi step. The coarse matrix is P^T * A * P.
+  Steps 1-3 are repeated on the coarse matrix, until it is small enough to be factored with dense Cholesky.
+  If the coarsening stalls, or maxNumLevels is reached first, the coarsest matrix is too large for a dense factorization;
+  the coarsest level is then solved approximately, with numCoarseSweeps symmetric Gauss-Seidel sweeps.
+
+  "Solving" the system performs one V-cycle, with a forward Gauss-Seidel pre-smoothing and a backward Gauss-Seidel post-smoothing sweep. 
+  The V-cycle is a symmetric operator, so it can be used as a preconditioner with CGSolver::SolveLinearSystemWithPreconditioner.
+  See also blockJacobiPreconditioner.h and incompleteCholeskyPreconditioner.h .
+*/
+
+#include <vector>
+#include "linearSolver.h"
+#include "sparseMatrix.h"
+
+namespace vegafem
+{
+
+class SmoothedAggregationPreconditioner : public LinearSolver
+{
+public:
+  // A: symmetric positive-definite matrix
+  // nullspaceBasis: "nullspaceDimension" vectors that A maps to zero or nearly zero (column-major, numRows(A) x nullspaceDimension)
+  // blockSize: number of consecutive DOFs that form a node (3 for FEM meshes with vertices, 1 for scalar problems)
+  SmoothedAggregationPreconditioner(const SparseMatrix * A, int nullspaceDimension, const double * nullspaceBasis, int blockSize=3, int verbose=0);
+  // same as above, using the six rigid-body modes of a mesh with numVertices vertices at "vertexPositions" as the nullspace;
+  // A is the 3n x 3n stiffness (or system) matrix, with the constrained DOFs removed (constrainedDOFs must be sorted, 0-indexed)
+  SmoothedAggregationPreconditioner(const SparseMatrix * A, int numVertices, const double * vertexPositions, int numConstrainedDOFs=0, const int * constrainedDOFs=NULL, int verbose=0);
+  virtual ~SmoothedAggregationPreconditioner();
+
+  // recomputes the coarse matrices; must be called after the entries of A change (the topology of A must not change)
+  // the aggregates and the tentative prolongators are kept
+  void FactorMatrix(const SparseMatrix * A);
+
+  // applies one V-cycle: x ~= inv(A) * rhs
+  virtual int SolveLinearSystem(double * x, const double * rhs);
+
+  inline int GetNumLevels() const { return (int)levels.size(); }
+  inline int GetNumRows(int level) const { return levels[level].A.numRows; }
+  inline int GetNumEntries(int level) const { return (int)levels[level].A.columnIndices.size(); }
+
+  // setup parameters (must be set before the constructor to have an effect)
+  static int maxNumLevels; // default: 10
+  static int maxCoarseSize; // the coarsest level is solved with dense Cholesky when it has at most this many rows; default: 500
+  static int numCoarseSweeps; // symmetric Gauss-Seidel sweeps on a coarsest level with more than maxCoarseSize rows; default: 4
+  static double strengthThreshold; // connection (i,j) is strong if |A_ij| >= threshold * sqrt(|A_ii| |A_jj|) (block Frobenius norms); default: 0.08
+
+protected:
+  // compressed row storage, sorted columns
+  struct CSRMatrix
+  {
+    int numRows, numColumns;
+    std::vector<int> rowOffsets, columnIndices;
+    std::vector<double> entries;
+
+    void MultiplyVector(const double * x, double * y) const; // y = M * x
+    void MultiplyVectorAdd(const double * x, double * y) const; // y += M * x
+  };
+
+  struct Level
+  {
+    CSRMatrix A;
+    CSRMatrix tentativeP; // from the next coarser level to this level
+    CSRMatrix P, R; // smoothed prolongator, and restriction R = P^T
+    std::vector<double> invDiagonal; // 0 for rows with a zero diagonal
+    std::vector<double> x, b, residual;
+  };
+
+  std::vector<Level> levels;
+  std::vector<double> coarseCholesky; // dense Cholesky factor of the coarsest matrix (row-major, lower triangle)
+  bool coarseDirectSolve; // false if the coarsest matrix has more than maxCoarseSize rows (it is then smoothed instead of factored)
+  int verbose;
+
+  void Setup(const SparseMatrix * A, int nullspaceDimension, const double * nullspaceBasis, int blockSize);
+  void CopyMatrix(const SparseMatrix * A, CSRMatrix * M);
+  // aggregation and tentative prolongator of one level; returns the coarse nullspace (column-major)
+  void BuildTentativeProlongator(int level, int nullspaceDimension, const std::vector<double> & nullspaceBasis, int blockSize, std::vector<double> & coarseNullspaceBasis);
+  void ComputeCoarseMatrices(); // smoothed prolongators and Galerkin products for all levels, coarse Cholesky factor
+  void ComputeInverseDiagonal(Level & level);
+  void VCycle(int level);
+
+  static void Transpose(const CSRMatrix & M, CSRMatrix * MT);
+  static void Multiply(const CSRMatrix & M1, const CSRMatrix & M2, CSRMatrix * M1M2);
+};
+
+}//namespace vegafem
+
+#endif
+
@@ -57,9 +57,24 @@ const int *CorotationalLinearFEMStencilForceModel::GetStencilVertexIndices(int s
   return corotationalLinearFEM->GetVolumetricMesh()->getVertexIndices(stencilId);
 }
 
-void CorotationalLinearFEMStencilForceModel::GetStencilLocalEnergyAndForceAndMatrix(int stencilType, int stencilId, const double * u, double * energy, double * internalForces, double * tangentStiffnessMatrix)
+void CorotationalLinearFEMStencilForceModel::GetStencilLocalEnergyAndForceAndMatrix(int, int stencilId, const double * u, double * energy, double * internalForces, double * tangentStiffnessMatrix)
 {
   corotationalLinearFEM->ComputeElementEnergyAndForceAndStiffnessMatrix(stencilId, u, energy, internalForces, tangentStiffnessMatrix, warp);
 }
 
+void CorotationalLinearFEMStencilForceModel::GetStencilLocalDeformation(int stencilType, int stencilId, const double * u, double * deformation)
+{
+  assert(stencilType == 0);
+
+  corotationalLinearFEM->ComputeElementDeformationGradient(stencilId, u, deformation);
+}
+
+void CorotationalLinearFEMStencilForceModel::SetSinglePrecision(bool singlePrecision)
+{
+  if (singlePrecision)
+    corotationalLinearFEM->SetPackedStiffnessMatrices(true, true);
+  else if (GetSinglePrecision())
+    corotationalLinearFEM->SetPackedStiffnessMatrices(false);
+}
+
 }//namespace vegafem
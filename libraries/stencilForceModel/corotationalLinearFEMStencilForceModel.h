@@ -51,9 +51,22 @@ public:
   virtual const int *GetStencilVertexIndices(int stencilType, int stencilId) const override;
   virtual void GetStencilLocalEnergyAndForceAndMatrix(int stencilType, int stencilId, const double * u, double * energy, double * internalForces, double * tangentStiffnessMatrix) override;
 
+  // the deformation measure is the deformation gradient of the element; see CorotationalLinearFEM::ComputeElementDeformationGradient
+  virtual int GetStencilLocalDeformationSize(int) const override { return 9; }
+  virtual void GetStencilLocalDeformation(int stencilType, int stencilId, const double * u, double * deformation) override;
+
   CorotationalLinearFEM * GetForceModelHandle() { return corotationalLinearFEM; }
   void SetWarp(int warp) { this->warp = warp; }
 
+  // Single precision: if enabled, the undeformed element stiffness matrices are stored in packed form, in single precision
+  // (78 floats per tet instead of 144 doubles; see CorotationalLinearFEM::SetPackedStiffnessMatrices); the element algebra stays in double.
+  // This is a setting of the CorotationalLinearFEM object, shared by all its users. Disabling it restores full double-precision
+  // matrices, which keep the single-precision rounding. With warp=1, the packed warp kernel makes the element sweeps faster;
+  // with warp=0, the packed products are about 25% slower than the full matrices, so there the option only saves memory.
+  // Default: disabled.
+  void SetSinglePrecision(bool singlePrecision);
+  bool GetSinglePrecision() const { return corotationalLinearFEM->GetSinglePrecisionStiffnessMatrices(); }
+
 protected:
   CorotationalLinearFEM * corotationalLinearFEM;
   int warp;
@@ -32,17 +32,18 @@
 
 #include "forceModelAssembler.h"
 #include <cassert>
+#include <cmath>
+#include <algorithm>
 
 namespace vegafem
 {
 
 using namespace std;
 
-ForceModelAssembler::ForceModelAssembler(StencilForceModel *eleFM) : stencilForceModel(eleFM)
+ForceModelAssembler::ForceModelAssembler(StencilForceModel *eleFM, assemblyModeType assemblyMode_) : stencilForceModel(eleFM), assemblyMode(assemblyMode_)
 {
   r = stencilForceModel->Getn3();
   SparseMatrixOutline *smo = new SparseMatrixOutline(r);
-  SparseMatrixOutline *smo1 = new SparseMatrixOutline(r / 3);
 
   for (int eltype = 0; eltype < stencilForceModel->GetNumStencilTypes(); eltype++) 
   {
@@ -56,7 +57,6 @@ ForceModelAssembler::ForceModelAssembler(StencilForceModel *eleFM) : stencilForc
         for (int vj = 0; vj < nelev; vj++) 
         {
           smo->AddBlock3x3Entry(vertexIndices[vi], vertexIndices[vj]);
-          smo1->AddEntry(vertexIndices[vi], vertexIndices[vj]);
         }
       }
     }
@@ -66,41 +66,32 @@ ForceModelAssembler::ForceModelAssembler(StencilForceModel *eleFM) : stencilForc
   Ktemplate = new SparseMatrix(smo);
   delete smo;
 
-  SparseMatrix *vertexK = new SparseMatrix(smo1);
-  delete smo1;
-
-  inverseIndices.resize(stencilForceModel->GetNumStencilTypes());
+  // precompute the locations of the stencil matrix entries in the stiffness matrix
+  stiffnessMatrixScatters.resize(stencilForceModel->GetNumStencilTypes());
   for (int eltype = 0; eltype < stencilForceModel->GetNumStencilTypes(); eltype++) 
   {
     int nelev = stencilForceModel->GetNumStencilVertices(eltype);
-    std::vector<int> &indices = inverseIndices[eltype];
-    indices.resize(nelev * nelev * stencilForceModel->GetNumStencils(eltype));
-
-    for (int ele = 0; ele < stencilForceModel->GetNumStencils(eltype); ele++) 
+    int nele = stencilForceModel->GetNumStencils(eltype);
+    std::vector<int> stencilVertices(nelev * nele);
+    for (int ele = 0; ele < nele; ele++) 
     {
       const int *vertexIndices = stencilForceModel->GetStencilVertexIndices(eltype, ele);
-      int *inverseVtxIdx = indices.data() + ele * nelev * nelev;
+      std::copy(vertexIndices, vertexIndices + nelev, stencilVertices.data() + ele * nelev);
+    }
 
-      for (int vi = 0; vi < nelev; vi++) 
-      {
-        for (int vj = 0; vj < nelev; vj++) 
-        {
-          int vtxColIdx = vertexK->GetInverseIndex(vertexIndices[vi], vertexIndices[vj]);
-          assert(vtxColIdx >= 0);
-          inverseVtxIdx[vj * nelev + vi] = vtxColIdx;
-        } // end vi
-      } // end vj
-    } // end ele
+    stiffnessMatrixScatters[eltype] = SparseMatrixScatter(Ktemplate, nele, nelev, stencilVertices.data());
   } // end ele type
 
-  delete vertexK;
+  stencilColors.resize(stencilForceModel->GetNumStencilTypes());
+  if (assemblyMode == COLORED_ASSEMBLY)
+    BuildStencilColors();
 
   // initialize all necessary buffers
   bufferExamplars.resize(stencilForceModel->GetNumStencilTypes());
   for (int eltype = 0; eltype < stencilForceModel->GetNumStencilTypes(); eltype++) 
   {
     int nelev = stencilForceModel->GetNumStencilVertices(eltype);
-    bufferExamplars[eltype].resize(nelev * 3 + nelev * nelev * 9);
+    bufferExamplars[eltype].resize(nelev * 6 + nelev * nelev * 9);
   }
 
 #ifdef VEGAFEM_USE_TBB
@@ -114,11 +105,24 @@ ForceModelAssembler::ForceModelAssembler(StencilForceModel *eleFM) : stencilForc
 
   internalForceVertexLocks = new tbb::spin_mutex[r / 3];
   stiffnessMatrixVertexRowLocks = new tbb::spin_mutex[r / 3];
+
+  if (assemblyMode == DETERMINISTIC_ASSEMBLY)
+  {
+    stencilSlots.resize(stencilForceModel->GetNumStencilTypes());
+    stencilEnergies.resize(stencilForceModel->GetNumStencilTypes());
+    for (int eltype = 0; eltype < stencilForceModel->GetNumStencilTypes(); eltype++) 
+    {
+      stencilSlots[eltype].resize(GetStencilSlotSize(eltype) * stencilForceModel->GetNumStencils(eltype));
+      stencilEnergies[eltype].resize(stencilForceModel->GetNumStencils(eltype));
+    }
+    BuildVertexIncidences();
+  }
 #endif
 }
 
 ForceModelAssembler::~ForceModelAssembler()
 {
+  delete incrementalStiffnessMatrix;
 #ifdef VEGAFEM_USE_TBB
   delete[] internalForceVertexLocks;
   delete[] stiffnessMatrixVertexRowLocks;
@@ -126,6 +130,147 @@ ForceModelAssembler::~ForceModelAssembler()
 #endif
 }
 
+void ForceModelAssembler::BuildStencilColors()
+{
+  // greedy coloring: each stencil gets the smallest color not yet used by any stencil sharing one of its vertices
+  int numVertices = stencilForceModel->Getn3() / 3;
+  for (int eltype = 0; eltype < stencilForceModel->GetNumStencilTypes(); eltype++) 
+  {
+    int nelev = stencilForceModel->GetNumStencilVertices(eltype);
+    int nele = stencilForceModel->GetNumStencils(eltype);
+
+    std::vector<std::vector<int>> vertexColors(numVertices); // colors of the stencils incident to each vertex
+    std::vector<int> colorStamp; // colorStamp[color] == ele if the color is forbidden for stencil ele
+    std::vector<std::vector<int>> & colors = stencilColors[eltype];
+    colors.clear();
+
+    for (int ele = 0; ele < nele; ele++) 
+    {
+      const int *vertexIndices = stencilForceModel->GetStencilVertexIndices(eltype, ele);
+      for (int v = 0; v < nelev; v++) 
+        for (int color : vertexColors[vertexIndices[v]])
+          colorStamp[color] = ele;
+
+      int color = 0;
+      while ((color < (int)colorStamp.size()) && (colorStamp[color] == ele))
+        color++;
+
+      if (color == (int)colors.size())
+      {
+        colors.emplace_back();
+        colorStamp.push_back(-1);
+      }
+      colors[color].push_back(ele);
+
+      for (int v = 0; v < nelev; v++) 
+        vertexColors[vertexIndices[v]].push_back(color);
+    } // end ele
+  } // end ele type
+}
+
+#ifdef VEGAFEM_USE_TBB
+void ForceModelAssembler::BuildVertexIncidences()
+{
+  int numVertices = stencilForceModel->Getn3() / 3;
+  vertexIncidenceOffsets.assign(numVertices + 1, 0);
+  for (int eltype = 0; eltype < stencilForceModel->GetNumStencilTypes(); eltype++) 
+  {
+    int nelev = stencilForceModel->GetNumStencilVertices(eltype);
+    for (int ele = 0; ele < stencilForceModel->GetNumStencils(eltype); ele++) 
+    {
+      const int *vertexIndices = stencilForceModel->GetStencilVertexIndices(eltype, ele);
+      for (int v = 0; v < nelev; v++) 
+        vertexIncidenceOffsets[vertexIndices[v] + 1]++;
+    }
+  }
+
+  for (int vi = 0; vi < numVertices; vi++) 
+    vertexIncidenceOffsets[vi + 1] += vertexIncidenceOffsets[vi];
+
+  // stencils are visited in (stencilType, stencilId) order, which fixes the summation order at each vertex
+  vertexIncidences.resize(3 * vertexIncidenceOffsets[numVertices]);
+  std::vector<int> fillPosition(vertexIncidenceOffsets.begin(), vertexIncidenceOffsets.end() - 1);
+  for (int eltype = 0; eltype < stencilForceModel->GetNumStencilTypes(); eltype++) 
+  {
+    int nelev = stencilForceModel->GetNumStencilVertices(eltype);
+    for (int ele = 0; ele < stencilForceModel->GetNumStencils(eltype); ele++) 
+    {
+      const int *vertexIndices = stencilForceModel->GetStencilVertexIndices(eltype, ele);
+      for (int v = 0; v < nelev; v++) 
+      {
+        int k = fillPosition[vertexIndices[v]]++;
+        vertexIncidences[3 * k + 0] = eltype;
+        vertexIncidences[3 * k + 1] = ele;
+        vertexIncidences[3 * k + 2] = v;
+      }
+    }
+  }
+}
+
+void ForceModelAssembler::GetEnergyAndForceAndMatrixDeterministic(const double * u, double * energy, double * internalForces, SparseMatrix * tangentStiffnessMatrix)
+{
+  // evaluate all stencils into their slots
+  tbb::parallel_for(0, stencilForceModel->GetNumStencilTypes(), 1, [&] (int eltype) 
+  {
+    int nele = stencilForceModel->GetNumStencils(eltype);
+    size_t slotSize = GetStencilSlotSize(eltype);
+    int nelev = stencilForceModel->GetNumStencilVertices(eltype);
+
+    tbb::parallel_for(0, nele, 1, [&] (int ele) 
+    {
+      double *fEle = stencilSlots[eltype].data() + ele * slotSize;
+      double *KEle = fEle + nelev * 3;
+
+      double energyEle = 0;
+
+      stencilForceModel->GetStencilLocalEnergyAndForceAndMatrix(eltype, ele, u,
+        (energy ? &energyEle : nullptr),
+        (internalForces ? fEle : nullptr),
+        (tangentStiffnessMatrix ? KEle : nullptr)
+      );
+
+      stencilEnergies[eltype][ele] = energyEle;
+    }, partitioners[eltype]);
+  });
+
+  // gather, in parallel over vertices; each vertex owns its force entries and its three matrix rows
+  if (internalForces || tangentStiffnessMatrix)
+  {
+    tbb::parallel_for(0, stencilForceModel->Getn3() / 3, [&] (int vIdxA) 
+    {
+      for (int k = vertexIncidenceOffsets[vIdxA]; k < vertexIncidenceOffsets[vIdxA + 1]; k++) 
+      {
+        int eltype = vertexIncidences[3 * k + 0];
+        int ele = vertexIncidences[3 * k + 1];
+        int va = vertexIncidences[3 * k + 2];
+
+        int nelev = stencilForceModel->GetNumStencilVertices(eltype);
+        const double *fEle = stencilSlots[eltype].data() + ele * GetStencilSlotSize(eltype);
+        const double *KEle = fEle + nelev * 3;
+
+        if (internalForces) 
+        {
+          internalForces[vIdxA * 3] += fEle[va * 3];
+          internalForces[vIdxA * 3 + 1] += fEle[va * 3 + 1];
+          internalForces[vIdxA * 3 + 2] += fEle[va * 3 + 2];
+        }
+
+        if (tangentStiffnessMatrix) 
+          stiffnessMatrixScatters[eltype].AddStencilVertexRows(ele, va, KEle, tangentStiffnessMatrix);
+      } // k
+    });
+  }
+
+  // the energy is summed in stencil order, same as in the single-threaded computation
+  if (energy) 
+  {
+    for (int eltype = 0; eltype < stencilForceModel->GetNumStencilTypes(); eltype++) 
+      for (double energyEle : stencilEnergies[eltype])
+        *energy += energyEle;
+  }
+}
+#endif
+
 void ForceModelAssembler::GetTangentStiffnessMatrixTopology(SparseMatrix ** tangentStiffnessMatrix)
 {
   *tangentStiffnessMatrix = new SparseMatrix(*Ktemplate);
@@ -136,175 +281,502 @@ void ForceModelAssembler::GetTangentStiffnessMatrixTopology(SparseMatrix ** tang
 void ForceModelAssembler::GetEnergyAndForceAndMatrix(const double * u, double * energy, double * internalForces, SparseMatrix * tangentStiffnessMatrix)
 {
   // reset to zero
+  if (energy)
+    *energy = 0.0;
+
   if (internalForces)
     memset(internalForces, 0, sizeof(double) * r);
 
+  if (tangentStiffnessMatrix && incrementalStiffness)
+  {
+    GetEnergyAndForceAndMatrixIncremental(u, energy, internalForces, tangentStiffnessMatrix);
+    return;
+  }
+
   if (tangentStiffnessMatrix)
     tangentStiffnessMatrix->ResetToZero();
 
+  // computes stencil 'ele' and adds its contribution into the global force vector and stiffness matrix;
+  // returns the stencil energy
+  // localBuffer must hold nelev * 3 + nelev * nelev * 9 doubles
+  // if useLocks is true, per-vertex locks guard the writes (only relevant with TBB)
+  auto addStencilContribution = [&] (int eltype, int ele, double * localBuffer, bool useLocks) -> double
+  {
+    int nelev = stencilForceModel->GetNumStencilVertices(eltype);
+    double *fEle = localBuffer;
+    double *KEle = localBuffer + nelev * 3;
+
+    double energyEle = 0;
+
+    stencilForceModel->GetStencilLocalEnergyAndForceAndMatrix(eltype, ele, u,
+      (energy ? &energyEle : nullptr),
+      (internalForces ? fEle : nullptr),
+      (tangentStiffnessMatrix ? KEle : nullptr)
+    );
+
+    const int *vIndices = stencilForceModel->GetStencilVertexIndices(eltype, ele);
+
+    if (internalForces) 
+    {
+      for (int v = 0; v < nelev; v++) 
+      {
 #ifdef VEGAFEM_USE_TBB
-  for (auto itt = energyLocalBuffer.begin(); itt != energyLocalBuffer.end(); ++itt)
-    *itt = 0.0;
+        if (useLocks)
+          internalForceVertexLocks[vIndices[v]].lock();
+#endif
 
-  tbb::parallel_for(0, stencilForceModel->GetNumStencilTypes(), 1, [&] (int eltype) 
+        internalForces[vIndices[v] * 3] += fEle[v * 3];
+        internalForces[vIndices[v] * 3 + 1] += fEle[v * 3 + 1];
+        internalForces[vIndices[v] * 3 + 2] += fEle[v * 3 + 2];
+
+#ifdef VEGAFEM_USE_TBB
+        if (useLocks)
+          internalForceVertexLocks[vIndices[v]].unlock();
+#endif
+      }
+    }
+
+    if (tangentStiffnessMatrix) 
+    {
+      const SparseMatrixScatter & scatter = stiffnessMatrixScatters[eltype];
+
+      // write matrices in place
+      for (int va = 0; va < nelev; va++) 
+      {
+#ifdef VEGAFEM_USE_TBB
+        if (useLocks)
+          stiffnessMatrixVertexRowLocks[vIndices[va]].lock();
+#endif
+
+        scatter.AddStencilVertexRows(ele, va, KEle, tangentStiffnessMatrix);
+
+#ifdef VEGAFEM_USE_TBB
+        if (useLocks)
+          stiffnessMatrixVertexRowLocks[vIndices[va]].unlock();
+#endif
+      } // va
+    }
+
+    return energyEle;
+  };
+
+#ifdef VEGAFEM_USE_TBB
+  if (assemblyMode == DETERMINISTIC_ASSEMBLY)
+  {
+    GetEnergyAndForceAndMatrixDeterministic(u, energy, internalForces, tangentStiffnessMatrix);
+  }
+  else
+  {
+    for (auto itt = energyLocalBuffer.begin(); itt != energyLocalBuffer.end(); ++itt)
+      *itt = 0.0;
+
+    if (assemblyMode == COLORED_ASSEMBLY)
+    {
+      // stencils of different types may share vertices, so the types are processed one after another
+      for (int eltype = 0; eltype < stencilForceModel->GetNumStencilTypes(); eltype++) 
+      {
+        tbb::enumerable_thread_specific<Buffer> &tls = *localBuffers[eltype];
+        for (const std::vector<int> & colorStencils : stencilColors[eltype])
+        {
+          // no two stencils in a color share a vertex: no locks needed
+          tbb::parallel_for(0, (int)colorStencils.size(), 1, [&] (int i) 
+          {
+            double energyEle = addStencilContribution(eltype, colorStencils[i], tls.local().data(), false);
+            if (energy) 
+              energyLocalBuffer.local() += energyEle;
+          });
+        }
+      }
+    }
+    else
+    {
+      tbb::parallel_for(0, stencilForceModel->GetNumStencilTypes(), 1, [&] (int eltype) 
+      {
+        tbb::enumerable_thread_specific<Buffer> &tls = *localBuffers[eltype];
+        int nele = stencilForceModel->GetNumStencils(eltype);
+
+        tbb::parallel_for(0, nele, 1, [&] (int ele) 
+        {
+          double energyEle = addStencilContribution(eltype, ele, tls.local().data(), true);
+          if (energy) 
+            energyLocalBuffer.local() += energyEle;
+        }, partitioners[eltype]);
+      });
+    }
+
+    if (energy) 
+    {
+      for (auto itt = energyLocalBuffer.begin(); itt != energyLocalBuffer.end(); ++itt) 
+      {
+        *energy += *itt;
+      }
+    }
+  }
+#else
+  for (int eltype = 0; eltype < stencilForceModel->GetNumStencilTypes(); eltype++) 
   {
-    tbb::enumerable_thread_specific<Buffer> &tls = *localBuffers[eltype];
-    int nelev = stencilForceModel->GetNumStencilVertices(eltype);
     int nele = stencilForceModel->GetNumStencils(eltype);
 
-    tbb::parallel_for(0, nele, 1, [&] (int ele) 
+    for (int ele = 0; ele < nele; ele++) 
     {
-      Buffer &localBuffer = tls.local();
-      double *fEle = localBuffer.data();
-      double *KEle = localBuffer.data() + nelev * 3;
+      double energyEle = addStencilContribution(eltype, ele, bufferExamplars[eltype].data(), false);
+      if (energy) 
+        *energy += energyEle;
+    }
+  }
+#endif
 
-      double energyEle = 0;
+  if (internalForces)
+    AddGravityForces(internalForces);
+}
+
+void ForceModelAssembler::SetIncrementalStiffness(bool enable, double tolerance)
+{
+  incrementalStiffness = enable;
+  incrementalStiffnessTolerance = tolerance;
+  incrementalCacheValid = false;
+
+  if (enable && (incrementalStiffnessMatrix == nullptr))
+  {
+    incrementalStiffnessMatrix = new SparseMatrix(*Ktemplate);
+    int numStencilTypes = stencilForceModel->GetNumStencilTypes();
+    incrementalStencilMatrices.resize(numStencilTypes);
+    incrementalStencilDeformations.resize(numStencilTypes);
+    incrementalStencilMisses.resize(numStencilTypes);
+    for (int eltype = 0; eltype < numStencilTypes; eltype++) 
+    {
+      int nelev = stencilForceModel->GetNumStencilVertices(eltype);
+      int nele = stencilForceModel->GetNumStencils(eltype);
+      assert(stencilForceModel->GetStencilLocalDeformationSize(eltype) <= nelev * 3);
+      incrementalStencilMatrices[eltype].resize((size_t)nele * nelev * nelev * 9);
+      incrementalStencilDeformations[eltype].resize((size_t)nele * stencilForceModel->GetStencilLocalDeformationSize(eltype));
+      incrementalStencilMisses[eltype].resize(nele);
+    }
+  }
+  else if (!enable)
+  {
+    // release the memory
+    delete incrementalStiffnessMatrix;
+    incrementalStiffnessMatrix = nullptr;
+    incrementalStencilMatrices.clear();
+    incrementalStencilDeformations.clear();
+    incrementalStencilMisses.clear();
+  }
+}
+
+void ForceModelAssembler::GetIncrementalStiffnessStatistics(long long * lastHits, long long * lastMisses, long long * totalHits, long long * totalMisses) const
+{
+  if (lastHits)
+    *lastHits = incrementalLastHits;
+  if (lastMisses)
+    *lastMisses = incrementalLastMisses;
+  if (totalHits)
+    *totalHits = incrementalTotalHits;
+  if (totalMisses)
+    *totalMisses = incrementalTotalMisses;
+}
 
+void ForceModelAssembler::ResetIncrementalStiffnessStatistics()
+{
+  incrementalLastHits = incrementalLastMisses = incrementalTotalHits = incrementalTotalMisses = 0;
+}
+
+void ForceModelAssembler::GetEnergyAndForceAndMatrixIncremental(const double * u, double * energy, double * internalForces, SparseMatrix * tangentStiffnessMatrix)
+{
+  if (incrementalCacheValid == false)
+  {
+    // the patches of the first evaluation are the full stencil matrices
+    incrementalStiffnessMatrix->ResetToZero();
+    for (std::vector<double> & matrices : incrementalStencilMatrices)
+      std::fill(matrices.begin(), matrices.end(), 0.0);
+  }
+
+  // evaluates stencil 'ele'; recomputes its matrix if its deformation changed by more than the tolerance,
+  // and patches the global matrix; returns the stencil energy
+  // localBuffer must hold nelev * 6 + nelev * nelev * 9 doubles
+  auto addStencilContribution = [&] (int eltype, int ele, double * localBuffer, bool useLocks) -> double
+  {
+    int nelev = stencilForceModel->GetNumStencilVertices(eltype);
+    int deformationSize = stencilForceModel->GetStencilLocalDeformationSize(eltype);
+    int matrixSize = nelev * nelev * 9;
+    double *fEle = localBuffer;
+    double *deformation = localBuffer + nelev * 3;
+    double *KEle = localBuffer + nelev * 6;
+    double *cachedDeformation = incrementalStencilDeformations[eltype].data() + (size_t)ele * deformationSize;
+    double *cachedKEle = incrementalStencilMatrices[eltype].data() + (size_t)ele * matrixSize;
+
+    stencilForceModel->GetStencilLocalDeformation(eltype, ele, u, deformation);
+    bool miss = (incrementalCacheValid == false);
+    for (int i = 0; (i < deformationSize) && (miss == false); i++)
+      miss = (fabs(deformation[i] - cachedDeformation[i]) > incrementalStiffnessTolerance);
+    incrementalStencilMisses[eltype][ele] = miss;
+
+    double energyEle = 0;
+    if (miss || energy || internalForces)
+    {
       stencilForceModel->GetStencilLocalEnergyAndForceAndMatrix(eltype, ele, u,
         (energy ? &energyEle : nullptr),
         (internalForces ? fEle : nullptr),
-        (tangentStiffnessMatrix ? KEle : nullptr)
+        (miss ? KEle : nullptr)
       );
+    }
 
-      const int *vIndices = stencilForceModel->GetStencilVertexIndices(eltype, ele);
+    const int *vIndices = stencilForceModel->GetStencilVertexIndices(eltype, ele);
 
-      if (internalForces) 
+    if (internalForces) 
+    {
+      for (int v = 0; v < nelev; v++) 
       {
-        for (int v = 0; v < nelev; v++) 
-        {
+#ifdef VEGAFEM_USE_TBB
+        if (useLocks)
           internalForceVertexLocks[vIndices[v]].lock();
+#endif
 
-          internalForces[vIndices[v] * 3] += fEle[v * 3];
-          internalForces[vIndices[v] * 3 + 1] += fEle[v * 3 + 1];
-          internalForces[vIndices[v] * 3 + 2] += fEle[v * 3 + 2];
+        internalForces[vIndices[v] * 3] += fEle[v * 3];
+        internalForces[vIndices[v] * 3 + 1] += fEle[v * 3 + 1];
+        internalForces[vIndices[v] * 3 + 2] += fEle[v * 3 + 2];
 
+#ifdef VEGAFEM_USE_TBB
+        if (useLocks)
           internalForceVertexLocks[vIndices[v]].unlock();
-        }
+#endif
       }
+    }
 
-      if (tangentStiffnessMatrix) 
+    if (miss) 
+    {
+      // KEle becomes the patch (new - cached), and the cache becomes the new matrix
+      for (int i = 0; i < matrixSize; i++)
       {
-        const int *vtxColIndices = inverseIndices[eltype].data() + ele * nelev * nelev;
+        double newEntry = KEle[i];
+        KEle[i] = newEntry - cachedKEle[i];
+        cachedKEle[i] = newEntry;
+      }
+      std::copy(deformation, deformation + deformationSize, cachedDeformation);
 
-        // write matrices in place
-        for (int va = 0; va < nelev; va++) 
-        {
-          int vIdxA = vIndices[va];
-          stiffnessMatrixVertexRowLocks[vIdxA].lock();
+      const SparseMatrixScatter & scatter = stiffnessMatrixScatters[eltype];
+      for (int va = 0; va < nelev; va++) 
+      {
+#ifdef VEGAFEM_USE_TBB
+        if (useLocks)
+          stiffnessMatrixVertexRowLocks[vIndices[va]].lock();
+#endif
 
-          for (int vb = 0; vb < nelev; vb++) 
-          {
-            int columnIndexCompressed = vtxColIndices[vb * nelev + va];
-
-            for (int i = 0; i < 3; i++) 
-            {
-              for (int j = 0; j < 3; j++) 
-              {
-                int row = 3 * vIdxA + i;
-                int columnIndex = 3 * columnIndexCompressed + j;
-
-                int local_row = 3 * va + i;
-                int local_col = 3 * vb + j;
-
-                tangentStiffnessMatrix->AddEntry(row, columnIndex, KEle[local_col * nelev * 3 + local_row]);
-              } // i
-            } // j
-          } // vb
-          stiffnessMatrixVertexRowLocks[vIdxA].unlock();
-        } // va
-      }
+        scatter.AddStencilVertexRows(ele, va, KEle, incrementalStiffnessMatrix);
 
+#ifdef VEGAFEM_USE_TBB
+        if (useLocks)
+          stiffnessMatrixVertexRowLocks[vIndices[va]].unlock();
+#endif
+      } // va
+    }
+
+    return energyEle;
+  };
+
+#ifdef VEGAFEM_USE_TBB
+  for (auto itt = energyLocalBuffer.begin(); itt != energyLocalBuffer.end(); ++itt)
+    *itt = 0.0;
+
+  tbb::parallel_for(0, stencilForceModel->GetNumStencilTypes(), 1, [&] (int eltype) 
+  {
+    tbb::enumerable_thread_specific<Buffer> &tls = *localBuffers[eltype];
+    int nele = stencilForceModel->GetNumStencils(eltype);
+
+    tbb::parallel_for(0, nele, 1, [&] (int ele) 
+    {
+      double energyEle = addStencilContribution(eltype, ele, tls.local().data(), true);
       if (energy) 
-      {
         energyLocalBuffer.local() += energyEle;
-      }
     }, partitioners[eltype]);
   });
 
   if (energy) 
   {
-    *energy = 0;
     for (auto itt = energyLocalBuffer.begin(); itt != energyLocalBuffer.end(); ++itt) 
-    {
       *energy += *itt;
-    }
   }
 #else
   for (int eltype = 0; eltype < stencilForceModel->GetNumStencilTypes(); eltype++) 
   {
-    int nelev = stencilForceModel->GetNumStencilVertices(eltype);
     int nele = stencilForceModel->GetNumStencils(eltype);
 
     for (int ele = 0; ele < nele; ele++) 
     {
-      double *fEle = bufferExamplars[eltype].data();
-      double *KEle = bufferExamplars[eltype].data() + nelev * 3;
+      double energyEle = addStencilContribution(eltype, ele, bufferExamplars[eltype].data(), false);
+      if (energy) 
+        *energy += energyEle;
+    }
+  }
+#endif
 
-      double energyEle = 0;
+  incrementalCacheValid = true;
+  *tangentStiffnessMatrix = *incrementalStiffnessMatrix;
 
-      stencilForceModel->GetStencilLocalEnergyAndForceAndMatrix(eltype, ele, u,
-        (energy ? &energyEle : nullptr),
-        (internalForces ? fEle : nullptr),
-        (tangentStiffnessMatrix ? KEle : nullptr)
-      );
+  // statistics
+  incrementalLastHits = incrementalLastMisses = 0;
+  for (const std::vector<char> & misses : incrementalStencilMisses)
+    for (char miss : misses)
+    {
+      if (miss)
+        incrementalLastMisses++;
+      else
+        incrementalLastHits++;
+    }
+  incrementalTotalHits += incrementalLastHits;
+  incrementalTotalMisses += incrementalLastMisses;
+
+  if (internalForces)
+    AddGravityForces(internalForces);
+}
+
+void ForceModelAssembler::AddGravityForces(double * internalForces)
+{
+  for (int vi = 0; vi < stencilForceModel->Getn3() / 3; vi++) {
+    double g[3];
+    stencilForceModel->GetVertexGravityForce(vi, g);
+    internalForces[vi * 3 + 1] += g[1];
+  }
+}
+
+void ForceModelAssembler::AssembleStencilVectors(const StencilVectorFunction & evaluateStencil, double * vector0, double * vector1)
+{
+  if (vector0)
+    memset(vector0, 0, sizeof(double) * r);
 
-      const int *vIndices = stencilForceModel->GetStencilVertexIndices(eltype, ele);
+  if (vector1)
+    memset(vector1, 0, sizeof(double) * r);
 
-      if (internalForces) 
+  // adds the stencil vectors into the global vectors
+  // localBuffer must hold nelev * 6 + nelev * nelev * 9 doubles
+  auto addStencilContribution = [&] (int eltype, int ele, double * localBuffer, bool useLocks)
+  {
+    int nelev = stencilForceModel->GetNumStencilVertices(eltype);
+    double *v0Ele = localBuffer;
+    double *v1Ele = localBuffer + nelev * 3;
+
+    evaluateStencil(eltype, ele, (vector0 ? v0Ele : nullptr), (vector1 ? v1Ele : nullptr), localBuffer + nelev * 6);
+
+    const int *vIndices = stencilForceModel->GetStencilVertexIndices(eltype, ele);
+    for (int v = 0; v < nelev; v++) 
+    {
+#ifdef VEGAFEM_USE_TBB
+      if (useLocks)
+        internalForceVertexLocks[vIndices[v]].lock();
+#endif
+
+      for (int dof = 0; dof < 3; dof++)
       {
-        for (int v = 0; v < nelev; v++) 
-        {
-          internalForces[vIndices[v] * 3] += fEle[v * 3];
-          internalForces[vIndices[v] * 3 + 1] += fEle[v * 3 + 1];
-          internalForces[vIndices[v] * 3 + 2] += fEle[v * 3 + 2];
-        }
+        if (vector0)
+          vector0[vIndices[v] * 3 + dof] += v0Ele[v * 3 + dof];
+        if (vector1)
+          vector1[vIndices[v] * 3 + dof] += v1Ele[v * 3 + dof];
       }
 
-      if (tangentStiffnessMatrix) 
+#ifdef VEGAFEM_USE_TBB
+      if (useLocks)
+        internalForceVertexLocks[vIndices[v]].unlock();
+#endif
+    }
+  };
+
+#ifdef VEGAFEM_USE_TBB
+  if (assemblyMode == DETERMINISTIC_ASSEMBLY)
+  {
+    // evaluate all stencils into their slots, then gather in parallel over vertices, in a fixed order
+    tbb::parallel_for(0, stencilForceModel->GetNumStencilTypes(), 1, [&] (int eltype) 
+    {
+      tbb::enumerable_thread_specific<Buffer> &tls = *localBuffers[eltype];
+      int nelev = stencilForceModel->GetNumStencilVertices(eltype);
+      size_t slotSize = GetStencilSlotSize(eltype);
+
+      tbb::parallel_for(0, stencilForceModel->GetNumStencils(eltype), 1, [&] (int ele) 
       {
-        const int *vtxColIndices = inverseIndices[eltype].data() + ele * nelev * nelev;
+        double *v0Ele = stencilSlots[eltype].data() + ele * slotSize;
+        double *v1Ele = v0Ele + nelev * 3;
+        evaluateStencil(eltype, ele, (vector0 ? v0Ele : nullptr), (vector1 ? v1Ele : nullptr), tls.local().data() + nelev * 6);
+      }, partitioners[eltype]);
+    });
 
-        // write matrices in place
-        for (int va = 0; va < nelev; va++) 
-        {
-          int vIdxA = vIndices[va];
-          for (int vb = 0; vb < nelev; vb++) 
-          {
-            int columnIndexCompressed = vtxColIndices[vb * nelev + va];
-
-            for (int i = 0; i < 3; i++) 
-            {
-              for (int j = 0; j < 3; j++) 
-              {
-                int row = 3 * vIdxA + i;
-                int columnIndex = 3 * columnIndexCompressed + j;
-
-                int local_row = 3 * va + i;
-                int local_col = 3 * vb + j;
-
-                tangentStiffnessMatrix->AddEntry(row, columnIndex, KEle[local_col * nelev * 3 + local_row]);
-              } // i
-            } // j
-          } // vb
-        } // va
-      }
+    tbb::parallel_for(0, stencilForceModel->Getn3() / 3, [&] (int vIdxA) 
+    {
+      for (int k = vertexIncidenceOffsets[vIdxA]; k < vertexIncidenceOffsets[vIdxA + 1]; k++) 
+      {
+        int eltype = vertexIncidences[3 * k + 0];
+        int ele = vertexIncidences[3 * k + 1];
+        int va = vertexIncidences[3 * k + 2];
 
-      if (energy) 
+        int nelev = stencilForceModel->GetNumStencilVertices(eltype);
+        const double *v0Ele = stencilSlots[eltype].data() + ele * GetStencilSlotSize(eltype);
+        const double *v1Ele = v0Ele + nelev * 3;
+
+        for (int dof = 0; dof < 3; dof++)
+        {
+          if (vector0)
+            vector0[vIdxA * 3 + dof] += v0Ele[va * 3 + dof];
+          if (vector1)
+            vector1[vIdxA * 3 + dof] += v1Ele[va * 3 + dof];
+        }
+      } // k
+    });
+  }
+  else if (assemblyMode == COLORED_ASSEMBLY)
+  {
+    for (int eltype = 0; eltype < stencilForceModel->GetNumStencilTypes(); eltype++) 
+    {
+      tbb::enumerable_thread_specific<Buffer> &tls = *localBuffers[eltype];
+      for (const std::vector<int> & colorStencils : stencilColors[eltype])
       {
-        *energy += energyEle;
+        tbb::parallel_for(0, (int)colorStencils.size(), 1, [&] (int i) 
+        {
+          addStencilContribution(eltype, colorStencils[i], tls.local().data(), false);
+        });
       }
     }
   }
+  else
+  {
+    tbb::parallel_for(0, stencilForceModel->GetNumStencilTypes(), 1, [&] (int eltype) 
+    {
+      tbb::enumerable_thread_specific<Buffer> &tls = *localBuffers[eltype];
+      tbb::parallel_for(0, stencilForceModel->GetNumStencils(eltype), 1, [&] (int ele) 
+      {
+        addStencilContribution(eltype, ele, tls.local().data(), true);
+      }, partitioners[eltype]);
+    });
+  }
+#else
+  for (int eltype = 0; eltype < stencilForceModel->GetNumStencilTypes(); eltype++) 
+  {
+    for (int ele = 0; ele < stencilForceModel->GetNumStencils(eltype); ele++) 
+      addStencilContribution(eltype, ele, bufferExamplars[eltype].data(), false);
+  }
 #endif
+}
 
-  if (internalForces)
+void ForceModelAssembler::GetTangentStiffnessMatrixVectorProduct(const double * u, const double * v, double * Kv)
+{
+  AssembleStencilVectors([&] (int eltype, int ele, double * KvEle, double *, double * scratch)
+  {
+    stencilForceModel->GetStencilLocalHessianVectorProduct(eltype, ele, u, v, KvEle, scratch);
+  }, Kv, nullptr);
+}
+
+void ForceModelAssembler::GetForceAndMatrixDiagonal(const double * u, double * internalForces, double * diagonal)
+{
+  AssembleStencilVectors([&] (int eltype, int ele, double * fEle, double * diagonalEle, double * KEle)
   {
-    for (int vi = 0; vi < stencilForceModel->Getn3() / 3; vi++) {
-      double g[3];
-      stencilForceModel->GetVertexGravityForce(vi, g);
-      internalForces[vi * 3 + 1] += g[1];
+    stencilForceModel->GetStencilLocalEnergyAndForceAndMatrix(eltype, ele, u, nullptr, fEle, (diagonalEle ? KEle : nullptr));
+    if (diagonalEle)
+    {
+      int dof = stencilForceModel->GetStencilInternalForceSize(eltype);
+      for (int i = 0; i < dof; i++)
+        diagonalEle[i] = KEle[i * dof + i];
     }
-  }
+  }, internalForces, diagonal);
+
+  if (internalForces)
+    AddGravityForces(internalForces);
 }
 
 double ForceModelAssembler::GetElasticEnergy(const double *u)
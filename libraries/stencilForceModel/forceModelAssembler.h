@@ -35,6 +35,8 @@
 
 #include "forceModel.h"
 #include "stencilForceModel.h"
+#include "sparseMatrixScatter.h"
+#include <functional>
 
 #ifdef VEGAFEM_USE_TBB
   #include <tbb/tbb.h>
@@ -52,14 +54,36 @@ namespace vegafem
   If Intel TBB is provided, assembly will be performed in parallel.
   The number of threads can be controlled outside the class using the Intel TBB APIs.
   If Intel TBB is not provided, the computation will be single-threaded.
+
+  With Intel TBB, two parallel assembly modes are available:
+    LOCKED_ASSEMBLY: all stencils are processed in parallel, and each scatter into the global
+      force vector and stiffness matrix is guarded by a per-vertex spin lock (default).
+    COLORED_ASSEMBLY: in the constructor, the stencils of each stencil type are colored
+      such that no two stencils of the same color share a vertex. At assembly time, colors are
+      processed one after another, and the stencils within each color are processed in parallel without any locks.
+      This avoids lock contention at high-valence vertices, at the cost of a synchronization point per color.
+    DETERMINISTIC_ASSEMBLY: all stencils are processed in parallel, and each stencil writes its energy, forces
+      and matrix into its own precomputed slot. Then, the slots are gathered into the global quantities
+      in parallel over vertices, with each vertex (force entries, stiffness matrix rows) summing its incident stencils
+      in a fixed order. The result is bitwise-identical from run to run, regardless of the number of threads,
+      and is also identical to the single-threaded (non-TBB) computation. The slots cost
+      (3 * nelev + 9 * nelev^2 + 1) doubles per stencil (157 for a tet).
+  Which of the first two modes is faster depends on the mesh and the number of cores; they produce the same result
+  up to floating-point summation order, which can differ from run to run.
 */
 
 class ForceModelAssembler : public ForceModel
 {
 public:
-  ForceModelAssembler(StencilForceModel *stencilForceModel);
+  typedef enum { LOCKED_ASSEMBLY, COLORED_ASSEMBLY, DETERMINISTIC_ASSEMBLY } assemblyModeType;
+
+  ForceModelAssembler(StencilForceModel *stencilForceModel, assemblyModeType assemblyMode = LOCKED_ASSEMBLY);
   virtual ~ForceModelAssembler();
 
+  assemblyModeType GetAssemblyMode() const { return assemblyMode; }
+  // number of colors used for the given stencil type (only non-zero in COLORED_ASSEMBLY mode)
+  int GetNumStencilColors(int stencilType) const { return (int)stencilColors[stencilType].size(); }
+
   // See comments in the parent class for the following functions.
   virtual double GetElasticEnergy(const double * u) override;
   virtual void GetInternalForce(const double * u, double * internalForces) override;
@@ -73,12 +97,54 @@ public:
   // internalForces points to a double array which dimension is the same as u.
   // tangentStiffnessMatrix point to a sparse matrix object.
   // energy, internalForces, tangentStiffnessMatrix can be nullptr. If nullptr, the corresponding quantity will not be computed.
-  virtual void GetEnergyAndForceAndMatrix(const double * u, double * energy, double * internalForces, SparseMatrix * tangentStiffnessMatrix);
+  virtual void GetEnergyAndForceAndMatrix(const double * u, double * energy, double * internalForces, SparseMatrix * tangentStiffnessMatrix) override;
+
+  // Matrix-free access to the tangent stiffness matrix K(u), for solvers that never form K (see ImplicitNewmarkSparse::UseMatrixFreeSolver).
+  // Computes Kv = K(u) * v, by summing the stencil products (see StencilForceModel::GetStencilLocalHessianVectorProduct).
+  // u, v and Kv have the same dimension.
+  virtual void GetTangentStiffnessMatrixVectorProduct(const double * u, const double * v, double * Kv);
+  // Computes the internal forces and the diagonal of K(u). Either internalForces or diagonal can be nullptr.
+  virtual void GetForceAndMatrixDiagonal(const double * u, double * internalForces, double * diagonal);
+
+  // Incremental tangent stiffness matrix (disabled by default).
+  // When enabled, the assembler caches the tangent stiffness matrix of each stencil, together with the stencil deformation
+  // at which it was computed (see StencilForceModel::GetStencilLocalDeformation; for FEM elements, the deformation gradient).
+  // In subsequent evaluations of the tangent stiffness matrix, only the stencils whose deformation differs from the cached one
+  // by more than "tolerance" (in any entry) are re-evaluated, and the global matrix is patched by the differences between
+  // their new and cached stencil matrices. The other stencils reuse their cached matrices, i.e., the matrix is only approximate;
+  // the energy and internal forces are always computed exactly. The global matrix is kept inside this class, and copied into
+  // the output matrix, which must have the topology returned by GetTangentStiffnessMatrixTopology.
+  // Stencils whose matrix is not recomputed still evaluate their forces, so the savings depend on the relative cost of the
+  // stencil matrix (e.g., for corotational linear FEM, the polar decomposition is still needed for the forces, but the warping is skipped).
+  // With TBB, the incremental evaluation uses per-vertex locks, regardless of the assembly mode.
+  void SetIncrementalStiffness(bool enable, double tolerance = 1e-4);
+  bool GetIncrementalStiffness() const { return incrementalStiffness; }
+  double GetIncrementalStiffnessTolerance() const { return incrementalStiffnessTolerance; }
+  // Discards the cached stencil matrices; the next evaluation recomputes all the stencils.
+  // Call this after the stencil force model changes (e.g., new material parameters), or to remove the round-off accumulated by the patches.
+  void ResetIncrementalStiffnessCache() { incrementalCacheValid = false; }
+  // Number of stencils whose cached matrix was reused (hits) or recomputed (misses), in the last evaluation of the tangent stiffness matrix,
+  // and in total since the last call to ResetIncrementalStiffnessStatistics. Any of the pointers can be nullptr.
+  void GetIncrementalStiffnessStatistics(long long * lastHits, long long * lastMisses, long long * totalHits = nullptr, long long * totalMisses = nullptr) const;
+  void ResetIncrementalStiffnessStatistics();
 
 protected:
   StencilForceModel * stencilForceModel = nullptr;
   SparseMatrix * Ktemplate = nullptr;
-  std::vector<std::vector<int>> inverseIndices;
+  // for each stencil type, the locations of the stencil matrix entries in the stiffness matrix
+  std::vector<SparseMatrixScatter> stiffnessMatrixScatters;
+
+  assemblyModeType assemblyMode;
+  // stencilColors[stencilType][color] lists the stencils of the given color; only built in COLORED_ASSEMBLY mode
+  std::vector<std::vector<std::vector<int>>> stencilColors;
+  void BuildStencilColors();
+
+  // Computes, for each stencil, up to two stencil vectors of size nelev * 3, and adds them into the global vectors vector0 and vector1 (either can be nullptr),
+  // using the parallel assembly mode of this class.
+  // evaluateStencil(eltype, ele, vector0Ele, vector1Ele, scratch) computes the stencil vectors; scratch holds nelev * nelev * 9 doubles.
+  typedef std::function<void(int eltype, int ele, double * vector0Ele, double * vector1Ele, double * scratch)> StencilVectorFunction;
+  void AssembleStencilVectors(const StencilVectorFunction & evaluateStencil, double * vector0, double * vector1);
+  void AddGravityForces(double * internalForces);
 
   // data structures for parallelism
 #ifdef VEGAFEM_USE_TBB
@@ -88,13 +154,40 @@ protected:
   tbb::affinity_partitioner * partitioners = nullptr;
   tbb::enumerable_thread_specific<double> energyLocalBuffer;
   tbb::spin_mutex * internalForceVertexLocks, *stiffnessMatrixVertexRowLocks = nullptr;
+
+  // DETERMINISTIC_ASSEMBLY data (without TBB, the single-threaded assembly is deterministic already)
+  // per-stencil output slots: stencilSlots[stencilType] holds, for each stencil, nelev * 3 forces followed by nelev * nelev * 9 matrix entries
+  // (or, in AssembleStencilVectors, the two stencil vectors)
+  std::vector<std::vector<double>> stencilSlots;
+  std::vector<std::vector<double>> stencilEnergies;
+  // for each vertex, the (stencilType, stencilId, local vertex index) triples of its incident stencils, in fixed (stencilType, stencilId) order
+  // the triples of vertex v are vertexIncidences[3*k+0..2], for vertexIncidenceOffsets[v] <= k < vertexIncidenceOffsets[v+1]
+  std::vector<int> vertexIncidenceOffsets;
+  std::vector<int> vertexIncidences;
+  void BuildVertexIncidences();
+  void GetEnergyAndForceAndMatrixDeterministic(const double * u, double * energy, double * internalForces, SparseMatrix * tangentStiffnessMatrix);
 #else
   // data structures for single-threaded computation
   typedef std::allocator<double> BufferAllocator;
   typedef std::vector<double, BufferAllocator> Buffer;
 #endif
 
+  // incremental tangent stiffness matrix data (see SetIncrementalStiffness); allocated on first use
+  bool incrementalStiffness = false;
+  double incrementalStiffnessTolerance = 1e-4;
+  bool incrementalCacheValid = false;
+  SparseMatrix * incrementalStiffnessMatrix = nullptr; // the assembled matrix of the cached stencil matrices
+  // for each stencil type: the cached stencil matrices (nelev * nelev * 9 doubles per stencil), and the deformations at which they were computed
+  std::vector<std::vector<double>> incrementalStencilMatrices;
+  std::vector<std::vector<double>> incrementalStencilDeformations;
+  // for each stencil type: 1 if the stencil matrix was recomputed in the last evaluation, 0 otherwise
+  std::vector<std::vector<char>> incrementalStencilMisses;
+  long long incrementalLastHits = 0, incrementalLastMisses = 0, incrementalTotalHits = 0, incrementalTotalMisses = 0;
+  void GetEnergyAndForceAndMatrixIncremental(const double * u, double * energy, double * internalForces, SparseMatrix * tangentStiffnessMatrix);
+
+  // per-stencil-type buffers of nelev * 6 + nelev * nelev * 9 doubles: forces (or stencil vector 0), stencil vector 1, matrix
   std::vector<Buffer> bufferExamplars;
+  size_t GetStencilSlotSize(int eltype) const { int nelev = stencilForceModel->GetNumStencilVertices(eltype); return nelev * 3 + nelev * nelev * 9; }
 };
 
 
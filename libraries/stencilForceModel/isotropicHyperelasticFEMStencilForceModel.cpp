@@ -51,7 +51,24 @@ void IsotropicHyperelasticFEMStencilForceModel::GetStencilLocalEnergyAndForceAnd
 {
   assert(stencilType == 0);
 
-  isotropicHyperelasticFEM->GetElementLocalEnergyAndForceAndMatrix(stencilId, u, energy, internalForces, tangentStiffnessMatrix);
+  if (singlePrecision)
+    isotropicHyperelasticFEM->GetElementLocalEnergyAndForceAndMatrixSinglePrecision(stencilId, u, energy, internalForces, tangentStiffnessMatrix);
+  else
+    isotropicHyperelasticFEM->GetElementLocalEnergyAndForceAndMatrix(stencilId, u, energy, internalForces, tangentStiffnessMatrix);
+}
+
+void IsotropicHyperelasticFEMStencilForceModel::GetStencilLocalDeformation(int stencilType, int stencilId, const double * u, double * deformation)
+{
+  assert(stencilType == 0);
+
+  isotropicHyperelasticFEM->ComputeElementDeformationGradient(stencilId, u, deformation);
+}
+
+void IsotropicHyperelasticFEMStencilForceModel::SetSinglePrecision(bool singlePrecision_)
+{
+  singlePrecision = singlePrecision_;
+  if (singlePrecision)
+    isotropicHyperelasticFEM->BuildSinglePrecisionData();
 }
 
 const int *IsotropicHyperelasticFEMStencilForceModel::GetStencilVertexIndices(int stencilType, int stencilId) const
@@ -51,10 +51,21 @@ public:
   virtual const int *GetStencilVertexIndices(int stencilType, int stencilId) const override;
   virtual void GetStencilLocalEnergyAndForceAndMatrix(int stencilType, int stencilId, const double * u, double * energy, double * internalForces, double * tangentStiffnessMatrix) override;
 
+  // the deformation measure is the deformation gradient of the element; see IsotropicHyperelasticFEM::ComputeElementDeformationGradient
+  virtual int GetStencilLocalDeformationSize(int) const override { return 9; }
+  virtual void GetStencilLocalDeformation(int stencilType, int stencilId, const double * u, double * deformation) override;
+
   IsotropicHyperelasticFEM * GetForceModelHandle() { return isotropicHyperelasticFEM; }
 
+  // Mixed precision: if enabled, the element tangent stiffness matrices are computed in single precision,
+  // and returned in double precision; see IsotropicHyperelasticFEM::GetElementLocalEnergyAndForceAndMatrixSinglePrecision.
+  // Default: disabled.
+  void SetSinglePrecision(bool singlePrecision);
+  bool GetSinglePrecision() const { return singlePrecision; }
+
 protected:
   IsotropicHyperelasticFEM * isotropicHyperelasticFEM;
+  bool singlePrecision = false;
 };
 
 
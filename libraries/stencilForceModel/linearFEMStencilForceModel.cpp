@@ -88,9 +88,30 @@ void LinearFEMStencilForceModel::GetStencilLocalEnergyAndForceAndMatrix(int sten
   int nelev = numStencilVerticesInDifferentTypes[stencilType];
   int dof = nelev * 3;
   int dof2 = dof * dof;
-  const double *K0 = elementK[stencilType].data() + stencilId * dof2;
   const int *vtxIdx = stencilForceModel->GetStencilVertexIndices(stencilType, stencilId);
 
+  if (packedK.size() > 0)
+  {
+    if (tangentStiffnessMatrix)
+      packedK[stencilType].GetMatrix(stencilId, tangentStiffnessMatrix);
+    if (internalForces || energy)
+      ComputeStencilLocalForceAndEnergyPacked(stencilType, stencilId, u, energy, internalForces);
+    return;
+  }
+
+  const double *K0 = elementK[stencilType].data() + stencilId * dof2;
+  if (singlePrecision)
+  {
+    if (tangentStiffnessMatrix)
+    {
+      const float * K0f = elementKFloat[stencilType].data() + stencilId * dof2;
+      for (int i = 0; i < dof2; i++)
+        tangentStiffnessMatrix[i] = K0f[i];
+    }
+    ComputeStencilLocalForceAndEnergySinglePrecision(stencilType, stencilId, u, energy, internalForces);
+    return;
+  }
+
   if (tangentStiffnessMatrix)
     memcpy(tangentStiffnessMatrix, K0, sizeof(double) * dof2);
 
@@ -116,6 +137,147 @@ void LinearFEMStencilForceModel::GetStencilLocalEnergyAndForceAndMatrix(int sten
 
 }
 
+void LinearFEMStencilForceModel::GetStencilLocalHessianVectorProduct(int stencilType, int stencilId, const double *, const double * v, double * Kv, double *)
+{
+  int dof = numStencilVerticesInDifferentTypes[stencilType] * 3;
+  if (packedK.size() > 0)
+  {
+    ComputeStencilLocalForceAndEnergyPacked(stencilType, stencilId, v, nullptr, Kv);
+    return;
+  }
+  if (singlePrecision)
+  {
+    // K * v is the force of the (linear) element at displacement v
+    ComputeStencilLocalForceAndEnergySinglePrecision(stencilType, stencilId, v, nullptr, Kv);
+    return;
+  }
+  MultiplyStencilLocalMatrix(stencilType, stencilId, elementK[stencilType].data() + stencilId * dof * dof, v, Kv);
+}
+
+void LinearFEMStencilForceModel::SetSinglePrecision(bool singlePrecision_)
+{
+  singlePrecision = singlePrecision_;
+  if ((singlePrecision == false) || (packedK.size() > 0))
+  {
+    elementKFloat.clear();
+    return;
+  }
+
+  elementKFloat.resize(elementK.size());
+  for (size_t eltype = 0; eltype < elementK.size(); eltype++)
+    elementKFloat[eltype].assign(elementK[eltype].begin(), elementK[eltype].end());
+}
+
+void LinearFEMStencilForceModel::SetPackedStiffnessMatrices(bool enable, bool singlePrecisionStorage)
+{
+  int numTypes = (int)numStencilsInDifferentTypes.size();
+  if (enable)
+  {
+    if ((packedK.size() > 0) && (packedK[0].IsSinglePrecision() == singlePrecisionStorage))
+      return;
+
+    std::vector<PackedElementStiffnessMatrices> newPackedK;
+    for (int eltype = 0; eltype < numTypes; eltype++)
+    {
+      int nelev = numStencilVerticesInDifferentTypes[eltype];
+      int nele = numStencilsInDifferentTypes[eltype];
+      int dof2 = nelev * nelev * 9;
+      newPackedK.emplace_back(nele, nelev, singlePrecisionStorage);
+      std::vector<double> K(dof2);
+      for (int el = 0; el < nele; el++)
+      {
+        if (packedK.size() > 0)
+          packedK[eltype].GetMatrix(el, K.data());
+        else
+          memcpy(K.data(), elementK[eltype].data() + el * dof2, sizeof(double) * dof2);
+        newPackedK[eltype].SetMatrix(el, K.data());
+      }
+    }
+    packedK.swap(newPackedK);
+
+    // release the full matrices
+    std::vector<std::vector<double>>(numTypes).swap(elementK);
+    elementKFloat.clear();
+  }
+  else
+  {
+    if (packedK.size() == 0)
+      return;
+
+    for (int eltype = 0; eltype < numTypes; eltype++)
+    {
+      int nelev = numStencilVerticesInDifferentTypes[eltype];
+      int nele = numStencilsInDifferentTypes[eltype];
+      int dof2 = nelev * nelev * 9;
+      elementK[eltype].resize(nele * dof2);
+      for (int el = 0; el < nele; el++)
+        packedK[eltype].GetMatrix(el, elementK[eltype].data() + el * dof2);
+    }
+    packedK.clear();
+    SetSinglePrecision(singlePrecision);
+  }
+}
+
+void LinearFEMStencilForceModel::ComputeStencilLocalForceAndEnergyPacked(int stencilType, int stencilId, const double * u, double * energy, double * internalForces)
+{
+  const int maxDOFs = 24; // 8 element vertices
+  int nelev = numStencilVerticesInDifferentTypes[stencilType];
+  int dof = nelev * 3;
+  assert(dof <= maxDOFs);
+  const int * vtxIdx = stencilForceModel->GetStencilVertexIndices(stencilType, stencilId);
+
+  double uLocal[maxDOFs], fBuffer[maxDOFs];
+  for (int i = 0; i < nelev; i++)
+    for (int j = 0; j < 3; j++)
+      uLocal[3 * i + j] = u[3 * vtxIdx[i] + j];
+
+  // f = K u
+  double * fLocal = (internalForces != nullptr) ? internalForces : fBuffer;
+  packedK[stencilType].MultiplyVector(stencilId, uLocal, fLocal);
+
+  if (energy)
+  {
+    double e = 0.0;
+    for (int i = 0; i < dof; i++)
+      e += fLocal[i] * uLocal[i];
+    *energy = 0.5 * e;
+  }
+}
+
+void LinearFEMStencilForceModel::ComputeStencilLocalForceAndEnergySinglePrecision(int stencilType, int stencilId, const double * u, double * energy, double * internalForces)
+{
+  const int maxDOFs = 24; // 8 element vertices
+  int nelev = numStencilVerticesInDifferentTypes[stencilType];
+  int dof = nelev * 3;
+  assert(dof <= maxDOFs);
+  const float * K0 = elementKFloat[stencilType].data() + stencilId * dof * dof;
+  const int * vtxIdx = stencilForceModel->GetStencilVertexIndices(stencilType, stencilId);
+
+  float uLocal[maxDOFs], fLocal[maxDOFs];
+  for (int i = 0; i < nelev; i++)
+    for (int j = 0; j < 3; j++)
+      uLocal[3 * i + j] = (float)u[3 * vtxIdx[i] + j];
+
+  // f = K u (K is symmetric)
+  for (int j = 0; j < dof; j++)
+    fLocal[j] = 0.0f;
+  for (int i = 0; i < dof; i++)
+    for (int j = 0; j < dof; j++)
+      fLocal[j] += K0[i * dof + j] * uLocal[i];
+
+  if (internalForces)
+    for (int i = 0; i < dof; i++)
+      internalForces[i] = fLocal[i];
+
+  if (energy)
+  {
+    float e = 0.0f;
+    for (int i = 0; i < dof; i++)
+      e += fLocal[i] * uLocal[i];
+    *energy = 0.5 * e;
+  }
+}
+
 const int *LinearFEMStencilForceModel::GetStencilVertexIndices(int stencilType, int stencilId) const
 {
   return stencilForceModel->GetStencilVertexIndices(stencilType, stencilId);
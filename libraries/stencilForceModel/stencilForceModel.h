@@ -83,7 +83,36 @@ public:
   // tangentStiffnessMatrix points to a dense column-major matrix
   // The pointers energy, internalForces and tangentStiffnessMatrix can be nullptr, in which case the corresponding quantity will not be computed.
   virtual void GetStencilLocalEnergyAndForceAndMatrix(int stencilType, int stencilId, const double * u, double * energy, double * internalForces, double * tangentStiffnessMatrix) = 0;
-  
+
+  // Compute the product of the tangent stiffness matrix of stencil stencilId in type stencilType with a vector, Kv = K(u) * v.
+  // Parameters u and v are vectors of all object vertices in R^n3.
+  // Kv points to a dense vector of size GetStencilInternalForceSize(stencilType).
+  // buffer points to GetStencilStiffnessMatrixSize(stencilType) doubles of scratch space.
+  // The default implementation forms the stencil tangent stiffness matrix in the buffer and multiplies it with v.
+  // Derived classes can override it to compute the product without forming the matrix.
+  virtual void GetStencilLocalHessianVectorProduct(int stencilType, int stencilId, const double * u, const double * v, double * Kv, double * buffer)
+  {
+    GetStencilLocalEnergyAndForceAndMatrix(stencilType, stencilId, u, nullptr, nullptr, buffer);
+    MultiplyStencilLocalMatrix(stencilType, stencilId, buffer, v, Kv);
+  }
+
+  // Return the number of doubles in the deformation measure of a stencil (see GetStencilLocalDeformation).
+  // It must not exceed GetStencilInternalForceSize(stencilType).
+  virtual int GetStencilLocalDeformationSize(int stencilType) const { return GetStencilInternalForceSize(stencilType) - 3; }
+
+  // Compute a measure of the deformation of stencil stencilId in type stencilType, at the displacements u.
+  // It is used to detect the stencils whose tangent stiffness matrix changed (see ForceModelAssembler::SetIncrementalStiffness).
+  // FEM stencils return the deformation gradient of the element (9 doubles, row-major).
+  // The default implementation returns the displacements of the stencil vertices 1, 2, ... relative to the displacement of vertex 0.
+  virtual void GetStencilLocalDeformation(int stencilType, int stencilId, const double * u, double * deformation)
+  {
+    int nelev = GetNumStencilVertices(stencilType);
+    const int * vertexIndices = GetStencilVertexIndices(stencilType, stencilId);
+    for (int v = 1; v < nelev; v++)
+      for (int dof = 0; dof < 3; dof++)
+        deformation[(v - 1) * 3 + dof] = u[vertexIndices[v] * 3 + dof] - u[vertexIndices[0] * 3 + dof];
+  }
+
   // Return an array of vertex indices that a stencil 'stencilId' in type 'stencilType' involves.
   // Typically, a tetrahedron involves 4 vertices. The return pointer will point to an array with 4 integers.
   virtual const int *GetStencilVertexIndices(int stencilType, int stencilId) const = 0;
@@ -92,6 +121,21 @@ public:
   virtual void GetVertexGravityForce(int vertexId, double gravity[3]) { gravity[0] = gravity[1] = gravity[2] = 0.0; }
 
 protected:
+  // Kv = K * v, where K is a column-major stencil matrix, v is a vector of all object vertices, and Kv is a stencil vector
+  void MultiplyStencilLocalMatrix(int stencilType, int stencilId, const double * K, const double * v, double * Kv) const
+  {
+    int dof = GetStencilInternalForceSize(stencilType);
+    const int * vertexIndices = GetStencilVertexIndices(stencilType, stencilId);
+    for (int i = 0; i < dof; i++)
+      Kv[i] = 0.0;
+    for (int j = 0; j < dof; j++)
+    {
+      double vj = v[vertexIndices[j / 3] * 3 + (j % 3)];
+      for (int i = 0; i < dof; i++)
+        Kv[i] += K[j * dof + i] * vj;
+    }
+  }
+
   std::vector<int> numStencilsInDifferentTypes;
   std::vector<int> numStencilVerticesInDifferentTypes;
   int n3;
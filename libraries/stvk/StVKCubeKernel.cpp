@@ -0,0 +1,396 @@
+/*************************************************************************
+ *                                                                       *
+ * Vega FEM Simulation Library Version 4.0                               *
+ *                                                                       *
+ * "StVK" library , Copyright (C) 2007 CMU, 2009 MIT, 2018 USC           *
+ * All rights reserved.                                                  *
+ *                                                                       *
+ * Code author: Jernej Barbic                                            *
+ * http://www.jernejbarbic.com/vega                                      *
+ *                                                                       *
+ * Research: Jernej Barbic, Hongyi Xu, Yijing Li,                        *
+ *           Danyong Zhao, Bohan Wang,                                   *
+ *           Fun Shing Sin, Daniel Schroeder,                            *
+ *           Doug L. James, Jovan Popovic                                *
+ *                                                                       *
+ * Funding: National Science Foundation, Link Foundation,                *
+ *          Singapore-MIT GAMBIT Game Lab,                               *
+ *          Zumberge Research and Innovation Fund at USC,                *
+ *          Sloan Foundation, Okawa Foundation,                          *
+ *          USC Annenberg Foundation                                     *
+ *                                                                       *
+ * This library is free software; you can redistribute it and/or         *
+ * modify it under the terms of the BSD-style license that is            *
+ * included with this library in the file LICENSE.txt                    *
+ *                                                                       *
+ * This library is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the file     *
+ * LICENSE.TXT for more details.                                         *
+ *                                                                       *
+ *************************************************************************/
+
+
+#include "StVKCubeKernel.h"
+
+namespace vegafem
+{
+
+StVKCubeKernel::StVKCubeKernel(StVKCubeABCD * cubeABCD)
+{
+  int p = 0;
+  for(int a=0; a<8; a++)
+    for(int b=a; b<8; b++)
+    {
+      pairVertex[p][0] = a;
+      pairVertex[p][1] = b;
+      pairIndex[a][b] = pairIndex[b][a] = p;
+      p++;
+    }
+
+  for(int k=0; k<2; k++)
+  {
+    linear[k].assign(24 * 24, 0.0);
+    quadraticPair[k].assign(8 * numPairs * 3, 0.0);
+    quadraticCross[k].assign(8 * 8 * 8 * 3, 0.0);
+    cubic[k].assign(numPairs * numPairs, 0.0);
+    quadraticStiffness[k].assign(numPairs * 3 * 8 * 3, 0.0);
+    cubicStiffness[k].assign(numPairs * 8 * 8, 0.0);
+  }
+
+  // the ABCD tables are the same for all cubes; the element iterator is not used
+  void * elIter = NULL;
+  cubeABCD->AllocateElementIterator(&elIter);
+  cubeABCD->PrepareElement(0, elIter);
+  #define C(a,b,c) (cubeABCD->C(elIter,(a),(b),(c)))
+  #define D(a,b,c,d) (cubeABCD->D(elIter,(a),(b),(c),(d)))
+
+  // linear terms: block (c,a) is lambda A_ca + mu (A_ac + B_ac I)
+  for(int c=0; c<8; c++)
+    for(int a=0; a<8; a++)
+    {
+      Mat3d Aca = cubeABCD->A(elIter, c, a);
+      Mat3d Aac = cubeABCD->A(elIter, a, c);
+      double Bac = cubeABCD->B(elIter, a, c);
+      for(int i=0; i<3; i++)
+        for(int j=0; j<3; j++)
+        {
+          linear[0][(3 * c + i) * 24 + 3 * a + j] = Aca[i][j];
+          linear[1][(3 * c + i) * 24 + 3 * a + j] = Aac[i][j] + ((i == j) ? Bac : 0.0);
+        }
+    }
+
+  // quadratic forces: f_c = sum_{a,b} (q_a . q_b) (lambda/2 C_cab + mu C_abc) + ((lambda C_abc + mu (C_cab + C_bac)) . q_a) q_b
+  for(int c=0; c<8; c++)
+    for(int a=0; a<8; a++)
+      for(int b=0; b<8; b++)
+      {
+        Vec3d Ccab = C(c,a,b);
+        Vec3d Cabc = C(a,b,c);
+        Vec3d Cbac = C(b,a,c);
+        for(int i=0; i<3; i++)
+        {
+          quadraticPair[0][(c * numPairs + pairIndex[a][b]) * 3 + i] += 0.5 * Ccab[i];
+          quadraticPair[1][(c * numPairs + pairIndex[a][b]) * 3 + i] += Cabc[i];
+          quadraticCross[0][(b * 8 + c) * 24 + 3 * a + i] = Cabc[i];
+          quadraticCross[1][(b * 8 + c) * 24 + 3 * a + i] = Ccab[i] + Cbac[i];
+        }
+      }
+
+  // cubic forces: M_cd = sum_{a,b} (q_a . q_b) (lambda/2 D_abcd + mu D_acbd)
+  for(int q=0; q<numPairs; q++)
+  {
+    int c = pairVertex[q][0];
+    int d = pairVertex[q][1];
+    for(int a=0; a<8; a++)
+      for(int b=0; b<8; b++)
+      {
+        cubic[0][q * numPairs + pairIndex[a][b]] += 0.5 * D(a,b,c,d);
+        cubic[1][q * numPairs + pairIndex[a][b]] += D(a,c,b,d);
+      }
+  }
+
+  // stiffness block (c,e), c <= e
+  for(int q=0; q<numPairs; q++)
+  {
+    int c = pairVertex[q][0];
+    int e = pairVertex[q][1];
+    for(int a=0; a<8; a++)
+    {
+      // quadratic: sum_a (u_a q_a^T + q_a v_a^T + (q_a . w_a) I), with
+      // u_a = lambda C_cae + mu (C_eac + C_aec), v_a = lambda C_eac + mu (C_cea + C_aec), w_a = lambda C_aec + mu (C_cae + C_eac)
+      Vec3d Ccae = C(c,a,e), Ceac = C(e,a,c), Caec = C(a,e,c), Ccea = C(c,e,a);
+      Vec3d uvw[2][3] = { { Ccae, Ceac, Caec }, { Ceac + Caec, Ccea + Caec, Ccae + Ceac } };
+      for(int k=0; k<2; k++)
+        for(int t=0; t<3; t++)
+          for(int i=0; i<3; i++)
+            quadraticStiffness[k][((q * 3 + t) * 8 + a) * 3 + i] = uvw[k][t][i];
+
+      // cubic: sum_{a,b} (lambda D_acbe + mu (D_aebc + D_abce)) q_a q_b^T + M_ce I
+      for(int b=0; b<8; b++)
+      {
+        cubicStiffness[0][(q * 8 + a) * 8 + b] = D(a,c,b,e);
+        cubicStiffness[1][(q * 8 + a) * 8 + b] = D(a,e,b,c) + D(a,b,c,e);
+      }
+    }
+  }
+
+  #undef C
+  #undef D
+  cubeABCD->ReleaseElementIterator(elIter);
+}
+
+void StVKCubeKernel::AddEnergyAndForceAndMatrix(const VolumetricMesh * volumetricMesh, const double * lambdaLame, const double * muLame,
+  const double * u, int elementLow, int elementHigh, double * energy, double * forces, 
+  const SparseMatrixScatter * matrixScatter, SparseMatrix * stiffnessMatrix) const
+{
+  const int W = batchSize;
+  const double * linearTable[2] = { linear[0].data(), linear[1].data() };
+  const double * quadraticPairTable[2] = { quadraticPair[0].data(), quadraticPair[1].data() };
+  const double * quadraticCrossTable[2] = { quadraticCross[0].data(), quadraticCross[1].data() };
+  const double * cubicTable[2] = { cubic[0].data(), cubic[1].data() };
+  const double * quadraticStiffnessTable[2] = { quadraticStiffness[0].data(), quadraticStiffness[1].data() };
+  const double * cubicStiffnessTable[2] = { cubicStiffness[0].data(), cubicStiffness[1].data() };
+
+  bool computeForces = (energy != NULL) || (forces != NULL);
+
+  // per-batch data; the last index is the lane (the element within the batch)
+  double lame[2][W]; // lambda, mu
+  double q[24][W]; // element vertex displacements
+  double dots[numPairs][W]; // q_a . q_b
+  double M[numPairs][W]; // the cubic-term matrix M_cd (symmetric)
+  double fLinear[24][W], fQuadratic[24][W], fCubic[24][W];
+  double Kbatch[576][W]; // 24 x 24 row-major element stiffness matrices
+  double Kel[576];
+
+  for(int batchStart = elementLow; batchStart < elementHigh; batchStart += W)
+  {
+    int numLanes = (elementHigh - batchStart < W) ? elementHigh - batchStart : W;
+
+    // gather; unused lanes repeat the last element, and are discarded at the end
+    int lane[W];
+    for(int l=0; l<W; l++)
+      lane[l] = batchStart + ((l < numLanes) ? l : numLanes - 1);
+    for(int l=0; l<W; l++)
+    {
+      lame[0][l] = lambdaLame[lane[l]];
+      lame[1][l] = muLame[lane[l]];
+      const int * vertices = volumetricMesh->getVertexIndices(lane[l]);
+      for(int a=0; a<8; a++)
+        for(int i=0; i<3; i++)
+          q[3 * a + i][l] = u[3 * vertices[a] + i];
+    }
+
+    for(int p=0; p<numPairs; p++)
+    {
+      int a = pairVertex[p][0];
+      int b = pairVertex[p][1];
+      for(int l=0; l<W; l++)
+        dots[p][l] = q[3 * a + 0][l] * q[3 * b + 0][l] + q[3 * a + 1][l] * q[3 * b + 1][l] + q[3 * a + 2][l] * q[3 * b + 2][l];
+    }
+
+    // M_cd = sum_p (lambda/2 D_abcd + mu D_acbd) (q_a . q_b)
+    for(int r=0; r<numPairs; r++)
+    {
+      double sum[2][W];
+      for(int k=0; k<2; k++)
+      {
+        for(int l=0; l<W; l++)
+          sum[k][l] = 0.0;
+        const double * row = cubicTable[k] + r * numPairs;
+        for(int p=0; p<numPairs; p++)
+          for(int l=0; l<W; l++)
+            sum[k][l] += row[p] * dots[p][l];
+      }
+      for(int l=0; l<W; l++)
+        M[r][l] = lame[0][l] * sum[0][l] + lame[1][l] * sum[1][l];
+    }
+
+    if (computeForces)
+    {
+      for(int k=0; k<24; k++)
+        for(int l=0; l<W; l++)
+          fLinear[k][l] = fQuadratic[k][l] = fCubic[k][l] = 0.0;
+
+      // linear terms
+      for(int k=0; k<24; k++)
+      {
+        double sum[2][W];
+        for(int t=0; t<2; t++)
+        {
+          for(int l=0; l<W; l++)
+            sum[t][l] = 0.0;
+          const double * row = linearTable[t] + k * 24;
+          for(int m=0; m<24; m++)
+            for(int l=0; l<W; l++)
+              sum[t][l] += row[m] * q[m][l];
+        }
+        for(int l=0; l<W; l++)
+          fLinear[k][l] = lame[0][l] * sum[0][l] + lame[1][l] * sum[1][l];
+      }
+
+      // quadratic terms
+      for(int c=0; c<8; c++)
+      {
+        for(int i=0; i<3; i++)
+        {
+          double sum[2][W];
+          for(int t=0; t<2; t++)
+          {
+            for(int l=0; l<W; l++)
+              sum[t][l] = 0.0;
+            const double * column = quadraticPairTable[t] + c * numPairs * 3 + i;
+            for(int p=0; p<numPairs; p++)
+              for(int l=0; l<W; l++)
+                sum[t][l] += column[3 * p] * dots[p][l];
+          }
+          for(int l=0; l<W; l++)
+            fQuadratic[3 * c + i][l] += lame[0][l] * sum[0][l] + lame[1][l] * sum[1][l];
+        }
+
+        for(int b=0; b<8; b++)
+        {
+          double sum[2][W];
+          for(int t=0; t<2; t++)
+          {
+            for(int l=0; l<W; l++)
+              sum[t][l] = 0.0;
+            const double * row = quadraticCrossTable[t] + (b * 8 + c) * 24;
+            for(int m=0; m<24; m++)
+              for(int l=0; l<W; l++)
+                sum[t][l] += row[m] * q[m][l];
+          }
+          for(int i=0; i<3; i++)
+            for(int l=0; l<W; l++)
+              fQuadratic[3 * c + i][l] += (lame[0][l] * sum[0][l] + lame[1][l] * sum[1][l]) * q[3 * b + i][l];
+        }
+      }
+
+      // cubic terms: f_c = sum_d M_cd q_d
+      for(int c=0; c<8; c++)
+        for(int d=0; d<8; d++)
+        {
+          const double * Mcd = M[pairIndex[c][d]];
+          for(int i=0; i<3; i++)
+            for(int l=0; l<W; l++)
+              fCubic[3 * c + i][l] += Mcd[l] * q[3 * d + i][l];
+        }
+
+      if (energy != NULL)
+      {
+        // the linear, quadratic and cubic force terms are homogeneous of degree 1, 2, 3 in q
+        double e[W];
+        for(int l=0; l<W; l++)
+          e[l] = 0.0;
+        for(int k=0; k<24; k++)
+          for(int l=0; l<W; l++)
+            e[l] += q[k][l] * (0.5 * fLinear[k][l] + (1.0 / 3) * fQuadratic[k][l] + 0.25 * fCubic[k][l]);
+        for(int l=0; l<numLanes; l++)
+          *energy += e[l];
+      }
+
+      if (forces != NULL)
+      {
+        for(int l=0; l<numLanes; l++)
+        {
+          const int * vertices = volumetricMesh->getVertexIndices(batchStart + l);
+          for(int a=0; a<8; a++)
+          {
+            double * force = &forces[3 * vertices[a]];
+            for(int i=0; i<3; i++)
+              force[i] += fLinear[3 * a + i][l] + fQuadratic[3 * a + i][l] + fCubic[3 * a + i][l];
+          }
+        }
+      }
+    }
+
+    if (stiffnessMatrix != NULL)
+    {
+      // linear terms
+      for(int k=0; k<576; k++)
+        for(int l=0; l<W; l++)
+          Kbatch[k][l] = lame[0][l] * linearTable[0][k] + lame[1][l] * linearTable[1][k];
+
+      // blocks (c,e), c <= e, of the quadratic and cubic terms; block (e,c) is the transpose
+      for(int r=0; r<numPairs; r++)
+      {
+        int c = pairVertex[r][0];
+        int e = pairVertex[r][1];
+        double block[3][3][W];
+        double diagonal[W];
+        for(int l=0; l<W; l++)
+          diagonal[l] = M[r][l];
+        for(int i=0; i<3; i++)
+          for(int j=0; j<3; j++)
+            for(int l=0; l<W; l++)
+              block[i][j][l] = 0.0;
+
+        // quadratic: sum_a (u_a q_a^T + q_a v_a^T + (q_a . w_a) I)
+        for(int a=0; a<8; a++)
+        {
+          double uvw[3][3][W];
+          for(int t=0; t<3; t++)
+          {
+            const double * entry0 = quadraticStiffnessTable[0] + ((r * 3 + t) * 8 + a) * 3;
+            const double * entry1 = quadraticStiffnessTable[1] + ((r * 3 + t) * 8 + a) * 3;
+            for(int i=0; i<3; i++)
+              for(int l=0; l<W; l++)
+                uvw[t][i][l] = lame[0][l] * entry0[i] + lame[1][l] * entry1[i];
+          }
+          for(int i=0; i<3; i++)
+            for(int j=0; j<3; j++)
+              for(int l=0; l<W; l++)
+                block[i][j][l] += uvw[0][i][l] * q[3 * a + j][l] + q[3 * a + i][l] * uvw[1][j][l];
+          for(int i=0; i<3; i++)
+            for(int l=0; l<W; l++)
+              diagonal[l] += q[3 * a + i][l] * uvw[2][i][l];
+        }
+
+        // cubic: sum_{a,b} Z_ab q_a q_b^T = sum_a q_a (sum_b Z_ab q_b)^T
+        for(int a=0; a<8; a++)
+        {
+          double Zq[3][W];
+          for(int j=0; j<3; j++)
+            for(int l=0; l<W; l++)
+              Zq[j][l] = 0.0;
+          const double * row0 = cubicStiffnessTable[0] + (r * 8 + a) * 8;
+          const double * row1 = cubicStiffnessTable[1] + (r * 8 + a) * 8;
+          for(int b=0; b<8; b++)
+            for(int j=0; j<3; j++)
+              for(int l=0; l<W; l++)
+                Zq[j][l] += (lame[0][l] * row0[b] + lame[1][l] * row1[b]) * q[3 * b + j][l];
+          for(int i=0; i<3; i++)
+            for(int j=0; j<3; j++)
+              for(int l=0; l<W; l++)
+                block[i][j][l] += q[3 * a + i][l] * Zq[j][l];
+        }
+
+        for(int i=0; i<3; i++)
+          for(int l=0; l<W; l++)
+            block[i][i][l] += diagonal[l];
+
+        for(int i=0; i<3; i++)
+          for(int j=0; j<3; j++)
+            for(int l=0; l<W; l++)
+              Kbatch[(3 * c + i) * 24 + 3 * e + j][l] += block[i][j][l];
+        if (c != e)
+        {
+          for(int i=0; i<3; i++)
+            for(int j=0; j<3; j++)
+              for(int l=0; l<W; l++)
+                Kbatch[(3 * e + j) * 24 + 3 * c + i][l] += block[i][j][l];
+        }
+      }
+
+      for(int l=0; l<numLanes; l++)
+      {
+        for(int k=0; k<576; k++)
+          Kel[k] = Kbatch[k][l];
+        matrixScatter->AddStencilMatrix(batchStart + l, Kel, stiffnessMatrix, 0);
+      }
+    }
+  }
+}
+
+}//namespace vegafem
+
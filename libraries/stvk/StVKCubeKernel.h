@@ -0,0 +1,110 @@
+/*************************************************************************
+ *                                                                       *
+ * Vega FEM Simulation Library Version 4.0                               *
+ *                                                                       *
+ * "StVK" library , Copyright (C) 2007 CMU, 2009 MIT, 2018 USC           *
+ * All rights reserved.                                                  *
+ *                                                                       *
+ * Code author: Jernej Barbic                                            *
+ * http://www.jernejbarbic.com/vega                                      *
+ *                                                                       *
+ * Research: Jernej Barbic, Hongyi Xu, Yijing Li,                        *
+ *           Danyong Zhao, Bohan Wang,                                   *
+ *           Fun Shing Sin, Daniel Schroeder,                            *
+ *           Doug L. James, Jovan Popovic                                *
+ *                                                                       *
+ * Funding: National Science Foundation, Link Foundation,                *
+ *          Singapore-MIT GAMBIT Game Lab,                               *
+ *          Zumberge Research and Innovation Fund at USC,                *
+ *          Sloan Foundation, Okawa Foundation,                          *
+ *          USC Annenberg Foundation                                     *
+ *                                                                       *
+ * This library is free software; you can redistribute it and/or         *
+ * modify it under the terms of the BSD-style license that is            *
+ * included with this library in the file LICENSE.txt                    *
+ *                                                                       *
+ * This library is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the file     *
+ * LICENSE.TXT for more details.                                         *
+ *                                                                       *
+ *************************************************************************/
+
+
+/*
+  Evaluates the St.Venant-Kirchhoff internal forces, tangent stiffness matrix and strain energy 
+  of a cubic (voxel) mesh, in a single pass over the elements.
+
+  All the cubes of a CubicMesh are identical, so StVKCubeABCD holds a single set of A,B,C,D tables,
+  shared by all the elements. The generic routines of StVKInternalForces and StVKStiffnessMatrix 
+  read these tables through the per-element virtual interface of StVKElementABCD.
+  This class instead contracts the tables once (at construction) into dense, fixed-size matrices
+  that act directly on the 24 element displacements, and on the 36 dot products q_a . q_b (a <= b)
+  of the element vertex displacements (e.g., the cubic force terms become a 36 x 36 matrix-vector product).
+  The tables are split into the parts multiplied by lambda and by mu, so that the Lame parameters 
+  can vary from element to element. The result is the same as the sum of the linear, quadratic and cubic 
+  terms computed by StVKInternalForces and StVKStiffnessMatrix (up to floating-point roundoff).
+
+  The cubes are processed in batches of "batchSize" elements. Within a batch, the innermost loops
+  run over the elements of the batch ("lanes") with unit stride, so that the compiler can vectorize them
+  (4 cubes per AVX2 vector, 8 cubes per AVX-512 vector, when the code is compiled for these instruction sets).
+
+  See also StVKInternalForces.h .
+*/
+
+#ifndef VEGAFEM_STVKCUBEKERNEL_H
+#define VEGAFEM_STVKCUBEKERNEL_H
+
+#include "StVKCubeABCD.h"
+#include "volumetricMesh.h"
+#include "sparseMatrix.h"
+#include "sparseMatrixScatter.h"
+#include <vector>
+
+namespace vegafem
+{
+
+class StVKCubeKernel
+{
+public:
+#ifdef __AVX512F__
+  enum { batchSize = 8 };
+#else
+  enum { batchSize = 4 };
+#endif
+
+  // contracts the A,B,C,D tables of the cube element
+  StVKCubeKernel(StVKCubeABCD * cubeABCD);
+
+  // Evaluates the elements elementLow <= el < elementHigh of the cubic mesh "volumetricMesh", given the vertex displacements u.
+  // lambdaLame, muLame: the Lame parameters of the elements.
+  // Adds the internal forces into "forces", the strain energy into "energy", 
+  // and the tangent stiffness matrix into "stiffnessMatrix" (via matrixScatter, which must be built for the mesh elements).
+  // Each of forces, energy, stiffnessMatrix can be NULL, in which case the corresponding quantity is not computed.
+  void AddEnergyAndForceAndMatrix(const VolumetricMesh * volumetricMesh, const double * lambdaLame, const double * muLame,
+    const double * u, int elementLow, int elementHigh, double * energy, double * forces, 
+    const SparseMatrixScatter * matrixScatter, SparseMatrix * stiffnessMatrix) const;
+
+protected:
+  enum { numPairs = 36 }; // vertex pairs (a,b), a <= b
+  int pairVertex[numPairs][2];
+  int pairIndex[8][8]; // index of the pair (min(a,b), max(a,b))
+
+  // each table comes in two parts, the first multiplied by lambda, the second by mu
+  // linear terms: 24 x 24 matrix (row-major), the rest stiffness matrix
+  std::vector<double> linear[2];
+  // quadratic forces: f_c += sum_{pairs p} (q_a . q_b) quadraticPair[c][p] + sum_b (sum_a quadraticCross[b][c][a] . q_a) q_b
+  std::vector<double> quadraticPair[2]; // [8][numPairs][3]
+  std::vector<double> quadraticCross[2]; // [8 * 8][8 * 3]
+  // cubic forces: f_c += sum_d M_cd q_d, with the symmetric matrix M_cd = sum_{pairs p} cubic[pair(c,d)][p] (q_a . q_b)
+  std::vector<double> cubic[2]; // [numPairs][numPairs]
+  // quadratic stiffness, block (c,e), c <= e: sum_a (u_a q_a^T + q_a v_a^T + (q_a . w_a) I), where u_a, v_a, w_a are 3-vectors
+  std::vector<double> quadraticStiffness[2]; // [numPairs][3 (u,v,w)][8][3]
+  // cubic stiffness, block (c,e), c <= e: sum_{a,b} Z_ab q_a q_b^T + M_ce I
+  std::vector<double> cubicStiffness[2]; // [numPairs][8][8]
+};
+
+}//namespace vegafem
+
+#endif
+
@@ -0,0 +1,120 @@
+/*************************************************************************
+ *                                                                       *
+ * Vega FEM Simulation Library Version 4.0                               *
+ *                                                                       *
+ * "StVK" library , Copyright (C) 2007 CMU, 2009 MIT, 2018 USC           *
+ * All rights reserved.                                                  *
+ *                                                                       *
+ * Code author: Jernej Barbic                                            *
+ * http://www.jernejbarbic.com/vega                                      *
+ *                                                                       *
+ * Research: Jernej Barbic, Hongyi Xu, Yijing Li,                        *
+ *           Danyong Zhao, Bohan Wang,                                   *
+ *           Fun Shing Sin, Daniel Schroeder,                            *
+ *           Doug L. James, Jovan Popovic                                *
+ *                                                                       *
+ * Funding: National Science Foundation, Link Foundation,                *
+ *          Singapore-MIT GAMBIT Game Lab,                               *
+ *          Zumberge Research and Innovation Fund at USC,                *
+ *          Sloan Foundation, Okawa Foundation,                          *
+ *          USC Annenberg Foundation                                     *
+ *                                                                       *
+ * This library is free software; you can redistribute it and/or         *
+ * modify it under the terms of the BSD-style license that is            *
+ * included with this library in the file LICENSE.txt                    *
+ *                                                                       *
+ * This library is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the file     *
+ * LICENSE.TXT for more details.                                         *
+ *                                                                       *
+ *************************************************************************/
+
+
+#include "StVKElementRangeEvaluator.h"
+
+#ifdef VEGAFEM_USE_TBB
+  #include <tbb/tbb.h>
+#endif
+
+namespace vegafem
+{
+
+StVKElementRangeEvaluator::StVKElementRangeEvaluator(VolumetricMesh * volumetricMesh): numElements(volumetricMesh->getNumElements())
+{
+#ifdef VEGAFEM_USE_TBB
+  int numElementVertices = volumetricMesh->getNumElementVertices();
+  int numBlocks = (numElements + blockSize - 1) / blockSize;
+
+  // greedy block coloring: each block gets the smallest color not used by any block sharing one of its vertices
+  std::vector<std::vector<int>> vertexColors(volumetricMesh->getNumVertices()); // colors of the blocks incident to each vertex
+  std::vector<int> colorStamp; // colorStamp[color] == block if the color is used by a neighbor of the block
+  for(int block=0; block<numBlocks; block++)
+  {
+    int elementLow = blockSize * block;
+    int elementHigh = (elementLow + blockSize < numElements) ? elementLow + blockSize : numElements;
+    for(int el=elementLow; el<elementHigh; el++)
+    {
+      const int * vtxIndex = volumetricMesh->getVertexIndices(el);
+      for(int i=0; i<numElementVertices; i++)
+        for(int color : vertexColors[vtxIndex[i]])
+          colorStamp[color] = block;
+    }
+
+    int color = 0;
+    while ((color < (int)colorStamp.size()) && (colorStamp[color] == block))
+      color++;
+
+    if (color == (int)blockColors.size())
+    {
+      blockColors.emplace_back();
+      colorStamp.push_back(-1);
+    }
+    blockColors[color].push_back(block);
+
+    for(int el=elementLow; el<elementHigh; el++)
+    {
+      const int * vtxIndex = volumetricMesh->getVertexIndices(el);
+      for(int i=0; i<numElementVertices; i++)
+      {
+        std::vector<int> & colors = vertexColors[vtxIndex[i]];
+        if (colors.empty() || (colors.back() != color)) // a vertex can be shared by several elements of the block
+          colors.push_back(color);
+      }
+    }
+  }
+#endif
+}
+
+StVKElementRangeEvaluator::~StVKElementRangeEvaluator()
+{
+}
+
+double StVKElementRangeEvaluator::Evaluate(const RangeFunction & evaluateRange)
+{
+#ifdef VEGAFEM_USE_TBB
+  // no two blocks of a color share a vertex, so the blocks of one color add into the outputs in parallel, without write conflicts
+  double value = 0.0;
+  for(const std::vector<int> & colorBlocks : blockColors)
+  {
+    // one block per task, and deterministic reduction: the value does not depend on the number of threads
+    value += tbb::parallel_deterministic_reduce(tbb::blocked_range<int>(0, (int)colorBlocks.size(), 1), 0.0,
+      [&](const tbb::blocked_range<int> & rng, double rangeValue)
+    {
+      for(int i=rng.begin(); i!=rng.end(); ++i)
+      {
+        int elementLow = blockSize * colorBlocks[i];
+        int elementHigh = (elementLow + blockSize < numElements) ? elementLow + blockSize : numElements;
+        rangeValue += evaluateRange(elementLow, elementHigh);
+      }
+      return rangeValue;
+    }, std::plus<double>());
+  }
+  return value;
+#else
+  return evaluateRange(0, numElements);
+#endif
+}
+
+}//namespace vegafem
+
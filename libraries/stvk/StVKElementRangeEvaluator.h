@@ -0,0 +1,86 @@
+/*************************************************************************
+ *                                                                       *
+ * Vega FEM Simulation Library Version 4.0                               *
+ *                                                                       *
+ * "StVK" library , Copyright (C) 2007 CMU, 2009 MIT, 2018 USC           *
+ * All rights reserved.                                                  *
+ *                                                                       *
+ * Code author: Jernej Barbic                                            *
+ * http://www.jernejbarbic.com/vega                                      *
+ *                                                                       *
+ * Research: Jernej Barbic, Hongyi Xu, Yijing Li,                        *
+ *           Danyong Zhao, Bohan Wang,                                   *
+ *           Fun Shing Sin, Daniel Schroeder,                            *
+ *           Doug L. James, Jovan Popovic                                *
+ *                                                                       *
+ * Funding: National Science Foundation, Link Foundation,                *
+ *          Singapore-MIT GAMBIT Game Lab,                               *
+ *          Zumberge Research and Innovation Fund at USC,                *
+ *          Sloan Foundation, Okawa Foundation,                          *
+ *          USC Annenberg Foundation                                     *
+ *                                                                       *
+ * This library is free software; you can redistribute it and/or         *
+ * modify it under the terms of the BSD-style license that is            *
+ * included with this library in the file LICENSE.txt                    *
+ *                                                                       *
+ * This library is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the file     *
+ * LICENSE.TXT for more details.                                         *
+ *                                                                       *
+ *************************************************************************/
+
+
+#ifndef VEGAFEM_STVKELEMENTRANGEEVALUATOR_H
+#define VEGAFEM_STVKELEMENTRANGEEVALUATOR_H
+
+/*
+  Multi-threaded evaluation of element ranges, for StVKInternalForces, StVKStiffnessMatrix and StVKHessianTensor.
+
+  If Intel TBB is provided, the mesh elements are split into blocks of "blockSize" consecutive elements,
+  and the blocks are colored (once, at construction) so that no two blocks of the same color share a vertex.
+  The colors are evaluated one after another; the blocks of a color are evaluated in parallel,
+  using the element-range routines of these classes (e.g., AddLinearTermsContribution).
+  Because an element only adds into the vector entries and sparse matrix rows of its own vertices,
+  the blocks of a color add their contributions directly into the output vectors and matrices,
+  without write conflicts, and without thread-local copies of the outputs.
+  Blocks of consecutive elements (rather than single elements) are colored so that the batched 
+  tet and cube kernels (StVKTetKernel.h, StVKCubeKernel.h) still see contiguous element ranges.
+  The scalar results (e.g., energy) are summed with a deterministic reduction, so the results 
+  do not depend on the number of threads, and are reproducible from run to run.
+  The number of threads can be controlled outside the class using the Intel TBB APIs.
+  Meshes with a local element order (see volumetricMeshReordering.h) give fewer colors.
+
+  If Intel TBB is not provided, all elements are evaluated as a single range.
+*/
+
+#include <functional>
+#include <vector>
+#include "volumetricMesh.h"
+
+namespace vegafem
+{
+
+class StVKElementRangeEvaluator
+{
+public:
+  // colors the element blocks of the mesh
+  StVKElementRangeEvaluator(VolumetricMesh * volumetricMesh);
+  virtual ~StVKElementRangeEvaluator();
+
+  // Calls evaluateRange(elementLow, elementHigh) for element ranges that cover all the elements, in parallel.
+  // evaluateRange must add the contributions of its elements into the outputs (only into the entries of the element vertices), 
+  // and return the sum of any scalar contributions (e.g., energy); the function returns the total of the returned values.
+  typedef std::function<double(int elementLow, int elementHigh)> RangeFunction;
+  double Evaluate(const RangeFunction & evaluateRange);
+
+protected:
+  enum { blockSize = 16 };
+  int numElements;
+  std::vector<std::vector<int>> blockColors; // the blocks of each color; block b holds the elements [blockSize * b, blockSize * (b+1))
+};
+
+}//namespace vegafem
+
+#endif
+
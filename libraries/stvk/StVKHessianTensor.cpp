@@ -33,6 +33,10 @@
 #include "StVKHessianTensor.h"
 #include "volumetricMeshENuMaterial.h"
 
+#ifdef VEGAFEM_USE_TBB
+  #include <tbb/tbb.h>
+#endif
+
 namespace vegafem
 {
 
@@ -63,7 +67,7 @@ namespace vegafem
   v1 = vertices[(aa)];\
   v2 = vertices[(bb)];\
   v3 = vertices[(cc)];\
-  for(int ii=0; ii<k-numRigidModes; ii++)\
+  for(int ii=modeLow; ii<modeHigh; ii++)\
     for(int jj=ii; jj<k-numRigidModes; jj++)\
     {\
       int derivPos = ii * (k-numRigidModes) - ii * (ii+1) / 2 + jj;\
@@ -96,10 +100,13 @@ StVKHessianTensor::StVKHessianTensor(StVKStiffnessMatrix * stVKStiffnessMatrix_)
     lambdaLame[el] = eNuMaterial->getLambda();
     muLame[el] = eNuMaterial->getMu();
   }
+
+  rangeEvaluator = new StVKElementRangeEvaluator(volumetricMesh);
 }
 
 StVKHessianTensor::~StVKHessianTensor()
 {
+  delete(rangeEvaluator);
   free(lambdaLame);
   free(muLame);
 }
@@ -309,34 +316,41 @@ int StVKHessianTensor::SaveHessianAtZeroToFile(const char * filename)
 }
 
 void StVKHessianTensor::EvaluateHessianQuadraticFormDirect(double * phir, double * phis, double * result)
+{
+  // reset result to zero
+  memset(result,0,sizeof(double)*3*numVertices_);
+
+  printf("Evaluating Hessian Quadratic Form (rhs matrix)... Total num elements: %d \n",numElements_);
+
+  rangeEvaluator->Evaluate([&](int elementLow, int elementHigh)
+  {
+    AddHessianQuadraticFormDirectContribution(phir, phis, result, elementLow, elementHigh);
+    return 0.0;
+  });
+}
+
+void StVKHessianTensor::AddHessianQuadraticFormDirectContribution(const double * phir, const double * phis, double * result, int elementLow, int elementHigh)
 {
   double entry[27];
   double * hijk0 = &entry[0];
   double * hijk1 = &entry[9];
   double * hijk2 = &entry[18];
 
-  double * phisk;
-  double * phirj;
+  const double * phisk;
+  const double * phirj;
 
   int v1,v2,v3;
 
   int i,j;
 
-  // reset result to zero
-  memset(result,0,sizeof(double)*3*numVertices_);
-
   int * vertices = (int*) malloc (sizeof(int) * numElementVertices);
 
   void * elIter;
   precomputedIntegrals->AllocateElementIterator(&elIter);
 
-  printf("Evaluating Hessian Quadratic Form (rhs matrix)... Total num elements: %d \n",numElements_);
-
-  for(int el=0; el < numElements_; el++)
+  for(int el=elementLow; el < elementHigh; el++)
   {
     precomputedIntegrals->PrepareElement(el, elIter);
-    if (el % 500 == 1)
-      printf("%d ",el);
 
     for(int ver=0; ver<numElementVertices; ver++)
       vertices[ver] = volumetricMesh->getVertexIndex(el, ver);
@@ -401,33 +415,16 @@ void StVKHessianTensor::EvaluateHessianQuadraticFormDirect(double * phir, double
   free(vertices);
 
   precomputedIntegrals->ReleaseElementIterator(elIter);
-
-  printf("\n");
 }
 
 void StVKHessianTensor::EvaluateHessianQuadraticFormDirectAll(double * Ulin, int k, double * result, int numRigidModes, int verbose)
 {
-  double entry[27];
-  double * hijk0 = &entry[0];
-  double * hijk1 = &entry[9];
-  double * hijk2 = &entry[18];
-
-  double * phisk;
-  double * phirj;
-
-  int v1,v2,v3;
-
   // reset result to zero
   int numDeriv = (k-numRigidModes) * (k-numRigidModes+1) / 2; 
   int m3 = 3*numVertices_;
 
   memset(result,0,sizeof(double)*m3*numDeriv);
 
-  int * vertices = (int*) malloc (sizeof(int) * numElementVertices);
-
-  void * elIter;
-  precomputedIntegrals->AllocateElementIterator(&elIter);
-
   if (verbose)
   {
     printf("Evaluating the Hessian quadratic form (rhs matrix)...\n");
@@ -438,6 +435,39 @@ void StVKHessianTensor::EvaluateHessianQuadraticFormDirectAll(double * Ulin, int
     printf("  Total num derivatives: %d \n",numDeriv);
   }
 
+  // each derivative (result column) is owned by a single first mode ii, so the modes can be processed in parallel without write conflicts
+#ifdef VEGAFEM_USE_TBB
+  tbb::parallel_for(tbb::blocked_range<int>(0, k-numRigidModes), [&](const tbb::blocked_range<int> & rng)
+  {
+    AddHessianQuadraticFormDirectAllContribution(Ulin, k, result, numRigidModes, rng.begin(), rng.end(), verbose && (rng.begin() == 0));
+  });
+#else
+  AddHessianQuadraticFormDirectAllContribution(Ulin, k, result, numRigidModes, 0, k-numRigidModes, verbose);
+#endif
+
+  if (verbose)
+    printf("\n");
+}
+
+void StVKHessianTensor::AddHessianQuadraticFormDirectAllContribution(const double * Ulin, int k, double * result, int numRigidModes, int modeLow, int modeHigh, int verbose)
+{
+  double entry[27];
+  double * hijk0 = &entry[0];
+  double * hijk1 = &entry[9];
+  double * hijk2 = &entry[18];
+
+  const double * phisk;
+  const double * phirj;
+
+  int v1,v2,v3;
+
+  int m3 = 3*numVertices_;
+
+  int * vertices = (int*) malloc (sizeof(int) * numElementVertices);
+
+  void * elIter;
+  precomputedIntegrals->AllocateElementIterator(&elIter);
+
   for(int el=0; el < numElements_; el++)
   {
     precomputedIntegrals->PrepareElement(el, elIter);
@@ -508,24 +538,21 @@ void StVKHessianTensor::EvaluateHessianQuadraticFormDirectAll(double * Ulin, int
   free(vertices);
 
   precomputedIntegrals->ReleaseElementIterator(elIter);
-
-  if (verbose)
-    printf("\n");
 }
 
 void StVKHessianTensor::ComputeStiffnessMatrixCorrection(double * u, double * du, SparseMatrix * dK)
 {
   dK->ResetToZero();
-  AddQuadraticTermsContribution(u, du, dK);
-  AddCubicTermsContribution(u, du, dK);
+  rangeEvaluator->Evaluate([&](int elementLow, int elementHigh)
+  {
+    AddQuadraticTermsContribution(u, du, dK, elementLow, elementHigh);
+    AddCubicTermsContribution(u, du, dK, elementLow, elementHigh);
+    return 0.0;
+  });
 }
 
 #define ADD_MATRIX_BLOCK(where)\
-  for(k=0; k<3; k++)\
-    for(l=0; l<3; l++)\
-    {\
-      dataHandle[rowc+k][3*column[c8+(where)]+l] += matrix[3*k+l];\
-    }
+  matrixScatter->AddStencilBlock3x3(el, c, (where), matrix, dK);
 
 void StVKHessianTensor::AddQuadraticTermsContribution(double * u, double * du, SparseMatrix * dK, int elementLow, int elementHigh) 
 {
@@ -534,21 +561,16 @@ void StVKHessianTensor::AddQuadraticTermsContribution(double * u, double * du, S
   if (elementHigh < 0)
     elementHigh = volumetricMesh->getNumElements();
 
-  int ** row_, ** column_;
-  stVKStiffnessMatrix->GetMatrixAccelerationIndices(&row_, &column_);
+  const SparseMatrixScatter * matrixScatter = stVKStiffnessMatrix->GetMatrixScatter();
 
   int * vertices = (int*) malloc (sizeof(int) * numElementVertices);
 
   void * elIter;
   precomputedIntegrals->AllocateElementIterator(&elIter);
 
-  double ** dataHandle = dK->GetDataHandle();
-
   for(int el=elementLow; el < elementHigh; el++)
   {
     precomputedIntegrals->PrepareElement(el, elIter);
-    int * row = row_[el];
-    int * column = column_[el];
 
     for(int ver=0; ver<numElementVertices ;ver++)
       vertices[ver] = volumetricMesh->getVertexIndex(el, ver);
@@ -558,8 +580,6 @@ void StVKHessianTensor::AddQuadraticTermsContribution(double * u, double * du, S
 
     for (int c=0; c<numElementVertices; c++) // over all vertices of the voxel
     {
-      int rowc = 3*row[c];
-      int c8 = numElementVertices*c;
       for (int e=0; e<numElementVertices; e++) // compute contribution to block (c,e) of dK
       {
         double matrix[9];
@@ -593,7 +613,6 @@ void StVKHessianTensor::AddQuadraticTermsContribution(double * u, double * du, S
           matrix[4] += dotp;
           matrix[8] += dotp;
         }
-        int k,l;
         ADD_MATRIX_BLOCK(e);
       }
     }
@@ -611,21 +630,16 @@ void StVKHessianTensor::AddCubicTermsContribution(double * u, double * du, Spars
   if (elementHigh < 0)
     elementHigh = volumetricMesh->getNumElements();
 
-  int ** row_, ** column_;
-  stVKStiffnessMatrix->GetMatrixAccelerationIndices(&row_, &column_);
+  const SparseMatrixScatter * matrixScatter = stVKStiffnessMatrix->GetMatrixScatter();
 
   int * vertices = (int*) malloc (sizeof(int) * numElementVertices);
 
   void * elIter;
   precomputedIntegrals->AllocateElementIterator(&elIter);
 
-  double ** dataHandle = dK->GetDataHandle();
-
   for(int el=elementLow; el < elementHigh; el++)
   {
     precomputedIntegrals->PrepareElement(el, elIter);
-    int * row = row_[el];
-    int * column = column_[el];
 
     for(int ver=0; ver<numElementVertices ;ver++)
       vertices[ver] = volumetricMesh->getVertexIndex(el, ver);
@@ -635,8 +649,6 @@ void StVKHessianTensor::AddCubicTermsContribution(double * u, double * du, Spars
 
     for (int c=0; c<numElementVertices; c++) // over all vertices of the voxel
     {
-      int rowc = 3*row[c];
-      int c8 = numElementVertices*c;
       for (int e=0; e<numElementVertices; e++) // compute contribution to block (c,e) of dK
       {
         double matrix[9];
@@ -675,7 +687,6 @@ void StVKHessianTensor::AddCubicTermsContribution(double * u, double * du, Spars
             matrix[8] += dotp;
           }
         }
-        int k,l;
         ADD_MATRIX_BLOCK(e);
       }
     }
@@ -36,6 +36,8 @@
 /*
   The second derivative (Hessian tensor) of internal elastic forces.
   See also StVKInternalForces.h .
+  With Intel TBB, ComputeStiffnessMatrixCorrection, EvaluateHessianQuadraticFormDirect and 
+  EvaluateHessianQuadraticFormDirectAll are multi-threaded (see StVKElementRangeEvaluator.h).
 */
 
 #include "triple.h"
@@ -43,6 +45,7 @@
 #include "volumetricMesh.h"
 #include "StVKElementABCD.h"
 #include "StVKStiffnessMatrix.h"
+#include "StVKElementRangeEvaluator.h"
 
 namespace vegafem
 {
@@ -98,6 +101,12 @@ protected:
 
   double * lambdaLame;
   double * muLame;
+
+  StVKElementRangeEvaluator * rangeEvaluator;
+
+  // element-range (respectively, mode-range) workers of EvaluateHessianQuadraticFormDirect(All); they add into result
+  void AddHessianQuadraticFormDirectContribution(const double * phir, const double * phis, double * result, int elementLow, int elementHigh);
+  void AddHessianQuadraticFormDirectAllContribution(const double * Ulin, int k, double * result, int numRigidModes, int modeLow, int modeHigh, int verbose);
 };
 
 
@@ -31,7 +31,10 @@
  *************************************************************************/
 
 #include "StVKInternalForces.h"
+#include "StVKTetABCD.h"
 #include "volumetricMeshENuMaterial.h"
+#include "StVKTetKernel.h"
+#include "StVKElementRangeEvaluator.h"
 
 namespace vegafem
 {
@@ -59,10 +62,28 @@ StVKInternalForces::StVKInternalForces(VolumetricMesh * volumetricMesh_, StVKEle
   buffer = (double*) malloc (sizeof(double) * 3 * volumetricMesh->getNumVertices());
   numElementVertices = volumetricMesh->getNumElementVertices();
   InitGravity();
+
+  useTetKernel = true;
+  elementCache = NULL;
+  StVKTetABCD * tetABCD = dynamic_cast<StVKTetABCD*>(precomputedIntegrals);
+  TetMesh * tetMesh = dynamic_cast<TetMesh*>(volumetricMesh);
+  if ((tetABCD != NULL) && (tetMesh != NULL))
+    elementCache = new TetMeshElementCache(tetMesh);
+
+  useCubeKernel = true;
+  cubeKernel = NULL;
+  StVKCubeABCD * cubeABCD = dynamic_cast<StVKCubeABCD*>(precomputedIntegrals);
+  if ((cubeABCD != NULL) && (volumetricMesh->getElementType() == VolumetricMesh::CUBIC))
+    cubeKernel = new StVKCubeKernel(cubeABCD);
+
+  rangeEvaluator = new StVKElementRangeEvaluator(volumetricMesh);
 }
 
 StVKInternalForces::~StVKInternalForces()
 {
+  delete(rangeEvaluator);
+  delete(elementCache);
+  delete(cubeKernel);
   free(gravityForce);
   free(buffer);
   free(lambdaLame);
@@ -80,36 +101,78 @@ void StVKInternalForces::InitGravity()
 
 double StVKInternalForces::ComputeEnergy(const double * vertexDisplacements)
 {
-  return ComputeEnergyContribution(vertexDisplacements, 0, volumetricMesh->getNumElements());
+  return rangeEvaluator->Evaluate([&](int elementLow, int elementHigh)
+  {
+    return ComputeEnergyContribution(vertexDisplacements, elementLow, elementHigh);
+  });
 }
 
 double StVKInternalForces::ComputeEnergyContribution(const double * vertexDisplacements, int elementLow, int elementHigh, double * buffer)
 {
+  if (GetTetKernelElementCache() != NULL)
+  {
+    double energy = 0;
+    StVKTetKernel::AddEnergyAndForceAndMatrix(elementCache, vertexDisplacements, elementLow, elementHigh, &energy, NULL, NULL, NULL);
+    return energy;
+  }
+
+  if (GetCubeKernel() != NULL)
+  {
+    double energy = 0;
+    cubeKernel->AddEnergyAndForceAndMatrix(volumetricMesh, lambdaLame, muLame, vertexDisplacements, elementLow, elementHigh, &energy, NULL, NULL, NULL);
+    return energy;
+  }
+
   if (buffer == NULL)
     buffer = this->buffer;
 
-  int numVertices = volumetricMesh->getNumVertices();
+  if (elementLow < 0)
+    elementLow = 0;
+  if (elementHigh < 0)
+    elementHigh = volumetricMesh->getNumElements();
+
+  // the specified elements only add into the buffer entries of their vertices, so only these entries are reset and read
+  // (and elements that share no vertices can use the same buffer concurrently);
+  // an entry is reset right after it is read, so that a vertex shared by several elements is counted once
+  auto resetElementEntries = [&]()
+  {
+    for(int el=elementLow; el<elementHigh; el++)
+      for(int ver=0; ver<numElementVertices; ver++)
+      {
+        int vtx = volumetricMesh->getVertexIndex(el, ver);
+        buffer[3*vtx+0] = buffer[3*vtx+1] = buffer[3*vtx+2] = 0.0;
+      }
+  };
+  auto readElementEntries = [&](double weight)
+  {
+    double work = 0;
+    for(int el=elementLow; el<elementHigh; el++)
+      for(int ver=0; ver<numElementVertices; ver++)
+      {
+        int vtx = volumetricMesh->getVertexIndex(el, ver);
+        for(int i=3*vtx; i<3*vtx+3; i++)
+        {
+          work += buffer[i] * vertexDisplacements[i];
+          buffer[i] = 0.0;
+        }
+      }
+    return weight * work;
+  };
+
   double energy = 0;
+  resetElementEntries();
 
   // ---- linear
-  ResetVector(buffer);
   AddLinearTermsContribution(vertexDisplacements, buffer, elementLow, elementHigh);
-  for (int i=0; i< 3 * numVertices; i++)
-    energy += 0.5 * buffer[i] * vertexDisplacements[i];
+  energy += readElementEntries(0.5);
 
   // ---- quadratic
-  ResetVector(buffer);
   AddQuadraticTermsContribution(vertexDisplacements, buffer, elementLow, elementHigh);
-  double oneThird = 1.0 / 3;
-  for (int i=0; i< 3 * numVertices; i++)
-    energy += oneThird * buffer[i] * vertexDisplacements[i];
+  energy += readElementEntries(1.0 / 3);
 
   // ---- cubic
-  ResetVector(buffer);
   AddCubicTermsContribution(vertexDisplacements, buffer, elementLow, elementHigh);
-  double oneQuarter = 1.0 / 4;
-  for (int i=0; i< 3 * numVertices; i++)
-    energy += oneQuarter * buffer[i] * vertexDisplacements[i];
+  energy += readElementEntries(1.0 / 4);
 
   return energy;
 }
@@ -119,19 +182,44 @@ void StVKInternalForces::ComputeForces(const double * vertexDisplacements, doubl
   //PerformanceCounter forceCounter;
 
   ResetVector(forces);
-  AddLinearTermsContribution(vertexDisplacements, forces);
-  AddQuadraticTermsContribution(vertexDisplacements, forces);
-  AddCubicTermsContribution(vertexDisplacements, forces);
+  rangeEvaluator->Evaluate([&](int elementLow, int elementHigh)
+  {
+    AddForcesContribution(vertexDisplacements, forces, elementLow, elementHigh);
+    return 0.0;
+  });
 
+  AddGravityContribution(forces);
+
+  //forceCounter.StopCounter();
+  //printf("Internal forces: %G\n", forceCounter.GetElapsedTime());
+}
+
+void StVKInternalForces::AddForcesContribution(const double * vertexDisplacements, double * forces, int elementLow, int elementHigh)
+{
+  if (GetTetKernelElementCache() != NULL)
+  {
+    StVKTetKernel::AddEnergyAndForceAndMatrix(elementCache, vertexDisplacements, elementLow, elementHigh, NULL, forces, NULL, NULL);
+  }
+  else if (GetCubeKernel() != NULL)
+  {
+    cubeKernel->AddEnergyAndForceAndMatrix(volumetricMesh, lambdaLame, muLame, vertexDisplacements, elementLow, elementHigh, NULL, forces, NULL, NULL);
+  }
+  else
+  {
+    AddLinearTermsContribution(vertexDisplacements, forces, elementLow, elementHigh);
+    AddQuadraticTermsContribution(vertexDisplacements, forces, elementLow, elementHigh);
+    AddCubicTermsContribution(vertexDisplacements, forces, elementLow, elementHigh);
+  }
+}
+
+void StVKInternalForces::AddGravityContribution(double * forces)
+{
   if (addGravity)
   {
     int n = volumetricMesh->getNumVertices();
     for(int i=0; i<3*n; i++)
       forces[i] -= gravityForce[i];
   }
-
-  //forceCounter.StopCounter();
-  //printf("Internal forces: %G\n", forceCounter.GetElapsedTime());
 }
 
 void StVKInternalForces::AddLinearTermsContribution(const double * vertexDisplacements, double * forces, int elementLow, int elementHigh)
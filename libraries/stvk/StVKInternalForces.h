@@ -73,6 +73,10 @@ Note: all matrices are stored in the column-major order (same format as in LAPAC
 
 #include "volumetricMesh.h"
 #include "StVKElementABCD.h"
+#include "StVKCubeABCD.h"
+#include "StVKCubeKernel.h"
+#include "tetMeshElementCache.h"
+#include "StVKElementRangeEvaluator.h"
 
 namespace vegafem
 {
@@ -100,11 +104,30 @@ public:
   inline VolumetricMesh * GetVolumetricMesh() { return volumetricMesh; }
   inline StVKElementABCD * GetPrecomputedIntegrals() { return precomputedIntegrals; }
 
+  // With tet meshes (StVKTetABCD integrals), ComputeForces and ComputeEnergy(Contribution) use the fused 
+  // closed-form tet kernel (see StVKTetKernel.h) instead of the separate linear, quadratic and cubic terms.
+  // The results are equal up to floating-point roundoff. Default: enabled.
+  void UseTetKernel(bool useTetKernel) { this->useTetKernel = useTetKernel; }
+  // returns the element cache read by the tet kernel if the tet kernel is used, otherwise NULL
+  inline const TetMeshElementCache * GetTetKernelElementCache() const { return useTetKernel ? elementCache : NULL; }
+
+  // With cubic meshes (StVKCubeABCD integrals), ComputeForces and ComputeEnergy(Contribution) use the voxel kernel
+  // (see StVKCubeKernel.h), which evaluates the shared cube tables in a single pass over batches of elements.
+  // The results are equal up to floating-point roundoff. Default: enabled.
+  void UseCubeKernel(bool useCubeKernel) { this->useCubeKernel = useCubeKernel; }
+  // returns the cube kernel if it is used, otherwise NULL
+  inline const StVKCubeKernel * GetCubeKernel() const { return useCubeKernel ? cubeKernel : NULL; }
+
   // === advanced routines below === 
-  double ComputeEnergyContribution(const double * vertexDisplacements, int elementLow, int elementHigh, double * buffer = NULL); // compute the contribution to strain energy due to the specified elements; needs a buffer for internal calculations; you can pass NULL (and then an internal buffer will be used), or pass your own buffer (useful with multi-threading)
+  // Note: with Intel TBB, ComputeForces and ComputeEnergy evaluate the elements in parallel, using the element-range routines below (see StVKElementRangeEvaluator.h).
+  double ComputeEnergyContribution(const double * vertexDisplacements, int elementLow, int elementHigh, double * buffer = NULL); // compute the contribution to strain energy due to the specified elements; needs a buffer (of length 3 * numVertices) for internal calculations; you can pass NULL (and then an internal buffer will be used), or pass your own buffer; only the buffer entries of the vertices of the specified elements are used, so calls on elements that share no vertices can use the same buffer concurrently
   void AddLinearTermsContribution(const double * vertexDisplacements, double * forces, int elementLow=-1, int elementHigh=-1);
   void AddQuadraticTermsContribution(const double * vertexDisplacements, double * forces, int elementLow=-1, int elementHigh=-1);
   void AddCubicTermsContribution(const double * vertexDisplacements, double * forces, int elementLow=-1, int elementHigh=-1);
+  // adds all (linear, quadratic and cubic) terms, with the tet kernel if it is used
+  void AddForcesContribution(const double * vertexDisplacements, double * forces, int elementLow, int elementHigh);
+  // subtracts the gravity force from the internal forces, if gravity is enabled (as in ComputeForces)
+  void AddGravityContribution(double * forces);
   
 protected:
   VolumetricMesh * volumetricMesh;
@@ -118,6 +141,13 @@ protected:
   double * buffer;
   int numElementVertices;
 
+  bool useTetKernel;
+  TetMeshElementCache * elementCache; // built for tet meshes with StVKTetABCD integrals; otherwise NULL
+  bool useCubeKernel;
+  StVKCubeKernel * cubeKernel; // built for cubic meshes with StVKCubeABCD integrals; otherwise NULL
+
+  StVKElementRangeEvaluator * rangeEvaluator;
+
   void ResetVector(double * vec); // aux function
 
   double * lambdaLame;
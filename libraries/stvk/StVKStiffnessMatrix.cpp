@@ -32,11 +32,12 @@
 
 #include "StVKStiffnessMatrix.h"
 #include "volumetricMeshENuMaterial.h"
+#include "StVKTetKernel.h"
 
 namespace vegafem
 {
 
-StVKStiffnessMatrix::StVKStiffnessMatrix(StVKInternalForces *  stVKInternalForces)
+StVKStiffnessMatrix::StVKStiffnessMatrix(StVKInternalForces *  stVKInternalForces_): stVKInternalForces(stVKInternalForces_)
 {
   precomputedIntegrals = stVKInternalForces->GetPrecomputedIntegrals();
   volumetricMesh = stVKInternalForces->GetVolumetricMesh();
@@ -65,23 +66,15 @@ StVKStiffnessMatrix::StVKStiffnessMatrix(StVKInternalForces *  stVKInternalForce
   GetStiffnessMatrixTopology(&stiffnessMatrixTopology);
 
   // build acceleration indices
-  row_ = (int**) malloc (sizeof(int*) * numElements);
-  column_ = (int**) malloc (sizeof(int*) * numElements);
-
+  int * elementVertices = (int*) malloc (sizeof(int) * numElements * numElementVertices);
   for (int el=0; el < numElements; el++)
-  {
-    row_[el] = (int*) malloc (sizeof(int) * numElementVertices);
-    column_[el] = (int*) malloc (sizeof(int) * numElementVertices * numElementVertices);
-
     for(int ver=0; ver<numElementVertices; ver++)
-      row_[el][ver] = volumetricMesh->getVertexIndex(el, ver);
+      elementVertices[numElementVertices * el + ver] = volumetricMesh->getVertexIndex(el, ver);
 
-    // seek for value row[j] in list associated with row[i]
-    for(int i=0; i<numElementVertices; i++)
-      for(int j=0; j<numElementVertices; j++)
-        column_[el][numElementVertices * i + j] =
-          stiffnessMatrixTopology->GetInverseIndex(3*row_[el][i],3*row_[el][j]) / 3;
-  }
+  matrixScatter = new SparseMatrixScatter(stiffnessMatrixTopology, numElements, numElementVertices, elementVertices);
+  free(elementVertices);
+
+  rangeEvaluator = new StVKElementRangeEvaluator(volumetricMesh);
 
   delete(stiffnessMatrixTopology);
 
@@ -125,34 +118,105 @@ void StVKStiffnessMatrix::GetStiffnessMatrixTopology(SparseMatrix ** stiffnessMa
 
 StVKStiffnessMatrix::~StVKStiffnessMatrix()
 {
-  int numElements = volumetricMesh->getNumElements();
-
-  for(int i=0; i<numElements; i++)
-    free(row_[i]);
-  free(row_);
+  if (row_ != NULL)
+  {
+    int numElements = volumetricMesh->getNumElements();
+    for(int i=0; i<numElements; i++)
+    {
+      free(row_[i]);
+      free(column_[i]);
+    }
+    free(row_);
+    free(column_);
+  }
 
-  for(int i=0; i<numElements; i++)
-    free(column_[i]);
-  free(column_);
+  delete(rangeEvaluator);
+  delete(matrixScatter);
 
   free(lambdaLame);
   free(muLame);
 }
 
+void StVKStiffnessMatrix::GetMatrixAccelerationIndices(int *** row__, int *** column__)
+{
+  if (row_ == NULL)
+  {
+    int numElements = volumetricMesh->getNumElements();
+    row_ = (int**) malloc (sizeof(int*) * numElements);
+    column_ = (int**) malloc (sizeof(int*) * numElements);
+    for (int el=0; el < numElements; el++)
+    {
+      row_[el] = (int*) malloc (sizeof(int) * numElementVertices);
+      column_[el] = (int*) malloc (sizeof(int) * numElementVertices * numElementVertices);
+      for(int i=0; i<numElementVertices; i++)
+      {
+        row_[el][i] = volumetricMesh->getVertexIndex(el, i);
+        // the blocks are full 3x3 blocks, so the block positions are multiples of 3
+        for(int j=0; j<numElementVertices; j++)
+          column_[el][numElementVertices * i + j] = matrixScatter->GetBlockPosition(el, 3 * i, j) / 3;
+      }
+    }
+  }
+
+  *row__ = row_;
+  *column__ = column_;
+}
+
 // the master function
 void StVKStiffnessMatrix::ComputeStiffnessMatrix(const double * vertexDisplacements, SparseMatrix * sparseMatrix)
 {
   //PerformanceCounter stiffnessCounter;
   sparseMatrix->ResetToZero();
 
-  AddLinearTermsContribution(vertexDisplacements, sparseMatrix);
-  AddQuadraticTermsContribution(vertexDisplacements, sparseMatrix);
-  AddCubicTermsContribution(vertexDisplacements, sparseMatrix);
+  const TetMeshElementCache * elementCache = stVKInternalForces->GetTetKernelElementCache();
+  const StVKCubeKernel * cubeKernel = stVKInternalForces->GetCubeKernel();
+  rangeEvaluator->Evaluate([&](int elementLow, int elementHigh)
+  {
+    if (elementCache != NULL)
+    {
+      StVKTetKernel::AddEnergyAndForceAndMatrix(elementCache, vertexDisplacements, elementLow, elementHigh, NULL, NULL, matrixScatter, sparseMatrix);
+    }
+    else if (cubeKernel != NULL)
+    {
+      cubeKernel->AddEnergyAndForceAndMatrix(volumetricMesh, lambdaLame, muLame, vertexDisplacements, elementLow, elementHigh, NULL, NULL, matrixScatter, sparseMatrix);
+    }
+    else
+    {
+      AddLinearTermsContribution(vertexDisplacements, sparseMatrix, elementLow, elementHigh);
+      AddQuadraticTermsContribution(vertexDisplacements, sparseMatrix, elementLow, elementHigh);
+      AddCubicTermsContribution(vertexDisplacements, sparseMatrix, elementLow, elementHigh);
+    }
+    return 0.0;
+  });
 
   //stiffnessCounter.StopCounter();
   //printf("Stiffness matrix: %G\n", stiffnessCounter.GetElapsedTime());
 }
 
+void StVKStiffnessMatrix::ComputeForceAndStiffnessMatrix(const double * vertexDisplacements, double * internalForces, SparseMatrix * sparseMatrix)
+{
+  const TetMeshElementCache * elementCache = stVKInternalForces->GetTetKernelElementCache();
+  const StVKCubeKernel * cubeKernel = stVKInternalForces->GetCubeKernel();
+  if ((elementCache == NULL) && (cubeKernel == NULL))
+  {
+    stVKInternalForces->ComputeForces(vertexDisplacements, internalForces);
+    ComputeStiffnessMatrix(vertexDisplacements, sparseMatrix);
+    return;
+  }
+
+  memset(internalForces, 0, sizeof(double) * 3 * volumetricMesh->getNumVertices());
+  sparseMatrix->ResetToZero();
+  rangeEvaluator->Evaluate([&](int elementLow, int elementHigh)
+  {
+    if (elementCache != NULL)
+      StVKTetKernel::AddEnergyAndForceAndMatrix(elementCache, vertexDisplacements, elementLow, elementHigh, NULL, internalForces, matrixScatter, sparseMatrix);
+    else
+      cubeKernel->AddEnergyAndForceAndMatrix(volumetricMesh, lambdaLame, muLame, vertexDisplacements, elementLow, elementHigh, NULL, internalForces, matrixScatter, sparseMatrix);
+    return 0.0;
+  });
+  stVKInternalForces->AddGravityContribution(internalForces);
+}
+
 void StVKStiffnessMatrix::AddLinearTermsContribution(const double * vertexDisplacements, SparseMatrix * sparseMatrix, int elementLow, int elementHigh)
 {
   if (elementLow < 0)
@@ -195,11 +259,7 @@ void StVKStiffnessMatrix::AddLinearTermsContribution(const double * vertexDispla
 }
 
 #define ADD_MATRIX_BLOCK(where)\
-  for(k=0; k<3; k++)\
-    for(l=0; l<3; l++)\
-    {\
-      dataHandle[rowc+k][3*column[c8+(where)]+l] += matrix[3*k+l];\
-    }
+  matrixScatter->AddStencilBlock3x3(el, c, (where), matrix, sparseMatrix);
 
 void StVKStiffnessMatrix::AddQuadraticTermsContribution(const double * vertexDisplacements, SparseMatrix * sparseMatrix, int elementLow, int elementHigh)
 {
@@ -213,13 +273,9 @@ void StVKStiffnessMatrix::AddQuadraticTermsContribution(const double * vertexDis
   void * elIter;
   precomputedIntegrals->AllocateElementIterator(&elIter);
 
-  double ** dataHandle = sparseMatrix->GetDataHandle();
-
   for(int el=elementLow; el < elementHigh; el++)
   {
     precomputedIntegrals->PrepareElement(el, elIter);
-    int * row = row_[el];
-    int * column = column_[el];
 
     for(int ver=0; ver<numElementVertices; ver++)
       vertices[ver] = volumetricMesh->getVertexIndex(el, ver);
@@ -229,8 +285,6 @@ void StVKStiffnessMatrix::AddQuadraticTermsContribution(const double * vertexDis
 
     for (int c=0; c<numElementVertices; c++) // over all vertices of the voxel, computing row of vertex c
     {
-      int rowc = 3*row[c];
-      int c8 = numElementVertices*c;
       // quadratic terms
       for (int e=0; e<numElementVertices; e++) // compute contribution to block (c,e) of the stiffness matrix
       {
@@ -266,7 +320,6 @@ void StVKStiffnessMatrix::AddQuadraticTermsContribution(const double * vertexDis
           matrix[8] += dotp; 
 
         }
-        int k,l;
         ADD_MATRIX_BLOCK(e);
       }
     }
@@ -289,13 +342,9 @@ void StVKStiffnessMatrix::AddCubicTermsContribution(const double * vertexDisplac
   void * elIter;
   precomputedIntegrals->AllocateElementIterator(&elIter);
 
-  double ** dataHandle = sparseMatrix->GetDataHandle();
-
   for(int el=elementLow; el < elementHigh; el++)
   {
     precomputedIntegrals->PrepareElement(el, elIter);
-    int * row = row_[el];
-    int * column = column_[el];
 
     for(int ver=0; ver<numElementVertices; ver++)
       vertices[ver] = volumetricMesh->getVertexIndex(el, ver);
@@ -305,8 +354,6 @@ void StVKStiffnessMatrix::AddCubicTermsContribution(const double * vertexDisplac
 
     for (int c=0; c<numElementVertices; c++) // over all vertices of the voxel, computing derivative on force on vertex c
     {
-      int rowc = 3*row[c];
-      int c8 = numElementVertices*c;
       // cubic terms
       for (int e=0; e<numElementVertices; e++) // compute contribution to block (c,e) of the stiffness matrix
       {
@@ -339,7 +386,6 @@ void StVKStiffnessMatrix::AddCubicTermsContribution(const double * vertexDisplac
             matrix[8] += dotpD; 
           }
         }
-        int k,l;
         ADD_MATRIX_BLOCK(e);
       }
     }
@@ -35,13 +35,16 @@
   The tangent stiffness matrix depends on the deformable configuration.
   As a special case, the routine can compute the stiffness matrix in the rest configuration.
   See also StVKInternalForces.h .
+  With Intel TBB, the elements are evaluated in parallel (see StVKElementRangeEvaluator.h).
 */
 
 #ifndef VEGAFEM_STVKSTIFFNESSMATRIX_H
 #define VEGAFEM_STVKSTIFFNESSMATRIX_H
 
 #include "sparseMatrix.h"
+#include "sparseMatrixScatter.h"
 #include "StVKInternalForces.h"
+#include "StVKElementRangeEvaluator.h"
 
 namespace vegafem
 {
@@ -62,6 +65,10 @@ public:
   // "vertexDisplacements" is an array of vertex deformations, of length 3*n, where n is the total number of mesh vertices
   virtual void ComputeStiffnessMatrix(const double * vertexDisplacements, SparseMatrix * sparseMatrix);
 
+  // evaluates the internal forces (same as StVKInternalForces::ComputeForces) and the tangent stiffness matrix
+  // with tet meshes and cubic meshes, both are computed in a single pass over the elements (see StVKTetKernel.h, StVKCubeKernel.h)
+  virtual void ComputeForceAndStiffnessMatrix(const double * vertexDisplacements, double * internalForces, SparseMatrix * sparseMatrix);
+
   inline void ResetStiffnessMatrix(SparseMatrix * sparseMatrix) {sparseMatrix->ResetToZero();}
 
   inline VolumetricMesh * GetVolumetricMesh() { return volumetricMesh; }
@@ -74,18 +81,27 @@ public:
   void AddQuadraticTermsContribution(const double * vertexDisplacements,SparseMatrix * sparseMatrix, int elementLow=-1, int elementHigh=-1);
   void AddCubicTermsContribution(const double * vertexDisplacements, SparseMatrix * sparseMatrix, int elementLow=-1, int elementHigh=-1);
 
-  void GetMatrixAccelerationIndices(int *** row__, int *** column__) { *row__ = row_; *column__ = column_;}
+  // locations of the element 3x3 blocks in the stiffness matrix (valid for all matrices with the topology of GetStiffnessMatrixTopology)
+  const SparseMatrixScatter * GetMatrixScatter() const { return matrixScatter; }
+
+  // the acceleration indices of earlier versions: (*row__)[el][i] is the vertex i of element el, and 
+  // (*column__)[el][numElementVertices * i + j] is the position (divided by 3) of the 3x3 block (i,j) in the sparse row of vertex i
+  // (as in SparseMatrix::GetInverseIndex); they are derived from the matrix scatter on the first call, and owned by this class
+  void GetMatrixAccelerationIndices(int *** row__, int *** column__);
 
 protected:
 
   int numElementVertices;
 
   // acceleration indices
-  int ** row_;
-  int ** column_;
+  SparseMatrixScatter * matrixScatter;
+  StVKElementRangeEvaluator * rangeEvaluator;
+  int ** row_ = NULL; // built by GetMatrixAccelerationIndices
+  int ** column_ = NULL;
 
   VolumetricMesh * volumetricMesh;
   StVKElementABCD * precomputedIntegrals;
+  StVKInternalForces * stVKInternalForces; // the tet and cube kernel settings (StVKInternalForces::UseTetKernel, UseCubeKernel) also apply to this class
 
   double * lambdaLame;
   double * muLame;
@@ -98,12 +114,7 @@ protected:
 
 inline void StVKStiffnessMatrix::AddMatrix3x3Block(int c, int a, int element, Mat3d & matrix, SparseMatrix * sparseMatrix)
 {
-  int * row = row_[element];
-  int * column = column_[element];
-
-  for(int k=0; k<3; k++)
-    for(int l=0; l<3; l++)
-      sparseMatrix->AddEntry(3*row[c]+k, 3*column[numElementVertices*c+a]+l, matrix[k][l]);
+  matrixScatter->AddStencilBlock3x3(element, c, a, matrix.data(), sparseMatrix);
 }
 
 
@@ -0,0 +1,217 @@
+/*************************************************************************
+ *                                                                       *
+ * Vega FEM Simulation Library Version 4.0                               *
+ *                                                                       *
+ * "StVK" library , Copyright (C) 2007 CMU, 2009 MIT, 2018 USC           *
+ * All rights reserved.                                                  *
+ *                                                                       *
+ * Code author: Jernej Barbic                                            *
+ * http://www.jernejbarbic.com/vega                                      *
+ *                                                                       *
+ * Research: Jernej Barbic, Hongyi Xu, Yijing Li,                        *
+ *           Danyong Zhao, Bohan Wang,                                   *
+ *           Fun Shing Sin, Daniel Schroeder,                            *
+ *           Doug L. James, Jovan Popovic                                *
+ *                                                                       *
+ * Funding: National Science Foundation, Link Foundation,                *
+ *          Singapore-MIT GAMBIT Game Lab,                               *
+ *          Zumberge Research and Innovation Fund at USC,                *
+ *          Sloan Foundation, Okawa Foundation,                          *
+ *          USC Annenberg Foundation                                     *
+ *                                                                       *
+ * This library is free software; you can redistribute it and/or         *
+ * modify it under the terms of the BSD-style license that is            *
+ * included with this library in the file LICENSE.txt                    *
+ *                                                                       *
+ * This library is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the file     *
+ * LICENSE.TXT for more details.                                         *
+ *                                                                       *
+ *************************************************************************/
+
+
+#include "StVKTetKernel.h"
+
+namespace vegafem
+{
+
+void StVKTetKernel::AddEnergyAndForceAndMatrix(const TetMeshElementCache * elementCache, const double * u, int elementLow, int elementHigh,
+  double * energy, double * forces, const SparseMatrixScatter * matrixScatter, SparseMatrix * stiffnessMatrix)
+{
+  const int W = batchSize;
+
+  const double * restVolumes = elementCache->getRestVolumes();
+  const double * lambdaLame = elementCache->getLambdaLame();
+  const double * muLame = elementCache->getMuLame();
+  const double * shapeFunctionGradients[4][3];
+  const int * vertexIndices[4];
+  for(int a=0; a<4; a++)
+  {
+    vertexIndices[a] = elementCache->getVertexIndices(a);
+    for(int i=0; i<3; i++)
+      shapeFunctionGradients[a][i] = elementCache->getShapeFunctionGradients(a, i);
+  }
+
+  // per-batch data; the last index is the lane (the element within the batch)
+  double volume[W], lambda[W], mu[W];
+  double g[4][3][W]; // basis function gradients
+  double F[3][3][W]; // deformation gradient
+  double S[3][3][W]; // second Piola-Kirchhoff stress
+  double P[3][3][W]; // first Piola-Kirchhoff stress
+  double Fg[4][3][W]; // F * g_a
+  double Sg[4][3][W]; // S * g_a
+  double FFt[3][3][W]; // F * F^T
+  double scalar[W];
+  double Kbatch[144][W]; // 12 x 12 row-major element stiffness matrices
+  double Kel[144];
+
+  for(int batchStart = elementLow; batchStart < elementHigh; batchStart += W)
+  {
+    int numLanes = (elementHigh - batchStart < W) ? elementHigh - batchStart : W;
+
+    // gather (unit-stride loads from the element cache); unused lanes repeat the last element, and are discarded at the end
+    int lane[W];
+    for(int l=0; l<W; l++)
+      lane[l] = batchStart + ((l < numLanes) ? l : numLanes - 1);
+    for(int l=0; l<W; l++)
+    {
+      volume[l] = restVolumes[lane[l]];
+      lambda[l] = lambdaLame[lane[l]];
+      mu[l] = muLame[lane[l]];
+    }
+    for(int a=0; a<4; a++)
+      for(int i=0; i<3; i++)
+        for(int l=0; l<W; l++)
+          g[a][i][l] = shapeFunctionGradients[a][i][lane[l]];
+
+    // F = I + sum_a q_a g_a^T
+    for(int i=0; i<3; i++)
+      for(int j=0; j<3; j++)
+        for(int l=0; l<W; l++)
+          F[i][j][l] = (i == j) ? 1.0 : 0.0;
+
+    for(int a=0; a<4; a++)
+    {
+      double q[3][W];
+      for(int l=0; l<W; l++)
+      {
+        const double * qa = &u[3 * vertexIndices[a][lane[l]]];
+        q[0][l] = qa[0];
+        q[1][l] = qa[1];
+        q[2][l] = qa[2];
+      }
+
+      for(int i=0; i<3; i++)
+        for(int j=0; j<3; j++)
+          for(int l=0; l<W; l++)
+            F[i][j][l] += q[i][l] * g[a][j][l];
+    }
+
+    // Green strain E = 1/2 (F^T F - I), stored into S; S = lambda tr(E) I + 2 mu E
+    double trE[W];
+    for(int l=0; l<W; l++)
+      trE[l] = 0.0;
+    for(int i=0; i<3; i++)
+      for(int j=0; j<3; j++)
+      {
+        for(int l=0; l<W; l++)
+          S[i][j][l] = 0.5 * (F[0][i][l] * F[0][j][l] + F[1][i][l] * F[1][j][l] + F[2][i][l] * F[2][j][l] - ((i == j) ? 1.0 : 0.0));
+        if (i == j)
+        {
+          for(int l=0; l<W; l++)
+            trE[l] += S[i][i][l];
+        }
+      }
+
+    if (energy != NULL)
+    {
+      // strain energy density: mu E:E + lambda/2 tr(E)^2
+      for(int l=0; l<W; l++)
+      {
+        double EE = 0.0;
+        for(int i=0; i<3; i++)
+          for(int j=0; j<3; j++)
+            EE += S[i][j][l] * S[i][j][l];
+        scalar[l] = volume[l] * (mu[l] * EE + 0.5 * lambda[l] * trE[l] * trE[l]);
+      }
+      for(int l=0; l<numLanes; l++)
+        *energy += scalar[l];
+    }
+
+    for(int i=0; i<3; i++)
+      for(int j=0; j<3; j++)
+        for(int l=0; l<W; l++)
+          S[i][j][l] = 2.0 * mu[l] * S[i][j][l] + ((i == j) ? lambda[l] * trE[l] : 0.0);
+
+    if (forces != NULL)
+    {
+      // P = F S; force on vertex c: volume * P g_c
+      for(int i=0; i<3; i++)
+        for(int j=0; j<3; j++)
+          for(int l=0; l<W; l++)
+            P[i][j][l] = F[i][0][l] * S[0][j][l] + F[i][1][l] * S[1][j][l] + F[i][2][l] * S[2][j][l];
+
+      for(int c=0; c<4; c++)
+      {
+        double f[3][W];
+        for(int i=0; i<3; i++)
+          for(int l=0; l<W; l++)
+            f[i][l] = volume[l] * (P[i][0][l] * g[c][0][l] + P[i][1][l] * g[c][1][l] + P[i][2][l] * g[c][2][l]);
+
+        for(int l=0; l<numLanes; l++)
+        {
+          double * force = &forces[3 * vertexIndices[c][batchStart + l]];
+          force[0] += f[0][l];
+          force[1] += f[1][l];
+          force[2] += f[2][l];
+        }
+      }
+    }
+
+    if (stiffnessMatrix != NULL)
+    {
+      // block (c,a) of the element stiffness matrix (derivative of the force on vertex c with respect to vertex a):
+      // volume * [ (g_a^T S g_c) I + lambda (F g_c) (F g_a)^T + mu (F g_a) (F g_c)^T + mu (g_a^T g_c) F F^T ]
+      for(int a=0; a<4; a++)
+        for(int i=0; i<3; i++)
+          for(int l=0; l<W; l++)
+          {
+            Fg[a][i][l] = F[i][0][l] * g[a][0][l] + F[i][1][l] * g[a][1][l] + F[i][2][l] * g[a][2][l];
+            Sg[a][i][l] = S[i][0][l] * g[a][0][l] + S[i][1][l] * g[a][1][l] + S[i][2][l] * g[a][2][l];
+          }
+
+      for(int i=0; i<3; i++)
+        for(int j=0; j<3; j++)
+          for(int l=0; l<W; l++)
+            FFt[i][j][l] = F[i][0][l] * F[j][0][l] + F[i][1][l] * F[j][1][l] + F[i][2][l] * F[j][2][l];
+
+      for(int c=0; c<4; c++)
+        for(int a=0; a<4; a++)
+        {
+          double gSg[W], gg[W];
+          for(int l=0; l<W; l++)
+          {
+            gSg[l] = g[a][0][l] * Sg[c][0][l] + g[a][1][l] * Sg[c][1][l] + g[a][2][l] * Sg[c][2][l];
+            gg[l] = g[a][0][l] * g[c][0][l] + g[a][1][l] * g[c][1][l] + g[a][2][l] * g[c][2][l];
+          }
+
+          for(int i=0; i<3; i++)
+            for(int j=0; j<3; j++)
+              for(int l=0; l<W; l++)
+                Kbatch[(3 * c + i) * 12 + 3 * a + j][l] = volume[l] * (((i == j) ? gSg[l] : 0.0) 
+                  + lambda[l] * Fg[c][i][l] * Fg[a][j][l] + mu[l] * Fg[a][i][l] * Fg[c][j][l] + mu[l] * gg[l] * FFt[i][j][l]);
+        }
+
+      for(int l=0; l<numLanes; l++)
+      {
+        for(int k=0; k<144; k++)
+          Kel[k] = Kbatch[k][l];
+        matrixScatter->AddStencilMatrix(batchStart + l, Kel, stiffnessMatrix, 0);
+      }
+    }
+  }
+}
+
+}//namespace vegafem
+
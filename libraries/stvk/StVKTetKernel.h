@@ -0,0 +1,80 @@
+/*************************************************************************
+ *                                                                       *
+ * Vega FEM Simulation Library Version 4.0                               *
+ *                                                                       *
+ * "StVK" library , Copyright (C) 2007 CMU, 2009 MIT, 2018 USC           *
+ * All rights reserved.                                                  *
+ *                                                                       *
+ * Code author: Jernej Barbic                                            *
+ * http://www.jernejbarbic.com/vega                                      *
+ *                                                                       *
+ * Research: Jernej Barbic, Hongyi Xu, Yijing Li,                        *
+ *           Danyong Zhao, Bohan Wang,                                   *
+ *           Fun Shing Sin, Daniel Schroeder,                            *
+ *           Doug L. James, Jovan Popovic                                *
+ *                                                                       *
+ * Funding: National Science Foundation, Link Foundation,                *
+ *          Singapore-MIT GAMBIT Game Lab,                               *
+ *          Zumberge Research and Innovation Fund at USC,                *
+ *          Sloan Foundation, Okawa Foundation,                          *
+ *          USC Annenberg Foundation                                     *
+ *                                                                       *
+ * This library is free software; you can redistribute it and/or         *
+ * modify it under the terms of the BSD-style license that is            *
+ * included with this library in the file LICENSE.txt                    *
+ *                                                                       *
+ * This library is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the file     *
+ * LICENSE.TXT for more details.                                         *
+ *                                                                       *
+ *************************************************************************/
+
+
+/*
+  Evaluates the St.Venant-Kirchhoff internal forces, tangent stiffness matrix and strain energy 
+  of a tetrahedral mesh directly from the rest volumes, basis function gradients and Lame parameters
+  stored in a TetMeshElementCache (see tetMeshElementCache.h).
+  The result is the same as the sum of the linear, quadratic and cubic terms computed by 
+  StVKInternalForces and StVKStiffnessMatrix (up to floating-point roundoff), but it is 
+  computed in closed form (via the deformation gradient), in a single pass over the elements.
+
+  The tets are processed in batches of "batchSize" elements. Within a batch, the innermost loops
+  run over the elements of the batch ("lanes") with unit stride, so that the compiler can vectorize them
+  (4 tets per AVX2 vector, 8 tets per AVX-512 vector, when the code is compiled for these instruction sets).
+
+  See also StVKInternalForces.h .
+*/
+
+#ifndef VEGAFEM_STVKTETKERNEL_H
+#define VEGAFEM_STVKTETKERNEL_H
+
+#include "tetMeshElementCache.h"
+#include "sparseMatrix.h"
+#include "sparseMatrixScatter.h"
+
+namespace vegafem
+{
+
+class StVKTetKernel
+{
+public:
+#ifdef __AVX512F__
+  enum { batchSize = 8 };
+#else
+  enum { batchSize = 4 };
+#endif
+
+  // Evaluates the elements elementLow <= el < elementHigh of the tet mesh of "elementCache", given the vertex displacements u.
+  // The element cache must hold the Lame parameters.
+  // Adds the internal forces into "forces", the strain energy into "energy", 
+  // and the tangent stiffness matrix into "stiffnessMatrix" (via matrixScatter, which must be built for the mesh elements).
+  // Each of forces, energy, stiffnessMatrix can be NULL, in which case the corresponding quantity is not computed.
+  static void AddEnergyAndForceAndMatrix(const TetMeshElementCache * elementCache, const double * u, int elementLow, int elementHigh,
+    double * energy, double * forces, const SparseMatrixScatter * matrixScatter, SparseMatrix * stiffnessMatrix);
+};
+
+}//namespace vegafem
+
+#endif
+
@@ -0,0 +1,106 @@
+/*************************************************************************
+ *                                                                       *
+ * Vega FEM Simulation Library Version 4.0                               *
+ *                                                                       *
+ * "volumetricMesh" library , Copyright (C) 2007 CMU, 2009 MIT, 2018 USC *
+ * All rights reserved.                                                  *
+ *                                                                       *
+ * Code author: Jernej Barbic                                            *
+ * http://www.jernejbarbic.com/vega                                      *
+ *                                                                       *
+ * Research: Jernej Barbic, Hongyi Xu, Yijing Li,                        *
+ *           Danyong Zhao, Bohan Wang,                                   *
+ *           Fun Shing Sin, Daniel Schroeder,                            *
+ *           Doug L. James, Jovan Popovic                                *
+ *                                                                       *
+ * Funding: National Science Foundation, Link Foundation,                *
+ *          Singapore-MIT GAMBIT Game Lab,                               *
+ *          Zumberge Research and Innovation Fund at USC,                *
+ *          Sloan Foundation, Okawa Foundation,                          *
+ *          USC Annenberg Foundation                                     *
+ *                                                                       *
+ * This library is free software; you can redistribute it and/or         *
+ * modify it under the terms of the BSD-style license that is            *
+ * included with this library in the file LICENSE.txt                    *
+ *                                                                       *
+ * This library is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the file     *
+ * LICENSE.TXT for more details.                                         *
+ *                                                                       *
+ *************************************************************************/
+
+
+#include "tetMeshElementCache.h"
+#include "volumetricMeshENuMaterial.h"
+#include <cstdint>
+#include <cmath>
+
+namespace vegafem
+{
+
+// returns the first 64-byte aligned address in "storage", whose size must be at least 64 bytes larger than needed
+template<class T>
+static T * alignTo64Bytes(std::vector<T> & storage)
+{
+  uintptr_t address = (uintptr_t) storage.data();
+  address = (address + 63) & ~((uintptr_t)63);
+  return (T*) address;
+}
+
+TetMeshElementCache::TetMeshElementCache(TetMesh * tetMesh)
+{
+  numElements = tetMesh->getNumElements();
+  paddedNumElements = (numElements + 7) / 8 * 8;
+
+  vertexIndicesStorage.assign(4 * paddedNumElements + 64 / sizeof(int), 0);
+  vertexIndices = alignTo64Bytes(vertexIndicesStorage);
+  dataStorage.assign(numDoubleArrays * paddedNumElements + 64 / sizeof(double), 0.0);
+  data = alignTo64Bytes(dataStorage);
+
+  lameParameters = true;
+  for(int el=0; el<numElements; el++)
+  {
+    Vec3d x[4];
+    for(int a=0; a<4; a++)
+    {
+      vertexIndices[a * paddedNumElements + el] = tetMesh->getVertexIndex(el, a);
+      x[a] = tetMesh->getVertex(el, a);
+    }
+
+    Vec3d e1 = x[1] - x[0];
+    Vec3d e2 = x[2] - x[0];
+    Vec3d e3 = x[3] - x[0];
+    Mat3d Dm(e1[0], e2[0], e3[0], e1[1], e2[1], e3[1], e1[2], e2[2], e3[2]);
+    Mat3d DmInverse = inv(Dm);
+    for(int i=0; i<3; i++)
+      for(int j=0; j<3; j++)
+        data[(dmInverseOffset + 3 * i + j) * paddedNumElements + el] = DmInverse[i][j];
+
+    data[restVolumeOffset * paddedNumElements + el] = fabs(det(Dm)) / 6.0;
+
+    // F = Ds Dm^{-1} = sum_{a=1}^{3} (x_a - x_0) (row a-1 of Dm^{-1}), hence g_a = row a-1 of Dm^{-1}, and g_0 = -(g_1 + g_2 + g_3)
+    for(int dim=0; dim<3; dim++)
+    {
+      double g0 = 0.0;
+      for(int a=1; a<4; a++)
+      {
+        data[(shapeFunctionGradientOffset + 3 * a + dim) * paddedNumElements + el] = DmInverse[a-1][dim];
+        g0 -= DmInverse[a-1][dim];
+      }
+      data[(shapeFunctionGradientOffset + dim) * paddedNumElements + el] = g0;
+    }
+
+    VolumetricMesh::ENuMaterial * eNuMaterial = downcastENuMaterial(tetMesh->getElementMaterial(el));
+    if (eNuMaterial != NULL)
+    {
+      data[lambdaOffset * paddedNumElements + el] = eNuMaterial->getLambda();
+      data[muOffset * paddedNumElements + el] = eNuMaterial->getMu();
+    }
+    else
+      lameParameters = false;
+  }
+}
+
+}//namespace vegafem
+
@@ -0,0 +1,103 @@
+/*************************************************************************
+ *                                                                       *
+ * Vega FEM Simulation Library Version 4.0                               *
+ *                                                                       *
+ * "volumetricMesh" library , Copyright (C) 2007 CMU, 2009 MIT, 2018 USC *
+ * All rights reserved.                                                  *
+ *                                                                       *
+ * Code author: Jernej Barbic                                            *
+ * http://www.jernejbarbic.com/vega                                      *
+ *                                                                       *
+ * Research: Jernej Barbic, Hongyi Xu, Yijing Li,                        *
+ *           Danyong Zhao, Bohan Wang,                                   *
+ *           Fun Shing Sin, Daniel Schroeder,                            *
+ *           Doug L. James, Jovan Popovic                                *
+ *                                                                       *
+ * Funding: National Science Foundation, Link Foundation,                *
+ *          Singapore-MIT GAMBIT Game Lab,                               *
+ *          Zumberge Research and Innovation Fund at USC,                *
+ *          Sloan Foundation, Okawa Foundation,                          *
+ *          USC Annenberg Foundation                                     *
+ *                                                                       *
+ * This library is free software; you can redistribute it and/or         *
+ * modify it under the terms of the BSD-style license that is            *
+ * included with this library in the file LICENSE.txt                    *
+ *                                                                       *
+ * This library is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the file     *
+ * LICENSE.TXT for more details.                                         *
+ *                                                                       *
+ *************************************************************************/
+
+
+/*
+  A structure-of-arrays cache of the per-element rest-configuration data of a tet mesh,
+  shared by the tet force models (StVK, corotational linear FEM, isotropic hyperelastic FEM).
+
+  The data of element "el" is stored at index "el" of separate arrays, one array per quantity
+  (e.g., the x-component of the gradient of the shape function of the element's vertex 1),
+  so that loops over consecutive elements read each quantity with unit stride, and can be vectorized.
+  Each array starts at a 64-byte (cache line) boundary, and is padded with zeros to a multiple of 8 elements.
+
+  The cache stores:
+  - the element vertex indices,
+  - Dm^{-1}, where Dm = [ x1 - x0, x2 - x0, x3 - x0 ] (columns are the rest edge vectors),
+  - the rest volumes,
+  - the gradients of the (linear) shape functions, g_a, so that the deformation gradient is F = sum_a x_a g_a^T,
+  - the Lame parameters lambda and mu, if the element materials are E, nu materials (otherwise, these are zero).
+
+  The cache is built once, from the rest configuration of the mesh; it must be rebuilt if the mesh changes.
+*/
+
+#ifndef VEGAFEM_TETMESHELEMENTCACHE_H
+#define VEGAFEM_TETMESHELEMENTCACHE_H
+
+#include "tetMesh.h"
+#include <vector>
+
+namespace vegafem
+{
+
+class TetMeshElementCache
+{
+public:
+  TetMeshElementCache(TetMesh * tetMesh);
+
+  inline int getNumElements() const { return numElements; }
+  // the array length, a multiple of 8 that is >= getNumElements()
+  inline int getPaddedNumElements() const { return paddedNumElements; }
+
+  // index of vertex "localVertex" (0 <= localVertex < 4) of all elements
+  inline const int * getVertexIndices(int localVertex) const { return vertexIndices + localVertex * paddedNumElements; }
+  // entry (i,j) of Dm^{-1} of all elements
+  inline const double * getDmInverse(int i, int j) const { return data + (dmInverseOffset + 3 * i + j) * paddedNumElements; }
+  inline const double * getRestVolumes() const { return data + restVolumeOffset * paddedNumElements; }
+  // component "dim" of the gradient of the shape function of vertex "localVertex", of all elements
+  inline const double * getShapeFunctionGradients(int localVertex, int dim) const { return data + (shapeFunctionGradientOffset + 3 * localVertex + dim) * paddedNumElements; }
+  inline const double * getLambdaLame() const { return data + lambdaOffset * paddedNumElements; }
+  inline const double * getMuLame() const { return data + muOffset * paddedNumElements; }
+  // returns true if all the element materials are E, nu materials (i.e., if the Lame parameters are available)
+  inline bool hasLameParameters() const { return lameParameters; }
+
+protected:
+  enum { dmInverseOffset = 0, restVolumeOffset = 9, shapeFunctionGradientOffset = 10, lambdaOffset = 22, muOffset = 23, numDoubleArrays = 24 };
+
+  int numElements;
+  int paddedNumElements;
+  bool lameParameters;
+
+  std::vector<int> vertexIndicesStorage;
+  std::vector<double> dataStorage;
+  int * vertexIndices; // aligned pointer into vertexIndicesStorage
+  double * data; // aligned pointer into dataStorage
+
+private:
+  TetMeshElementCache(const TetMeshElementCache &); // not copyable (the pointers point into the storage)
+  TetMeshElementCache & operator=(const TetMeshElementCache &);
+};
+
+}//namespace vegafem
+
+#endif
+
@@ -2928,6 +2928,32 @@ void VolumetricMesh::renumberVertices(const vector<int> & permutation)
       elements[i][j] = permutation[elements[i][j]];
 }
 
+void VolumetricMesh::renumberElements(const vector<int> & permutation)
+{
+  // renumber elements
+  int ** newElements = (int**) malloc (sizeof(int*) * numElements);
+  int * newElementMaterial = (int*) malloc (sizeof(int) * numElements);
+  for (int i = 0; i < numElements; i++)
+  {
+    newElements[permutation[i]] = elements[i];
+    newElementMaterial[permutation[i]] = elementMaterial[i];
+  }
+  free(elements);
+  elements = newElements;
+  free(elementMaterial);
+  elementMaterial = newElementMaterial;
+
+  // renumber sets (regions refer to sets by index, and need no change)
+  for (int i = 0; i < numSets; i++)
+  {
+    set<int> & setElements = sets[i]->getElements();
+    set<int> newSetElements;
+    for (set<int>::iterator iter = setElements.begin(); iter != setElements.end(); iter++)
+      newSetElements.insert(permutation[*iter]);
+    setElements.swap(newSetElements);
+  }
+}
+
 void VolumetricMesh::addMaterial(const Material * material, const Set & newSet, bool removeEmptySets, bool removeEmptyMaterials)
 {
   // add new material to materials
@@ -124,6 +124,7 @@ public:
   inline int getNumElements() const { return numElements; }
   inline int getNumElementVertices() const { return numElementVertices; } 
   void renumberVertices(const std::vector<int> & permutation); // renumbers the vertices using the provided permutation
+  void renumberElements(const std::vector<int> & permutation); // renumbers the elements using the provided permutation (element i becomes element permutation[i]); sets and regions are renumbered accordingly
   inline void setVertex(int i, const Vec3d & pos) { vertices[i] = pos; } // set the position of a vertex
 
   // === materials access === 
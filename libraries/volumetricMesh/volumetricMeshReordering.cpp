@@ -0,0 +1,318 @@
+/*************************************************************************
+ *                                                                       *
+ * Vega FEM Simulation Library Version 4.0                               *
+ *                                                                       *
+ * "volumetricMesh" library , Copyright (C) 2007 CMU, 2009 MIT, 2018 USC *
+ * All rights reserved.                                                  *
+ *                                                                       *
+ * Code author: Jernej Barbic                                            *
+ * http://www.jernejbarbic.com/vega                                      *
+ *                                                                       *
+ * Research: Jernej Barbic, Hongyi Xu, Yijing Li,                        *
+ *           Danyong Zhao, Bohan Wang,                                   *
+ *           Fun Shing Sin, Daniel Schroeder,                            *
+ *           Doug L. James, Jovan Popovic                                *
+ *                                                                       *
+ * Funding: National Science Foundation, Link Foundation,                *
+ *          Singapore-MIT GAMBIT Game Lab,                               *
+ *          Zumberge Research and Innovation Fund at USC,                *
+ *          Sloan Foundation, Okawa Foundation,                          *
+ *          USC Annenberg Foundation                                     *
+ *                                                                       *
+ * This library is free software; you can redistribute it and/or         *
+ * modify it under the terms of the BSD-style license that is            *
+ * included with this library in the file LICENSE.txt                    *
+ *                                                                       *
+ * This library is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the file     *
+ * LICENSE.TXT for more details.                                         *
+ *                                                                       *
+ *************************************************************************/
+
+
+#include "volumetricMeshReordering.h"
+#include <algorithm>
+#include <numeric>
+#include <utility>
+using namespace std;
+
+namespace vegafem
+{
+
+void VolumetricMeshReordering::reorder(VolumetricMesh * volumetricMesh, vertexOrderType vertexOrder, elementOrderType elementOrder,
+    vector<int> * vertexPermutation, vector<int> * elementPermutation)
+{
+  vector<int> vertexPerm;
+  computeVertexPermutation(volumetricMesh, vertexOrder, vertexPerm);
+  if (vertexOrder != VERTEX_ORDER_NONE)
+    volumetricMesh->renumberVertices(vertexPerm);
+
+  // the element order is computed from the renumbered vertices
+  vector<int> elementPerm;
+  computeElementPermutation(volumetricMesh, elementOrder, elementPerm);
+  if (elementOrder != ELEMENT_ORDER_NONE)
+    volumetricMesh->renumberElements(elementPerm);
+
+  if (vertexPermutation != NULL)
+    vertexPermutation->swap(vertexPerm);
+  if (elementPermutation != NULL)
+    elementPermutation->swap(elementPerm);
+}
+
+void VolumetricMeshReordering::buildVertexAdjacency(const VolumetricMesh * volumetricMesh, vector<int> & offsets, vector<int> & neighbors)
+{
+  int numVertices = volumetricMesh->getNumVertices();
+  int numElements = volumetricMesh->getNumElements();
+  int numElementVertices = volumetricMesh->getNumElementVertices();
+
+  // elements incident to each vertex
+  vector<int> vertexElementOffsets(numVertices + 1, 0);
+  for(int el=0; el<numElements; el++)
+    for(int j=0; j<numElementVertices; j++)
+      vertexElementOffsets[volumetricMesh->getVertexIndex(el, j) + 1]++;
+  for(int v=0; v<numVertices; v++)
+    vertexElementOffsets[v+1] += vertexElementOffsets[v];
+  vector<int> vertexElements(vertexElementOffsets[numVertices]);
+  vector<int> position(vertexElementOffsets.begin(), vertexElementOffsets.end() - 1);
+  for(int el=0; el<numElements; el++)
+    for(int j=0; j<numElementVertices; j++)
+      vertexElements[position[volumetricMesh->getVertexIndex(el, j)]++] = el;
+
+  // neighbors of each vertex: the other vertices of the incident elements, sorted and without duplicates
+  offsets.assign(numVertices + 1, 0);
+  neighbors.clear();
+  vector<int> buffer;
+  for(int v=0; v<numVertices; v++)
+  {
+    buffer.clear();
+    for(int i=vertexElementOffsets[v]; i<vertexElementOffsets[v+1]; i++)
+    {
+      const int * vtx = volumetricMesh->getVertexIndices(vertexElements[i]);
+      for(int j=0; j<numElementVertices; j++)
+        if (vtx[j] != v)
+          buffer.push_back(vtx[j]);
+    }
+    sort(buffer.begin(), buffer.end());
+    buffer.erase(unique(buffer.begin(), buffer.end()), buffer.end());
+    neighbors.insert(neighbors.end(), buffer.begin(), buffer.end());
+    offsets[v+1] = (int)neighbors.size();
+  }
+}
+
+// spreads the lowest 21 bits of x so that there are two zero bits between consecutive bits
+static inline unsigned long long spreadBits(unsigned long long x)
+{
+  x &= 0x1fffffULL;
+  x = (x | (x << 32)) & 0x1f00000000ffffULL;
+  x = (x | (x << 16)) & 0x1f0000ff0000ffULL;
+  x = (x | (x << 8)) & 0x100f00f00f00f00fULL;
+  x = (x | (x << 4)) & 0x10c30c30c30c30c3ULL;
+  x = (x | (x << 2)) & 0x1249249249249249ULL;
+  return x;
+}
+
+unsigned long long VolumetricMeshReordering::computeMortonCode(const Vec3d & pos, const Vec3d & bmin, const Vec3d & invSize)
+{
+  const double maxCell = (double)((1 << 21) - 1);
+  unsigned long long code = 0;
+  for(int dim=0; dim<3; dim++)
+  {
+    double t = (pos[dim] - bmin[dim]) * invSize[dim];
+    t = (t < 0.0) ? 0.0 : ((t > 1.0) ? 1.0 : t);
+    code |= spreadBits((unsigned long long)(t * maxCell)) << dim;
+  }
+  return code;
+}
+
+// converts a list of (key, old index) pairs, sorted by key, into a permutation (old index -> new index)
+template<class Key>
+static void sortedOrderToPermutation(vector<pair<Key,int> > & keys, vector<int> & permutation)
+{
+  sort(keys.begin(), keys.end());
+  permutation.resize(keys.size());
+  for(size_t i=0; i<keys.size(); i++)
+    permutation[keys[i].second] = (int)i;
+}
+
+void VolumetricMeshReordering::computeVertexPermutation(const VolumetricMesh * volumetricMesh, vertexOrderType vertexOrder, vector<int> & vertexPermutation)
+{
+  int numVertices = volumetricMesh->getNumVertices();
+  vertexPermutation.resize(numVertices);
+
+  if (vertexOrder == VERTEX_ORDER_MORTON)
+  {
+    BoundingBox bbox = volumetricMesh->getBoundingBox();
+    Vec3d bmin = bbox.bmin();
+    Vec3d side = bbox.bmax() - bbox.bmin();
+    Vec3d invSize;
+    for(int dim=0; dim<3; dim++)
+      invSize[dim] = (side[dim] > 0.0) ? 1.0 / side[dim] : 0.0;
+
+    vector<pair<unsigned long long, int> > keys(numVertices);
+    for(int v=0; v<numVertices; v++)
+      keys[v] = make_pair(computeMortonCode(volumetricMesh->getVertex(v), bmin, invSize), v);
+    sortedOrderToPermutation(keys, vertexPermutation);
+  }
+  else if (vertexOrder == VERTEX_ORDER_REVERSE_CUTHILL_MCKEE)
+  {
+    vector<int> offsets, neighbors;
+    buildVertexAdjacency(volumetricMesh, offsets, neighbors);
+    #define DEGREE(v) (offsets[(v)+1] - offsets[(v)])
+
+    // order[k] is the k-th vertex in the Cuthill-McKee order
+    vector<int> order;
+    order.reserve(numVertices);
+    vector<int> level(numVertices, -1);
+    vector<char> visited(numVertices, 0);
+    vector<int> sortBuffer;
+
+    // breadth-first search from "root" over the unvisited vertices of its connected component;
+    // returns the vertices in the order of the search (neighbors visited in increasing degree),
+    // and the last vertex of the lowest degree in the last level
+    auto breadthFirstSearch = [&](int root, vector<int> & queue, int * lastLevelVertex)
+    {
+      queue.clear();
+      queue.push_back(root);
+      level[root] = 0;
+      for(size_t head=0; head<queue.size(); head++)
+      {
+        int v = queue[head];
+        sortBuffer.clear();
+        for(int i=offsets[v]; i<offsets[v+1]; i++)
+        {
+          int w = neighbors[i];
+          if ((level[w] < 0) && (visited[w] == 0))
+          {
+            level[w] = level[v] + 1;
+            sortBuffer.push_back(w);
+          }
+        }
+        stable_sort(sortBuffer.begin(), sortBuffer.end(), [&](int a, int b) { return DEGREE(a) < DEGREE(b); });
+        queue.insert(queue.end(), sortBuffer.begin(), sortBuffer.end());
+      }
+
+      int lastLevel = level[queue.back()];
+      *lastLevelVertex = queue.back();
+      for(size_t i=0; i<queue.size(); i++)
+        if ((level[queue[i]] == lastLevel) && (DEGREE(queue[i]) < DEGREE(*lastLevelVertex)))
+          *lastLevelVertex = queue[i];
+      for(size_t i=0; i<queue.size(); i++)
+        level[queue[i]] = -1;
+      return lastLevel;
+    };
+
+    // process the vertices in the increasing order of degree, to start each component from a low-degree vertex
+    vector<int> seeds(numVertices);
+    iota(seeds.begin(), seeds.end(), 0);
+    stable_sort(seeds.begin(), seeds.end(), [&](int a, int b) { return DEGREE(a) < DEGREE(b); });
+
+    vector<int> queue;
+    for(int s=0; s<numVertices; s++)
+    {
+      int root = seeds[s];
+      if (visited[root])
+        continue;
+
+      // find a pseudo-peripheral vertex (George-Liu): move the root to a far vertex of its level structure while the depth increases
+      int farVertex;
+      int depth = breadthFirstSearch(root, queue, &farVertex);
+      for(int iter=0; iter<8; iter++)
+      {
+        int nextFarVertex;
+        int farDepth = breadthFirstSearch(farVertex, queue, &nextFarVertex);
+        if (farDepth <= depth)
+          break;
+        root = farVertex;
+        depth = farDepth;
+        farVertex = nextFarVertex;
+      }
+
+      breadthFirstSearch(root, queue, &farVertex);
+      for(size_t i=0; i<queue.size(); i++)
+      {
+        visited[queue[i]] = 1;
+        order.push_back(queue[i]);
+      }
+    }
+    #undef DEGREE
+
+    // reverse
+    for(int k=0; k<numVertices; k++)
+      vertexPermutation[order[k]] = numVertices - 1 - k;
+  }
+  else
+  {
+    iota(vertexPermutation.begin(), vertexPermutation.end(), 0);
+  }
+}
+
+void VolumetricMeshReordering::computeElementPermutation(const VolumetricMesh * volumetricMesh, elementOrderType elementOrder, vector<int> & elementPermutation)
+{
+  int numElements = volumetricMesh->getNumElements();
+  int numElementVertices = volumetricMesh->getNumElementVertices();
+  elementPermutation.resize(numElements);
+
+  if (elementOrder == ELEMENT_ORDER_MORTON)
+  {
+    BoundingBox bbox = volumetricMesh->getBoundingBox();
+    Vec3d bmin = bbox.bmin();
+    Vec3d side = bbox.bmax() - bbox.bmin();
+    Vec3d invSize;
+    for(int dim=0; dim<3; dim++)
+      invSize[dim] = (side[dim] > 0.0) ? 1.0 / side[dim] : 0.0;
+
+    vector<pair<unsigned long long, int> > keys(numElements);
+    for(int el=0; el<numElements; el++)
+      keys[el] = make_pair(computeMortonCode(volumetricMesh->getElementCenter(el), bmin, invSize), el);
+    sortedOrderToPermutation(keys, elementPermutation);
+  }
+  else if (elementOrder == ELEMENT_ORDER_VERTEX)
+  {
+    // sort by the smallest vertex index, then by the largest vertex index
+    vector<pair<pair<int,int>, int> > keys(numElements);
+    for(int el=0; el<numElements; el++)
+    {
+      const int * vtx = volumetricMesh->getVertexIndices(el);
+      int minIndex = vtx[0], maxIndex = vtx[0];
+      for(int j=1; j<numElementVertices; j++)
+      {
+        minIndex = min(minIndex, vtx[j]);
+        maxIndex = max(maxIndex, vtx[j]);
+      }
+      keys[el] = make_pair(make_pair(minIndex, maxIndex), el);
+    }
+    sortedOrderToPermutation(keys, elementPermutation);
+  }
+  else
+  {
+    iota(elementPermutation.begin(), elementPermutation.end(), 0);
+  }
+}
+
+void VolumetricMeshReordering::remapVertexIndices(const vector<int> & permutation, int numIndices, int * indices, int oneIndexed)
+{
+  for(int i=0; i<numIndices; i++)
+    if (indices[i] - oneIndexed >= 0)
+      indices[i] = permutation[indices[i] - oneIndexed] + oneIndexed;
+}
+
+void VolumetricMeshReordering::computeBandwidthAndProfile(const VolumetricMesh * volumetricMesh, int * bandwidth, long long * profile)
+{
+  vector<int> offsets, neighbors;
+  buildVertexAdjacency(volumetricMesh, offsets, neighbors);
+  *bandwidth = 0;
+  *profile = 0;
+  for(int v=0; v<volumetricMesh->getNumVertices(); v++)
+  {
+    // neighbors are sorted
+    if (offsets[v+1] > offsets[v])
+    {
+      *bandwidth = max(*bandwidth, max(v - neighbors[offsets[v]], neighbors[offsets[v+1]-1] - v));
+      *profile += max(0, v - neighbors[offsets[v]]);
+    }
+  }
+}
+
+}//namespace vegafem
+
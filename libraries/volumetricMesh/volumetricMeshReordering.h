@@ -0,0 +1,97 @@
+/*************************************************************************
+ *                                                                       *
+ * Vega FEM Simulation Library Version 4.0                               *
+ *                                                                       *
+ * "volumetricMesh" library , Copyright (C) 2007 CMU, 2009 MIT, 2018 USC *
+ * All rights reserved.                                                  *
+ *                                                                       *
+ * Code author: Jernej Barbic                                            *
+ * http://www.jernejbarbic.com/vega                                      *
+ *                                                                       *
+ * Research: Jernej Barbic, Hongyi Xu, Yijing Li,                        *
+ *           Danyong Zhao, Bohan Wang,                                   *
+ *           Fun Shing Sin, Daniel Schroeder,                            *
+ *           Doug L. James, Jovan Popovic                                *
+ *                                                                       *
+ * Funding: National Science Foundation, Link Foundation,                *
+ *          Singapore-MIT GAMBIT Game Lab,                               *
+ *          Zumberge Research and Innovation Fund at USC,                *
+ *          Sloan Foundation, Okawa Foundation,                          *
+ *          USC Annenberg Foundation                                     *
+ *                                                                       *
+ * This library is free software; you can redistribute it and/or         *
+ * modify it under the terms of the BSD-style license that is            *
+ * included with this library in the file LICENSE.txt                    *
+ *                                                                       *
+ * This library is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the file     *
+ * LICENSE.TXT for more details.                                         *
+ *                                                                       *
+ *************************************************************************/
+
+
+/*
+  Reorders the vertices and elements of a volumetric mesh (tet or cubic mesh) to improve memory locality.
+
+  Meshes produced by mesh generators typically list the vertices and elements in an order
+  unrelated to their spatial position. The element loops (force and stiffness matrix assembly)
+  then gather the vertex data from all over memory, and the rows of the stiffness matrix have a large bandwidth.
+  Renumbering the mesh before the force models and matrices are created fixes this.
+
+  Vertex orderings:
+  - REVERSE_CUTHILL_MCKEE: reverse Cuthill-McKee ordering of the vertex graph (two vertices are connected
+    if they share an element, i.e., the sparsity pattern of the stiffness matrix); reduces the matrix bandwidth,
+  - MORTON: vertices sorted along the Morton (Z-order) space-filling curve of the vertex positions.
+  Element orderings:
+  - MORTON: elements sorted along the Morton space-filling curve of the element centers,
+  - VERTEX: elements sorted by their smallest (new) vertex index, so that consecutive elements touch nearby vertices.
+  The permutations follow the convention of VolumetricMesh::renumberVertices: entry i is the new index of (old) vertex/element i.
+
+  Vertex indices stored outside of the mesh (fixed vertices, interpolation weights, etc.)
+  must be remapped with the vertex permutation; see remapVertexIndices.
+*/
+
+#ifndef VEGAFEM_VOLUMETRICMESHREORDERING_H
+#define VEGAFEM_VOLUMETRICMESHREORDERING_H
+
+#include "volumetricMesh.h"
+#include <vector>
+
+namespace vegafem
+{
+
+class VolumetricMeshReordering
+{
+public:
+  typedef enum { VERTEX_ORDER_NONE, VERTEX_ORDER_REVERSE_CUTHILL_MCKEE, VERTEX_ORDER_MORTON } vertexOrderType;
+  typedef enum { ELEMENT_ORDER_NONE, ELEMENT_ORDER_MORTON, ELEMENT_ORDER_VERTEX } elementOrderType;
+
+  // renumbers the vertices, and then the elements, of the mesh
+  // if vertexPermutation / elementPermutation are not NULL, the applied permutations are returned in them (identity if ORDER_NONE)
+  static void reorder(VolumetricMesh * volumetricMesh, vertexOrderType vertexOrder, elementOrderType elementOrder,
+    std::vector<int> * vertexPermutation = NULL, std::vector<int> * elementPermutation = NULL);
+
+  // computes the permutations, without modifying the mesh
+  static void computeVertexPermutation(const VolumetricMesh * volumetricMesh, vertexOrderType vertexOrder, std::vector<int> & vertexPermutation);
+  static void computeElementPermutation(const VolumetricMesh * volumetricMesh, elementOrderType elementOrder, std::vector<int> & elementPermutation);
+
+  // indices[i] = permutation[indices[i] - oneIndexed] + oneIndexed, for i = 0, ..., numIndices - 1
+  // negative indices (e.g., unused entries) are left unchanged
+  // use oneIndexed=1 for 1-indexed lists (e.g., the fixed vertices in a .bou file)
+  static void remapVertexIndices(const std::vector<int> & permutation, int numIndices, int * indices, int oneIndexed = 0);
+
+  // the bandwidth and the profile (sum over rows of the distance from the diagonal to the leftmost entry) of the vertex graph
+  static void computeBandwidthAndProfile(const VolumetricMesh * volumetricMesh, int * bandwidth, long long * profile);
+
+protected:
+  // vertex adjacency in the compressed-row format (two vertices are adjacent if they share an element)
+  static void buildVertexAdjacency(const VolumetricMesh * volumetricMesh, std::vector<int> & offsets, std::vector<int> & neighbors);
+  // 63-bit Morton code of a point, quantized to 2^21 cells per axis of the bounding box
+  static unsigned long long computeMortonCode(const Vec3d & pos, const Vec3d & bmin, const Vec3d & invSize);
+};
+
+}//namespace vegafem
+
+#endif
+
@@ -118,6 +118,7 @@ static double compressionResistance = 500;
 static double inversionThreshold = -1;
 
 static int corotationalLinearFEM_warp = 1;
+static bool singlePrecisionElements = false; // mixed-precision element evaluation (InvertibleFEM, CLFEM, LinearFEM)
 
 static ObjMesh * mesh = nullptr;
 static ClothBW * cloth = nullptr;
@@ -171,6 +172,7 @@ static void initConfig(const char * configFilename)
   ADD_CONFIG(compressionResistance);
   ADD_CONFIG(inversionThreshold);
   ADD_CONFIG(corotationalLinearFEM_warp);
+  ADD_CONFIG(singlePrecisionElements);
   ADD_CONFIG(testStiffness);
   ADD_CONFIG(hApproachZero);
   ADD_CONFIG(customMassSpringSystem);
@@ -228,7 +230,9 @@ static void initForceModel()
 
     // create the invertible FEM deformable model
     isotropicHyperelasticFEM = new IsotropicHyperelasticFEM(tetMesh, isotropicMaterial, inversionThreshold);
-    stencilForceModel = new IsotropicHyperelasticFEMStencilForceModel(isotropicHyperelasticFEM);
+    IsotropicHyperelasticFEMStencilForceModel * isotropicStencilForceModel = new IsotropicHyperelasticFEMStencilForceModel(isotropicHyperelasticFEM);
+    isotropicStencilForceModel->SetSinglePrecision(singlePrecisionElements);
+    stencilForceModel = isotropicStencilForceModel;
   }
   else if (deformableObjectMethod == "CLFEM")
   {
@@ -237,7 +241,9 @@ static void initForceModel()
     r = 3 * n;
     volumetricMesh = tetMesh;
     corotationalLinearFEM = new CorotationalLinearFEM(tetMesh);
-    stencilForceModel = new CorotationalLinearFEMStencilForceModel(corotationalLinearFEM);
+    CorotationalLinearFEMStencilForceModel * corotationalStencilForceModel = new CorotationalLinearFEMStencilForceModel(corotationalLinearFEM);
+    corotationalStencilForceModel->SetSinglePrecision(singlePrecisionElements);
+    stencilForceModel = corotationalStencilForceModel;
   }
   else if (deformableObjectMethod == "StVK" || deformableObjectMethod == "LinearFEM")
   {
@@ -255,7 +261,11 @@ static void initForceModel()
     if (deformableObjectMethod == "StVK")
       stencilForceModel = new StVKStencilForceModel(stvkFEM);
     else if (deformableObjectMethod == "LinearFEM")
-      stencilForceModel = new LinearFEMStencilForceModel(new StVKStencilForceModel(stvkFEM));
+    {
+      LinearFEMStencilForceModel * linearStencilForceModel = new LinearFEMStencilForceModel(new StVKStencilForceModel(stvkFEM));
+      linearStencilForceModel->SetSinglePrecision(singlePrecisionElements);
+      stencilForceModel = linearStencilForceModel;
+    }
   }
   else if (deformableObjectMethod == "MassSpring")
   {
@@ -206,6 +206,9 @@ double epsilon; // for implicit integration
 char backgroundColorString[4096] = "255 255 255";
 int numInternalForceThreads;
 int numSolverThreads;
+char assemblyModeString[4096] = "locked"; // "locked", "colored" or "deterministic"; see forceModelAssembler.h
+char linearSolverString[4096] = "default"; // "default", "auto", "PARDISO", "SPOOLES" or "PCG"; see integratorSolverSelection.h
+char linearSolverName[96] = "UNKNOWN"; // the solver selected by the integrator
 
 // simulation
 int syncTimestepWithGraphics=1;
@@ -769,10 +772,8 @@ void idleFunction(void)
     char ptext1[96];
     sprintf(ptext1, "Force assembly: %G", forceAssemblyTime);
     forceAssemblyStaticText->set_text(ptext1);
-    char solverName[96];
-    GetIntegratorSolver(solverName);
     char ptext2[96];
-    sprintf(ptext2, "System solve (%s): %G", solverName, systemSolveTime);
+    sprintf(ptext2, "System solve (%s): %G", linearSolverName, systemSolveTime);
     systemSolveStaticText->set_text(ptext2);
     Sync_GLUI();
 
@@ -1528,39 +1529,71 @@ void initSimulation()
   }
 
   assert(stencilForceModel != nullptr);
-  forceModelAssembler = new ForceModelAssembler(stencilForceModel);
+  ForceModelAssembler::assemblyModeType assemblyMode = ForceModelAssembler::LOCKED_ASSEMBLY;
+  if (strcmp(assemblyModeString, "colored") == 0)
+    assemblyMode = ForceModelAssembler::COLORED_ASSEMBLY;
+  else if (strcmp(assemblyModeString, "deterministic") == 0)
+    assemblyMode = ForceModelAssembler::DETERMINISTIC_ASSEMBLY;
+  else if (strcmp(assemblyModeString, "locked") != 0)
+  {
+    printf("Error: unknown assembly mode %s.\n", assemblyModeString);
+    exit(1);
+  }
+  forceModelAssembler = new ForceModelAssembler(stencilForceModel, assemblyMode);
   forceModel = forceModelAssembler;
 
   // initialize the integrator
   printf("Initializing the integrator, n = %d...\n", n);
   printf("Solver type: %s\n", solverMethod);
 
+  integratorSolverType linearSolverType = INTEGRATOR_SOLVER_DEFAULT;
+  if (GetIntegratorSolverType(linearSolverString, &linearSolverType) != 0)
+  {
+    printf("Error: unknown linear solver %s.\n", linearSolverString);
+    exit(1);
+  }
+
   integratorBaseSparse = nullptr;
+  IntegratorSparseSolver * systemSolver = nullptr;
   if (solver == IMPLICITNEWMARK)
   {
     implicitNewmarkSparse = new ImplicitNewmarkSparse(3*n, timeStep, massMatrix, forceModel, numFixedDOFs, fixedDOFs,
-       dampingMassCoef, dampingStiffnessCoef, maxIterations, epsilon, newmarkBeta, newmarkGamma, numSolverThreads);
+       dampingMassCoef, dampingStiffnessCoef, maxIterations, epsilon, newmarkBeta, newmarkGamma, numSolverThreads, linearSolverType);
     integratorBaseSparse = implicitNewmarkSparse;
+    systemSolver = implicitNewmarkSparse->GetSystemSolver();
   }
   else if (solver == IMPLICITBACKWARDEULER)
   {
     implicitNewmarkSparse = new ImplicitBackwardEulerSparse(3*n, timeStep, massMatrix, forceModel, numFixedDOFs, fixedDOFs,
-       dampingMassCoef, dampingStiffnessCoef, maxIterations, epsilon, numSolverThreads);
+       dampingMassCoef, dampingStiffnessCoef, maxIterations, epsilon, numSolverThreads, linearSolverType);
     integratorBaseSparse = implicitNewmarkSparse;
+    systemSolver = implicitNewmarkSparse->GetSystemSolver();
   }
   else if (solver == EULER)
   {
     int symplectic = 0;
-    integratorBaseSparse = new EulerSparse(3*n, timeStep, massMatrix, forceModel, symplectic, numFixedDOFs, fixedDOFs, dampingMassCoef);
+    EulerSparse * eulerSparse = new EulerSparse(3*n, timeStep, massMatrix, forceModel, symplectic, numFixedDOFs, fixedDOFs, dampingMassCoef, numSolverThreads, linearSolverType);
+    integratorBaseSparse = eulerSparse;
+    systemSolver = eulerSparse->GetSystemSolver();
   }
   else if (solver == SYMPLECTICEULER)
   {
     int symplectic = 1;
-    integratorBaseSparse = new EulerSparse(3*n, timeStep, massMatrix, forceModel, symplectic, numFixedDOFs, fixedDOFs, dampingMassCoef);
+    EulerSparse * eulerSparse = new EulerSparse(3*n, timeStep, massMatrix, forceModel, symplectic, numFixedDOFs, fixedDOFs, dampingMassCoef, numSolverThreads, linearSolverType);
+    integratorBaseSparse = eulerSparse;
+    systemSolver = eulerSparse->GetSystemSolver();
   }
   else if (solver == CENTRALDIFFERENCES)
   {
-    integratorBaseSparse = new CentralDifferencesSparse(3*n, timeStep, massMatrix, forceModel, numFixedDOFs, fixedDOFs, dampingMassCoef, dampingStiffnessCoef, centralDifferencesTangentialDampingUpdateMode, numSolverThreads);
+    CentralDifferencesSparse * centralDifferencesSparse = new CentralDifferencesSparse(3*n, timeStep, massMatrix, forceModel, numFixedDOFs, fixedDOFs, dampingMassCoef, dampingStiffnessCoef, centralDifferencesTangentialDampingUpdateMode, numSolverThreads, linearSolverType);
+    integratorBaseSparse = centralDifferencesSparse;
+    systemSolver = centralDifferencesSparse->GetSystemSolver();
+  }
+
+  if (systemSolver != nullptr)
+  {
+    strcpy(linearSolverName, systemSolver->GetSolverName());
+    printf("Linear solver: %s\n", linearSolverName);
   }
 
   integratorBase = integratorBaseSparse;
@@ -1669,6 +1702,8 @@ void initConfigurations()
   configFile.addOptionOptional("epsilon", &epsilon, 1E-6);
   configFile.addOptionOptional("numInternalForceThreads", &numInternalForceThreads, 0);
   configFile.addOptionOptional("numSolverThreads", &numSolverThreads, 1);
+  configFile.addOptionOptional("assemblyMode", assemblyModeString, assemblyModeString);
+  configFile.addOptionOptional("linearSolver", linearSolverString, linearSolverString);
   configFile.addOptionOptional("inversionThreshold", &inversionThreshold, -DBL_MAX);
   configFile.addOptionOptional("forceLoadsFilename", forceLoadsFilename, "__none");
 
@@ -0,0 +1,233 @@
+/*************************************************************************
+ *                                                                       *
+ * Vega FEM Simulation Library Version 4.0                               *
+ *                                                                       *
+ * "generateInterpolant" utility , Copyright (C) 2007 CMU, 2009 MIT,     *
+ *                                               2018 USC                *
+ * All rights reserved.                                                  *
+ *                                                                       *
+ * Code author: Jernej Barbic                                            *
+ * http://www.jernejbarbic.com/vega                                      *
+ *                                                                       *
+ * Research: Jernej Barbic, Hongyi Xu, Yijing Li,                        *
+ *           Danyong Zhao, Bohan Wang,                                   *
+ *           Fun Shing Sin, Daniel Schroeder,                            *
+ *           Doug L. James, Jovan Popovic                                *
+ *                                                                       *
+ * Funding: National Science Foundation, Link Foundation,                *
+ *          Singapore-MIT GAMBIT Game Lab,                               *
+ *          Zumberge Research and Innovation Fund at USC,                *
+ *          Sloan Foundation, Okawa Foundation,                          *
+ *          USC Annenberg Foundation                                     *
+ *                                                                       *
+ * This utility is free software; you can redistribute it and/or         *
+ * modify it under the terms of the BSD-style license that is            *
+ * included with this utility in the file LICENSE.txt                    *
+ *                                                                       *
+ * This utility is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the file     *
+ * LICENSE.TXT for more details.                                         *
+ *                                                                       *
+ *************************************************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+#include <vegafem/volumetricMesh.h>
+#include <vegafem/volumetricMeshLoader.h>
+#include <vegafem/volumetricMeshReordering.h>
+#include <vegafem/getopts.h>
+#include <vegafem/listIO.h>
+using namespace vegafem;
+
+/*
+  Renumbers the vertices and elements of a volumetric mesh to improve memory locality
+  (see volumetricMeshReordering.h), and remaps the fixed vertex lists and interpolants that refer to the mesh vertices.
+*/
+
+int main(int argc, char ** argv)
+{
+  if (argc < 3)
+  {
+    printf("Reorders the vertices and elements of a volumetric mesh for memory locality.\n");
+    printf("Usage: %s <input volumetric mesh file> <output volumetric mesh file> [-v vertex order] [-e element order] [-f input fixed vertices file] [-F output fixed vertices file] [-i input interpolant file] [-I output interpolant file] [-p output vertex permutation file]\n",argv[0]);
+    printf("-v : vertex order: rcm (reverse Cuthill-McKee; default), morton, none\n");
+    printf("-e : element order: morton (default), vertex (by smallest vertex index), none\n");
+    printf("-f, -F : remap a (1-indexed) list of fixed vertices\n");
+    printf("-i, -I : remap the vertex indices of an interpolant (e.g., generated by generateInterpolant)\n");
+    printf("-p : output the (0-indexed) new index of each input vertex\n");
+    return 0;
+  }
+
+  char * inputMeshFilename = argv[1];
+  char * outputMeshFilename = argv[2];
+
+  char vertexOrderString[4096] = "rcm";
+  char elementOrderString[4096] = "morton";
+  char inputFixedVerticesFilename[4096] = "__none";
+  char outputFixedVerticesFilename[4096] = "__none";
+  char inputInterpolantFilename[4096] = "__none";
+  char outputInterpolantFilename[4096] = "__none";
+  char outputPermutationFilename[4096] = "__none";
+
+  opt_t opttable[] =
+  {
+    { (char*)"v", OPTSTR, &vertexOrderString },
+    { (char*)"e", OPTSTR, &elementOrderString },
+    { (char*)"f", OPTSTR, &inputFixedVerticesFilename },
+    { (char*)"F", OPTSTR, &outputFixedVerticesFilename },
+    { (char*)"i", OPTSTR, &inputInterpolantFilename },
+    { (char*)"I", OPTSTR, &outputInterpolantFilename },
+    { (char*)"p", OPTSTR, &outputPermutationFilename },
+    { NULL, 0, NULL }
+  };
+
+  argv += 2;
+  argc -= 2;
+  int optup = getopts(argc,argv,opttable);
+  if (optup != argc)
+  {
+    printf("Error parsing options. Error at option %s.\n",argv[optup]);
+    return 1;
+  }
+
+  VolumetricMeshReordering::vertexOrderType vertexOrder;
+  if (strcmp(vertexOrderString, "rcm") == 0)
+    vertexOrder = VolumetricMeshReordering::VERTEX_ORDER_REVERSE_CUTHILL_MCKEE;
+  else if (strcmp(vertexOrderString, "morton") == 0)
+    vertexOrder = VolumetricMeshReordering::VERTEX_ORDER_MORTON;
+  else if (strcmp(vertexOrderString, "none") == 0)
+    vertexOrder = VolumetricMeshReordering::VERTEX_ORDER_NONE;
+  else
+  {
+    printf("Error: unknown vertex order %s.\n", vertexOrderString);
+    return 1;
+  }
+
+  VolumetricMeshReordering::elementOrderType elementOrder;
+  if (strcmp(elementOrderString, "morton") == 0)
+    elementOrder = VolumetricMeshReordering::ELEMENT_ORDER_MORTON;
+  else if (strcmp(elementOrderString, "vertex") == 0)
+    elementOrder = VolumetricMeshReordering::ELEMENT_ORDER_VERTEX;
+  else if (strcmp(elementOrderString, "none") == 0)
+    elementOrder = VolumetricMeshReordering::ELEMENT_ORDER_NONE;
+  else
+  {
+    printf("Error: unknown element order %s.\n", elementOrderString);
+    return 1;
+  }
+
+  if ((strcmp(inputFixedVerticesFilename, "__none") == 0) != (strcmp(outputFixedVerticesFilename, "__none") == 0))
+  {
+    printf("Error: options -f and -F must be given together.\n");
+    return 1;
+  }
+  if ((strcmp(inputInterpolantFilename, "__none") == 0) != (strcmp(outputInterpolantFilename, "__none") == 0))
+  {
+    printf("Error: options -i and -I must be given together.\n");
+    return 1;
+  }
+
+  VolumetricMesh * volumetricMesh = VolumetricMeshLoader::load(inputMeshFilename);
+  if (volumetricMesh == NULL)
+  {
+    printf("Error: unable to load the volumetric mesh from %s.\n", inputMeshFilename);
+    return 1;
+  }
+
+  printf("Num vertices: %d\n", volumetricMesh->getNumVertices());
+  printf("Num elements: %d\n", volumetricMesh->getNumElements());
+
+  int bandwidth;
+  long long profile;
+  VolumetricMeshReordering::computeBandwidthAndProfile(volumetricMesh, &bandwidth, &profile);
+  printf("Input mesh: vertex graph bandwidth: %d, profile: %lld\n", bandwidth, profile);
+
+  vector<int> vertexPermutation;
+  VolumetricMeshReordering::reorder(volumetricMesh, vertexOrder, elementOrder, &vertexPermutation);
+
+  VolumetricMeshReordering::computeBandwidthAndProfile(volumetricMesh, &bandwidth, &profile);
+  printf("Reordered mesh: vertex graph bandwidth: %d, profile: %lld\n", bandwidth, profile);
+
+  printf("Saving the reordered mesh to %s...\n", outputMeshFilename);
+  if (volumetricMesh->save(outputMeshFilename) != 0)
+  {
+    printf("Error: unable to save the mesh to %s.\n", outputMeshFilename);
+    return 1;
+  }
+
+  if (strcmp(inputFixedVerticesFilename, "__none") != 0)
+  {
+    vector<int> fixedVertices;
+    int oneIndexed = 1;
+    if (ListIO::load(inputFixedVerticesFilename, fixedVertices, oneIndexed) != 0)
+    {
+      printf("Error: unable to load the fixed vertices from %s.\n", inputFixedVerticesFilename);
+      return 1;
+    }
+    VolumetricMeshReordering::remapVertexIndices(vertexPermutation, (int)fixedVertices.size(), fixedVertices.data());
+    sort(fixedVertices.begin(), fixedVertices.end());
+    printf("Saving %d fixed vertices to %s...\n", (int)fixedVertices.size(), outputFixedVerticesFilename);
+    ListIO::save(outputFixedVerticesFilename, fixedVertices, oneIndexed);
+  }
+
+  if (strcmp(inputInterpolantFilename, "__none") != 0)
+  {
+    int numElementVertices = VolumetricMesh::getNumInterpolationElementVertices(inputInterpolantFilename);
+    if (numElementVertices <= 0)
+    {
+      printf("Error: unable to read the interpolant %s.\n", inputInterpolantFilename);
+      return 1;
+    }
+
+    // count the target locations (one per line)
+    int numTargetLocations = 0;
+    FILE * fin = fopen(inputInterpolantFilename, "r");
+    if (fin == NULL)
+    {
+      printf("Error: unable to open %s.\n", inputInterpolantFilename);
+      return 1;
+    }
+    char line[4096];
+    while (fgets(line, 4096, fin) != NULL)
+      if (strspn(line, " \t\r\n") != strlen(line))
+        numTargetLocations++;
+    fclose(fin);
+
+    int * vertices;
+    double * weights;
+    if (VolumetricMesh::loadInterpolationWeights(inputInterpolantFilename, numTargetLocations, numElementVertices, &vertices, &weights) != 0)
+    {
+      printf("Error: unable to load the interpolant %s.\n", inputInterpolantFilename);
+      return 1;
+    }
+    VolumetricMeshReordering::remapVertexIndices(vertexPermutation, numTargetLocations * numElementVertices, vertices);
+    printf("Saving the interpolant (%d target locations) to %s...\n", numTargetLocations, outputInterpolantFilename);
+    VolumetricMesh::saveInterpolationWeights(outputInterpolantFilename, numTargetLocations, numElementVertices, vertices, weights);
+    free(vertices);
+    free(weights);
+  }
+
+  if (strcmp(outputPermutationFilename, "__none") != 0)
+  {
+    FILE * fout = fopen(outputPermutationFilename, "w");
+    if (fout == NULL)
+    {
+      printf("Error: unable to write to %s.\n", outputPermutationFilename);
+      return 1;
+    }
+    for(size_t i=0; i<vertexPermutation.size(); i++)
+      fprintf(fout, "%d\n", vertexPermutation[i]);
+    fclose(fout);
+  }
+
+  delete volumetricMesh;
+
+  return 0;
+}
+